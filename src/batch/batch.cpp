@@ -0,0 +1,476 @@
+/**
+ * @file batch.cpp
+ * @brief This file processes a batch of flash files, e.g. all variant images
+ * of a release, on a work-stealing thread pool. Each file is parsed by one
+ * task, which then queues a checksum task per segment, so the segments of a
+ * large file are spread over idle threads while small files keep flowing.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "batch.h"
+#include "crc.h"
+#include "filepraser.h"
+
+namespace
+{
+
+// A task parses file entry if segment is -1, otherwise it checksums a segment of it.
+struct BatchTask
+{
+  uint32_t entry;
+  int32_t segment;
+};
+
+// Tasks of a thread. The thread takes its newest task, other threads steal the oldest one.
+struct BatchQueue
+{
+  std::mutex mutex;
+  std::deque<BatchTask> tasks;
+};
+
+// A file while it is processed.
+struct BatchWork
+{
+  FlashImage image;
+  std::atomic<uint32_t> remaining; // Segments not checksummed yet.
+  std::atomic<uint64_t> checksumTicks;
+};
+
+struct BatchScheduler
+{
+  Batch *batch;
+  std::vector<BatchQueue> queues;
+  std::unique_ptr<BatchWork[]> works;
+  std::atomic<uint64_t> pending; // Tasks queued or running.
+  std::atomic<uint64_t> steals;
+  uint64_t ticksPerSecond;
+
+  BatchScheduler(Batch *batch, uint32_t threads)
+      : batch(batch), queues(threads), works(new BatchWork[batch->count]), pending(0), steals(0),
+        ticksPerSecond(TraceTicksPerSecond())
+  {
+  }
+};
+
+uint64_t Microseconds(const BatchScheduler *scheduler, uint64_t ticks)
+{
+  return ticks / scheduler->ticksPerSecond * 1000000 + ticks % scheduler->ticksPerSecond * 1000000 / scheduler->ticksPerSecond;
+}
+
+void PushTask(BatchScheduler *scheduler, uint32_t thread, BatchTask task)
+{
+  std::lock_guard<std::mutex> lock(scheduler->queues[thread].mutex);
+  scheduler->queues[thread].tasks.push_back(task);
+}
+
+/*
+Take the newest task of the own queue, or else steal the oldest task of
+another queue, starting with the next thread so thieves spread out.
+*/
+bool TakeTask(BatchScheduler *scheduler, uint32_t thread, BatchTask *task)
+{
+  {
+    BatchQueue &own = scheduler->queues[thread];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty())
+    {
+      *task = own.tasks.back();
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  uint32_t threads = (uint32_t)scheduler->queues.size();
+  for (uint32_t i = 1; i < threads; i++)
+  {
+    BatchQueue &victim = scheduler->queues[(thread + i) % threads];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty())
+    {
+      *task = victim.tasks.front();
+      victim.tasks.pop_front();
+      scheduler->steals++;
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+Save the segment table of a processed file, compare its checksums with the
+expected ones and release its data.
+*/
+void FinishFile(BatchScheduler *scheduler, uint32_t index)
+{
+  BatchEntry *entry = &scheduler->batch->entries[index];
+  BatchWork *work = &scheduler->works[index];
+  uint8_t crcBytes = scheduler->batch->crcBytes;
+  entry->segmentsCount = work->image.count;
+  entry->segments = (BatchSegment *)calloc(work->image.count + 1, sizeof(BatchSegment));
+  if (entry->segments == 0)
+  {
+    entry->status = BATCH_ERROR;
+    ImageClear(&work->image);
+    return;
+  }
+  for (uint32_t i = 0; i < work->image.count; i++)
+  {
+    const FlashSegment *segment = &work->image.segments[i];
+    uint64_t crc = (uint64_t)segment->checksum << 32 | segment->checksumExtension;
+    entry->segments[i].address = segment->address;
+    entry->segments[i].size = segment->size;
+    entry->segments[i].checksum = crcBytes != 0 ? crc >> (64 - 8 * crcBytes) : 0;
+    entry->bytes += segment->size;
+  }
+  entry->checksumTime = Microseconds(scheduler, work->checksumTicks);
+  if (entry->expectedCount == 0)
+  {
+    entry->status = BATCH_UNCHECKED;
+  }
+  else
+  {
+    entry->status = entry->expectedCount == entry->segmentsCount ? BATCH_OK : BATCH_MISMATCH;
+    for (uint32_t i = 0; entry->status == BATCH_OK && i < entry->segmentsCount; i++)
+    {
+      if (entry->segments[i].checksum != entry->expected[i])
+      {
+        entry->status = BATCH_MISMATCH;
+      }
+    }
+  }
+  if (entry->status == BATCH_MISMATCH)
+  {
+    LOG_ERROR("Checksums of %s don't match", entry->fileName);
+  }
+  ImageClear(&work->image);
+}
+
+void ParseFile(BatchScheduler *scheduler, uint32_t thread, uint32_t index)
+{
+  BatchEntry *entry = &scheduler->batch->entries[index];
+  BatchWork *work = &scheduler->works[index];
+  uint64_t start = TraceTimestamp();
+  uint8_t result;
+  switch (DetectFlashFileFormat(entry->fileName))
+  {
+  case FORMAT_HEX:
+    result = ParseHex(entry->fileName, &work->image);
+    break;
+  case FORMAT_SREC:
+    result = ParseSREC(entry->fileName, &work->image);
+    break;
+  case FORMAT_ELF:
+    result = ParseElf(entry->fileName, &work->image);
+    break;
+  default:
+    result = ParseBin(entry->fileName, 0, &work->image);
+    break;
+  }
+  entry->parseTime = Microseconds(scheduler, TraceTimestamp() - start);
+  TRACE_SPAN(start, "Batch parse file %u, result %u", index, result);
+  if (result != 0)
+  {
+    LOG_ERROR("Can't parse %s", entry->fileName);
+    entry->status = BATCH_ERROR;
+    ImageClear(&work->image);
+    return;
+  }
+  if (work->image.count == 0)
+  {
+    FinishFile(scheduler, index);
+    return;
+  }
+  work->remaining = work->image.count;
+  scheduler->pending += work->image.count;
+  for (uint32_t i = work->image.count; i-- > 0;)
+  {
+    // Queued in reverse, the own thread takes segment 0 first.
+    PushTask(scheduler, thread, BatchTask{index, (int32_t)i});
+  }
+}
+
+void ChecksumSegment(BatchScheduler *scheduler, uint32_t index, uint32_t segment)
+{
+  BatchWork *work = &scheduler->works[index];
+  uint64_t start = TraceTimestamp();
+  SegmentCalculateChecksum(&work->image.segments[segment]);
+  work->checksumTicks += TraceTimestamp() - start;
+  TRACE_SPAN(start, "Batch checksum file %u segment %u", index, segment);
+  if (--work->remaining == 0)
+  {
+    FinishFile(scheduler, index);
+  }
+}
+
+void RunWorker(BatchScheduler *scheduler, uint32_t thread)
+{
+  BatchTask task;
+  while (scheduler->pending != 0)
+  {
+    if (!TakeTask(scheduler, thread, &task))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    if (task.segment < 0)
+    {
+      ParseFile(scheduler, thread, task.entry);
+    }
+    else
+    {
+      ChecksumSegment(scheduler, task.entry, (uint32_t)task.segment);
+    }
+    scheduler->pending--;
+  }
+}
+
+uint64_t FileSize(const char *fileName)
+{
+  struct stat status;
+  return stat(fileName, &status) == 0 ? (uint64_t)status.st_size : 0;
+}
+
+const char *const batchStatusNames[] = {"PENDING", "OK", "UNCHECKED", "MISMATCH", "ERROR"};
+
+} // namespace
+
+/**
+ * @brief Add a flash file to a batch.
+ *
+ * @param batch The batch.
+ * @param fileName Path of the flash file.
+ * @param expected Expected CRC of each segment, right aligned, or 0.
+ * @param expectedCount Amount of expected CRCs, 0 to only parse the file.
+ * @return uint8_t 0 on success, 1 if out of memory.
+ */
+uint8_t BatchAddFile(Batch *batch, const char *fileName, const uint64_t *expected, uint32_t expectedCount)
+{
+  if (batch->count == batch->capacity)
+  {
+    uint32_t capacity = batch->capacity != 0 ? batch->capacity * 2 : 16;
+    BatchEntry *entries = (BatchEntry *)realloc(batch->entries, capacity * sizeof(BatchEntry));
+    if (entries == 0)
+    {
+      return 1;
+    }
+    batch->entries = entries;
+    batch->capacity = capacity;
+  }
+  BatchEntry *entry = &batch->entries[batch->count];
+  memset(entry, 0, sizeof(BatchEntry));
+  entry->fileName = (char *)malloc(strlen(fileName) + 1);
+  entry->expected = (uint64_t *)malloc((expectedCount + 1) * sizeof(uint64_t));
+  if (entry->fileName == 0 || entry->expected == 0)
+  {
+    free(entry->fileName);
+    free(entry->expected);
+    return 1;
+  }
+  strcpy(entry->fileName, fileName);
+  if (expectedCount != 0)
+  {
+    memcpy(entry->expected, expected, expectedCount * sizeof(uint64_t));
+  }
+  entry->expectedCount = expectedCount;
+  batch->count++;
+  return 0;
+}
+
+/**
+ * @brief Add the files of a manifest to a batch. Each line of the manifest
+ * holds the path of a flash file followed by the expected CRC of each of
+ * its segments in hexadecimal, separated by spaces. Relative paths are
+ * relative to the directory of the manifest. Empty lines and lines starting
+ * with # are skipped.
+ *
+ * @param batch The batch.
+ * @param manifestName Path of the manifest.
+ * @return uint8_t 0 on success, 1 if the manifest can't be read or has an invalid line.
+ */
+uint8_t BatchLoadManifest(Batch *batch, const char *manifestName)
+{
+  FILE *pFile = fopen(manifestName, "r");
+  if (pFile == 0)
+  {
+    LOG_ERROR("Can't open batch manifest: %s", manifestName);
+    return 1;
+  }
+  const char *slash = strrchr(manifestName, '/');
+  const char *backslash = strrchr(manifestName, '\\');
+  if (backslash > slash)
+  {
+    slash = backslash;
+  }
+  std::string directory(manifestName, slash != 0 ? slash - manifestName + 1 : 0);
+  std::vector<uint64_t> expected;
+  char line[4096];
+  uint32_t lineNumber = 0;
+  uint8_t result = 0;
+  while (result == 0 && fgets(line, sizeof(line), pFile) != 0)
+  {
+    lineNumber++;
+    std::vector<char *> fields;
+    for (char *field = line + strspn(line, " \t\r\n"); *field != '\0'; field += strspn(field, " \t\r\n"))
+    {
+      fields.push_back(field);
+      field += strcspn(field, " \t\r\n");
+      if (*field != '\0')
+      {
+        *field++ = '\0';
+      }
+    }
+    if (fields.empty() || fields[0][0] == '#')
+    {
+      continue;
+    }
+    const char *fileName = fields[0];
+    expected.clear();
+    for (size_t i = 1; i < fields.size(); i++)
+    {
+      char *end;
+      expected.push_back(strtoull(fields[i], &end, 16));
+      if (*end != '\0' || strlen(fields[i]) > 16)
+      {
+        LOG_ERROR("Invalid checksum %s in line %u of %s", fields[i], lineNumber, manifestName);
+        result = 1;
+      }
+    }
+    bool absolute = fileName[0] == '/' || fileName[0] == '\\' || (fileName[0] != '\0' && fileName[1] == ':');
+    std::string path = absolute ? std::string(fileName) : directory + fileName;
+    if (result == 0 && BatchAddFile(batch, path.c_str(), expected.data(), (uint32_t)expected.size()) != 0)
+    {
+      result = 1;
+    }
+  }
+  fclose(pFile);
+  LOG_INFO("Batch manifest %s: %u files", manifestName, batch->count);
+  return result;
+}
+
+/**
+ * @brief Parse and checksum all pending files of a batch with the selected
+ * CRC profile. The largest files are dealt to the threads first, each
+ * thread works on its own queue and steals from the others when it runs
+ * dry. The data of a file is released as soon as its checksums are done.
+ *
+ * @param batch The batch.
+ * @param threads Amount of threads, 0 for one per processor.
+ */
+void BatchRun(Batch *batch, uint32_t threads)
+{
+  uint64_t start = TraceTimestamp();
+  if (threads == 0)
+  {
+    threads = std::thread::hardware_concurrency();
+  }
+  if (threads == 0)
+  {
+    threads = 1;
+  }
+  batch->crcBytes = GetCrcBytes();
+  batch->threads = threads;
+  BatchScheduler scheduler(batch, threads);
+  std::vector<std::pair<uint64_t, uint32_t>> sizes;
+  for (uint32_t i = 0; i < batch->count; i++)
+  {
+    memset(&scheduler.works[i].image, 0, sizeof(FlashImage));
+    scheduler.works[i].remaining = 0;
+    scheduler.works[i].checksumTicks = 0;
+    if (batch->entries[i].status == BATCH_PENDING)
+    {
+      sizes.push_back(std::make_pair(FileSize(batch->entries[i].fileName), i));
+    }
+  }
+  std::stable_sort(sizes.begin(), sizes.end(),
+                   [](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b)
+                   { return a.first > b.first; });
+  // Each thread takes its newest task, so the largest file is queued last.
+  for (size_t i = sizes.size(); i-- > 0;)
+  {
+    scheduler.queues[i % threads].tasks.push_back(BatchTask{sizes[i].second, -1});
+  }
+  scheduler.pending = sizes.size();
+  std::vector<std::thread> workers;
+  for (uint32_t i = 1; i < threads; i++)
+  {
+    workers.emplace_back(RunWorker, &scheduler, i);
+  }
+  RunWorker(&scheduler, 0);
+  for (std::thread &worker : workers)
+  {
+    worker.join();
+  }
+  batch->steals = scheduler.steals;
+  batch->time = Microseconds(&scheduler, TraceTimestamp() - start);
+  LOG_INFO("Batch of %u files on %u threads: %u us, %u steals",
+           (uint32_t)sizes.size(), threads, (uint32_t)batch->time, (uint32_t)batch->steals);
+}
+
+/**
+ * @brief Write the consolidated report of a batch as CSV, one line per
+ * file, followed by a summary line starting with #.
+ *
+ * @param batch A batch that has been run.
+ * @param pFile The report file, e.g. stdout.
+ * @return uint32_t Amount of files with a mismatch or error.
+ */
+uint32_t BatchWriteReport(const Batch *batch, FILE *pFile)
+{
+  uint32_t statusCount[BATCH_ERROR + 1] = {0};
+  uint64_t bytes = 0;
+  fprintf(pFile, "file,status,segments,bytes,parseTime,checksumTime,checksums,expected\n");
+  for (uint32_t i = 0; i < batch->count; i++)
+  {
+    const BatchEntry *entry = &batch->entries[i];
+    statusCount[entry->status]++;
+    bytes += entry->bytes;
+    fprintf(pFile, "%s,%s,%u,%llu,%llu,%llu,", entry->fileName, batchStatusNames[entry->status],
+            entry->segmentsCount, (unsigned long long)entry->bytes,
+            (unsigned long long)entry->parseTime, (unsigned long long)entry->checksumTime);
+    for (uint32_t j = 0; j < entry->segmentsCount; j++)
+    {
+      fprintf(pFile, "%s%.*llX", j != 0 ? " " : "", batch->crcBytes * 2,
+              (unsigned long long)entry->segments[j].checksum);
+    }
+    fprintf(pFile, ",");
+    for (uint32_t j = 0; j < entry->expectedCount; j++)
+    {
+      fprintf(pFile, "%s%.*llX", j != 0 ? " " : "", batch->crcBytes * 2, (unsigned long long)entry->expected[j]);
+    }
+    fprintf(pFile, "\n");
+  }
+  double seconds = batch->time / 1e6;
+  fprintf(pFile, "# files %u ok %u unchecked %u mismatch %u error %u bytes %llu time %llu us %.1f MB/s threads %u steals %llu\n",
+          batch->count, statusCount[BATCH_OK], statusCount[BATCH_UNCHECKED], statusCount[BATCH_MISMATCH],
+          statusCount[BATCH_ERROR], (unsigned long long)bytes, (unsigned long long)batch->time,
+          seconds > 0 ? bytes / seconds / 1e6 : 0.0, batch->threads, (unsigned long long)batch->steals);
+  return statusCount[BATCH_MISMATCH] + statusCount[BATCH_ERROR];
+}
+
+/**
+ * @brief Release all files and results of a batch.
+ *
+ * @param batch The batch.
+ */
+void BatchClear(Batch *batch)
+{
+  for (uint32_t i = 0; i < batch->count; i++)
+  {
+    free(batch->entries[i].fileName);
+    free(batch->entries[i].expected);
+    free(batch->entries[i].segments);
+  }
+  free(batch->entries);
+  memset(batch, 0, sizeof(Batch));
+}
@@ -0,0 +1,75 @@
+#ifndef BATCH_H
+#define BATCH_H
+#include <stdint.h>
+#include <stdio.h>
+#include "minilogger.h"
+#include "flashimage.h"
+
+/**
+ * @brief Result of a file of a batch.
+ *
+ */
+typedef enum
+{
+    BATCH_PENDING,   // Not processed yet.
+    BATCH_OK,        // All checksums match the expected ones.
+    BATCH_UNCHECKED, // Parsed, no expected checksums given.
+    BATCH_MISMATCH,  // A checksum or the amount of segments differs.
+    BATCH_ERROR      // The file can't be parsed.
+} batchStatus;
+
+/**
+ * @brief Segment table entry of a processed file, its data is released.
+ *
+ */
+typedef struct
+{
+    uint32_t address;
+    uint32_t size;
+    uint64_t checksum; // CRC of the selected profile, right aligned like in the manifest.
+} BatchSegment;
+
+/**
+ * @brief A flash file of a batch with its expected checksums and result.
+ *
+ */
+typedef struct
+{
+    char *fileName;
+    uint32_t expectedCount; // Amount of expected checksums, 0 to only parse.
+    uint64_t *expected;     // Expected CRC of each segment in order.
+    batchStatus status;
+    uint32_t segmentsCount;
+    BatchSegment *segments;
+    uint64_t bytes;         // Bytes of data of all segments.
+    uint64_t parseTime;     // Microseconds to parse the file.
+    uint64_t checksumTime;  // Microseconds to checksum all segments, summed over threads.
+} BatchEntry;
+
+/**
+ * @brief A batch of flash files processed together on a work-stealing thread pool.
+ *
+ */
+typedef struct
+{
+    uint32_t count;    // Amount of files.
+    uint32_t capacity; // Amount of files allocated.
+    BatchEntry *entries;
+    uint8_t crcBytes;  // Bytes of the CRC of the profile used by the last run.
+    uint32_t threads;  // Threads of the last run.
+    uint64_t time;     // Microseconds of the last run.
+    uint64_t steals;   // Tasks taken from the queue of another thread in the last run.
+} Batch;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint8_t BatchAddFile(Batch *batch, const char *fileName, const uint64_t *expected, uint32_t expectedCount);
+uint8_t BatchLoadManifest(Batch *batch, const char *manifestName);
+void BatchRun(Batch *batch, uint32_t threads);
+uint32_t BatchWriteReport(const Batch *batch, FILE *pFile);
+void BatchClear(Batch *batch);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -30,11 +30,17 @@
 
 #define USECDLL_FEATURE
 #define _BUILDNODELAYERDLL
+#define CAPLDLL_EXPORTS
 
 #include "cdll.h"
 #include "VIA.h"
 #include "VIA_CDLL.h"
+#include "capldll.h"
 #include "filepraser.h"
+#include "flashimage.h"
+#include "imagecache.h"
+#include "imageshare.h"
+#include "stats.h"
 #include "minilogger.h"
 #include "crc.h"
 
@@ -43,6 +49,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <map>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <atomic>
+#include <system_error>
 #include <time.h>
 
 #if defined(_WIN64) || defined(__linux__)
@@ -62,6 +76,8 @@ static char dlldata[100];
 
 VCaplMap gCaplMap;
 VServiceMap gServiceMap;
+static void DeleteFlashFileJobs(uint32_t handle);
+static void StopLazyDecoding();
 
 // ============================================================================
 // CaplInstanceData
@@ -372,6 +388,9 @@ void CAPLEXPORT CAPLPASCAL appInit(uint32_t handle)
 
 void CAPLEXPORT CAPLPASCAL appEnd(uint32_t handle)
 {
+  // jobs of this CAPL block can't be polled after it has gone
+  DeleteFlashFileJobs(handle);
+  FileLoggerFlush();
   CaplInstanceData *inst = GetCaplInstanceData(handle);
   if (inst == nullptr)
   {
@@ -460,6 +479,15 @@ void ClearAll()
   // just for clarity (would be done automatically)
   gCaplMap.clear();
   gServiceMap.clear();
+
+  // release the opened image, a shared image loses one reference
+  DeleteFlashFileJobs(0);
+  StopLazyDecoding();
+  ImageClear(&flashImage);
+
+  // write the buffered log messages and trace events and stop the flusher thread
+  TraceClose();
+  FileLoggerClose();
 }
 
 void CAPLEXPORT CAPLPASCAL voidFct(void)
@@ -560,13 +588,282 @@ void CAPLEXPORT CAPLPASCAL appPutDataOnePar(const uint8_t dataBlock[])
 }
 
 // BOOTLOADER SECTION
+// Parsing uses the global CRC parameters and look up table, so only
+// one flash file is opened at a time, synchronously or by a job.
+static std::mutex gOpenMutex;
+// Guards flashImage, which is replaced when a job completes.
+static std::mutex gImageMutex;
+// Profiles of crcspec calculated together with the checksum of each
+// segment, and their algorithms resolved by LoadCrcSpecification.
+// Guarded by gOpenMutex.
+static std::string gDigestNames;
+static CrcDigestSet gDigestSet;
+// HEX and SREC files larger than this many megabytes are streamed through
+// a spill file instead of being parsed in memory, 0 to parse all files in
+// memory. Set by blSetMemoryCeiling.
+static uint32_t gMemoryCeiling = 0;
+// Numbers the spill files of this process, so a file opened by a job doesn't
+// replace the spill of the image in transfer. Guarded by gOpenMutex.
+static uint32_t gSpillNumber = 0;
+
+/*
+Use an image published in shared memory by another CAPL node or process,
+or an image saved in the image cache, instead of parsing the flash file.
+An image loaded from the image cache is published for the other nodes.
+Returns 0 if the image has been found.
+*/
+static uint8_t OpenKnownImage(const ImageCacheKey *key, FlashImage *image)
+{
+  if (ImageShareAttach(key, image) == 0)
+  {
+    return 0;
+  }
+  if (ImageCacheLoad(key, image) == 0)
+  {
+    ImageSharePublish(key, image);
+    return 0;
+  }
+  return 1;
+}
+
+/*
+Calculate the checksums of all segments of an image with the CRCs of the
+digest set and, if enabled, their SHA-256 digests. Segments are distributed
+over all cores, the digest of the whole image is one more task running
+next to them. Checksums and digests already known are not calculated again.
+*/
+static void ChecksumSegments(FlashImage *image)
+{
+  bool checksums = !image->checksumsValid;
+  bool sha256 = sha256Enabled && !image->sha256Valid;
+  // Task 0 is the digest of the whole image, task i + 1 segment i.
+  std::atomic<uint32_t> next(sha256 ? 0 : 1);
+  auto worker = [image, checksums, sha256, &next]()
+  {
+    for (uint32_t task = next++; task <= image->count; task = next++)
+    {
+      uint64_t start = StatsStart();
+      if (task == 0)
+      {
+        ImageCalculateSha256(image);
+        StatsAddPhase(PHASE_CHECKSUM, start);
+        TRACE_SPAN(start, "SHA-256 of image, %u segments", image->count);
+        continue;
+      }
+      uint32_t i = task - 1;
+      if (checksums)
+      {
+        SegmentCalculateChecksum(&image->segments[i]);
+      }
+      SegmentCalculateDigests(&image->segments[i], checksums ? &gDigestSet : 0, sha256);
+      StatsAddPhase(PHASE_CHECKSUM, start);
+      TRACE_SPAN(start, "Checksum segment %u: 0x%.8x", i, image->segments[i].checksum);
+    }
+  };
+  if (!checksums && !sha256)
+  {
+    return;
+  }
+  uint32_t threadsCount = std::thread::hardware_concurrency();
+  if (threadsCount > image->count + sha256)
+  {
+    threadsCount = image->count + sha256;
+  }
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < threadsCount; i++)
+  {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+  image->checksumsValid = 1;
+  image->sha256Valid |= sha256;
+}
+
+/*
+Get CRC specifcation and its look up table. crcspec is parsed again only
+when it changed, the tables of its profiles are cached.
+*/
+static void LoadCrcSpecification()
+{
+  LOG_INFO("Get CRC specification from crcspec");
+  uint64_t start = StatsStart();
+  LoadCrcSpec("crcspec");
+  if (ResolveCrcDigests(gDigestNames.c_str(), &gDigestSet) != 0)
+  {
+    LOG_ERROR("Digest set %s is not calculated", gDigestNames.c_str());
+  }
+  StatsAddPhase(PHASE_CONFIG_LOAD, start);
+  TRACE_SPAN(start, "Load crcspec");
+}
+
+/*
+Save the sizes of the checksum and of the CRCs of the digest set of an
+image opened with the loaded crcspec.
+*/
+static void DescribeChecksums(FlashImage *image)
+{
+  image->checksumBytes = GetCrcBytes();
+  image->digestsCount = (uint8_t)gDigestSet.count;
+  memcpy(image->digestBytes, gDigestSet.bytes, sizeof(image->digestBytes));
+}
+
+/*
+Calculate the image cache key of a flash file. A selected CRC profile and
+the digest set are part of the key, images checksummed with other
+algorithms are not reused.
+The key of the first profile is the key of crcspec alone.
+Returns 0 on success.
+*/
+static uint8_t FlashCacheKeyOf(const char *fileName, ImageCacheKey *key)
+{
+  if (ImageCacheKeyOf(fileName, "crcspec", key) != 0)
+  {
+    return 1;
+  }
+  const char *profileName = GetCrcProfileName();
+  if (profileName[0] != '\0')
+  {
+    key->specHash = HashBuffer((const uint8_t *)profileName, strlen(profileName), key->specHash);
+  }
+  if (!gDigestNames.empty())
+  {
+    key->specHash = HashBuffer((const uint8_t *)gDigestNames.data(), gDigestNames.size(), key->specHash);
+  }
+  return 0;
+}
+
+/*
+Check if a flash file is streamed because it is larger than the memory
+ceiling. Only HEX and SREC files are streamed.
+*/
+static bool StreamedFile(const char *fileName, flashFileFormat format)
+{
+  if (gMemoryCeiling == 0 || (format != FORMAT_HEX && format != FORMAT_SREC))
+  {
+    return false;
+  }
+  std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+  return file && (uint64_t)file.tellg() > ((uint64_t)gMemoryCeiling << 20);
+}
+
+/*
+Stream a flash file larger than the memory ceiling into an image. The data
+is written to a spill file and read back by blBuffer, the checksums and
+digests are calculated in the same pass. The image is neither saved to the
+image cache nor shared. gOpenMutex must be held.
+Returns 0 on success, -1 on failure.
+*/
+static int32_t StreamFlashImage(const char *fileName, flashFileFormat format, FlashImage *image)
+{
+  char spillName[48];
+  SpillFileName(spillName, sizeof(spillName), "blspill", gSpillNumber++);
+  LOG_INFO("Stream flash file through %s: %s", spillName, fileName);
+  uint64_t start = StatsStart();
+  uint8_t result = StreamFlashText(fileName, format, gMemoryCeiling << 20, spillName, &gDigestSet,
+                                   sha256Enabled, image);
+  StatsAddPhase(PHASE_PARSE, start);
+  if (result != 0)
+  {
+    return -1;
+  }
+  TRACE_SPAN(start, "Stream flash file, %u segments", image->count);
+  return 0;
+}
+
+/*
+Open a flash file into an image with valid checksums. format is the format
+of the file, FORMAT_UNKNOWN to detect it from the first bytes of the file.
+Returns 0 on success, -1 on failure.
+*/
+static int32_t OpenFlashImage(const char *fileName, flashFileFormat format, uint32_t baseAddress, FlashImage *image)
+{
+  std::lock_guard<std::mutex> lock(gOpenMutex);
+  uint8_t result = 1;
+  ImageCacheKey key;
+  // An image parsed before with the same crcspec is mapped from shared
+  // memory or the image cache, the flash file is not parsed again.
+  // crcspec is parsed only if it changed.
+  LoadCrcSpecification();
+  if (gMemoryCeiling != 0 && format == FORMAT_UNKNOWN)
+  {
+    format = DetectFlashFileFormat(fileName);
+  }
+  if (StreamedFile(fileName, format))
+  {
+    DescribeChecksums(image);
+    return StreamFlashImage(fileName, format, image);
+  }
+  uint8_t keyValid = FlashCacheKeyOf(fileName, &key) == 0;
+  if (format == FORMAT_BIN)
+  {
+    // The base address is part of the cache key of a binary file.
+    key.specHash = HashBuffer((const uint8_t *)&baseAddress, sizeof(baseAddress), key.specHash);
+  }
+  TRACE_EVENT("Open flash file, format %u", format);
+  DescribeChecksums(image);
+  if (keyValid && OpenKnownImage(&key, image) == 0)
+  {
+    TRACE_EVENT("Known image opened, %u segments", image->count);
+    return 0;
+  }
+
+  if (format == FORMAT_UNKNOWN)
+  {
+    LOG_INFO("Get format info of flash file: %s", fileName);
+    format = DetectFlashFileFormat(fileName);
+  }
+  uint64_t start = StatsStart();
+  switch (format)
+  {
+  case FORMAT_HEX:
+    LOG_INFO("This is a Intel HEX file");
+    result = ParseHex(fileName, image);
+    break;
+  case FORMAT_SREC:
+    LOG_INFO("This is a SREC file");
+    result = ParseSREC(fileName, image);
+    break;
+  case FORMAT_ELF:
+    LOG_INFO("This is a ELF file");
+    result = ParseElf(fileName, image);
+    break;
+  case FORMAT_BIN:
+    LOG_INFO("This is a raw binary file");
+    result = ParseBin(fileName, baseAddress, image);
+    break;
+  default:
+    LOG_ERROR("Can't open this flash file");
+    break;
+  }
+  StatsAddPhase(PHASE_PARSE, start);
+  if (result != 0)
+  {
+    return -1;
+  }
+  TRACE_SPAN(start, "Parse flash file, %u segments", image->count);
+  ChecksumSegments(image);
+  if (keyValid)
+  {
+    // Save the parsed image to the image cache and publish it in shared memory.
+    ImageCacheStore(&key, image);
+    ImageSharePublish(&key, image);
+  }
+  return 0;
+}
+
 /*
 Function Name: blOpenFlashFile
 
-Function: Parsing a HEX or SREC file. 
+Function: Parsing a HEX, SREC, ELF or raw binary file. The format is
+detected from the first bytes of the file. A raw binary file is
+loaded at address 0, use blOpenBinFile for other base addresses.
 
 Parameters:
-  fileName:       The path of a HEX or SREC file to be parsed.
+  fileName:       The path of a flash file to be parsed.
   segmentsCount:  Qauntity of blockes will be saved in this variable.
   AddressAndSize: Start address and size of each block will be saved in this array.
   checksum:       Checksum of each block will be saved in this array.
@@ -575,171 +872,990 @@ int32_t CAPLEXPORT CAPLPASCAL blOpenFlashFile(const char *fileName,
                                               uint32_t *segmentsCount, uint8_t addressAndSize[][8],
                                               uint8_t checksum[][4])
 {
-  FILE *pFile = 0;  // SREC file pointer
-  char string[255]; // String to receive lines read from the SREC file.
   // Init log file
   FileLoggerInit("capldlllog");
-  // Get CRC specifcation and calculate its look
-  // up table.
-  LOG_INFO("Get CRC32 specification from crcspec");
-  appSepcifyCRCParameters();
-  LOG_INFO("Calculate CRC32 look up table");
-  CalculateCrcTable();
-
-  // Open the SREC file by path in read only mode.
-  LOG_INFO("Open flash file: %s", fileName);
-  pFile = fopen(fileName, "r");
-  if (pFile == 0)
+  uint64_t start = TraceTimestamp();
+  *segmentsCount = 0;
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  StopLazyDecoding();
+  if (OpenFlashImage(fileName, FORMAT_UNKNOWN, 0x0, &flashImage) != 0)
   {
-    LOG_ERROR("Can't open this flash file");
     return -1;
   }
-  // Check whether the SREC file opened successfully.
-  LOG_INFO("Get format info of this file");
-  fscanf(pFile, "%s", string);
-  LOG_INFO("Close flash file: %s", fileName);
-  fclose(pFile);
+  TRACE_SPAN(start, "Open flash file, %u segments", flashImage.count);
+  return ImageExport(&flashImage, segmentsCount, addressAndSize, checksum) == 0 ? 0 : -1;
+}
 
-  if (string[0] == ':')
-  {
-    LOG_INFO("This is a Intel HEX file");
-    HandleHex(fileName, segmentsCount, addressAndSize, checksum);
-  }
-  else if (string[0] == 'S')
+/*
+Function Name: blOpenBinFile
+
+Function: Loading a raw binary file as one block starting at baseAddress.
+
+Parameters:
+  fileName:       The path of a binary file to be loaded.
+  baseAddress:    Address of the first byte in the file.
+  segmentsCount:  Qauntity of blockes will be saved in this variable.
+  AddressAndSize: Start address and size of each block will be saved in this array.
+  checksum:       Checksum of each block will be saved in this array.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blOpenBinFile(const char *fileName, uint32_t baseAddress,
+                                            uint32_t *segmentsCount, uint8_t addressAndSize[][8],
+                                            uint8_t checksum[][4])
+{
+  FileLoggerInit("capldlllog");
+  uint64_t start = TraceTimestamp();
+  *segmentsCount = 0;
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  StopLazyDecoding();
+  if (OpenFlashImage(fileName, FORMAT_BIN, baseAddress, &flashImage) != 0)
   {
-    LOG_INFO("This is a SREC file");
-    HandleSREC(fileName, segmentsCount, addressAndSize, checksum);
+    return -1;
   }
-  return 0;
+  TRACE_SPAN(start, "Open binary file at 0x%.8x", baseAddress);
+  return ImageExport(&flashImage, segmentsCount, addressAndSize, checksum) == 0 ? 0 : -1;
 }
 
 /*
-Function name: blBuffer
+A flash file opened in the background by blOpenFlashFileAsync.
+*/
+struct FlashFileJob
+{
+  uint32_t handle; // CAPL block that started the job.
+  std::string fileName;
+  std::thread worker;
+  std::atomic<int32_t> result; // 1 while running, then 0 on success or -1 on failure.
+  FlashImage image;
+};
+typedef std::map<uint32_t, FlashFileJob *> VJobMap;
 
-Function: Composing whole Transfer Data PDUs i.e. 0x3601xxxx...xxxxx 
-according to the data in each block and fill the transimition buffer
-with those PDUs.
+static std::mutex gJobMutex; // Guards gJobMap and gNextJob.
+static VJobMap gJobMap;
+static uint32_t gNextJob = 1;
 
-Parameters:
-  bufferLength: Availabel length of the transimition buffer.
-  data:         Transimition buffer. The PDU will be saved in this buffer.
-  dataLength:   Length of a PDU saved in the transimition buffer will
-                be saved in this variable.
-  segment:      Indicate which block will be used for composing PDUs.
-*/
-int32_t CAPLEXPORT CAPLPASCAL blBuffer(uint32_t bufferLength,
-uint8_t *data, uint32_t *dataLength, uint32_t segment)
+static void RunFlashFileJob(uint32_t job, FlashFileJob *flashFileJob)
 {
-  static uint8_t blockSequenceCounter = 0x0;
-  static FILE *tempFile = 0;
-  static char tempName[12] = "hex000";
+  uint64_t start = TraceTimestamp();
+  int32_t result = OpenFlashImage(flashFileJob->fileName.c_str(), FORMAT_UNKNOWN, 0x0, &flashFileJob->image);
+  TRACE_SPAN(start, "Job %u opened flash file, result %d", job, result);
+  LOG_INFO("Job %d completed with result %d", job, result);
+  // CAPL may only be called from the measurement thread, so the completion
+  // is picked up by blPollFlashFile.
+  flashFileJob->result = result;
+}
 
-  *dataLength = 2;
-  data[0] = 0x36;
-  data[1] = ++blockSequenceCounter;
+/*
+Wait for a job and free it. gJobMutex mustn't be held, so other jobs
+can be polled meanwhile.
+*/
+static void DeleteFlashFileJob(FlashFileJob *flashFileJob)
+{
+  if (flashFileJob->worker.joinable())
+  {
+    flashFileJob->worker.join();
+  }
+  ImageClear(&flashFileJob->image);
+  delete flashFileJob;
+}
 
-  // Open temp file
-  if (tempFile == 0)
+/*
+Wait for and free all jobs started by a CAPL block, all jobs if handle is 0.
+*/
+static void DeleteFlashFileJobs(uint32_t handle)
+{
+  std::vector<FlashFileJob *> jobs;
   {
-    // tempName[5] += segment;
-    sprintf(tempName+3,"%03.3d",segment);
-    LOG_INFO("Open temp file: %s", tempName);
-    tempFile = fopen(tempName, "r");
-    if (tempFile == 0)
+    std::lock_guard<std::mutex> lock(gJobMutex);
+    for (VJobMap::iterator lIter = gJobMap.begin(); lIter != gJobMap.end();)
     {
-      // Logs on failure and return -1(Failure)
-      LOG_ERROR("Can't open temp file %s", tempName);
-      return -1;
+      if (handle == 0 || lIter->second->handle == handle)
+      {
+        jobs.push_back(lIter->second);
+        lIter = gJobMap.erase(lIter);
+      }
+      else
+      {
+        ++lIter;
+      }
     }
   }
-  // Read data from temp file
-  for (uint32_t i = 2; i < bufferLength; i++)
+  for (FlashFileJob *flashFileJob : jobs)
   {
-    uint32_t tempChar;
-    if (fscanf(tempFile, "%2hhx", &tempChar) != EOF)
-    {
-      data[i] = tempChar;
-      (*dataLength)++;
-    }
-    else if (*dataLength > 2)
-    {
-      LOG_INFO("Last block size: 0x%.3X",*dataLength);
-      LOG_INFO("Last block sequence counter: 0x%.2X",blockSequenceCounter);
-      return 0;
-    }
-    else
-    {
-      LOG_INFO("Has reached the end of this temp file");
-      LOG_INFO("Close temp file: %s", tempName);
-      fclose(tempFile);
-      tempFile = 0;
-      blockSequenceCounter = 0x0;
-      tempName[5] = '0';
-      return -1;
-    }
+    DeleteFlashFileJob(flashFileJob);
   }
-  return 0;
 }
 
-/**
- * @brief 
- * 
- * @param bufferLength 
- * @param data 
- * @param dataLength 
- * @param segment 
- * @return int32_t 
- */
-int32_t CAPLEXPORT CAPLPASCAL blFaultInjectionBufferCorruptData(uint32_t bufferLength,
-uint8_t *data, uint32_t *dataLength, uint32_t segment)
-{
-  static uint8_t blockSequenceCounter = 0x01;
-  static FILE *tempFile = 0;
-  static char tempName[12] = "hex000";
+/*
+Function Name: blOpenFlashFileAsync
 
-  *dataLength = 2;
-  data[0] = 0x36;
-  data[1] = blockSequenceCounter++;
+Function: Parsing a flash file like blOpenFlashFile, but in the background.
+Returns immediately with a job handle. The job is polled with
+blPollFlashFile, e.g. from a CAPL timer, until it returns the segment info.
+CAPL isn't called back from the worker thread, CAPL functions may only be
+called from the measurement thread.
 
-  // Open temp file
-  if (tempFile == 0)
+Parameters:
+  handle:   Handle of the calling CAPL block, as passed to dllInit.
+  fileName: The path of a flash file to be parsed.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blOpenFlashFileAsync(uint32_t handle, const char *fileName)
+{
+  FileLoggerInit("capldlllog");
+  FlashFileJob *flashFileJob;
+  try
   {
-    // tempName[5] += segment;
-    sprintf(tempName+3,"%03.3d",segment);
-    LOG_INFO("Open temp file: %s", tempName);
-    tempFile = fopen(tempName, "r");
-    if (tempFile == 0)
-    {
-      // Logs on failure and return -1(Failure)
-      LOG_ERROR("Can't open temp file %s", tempName);
-      return -1;
-    }
+    flashFileJob = new FlashFileJob();
   }
-  // Read data from temp file
-  for (uint32_t i = 2; i < bufferLength; i++)
+  catch (std::bad_alloc &)
   {
-    uint32_t tempChar;
-    if (fscanf(tempFile, "%2hhx", &tempChar) != EOF)
-    {
-      data[i] = tempChar + 1;
-      (*dataLength)++;
-    }
-    else if (*dataLength > 2)
+    return -1;
+  }
+  flashFileJob->handle = handle;
+  flashFileJob->fileName = fileName;
+  flashFileJob->result = 1;
+  flashFileJob->image = {0, 0, 0, 0, 0, 0, 0};
+  std::lock_guard<std::mutex> lock(gJobMutex);
+  uint32_t job = gNextJob++;
+  LOG_INFO("Job %d opens flash file: %s", job, fileName);
+  try
+  {
+    flashFileJob->worker = std::thread(RunFlashFileJob, job, flashFileJob);
+  }
+  catch (std::system_error &)
+  {
+    LOG_ERROR("Can't start job %d", job);
+    delete flashFileJob;
+    return -1;
+  }
+  gJobMap[job] = flashFileJob;
+  return (int32_t)job;
+}
+
+/*
+Function Name: blPollFlashFile
+
+Function: Get the result of a job started by blOpenFlashFileAsync.
+When the job has completed successfully, its image becomes the image
+used by blBuffer and the segment info is saved like blOpenFlashFile does.
+A completed job is freed.
+
+Returns 1 while the job is running, 0 on success and -1 on failure
+or if the job doesn't exist.
+
+Parameters:
+  job:            Job handle returned by blOpenFlashFileAsync.
+  segmentsCount:  Qauntity of blockes will be saved in this variable.
+  AddressAndSize: Start address and size of each block will be saved in this array.
+  checksum:       Checksum of each block will be saved in this array.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blPollFlashFile(uint32_t job,
+                                              uint32_t *segmentsCount, uint8_t addressAndSize[][8],
+                                              uint8_t checksum[][4])
+{
+  FlashFileJob *flashFileJob;
+  {
+    std::lock_guard<std::mutex> lock(gJobMutex);
+    VJobMap::iterator lSearchResult(gJobMap.find(job));
+    if (gJobMap.end() == lSearchResult)
     {
-      return 0;
+      return -1;
     }
-    else
+    flashFileJob = lSearchResult->second;
+    if (flashFileJob->result == 1)
     {
-      LOG_INFO("Has reached the end of this temp file");
-      LOG_INFO("Close temp file: %s", tempName);
-      fclose(tempFile);
-      tempFile = 0;
-      blockSequenceCounter = 0x1;
-      tempName[5] = 0;
-      return -1;
+      return 1;
     }
+    gJobMap.erase(lSearchResult);
   }
-  return 0;
+  int32_t result = flashFileJob->result;
+  *segmentsCount = 0;
+  if (result == 0)
+  {
+    // Hand over the parsed image to blBuffer.
+    std::lock_guard<std::mutex> lock(gImageMutex);
+    StopLazyDecoding();
+    ImageClear(&flashImage);
+    flashImage = flashFileJob->image;
+    flashFileJob->image = {0, 0, 0, 0, 0, 0, 0};
+    result = ImageExport(&flashImage, segmentsCount, addressAndSize, checksum) == 0 ? 0 : -1;
+  }
+  DeleteFlashFileJob(flashFileJob);
+  return result;
+}
+
+/*
+Function Name: blSetImageCache
+
+Function: Enable or disable the image cache. Parsed images are saved in
+directory blcache of the CANoe project root and mapped from there when
+the same flash file is opened again with the same crcspec. The cache is
+disabled by default.
+
+Parameters:
+  enable: 1 to enable the image cache, 0 to disable it.
+*/
+void CAPLEXPORT CAPLPASCAL blSetImageCache(uint32_t enable)
+{
+  imageCacheEnabled = enable != 0;
+}
+
+/*
+Function Name: blSetSha256
+
+Function: Enable or disable SHA-256 digests of flash files. Digests of
+each segment and of the whole image are calculated with the checksums
+and fetched with blGetSha256.
+
+Parameters:
+  enable: 1 to enable SHA-256 digests, 0 to disable them.
+*/
+void CAPLEXPORT CAPLPASCAL blSetSha256(uint32_t enable)
+{
+  sha256Enabled = enable != 0;
+}
+
+/*
+Function Name: blSetImageShare
+
+Function: Enable or disable sharing of parsed images. A parsed image is
+published in named shared memory and other CAPL nodes or processes opening
+the same flash file with the same crcspec attach to it instead of parsing.
+Only processes of the same user can attach. Sharing is disabled by default.
+
+Parameters:
+  enable: 1 to enable image sharing, 0 to disable it.
+*/
+void CAPLEXPORT CAPLPASCAL blSetImageShare(uint32_t enable)
+{
+  imageShareEnabled = enable != 0;
+}
+
+/*
+Function Name: blSetHugePages
+
+Function: Enable or disable huge pages for parsed images. The segment table
+and the data of an image are allocated in chunks growing up to 64 MB,
+chunks of 2 MB and more are backed by huge pages if enabled, which saves
+TLB misses when large images are checksummed and transferred. Normal pages
+are used if the system has no huge pages available.
+
+Parameters:
+  enable: 1 to enable huge pages, 0 to disable them.
+*/
+void CAPLEXPORT CAPLPASCAL blSetHugePages(uint32_t enable)
+{
+  arenaHugePages = enable != 0;
+}
+
+/*
+Function Name: blSetMemoryCeiling
+
+Function: Set the memory ceiling of opening flash files. A HEX or SREC file
+larger than the ceiling is streamed: its records are decoded and checksummed
+in one pass and the data is written to a binary spill file blspill<pid>_* in the
+CANoe project root, only a window of it stays in memory. blBuffer reads each
+block sequentially from the spill file. Enable SHA-256 digests before such a
+file is opened, they can't be calculated afterwards.
+
+Parameters:
+  megabytes: Memory for the text and the decoded data of a flash file, at most
+             4095, 0 to parse all flash files in memory.
+*/
+void CAPLEXPORT CAPLPASCAL blSetMemoryCeiling(uint32_t megabytes)
+{
+  gMemoryCeiling = megabytes < 4096 ? megabytes : 4095;
+}
+
+/*
+Function Name: blSelectCrcProfile
+
+Function: Select the CRC profile used by the following opens of flash
+files. crcspec may hold several profiles, each starting with a line
+"Profile name", e.g. one per ECU or logical block. The profiles and their
+look up tables are cached, selecting one doesn't calculate any table.
+
+Parameters:
+  profileName: Name of a profile in crcspec, an empty name selects the first profile.
+
+Return: 0 on success, -1 if crcspec has no valid profile of this name.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blSelectCrcProfile(const char *profileName)
+{
+  FileLoggerInit("capldlllog");
+  std::lock_guard<std::mutex> lock(gOpenMutex);
+  if (LoadCrcSpec("crcspec") != 0 || SelectCrcProfile(profileName) != 0)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+Function Name: blSetDigests
+
+Function: Select the profiles of crcspec calculated together with the
+checksum of each segment by the following opens of flash files, e.g.
+the CRC32 and CRC16 of different ECU generations. Each chunk of segment
+data is fed to all of them in one pass, the file is parsed only once.
+
+Parameters:
+  profileNames: Names of up to 8 profiles separated by commas, e.g.
+                "default,CCITT". An empty string calculates only the checksum.
+
+Return: 0 on success, -1 if a profile doesn't exist in crcspec.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blSetDigests(const char *profileNames)
+{
+  FileLoggerInit("capldlllog");
+  std::lock_guard<std::mutex> lock(gOpenMutex);
+  CrcDigestSet digests;
+  if (LoadCrcSpec("crcspec") != 0 || ResolveCrcDigests(profileNames, &digests) != 0)
+  {
+    return -1;
+  }
+  gDigestNames = profileNames;
+  gDigestSet = digests;
+  LOG_INFO("Digest set: %s", profileNames);
+  return 0;
+}
+
+/*
+Function Name: blSetLogLevel
+
+Function: Set the level of messages written to capldlllog. Messages
+of a lower level are skipped before they are formatted. Messages below
+the build time level LOG_COMPILE_LEVEL are never logged.
+
+Parameters:
+  level: 0 trace, 1 debug, 2 info(default), 3 warning, 4 error, 5 fatal, 6 off.
+*/
+void CAPLEXPORT CAPLPASCAL blSetLogLevel(uint32_t level)
+{
+  logLevel = (unsigned char)(level > LOG_LEVEL_OFF ? LOG_LEVEL_OFF : level);
+}
+
+/*
+Function Name: blStartTrace
+
+Function: Start recording a binary trace of every PDU and open phase to
+a trace file, which is overwritten. Recording costs a few nanoseconds per
+event, tools/tracedump converts the trace file to text or CSV.
+
+Parameters:
+  fileName: The path of the trace file.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blStartTrace(const char *fileName)
+{
+  FileLoggerInit("capldlllog");
+  return TraceOpen(fileName) == 0 ? 0 : -1;
+}
+
+/*
+Function Name: blStopTrace
+
+Function: Stop recording and close the trace file.
+*/
+void CAPLEXPORT CAPLPASCAL blStopTrace(void)
+{
+  TraceClose();
+}
+
+/*
+Function Name: blGetStats
+
+Function: Getting the timing statistics of the DLL since the last
+blResetStats. For each phase, config load, CRC table, parse, checksum
+and PDU fill, three entries hold the amount of calls, the total time
+and the longest call in microseconds. They are followed by the amount
+of blBuffer calls, the bytes filled into PDUs and the 50th, 90th and
+99th percentile and the maximum of the blBuffer latency in nanoseconds.
+Returns the amount of entries saved.
+
+Parameters:
+  length: Entries available in stats.
+  stats:  The statistics will be saved in this array.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blGetStats(uint32_t length, uint32_t stats[])
+{
+  return (int32_t)StatsExport(length, stats);
+}
+
+/*
+Function Name: blResetStats
+
+Function: Clearing the timing statistics, e.g. before opening the next image.
+*/
+void CAPLEXPORT CAPLPASCAL blResetStats(void)
+{
+  StatsReset();
+}
+
+/*
+Decoding state of a flash file opened by blOpenFlashFileLazy. Only the
+record headers are scanned when the file is opened, the payload of each
+segment is decoded and checksummed by a worker in the background while
+earlier segments are already transferred. The worker decodes in segment
+order, unless a transfer waits for a later segment.
+*/
+struct LazyDecoder
+{
+  std::mutex mutex;                // Guards the members below.
+  std::condition_variable decoded; // Notified when a segment has been decoded.
+  std::thread worker;
+  std::vector<uint8_t> state;      // Per segment 0 pending, 1 decoded, 2 failed. Empty if nothing is pending.
+  int32_t wanted = -1;             // Segment a transfer waits for, -1 if none.
+  bool cancel = false;
+  const char *text = nullptr; // Mapped flash file.
+  size_t textSize = 0;
+  flashFileFormat format;
+  ImageCacheKey key;
+  bool keyValid;
+};
+static LazyDecoder gLazy;
+
+/*
+Decode and checksum the segments of flashImage with the CRCs of the
+digest set, also their SHA-256 digests if enabled when decoding starts,
+then save the image to the image cache. Runs on gLazy.worker, which
+holds gOpenMutex as it uses the CRC look up table and the digest set.
+*/
+static void RunLazyDecoder()
+{
+  std::lock_guard<std::mutex> openLock(gOpenMutex);
+  std::unique_lock<std::mutex> lock(gLazy.mutex);
+  uint32_t next = 0;
+  bool failed = false;
+  bool sha256 = sha256Enabled != 0;
+  while (!gLazy.cancel)
+  {
+    uint32_t segment = next;
+    if (gLazy.wanted >= 0 && gLazy.state[gLazy.wanted] == 0)
+    {
+      segment = (uint32_t)gLazy.wanted;
+    }
+    while (segment == next && next < gLazy.state.size() && gLazy.state[next] != 0)
+    {
+      segment = ++next;
+    }
+    if (segment >= gLazy.state.size())
+    {
+      break;
+    }
+    lock.unlock();
+    FlashSegment *flashSegment = &flashImage.segments[segment];
+    uint64_t start = StatsStart();
+    uint8_t result = DecodeFlashSegment(gLazy.text, gLazy.format, &flashImage, flashSegment);
+    StatsAddPhase(PHASE_PARSE, start);
+    if (result == 0)
+    {
+      start = StatsStart();
+      SegmentCalculateChecksum(flashSegment);
+      // The data just decoded is still in the cache.
+      SegmentCalculateDigests(flashSegment, &gDigestSet, sha256);
+      StatsAddPhase(PHASE_CHECKSUM, start);
+      TRACE_SPAN(start, "Checksum segment %u: 0x%.8x", segment, flashSegment->checksum);
+    }
+    lock.lock();
+    gLazy.state[segment] = result == 0 ? 1 : 2;
+    failed |= result != 0;
+    gLazy.decoded.notify_all();
+  }
+  bool complete = !gLazy.cancel && !failed;
+  lock.unlock();
+  if (complete)
+  {
+    LOG_INFO("All %d segments decoded", flashImage.count);
+    flashImage.checksumsValid = 1;
+    if (sha256)
+    {
+      uint64_t start = StatsStart();
+      ImageCalculateSha256(&flashImage);
+      StatsAddPhase(PHASE_CHECKSUM, start);
+      flashImage.sha256Valid = 1;
+    }
+    if (gLazy.keyValid)
+    {
+      // Published in shared memory when the file is opened again.
+      ImageCacheStore(&gLazy.key, &flashImage);
+    }
+  }
+}
+
+/*
+Stop decoding in the background, before flashImage is replaced.
+gImageMutex must be held.
+*/
+static void StopLazyDecoding()
+{
+  {
+    std::lock_guard<std::mutex> lock(gLazy.mutex);
+    gLazy.cancel = true;
+  }
+  if (gLazy.worker.joinable())
+  {
+    gLazy.worker.join();
+  }
+  std::lock_guard<std::mutex> lock(gLazy.mutex);
+  UnmapFile((void *)gLazy.text, gLazy.textSize);
+  gLazy.text = nullptr;
+  gLazy.textSize = 0;
+  gLazy.state.clear();
+  gLazy.wanted = -1;
+  gLazy.cancel = false;
+}
+
+/*
+Wait until a segment of flashImage has been decoded. gImageMutex must be held.
+Returns 0 if the data and checksum of the segment are valid.
+*/
+static uint8_t WaitSegmentDecoded(uint32_t segment)
+{
+  std::unique_lock<std::mutex> lock(gLazy.mutex);
+  if (segment >= gLazy.state.size())
+  {
+    return 0;
+  }
+  if (gLazy.state[segment] == 0)
+  {
+    LOG_DEBUG("Wait for segment %d to be decoded", segment);
+    uint64_t start = TraceTimestamp();
+    gLazy.wanted = (int32_t)segment;
+    gLazy.decoded.wait(lock, [segment]()
+                       { return gLazy.state[segment] != 0; });
+    gLazy.wanted = -1;
+    TRACE_SPAN(start, "Wait for segment %u to be decoded", segment);
+  }
+  return gLazy.state[segment] == 1 ? 0 : 1;
+}
+
+/*
+Index a HEX or SREC file into flashImage and start decoding it in the
+background. gImageMutex must be held and no decoding may be running.
+Returns 0 on success, -1 on failure.
+*/
+static int32_t OpenLazyImage(const char *fileName, flashFileFormat format)
+{
+  std::lock_guard<std::mutex> lock(gOpenMutex);
+  LoadCrcSpecification();
+  DescribeChecksums(&flashImage);
+  gLazy.keyValid = FlashCacheKeyOf(fileName, &gLazy.key) == 0;
+  if (gLazy.keyValid && OpenKnownImage(&gLazy.key, &flashImage) == 0)
+  {
+    return 0;
+  }
+  gLazy.text = (const char *)MapFile(fileName, &gLazy.textSize);
+  if (gLazy.text == nullptr)
+  {
+    // An empty file has no segments to be decoded.
+    ImageClear(&flashImage);
+    return DetectFlashFileFormat(fileName) == FORMAT_UNKNOWN ? -1 : 0;
+  }
+  LOG_INFO("Index flash file: %s", fileName);
+  uint64_t start = StatsStart();
+  uint8_t result = IndexFlashText(gLazy.text, gLazy.textSize, format, &flashImage);
+  StatsAddPhase(PHASE_PARSE, start);
+  if (result != 0)
+  {
+    return -1;
+  }
+  TRACE_SPAN(start, "Index flash file, %u segments", flashImage.count);
+  gLazy.format = format;
+  gLazy.state.assign(flashImage.count, 0);
+  try
+  {
+    gLazy.worker = std::thread(RunLazyDecoder);
+  }
+  catch (std::system_error &)
+  {
+    LOG_ERROR("Can't start decoding of flash file: %s", fileName);
+    gLazy.state.clear();
+    return -1;
+  }
+  return 0;
+}
+
+/*
+Function Name: blOpenFlashFileLazy
+
+Function: Opening a flash file like blOpenFlashFile, but only the segment
+table is built before returning. A HEX or SREC file is decoded and
+checksummed in the background, blBuffer waits for the data of a segment
+not decoded yet. The checksum of each segment is fetched with
+blGetSegmentChecksum. Other formats and files streamed because they are
+larger than the memory ceiling are opened completely.
+
+Parameters:
+  fileName:       The path of a flash file to be opened.
+  segmentsCount:  Qauntity of blockes will be saved in this variable.
+  AddressAndSize: Start address and size of each block will be saved in this array.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blOpenFlashFileLazy(const char *fileName,
+                                                  uint32_t *segmentsCount, uint8_t addressAndSize[][8])
+{
+  FileLoggerInit("capldlllog");
+  uint64_t start = TraceTimestamp();
+  *segmentsCount = 0;
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  StopLazyDecoding();
+  LOG_INFO("Get format info of flash file: %s", fileName);
+  flashFileFormat format = DetectFlashFileFormat(fileName);
+  int32_t result;
+  if ((format == FORMAT_HEX || format == FORMAT_SREC) && !StreamedFile(fileName, format))
+  {
+    result = OpenLazyImage(fileName, format);
+  }
+  else
+  {
+    result = OpenFlashImage(fileName, format, 0x0, &flashImage);
+  }
+  if (result != 0)
+  {
+    return -1;
+  }
+  TRACE_SPAN(start, "Open flash file lazily, %u segments", flashImage.count);
+  return ImageExportLayout(&flashImage, segmentsCount, addressAndSize) == 0 ? 0 : -1;
+}
+
+/*
+Function Name: blGetSegmentChecksum
+
+Function: Getting the checksum of a segment of the opened flash file,
+waiting until the segment has been decoded.
+
+Parameters:
+  segment:  Index of the segment.
+  checksum: Checksum of the segment will be saved in this array.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blGetSegmentChecksum(uint32_t segment, uint8_t checksum[4])
+{
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  if (segment >= flashImage.count)
+  {
+    LOG_ERROR("Block %d doesn't exist", segment);
+    return -1;
+  }
+  if (WaitSegmentDecoded(segment) != 0)
+  {
+    return -1;
+  }
+  Uint2Array(&flashImage.segments[segment].checksum, checksum);
+  return 0;
+}
+
+/*
+Function Name: blGetWideChecksum
+
+Function: Getting the checksum of a segment of the opened flash file for
+CRC widths up to 64 bits, e.g. CRC-64/XZ. The CRC is saved big endian in
+the first bytes of the array, the 4 byte checksum of the other functions
+holds only its first 4 bytes. Waits until the segment has been decoded.
+
+Parameters:
+  segment:  Index of the segment.
+  checksum: Checksum of the segment will be saved in this array.
+
+Return: Amount of bytes of the CRC, -1 on failure.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blGetWideChecksum(uint32_t segment, uint8_t checksum[8])
+{
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  if (segment >= flashImage.count)
+  {
+    LOG_ERROR("Block %d doesn't exist", segment);
+    return -1;
+  }
+  if (WaitSegmentDecoded(segment) != 0)
+  {
+    return -1;
+  }
+  Uint2Array(&flashImage.segments[segment].checksum, checksum);
+  Uint2Array(&flashImage.segments[segment].checksumExtension, checksum + 4);
+  return flashImage.checksumBytes;
+}
+
+/*
+Function Name: blGetDigests
+
+Function: Getting the CRCs of the digest set selected by blSetDigests of
+a segment of the opened flash file, waiting until the segment has been
+decoded. Each CRC is saved big endian in the first bytes of its array
+like the checksum of blGetWideChecksum.
+
+Parameters:
+  segment: Index of the segment.
+  digests: The CRC of each profile of the digest set will be saved in this array.
+
+Return: Amount of CRCs, -1 on failure.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blGetDigests(uint32_t segment, uint8_t digests[][8])
+{
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  if (segment >= flashImage.count)
+  {
+    LOG_ERROR("Block %d doesn't exist", segment);
+    return -1;
+  }
+  if (WaitSegmentDecoded(segment) != 0)
+  {
+    return -1;
+  }
+  for (uint32_t i = 0; i < flashImage.digestsCount; i++)
+  {
+    uint32_t high = (uint32_t)(flashImage.segments[segment].digests[i] >> 32);
+    uint32_t low = (uint32_t)flashImage.segments[segment].digests[i];
+    Uint2Array(&high, digests[i]);
+    Uint2Array(&low, digests[i] + 4);
+  }
+  return flashImage.digestsCount;
+}
+
+/*
+Function Name: blGetBlockChecksum
+
+Function: Getting the checksum of the selected CRC profile over an address
+window of the opened flash file, e.g. a logical block verified by the ECU
+over its whole address range. Bytes of the window outside of all segments
+count as fill bytes, gaps of any size cost no more than a few microseconds.
+The checksum is saved big endian in the first bytes of the array like the
+checksum of blGetWideChecksum. Waits until a lazily opened file has been decoded.
+
+Parameters:
+  start:    First address of the window.
+  end:      Address after the window, 0 for the end of the address space.
+  fill:     Value of the bytes in gaps, e.g. 0xFF for erased flash.
+  checksum: Checksum of the window will be saved in this array.
+
+Return: Amount of bytes of the checksum, -1 on failure.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blGetBlockChecksum(uint32_t start, uint32_t end, uint32_t fill, uint8_t checksum[8])
+{
+  uint64_t windowEnd = end != 0 ? end : 0x100000000ULL;
+  uint64_t value;
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  if (windowEnd < start || fill > 0xFF)
+  {
+    LOG_ERROR("Invalid block 0x%.8x to 0x%.8x with fill value 0x%x", start, end, fill);
+    return -1;
+  }
+  for (uint32_t i = 0; i < flashImage.count; i++)
+  {
+    if (WaitSegmentDecoded(i) != 0)
+    {
+      return -1;
+    }
+  }
+  // The lazy worker uses the CRC profiles until the last segment is done.
+  std::lock_guard<std::mutex> openLock(gOpenMutex);
+  const CrcProfile *profile = GetCrcProfile();
+  if (profile == 0 ||
+      ImageCalculateBlockChecksum(&flashImage, profile, start, windowEnd, (uint8_t)fill, &value) != 0)
+  {
+    return -1;
+  }
+  uint8_t bytes = (uint8_t)((profile->bits + 7) / 8);
+  value <<= 64 - 8 * bytes;
+  uint32_t high = (uint32_t)(value >> 32);
+  uint32_t low = (uint32_t)value;
+  Uint2Array(&high, checksum);
+  Uint2Array(&low, checksum + 4);
+  return bytes;
+}
+
+/*
+Function Name: blGetSha256
+
+Function: Getting the SHA-256 digests of all segments of the opened flash
+file and of the data of all segments in order, e.g. to be compared with
+the digests verified by a secure boot ECU. Digests are calculated with
+the checksums while a flash file is opened if enabled by blSetSha256,
+otherwise or for an image from the image cache without digests when
+this function is called. Waits until a lazily opened file has been decoded.
+Digests of a streamed flash file are only available if SHA-256 was
+enabled when it was opened.
+
+Parameters:
+  length:       Amount of digests segmentDigest can hold.
+  segmentDigest: SHA-256 of each segment will be saved in this array.
+  imageDigest:  SHA-256 of the whole image will be saved in this array.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blGetSha256(uint32_t length, uint8_t segmentDigest[][32], uint8_t imageDigest[32])
+{
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  if (!sha256Enabled)
+  {
+    LOG_ERROR("SHA-256 is not enabled");
+    return -1;
+  }
+  if (length < flashImage.count)
+  {
+    LOG_ERROR("Array of %d digests is too short for %d segments", length, flashImage.count);
+    return -1;
+  }
+  for (uint32_t i = 0; i < flashImage.count; i++)
+  {
+    if (WaitSegmentDecoded(i) != 0)
+    {
+      return -1;
+    }
+  }
+  if (gLazy.worker.joinable())
+  {
+    // The worker calculates the image digest after the last segment.
+    gLazy.worker.join();
+  }
+  if (flashImage.spill != 0 && !flashImage.sha256Valid)
+  {
+    LOG_ERROR("SHA-256 of a streamed flash file is calculated only if enabled before it is opened");
+    return -1;
+  }
+  // Checksums are valid here, only missing digests are calculated.
+  ChecksumSegments(&flashImage);
+  for (uint32_t i = 0; i < flashImage.count; i++)
+  {
+    memcpy(segmentDigest[i], flashImage.segments[i].sha256, SHA256_DIGEST_SIZE);
+  }
+  memcpy(imageDigest, flashImage.sha256, SHA256_DIGEST_SIZE);
+  return 0;
+}
+
+/*
+State of the transfer of one block. Each PDU filling function keeps
+its own state, so a fault injection doesn't disturb a normal transfer.
+*/
+struct TransferState
+{
+  uint8_t blockSequenceCounter;
+  int32_t segment; // Block in transfer, -1 if no transfer is ongoing.
+  uint32_t offset; // Bytes of the block already transferred.
+  uint64_t start;  // Time stamp of the first PDU of the block.
+};
+
+/*
+Fill the transimition buffer with the next piece of the block in transfer.
+Returns -1 and resets the state when the block has been transferred completely.
+*/
+static int32_t FillTransferData(TransferState *state, uint32_t bufferLength,
+                                uint8_t *data, uint32_t *dataLength, uint32_t segment)
+{
+  // Start a new transfer
+  if (state->segment < 0)
+  {
+    if (segment >= flashImage.count)
+    {
+      // Logs on failure and return -1(Failure)
+      LOG_ERROR("Block %d doesn't exist", segment);
+      return -1;
+    }
+    state->start = TraceTimestamp();
+    if (WaitSegmentDecoded(segment) != 0)
+    {
+      LOG_ERROR("Block %d can't be decoded", segment);
+      return -1;
+    }
+    LOG_INFO("Start transfer of block %d", segment);
+    state->segment = segment;
+    state->offset = 0;
+  }
+  uint64_t start = StatsStart();
+  const FlashSegment *block = &flashImage.segments[state->segment];
+  uint32_t length = block->size - state->offset;
+  if (length == 0)
+  {
+    LOG_INFO("Has reached the end of block %d", state->segment);
+    TRACE_SPAN(state->start, "Transfer block %u, %u bytes", state->segment, block->size);
+    state->segment = -1;
+    state->blockSequenceCounter = 0x0;
+    return -1;
+  }
+  uint32_t room = bufferLength > 2 ? bufferLength - 2 : 0;
+  if (length > room)
+  {
+    length = room;
+  }
+  if (flashImage.spill != 0)
+  {
+    // A streamed block is read sequentially through the window of its spill file.
+    const uint8_t *spillData = SpillRead(flashImage.spill, state->segment, state->offset, &length);
+    if (spillData == 0)
+    {
+      LOG_ERROR("Block %d can't be read from the spill file", state->segment);
+      state->segment = -1;
+      state->blockSequenceCounter = 0x0;
+      return -1;
+    }
+    memcpy(data + 2, spillData, length);
+  }
+  else
+  {
+    memcpy(data + 2, block->data + state->offset, length);
+  }
+  TRACE_EVENT("PDU block %u sequence counter 0x%.2x length %u offset 0x%x",
+              state->segment, data[1], length + 2, state->offset);
+  state->offset += length;
+  *dataLength += length;
+  StatsAddPhase(PHASE_PDU_FILL, start);
+  if (state->offset == block->size)
+  {
+    LOG_INFO("Last block size: 0x%.3X", *dataLength);
+    LOG_INFO("Last block sequence counter: 0x%.2X", state->blockSequenceCounter);
+  }
+  return 0;
+}
+
+/*
+Function name: blBuffer
+
+Function: Composing whole Transfer Data PDUs i.e. 0x3601xxxx...xxxxx 
+according to the data in each block and fill the transimition buffer
+with those PDUs.
+
+Parameters:
+  bufferLength: Availabel length of the transimition buffer.
+  data:         Transimition buffer. The PDU will be saved in this buffer.
+  dataLength:   Length of a PDU saved in the transimition buffer will
+                be saved in this variable.
+  segment:      Indicate which block will be used for composing PDUs.
+*/
+int32_t CAPLEXPORT CAPLPASCAL blBuffer(uint32_t bufferLength,
+uint8_t *data, uint32_t *dataLength, uint32_t segment)
+{
+  static TransferState state = {0x0, -1, 0, 0};
+  uint64_t start = StatsStart();
+
+  *dataLength = 2;
+  data[0] = 0x36;
+  data[1] = ++state.blockSequenceCounter;
+
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  int32_t result = FillTransferData(&state, bufferLength, data, dataLength, segment);
+  StatsAddBuffer(start, *dataLength - 2);
+  return result;
+}
+
+/**
+ * @brief Same as blBuffer, but every data byte of the PDU is corrupted by adding 1.
+ * 
+ * @param bufferLength 
+ * @param data 
+ * @param dataLength 
+ * @param segment 
+ * @return int32_t 
+ */
+int32_t CAPLEXPORT CAPLPASCAL blFaultInjectionBufferCorruptData(uint32_t bufferLength,
+uint8_t *data, uint32_t *dataLength, uint32_t segment)
+{
+  static TransferState state = {0x0, -1, 0, 0};
+
+  *dataLength = 2;
+  data[0] = 0x36;
+  data[1] = ++state.blockSequenceCounter;
+
+  std::lock_guard<std::mutex> lock(gImageMutex);
+  int32_t result = FillTransferData(&state, bufferLength, data, dataLength, segment);
+  for (uint32_t i = 2; i < *dataLength; i++)
+  {
+    data[i]++;
+  }
+  return result;
 }
 
 int32_t CAPLEXPORT CAPLPASCAL blRequest2Array(char * request, uint32_t &requestLength, uint8_t * data)
@@ -785,7 +1901,28 @@ CAPL_DLL_INFO4 table[] = {
     {"dllAdd64Parameters", (CAPL_FARCALL)appAddValues64, "CAPL_DLL", "This function will add 64 values. The return value is the result", 'L', 64, {SixtyFourLongPars}, "", {"val01", "val02", "val03", "val04", "val05", "val06", "val07", "val08", "val09", "val10", "val11", "val12", "val13", "val14", "val15", "val16", "val17", "val18", "val19", "val20", "val21", "val22", "val23", "val24", "val25", "val26", "val27", "val28", "val29", "val30", "val31", "val32", "val33", "val34", "val35", "val36", "val37", "val38", "val39", "val40", "val41", "val42", "val43", "val44", "val45", "val46", "val47", "val48", "val49", "val50", "val51", "val52", "val53", "val54", "val55", "val56", "val57", "val58", "val59", "val60", "val61", "val62", "val63", "val64"}},
     {"dllBuffer", (CAPL_FARCALL)blBuffer, "BOOT_LOADER", "This function will fill the data buffer with 0xff", 'L', 4, {'D', 'B', 'D' - 128, 'D'}, "\000\001\000\000", {"bufferLength", "data", "dataLength", "segment"}},
     {"dllFaultInjectionBufferCorruptData", (CAPL_FARCALL)blFaultInjectionBufferCorruptData, "BOOT_LOADER", "This function will fill the data buffer with 0xff", 'L', 4, {'D', 'B', 'D' - 128, 'D'}, "\000\001\000\000", {"bufferLength", "data", "dataLength", "segment"}},
-    {"dllOpenFlashFile", (CAPL_FARCALL)blOpenFlashFile, "BOOT_LOADER", "This function will open a SREC file", 'L', 4, {'C', 'D' - 128, 'B', 'B'}, "\001\000\002\002", {"fileName", "segmentsCount", "addressAndSize", "checksum"}},
+    {"dllOpenFlashFile", (CAPL_FARCALL)blOpenFlashFile, "BOOT_LOADER", "This function will open a HEX, SREC, ELF or binary file", 'L', 4, {'C', 'D' - 128, 'B', 'B'}, "\001\000\002\002", {"fileName", "segmentsCount", "addressAndSize", "checksum"}},
+    {"dllSetImageCache", (CAPL_FARCALL)blSetImageCache, "BOOT_LOADER", "This function will enable or disable the image cache", 'V', 1, "D", "", {"enable"}},
+    {"dllSetImageShare", (CAPL_FARCALL)blSetImageShare, "BOOT_LOADER", "This function will enable or disable sharing of parsed images between nodes", 'V', 1, "D", "", {"enable"}},
+    {"dllSetHugePages", (CAPL_FARCALL)blSetHugePages, "BOOT_LOADER", "This function will enable or disable huge pages for the data of parsed images", 'V', 1, "D", "", {"enable"}},
+    {"dllSetMemoryCeiling", (CAPL_FARCALL)blSetMemoryCeiling, "BOOT_LOADER", "This function will set the size above which flash files are streamed through a spill file", 'V', 1, "D", "", {"megabytes"}},
+    {"dllOpenFlashFileAsync", (CAPL_FARCALL)blOpenFlashFileAsync, "BOOT_LOADER", "This function will open a flash file in the background and return a job handle", 'L', 2, "DC", "\000\001", {"handle", "fileName"}},
+    {"dllPollFlashFile", (CAPL_FARCALL)blPollFlashFile, "BOOT_LOADER", "This function will get the result of a job started by dllOpenFlashFileAsync", 'L', 4, {'D', 'D' - 128, 'B', 'B'}, "\000\000\002\002", {"job", "segmentsCount", "addressAndSize", "checksum"}},
+    {"dllOpenBinFile", (CAPL_FARCALL)blOpenBinFile, "BOOT_LOADER", "This function will open a raw binary file at a base address", 'L', 5, {'C', 'D', 'D' - 128, 'B', 'B'}, "\001\000\000\002\002", {"fileName", "baseAddress", "segmentsCount", "addressAndSize", "checksum"}},
+    {"dllOpenFlashFileLazy", (CAPL_FARCALL)blOpenFlashFileLazy, "BOOT_LOADER", "This function will open a flash file and decode its data in the background", 'L', 3, {'C', 'D' - 128, 'B'}, "\001\000\002", {"fileName", "segmentsCount", "addressAndSize"}},
+    {"dllGetSegmentChecksum", (CAPL_FARCALL)blGetSegmentChecksum, "BOOT_LOADER", "This function will get the checksum of a segment opened by dllOpenFlashFileLazy", 'L', 2, "DB", "\000\001", {"segment", "checksum"}},
+    {"dllGetWideChecksum", (CAPL_FARCALL)blGetWideChecksum, "BOOT_LOADER", "This function will get the checksum of a segment for CRC widths up to 64 bits", 'L', 2, "DB", "\000\001", {"segment", "checksum"}},
+    {"dllSetDigests", (CAPL_FARCALL)blSetDigests, "BOOT_LOADER", "This function will select the CRC profiles calculated together with the checksum of each segment", 'L', 1, "C", "\001", {"profileNames"}},
+    {"dllGetDigests", (CAPL_FARCALL)blGetDigests, "BOOT_LOADER", "This function will get the CRCs of the digest set of a segment", 'L', 2, "DB", "\000\002", {"segment", "digests"}},
+    {"dllGetBlockChecksum", (CAPL_FARCALL)blGetBlockChecksum, "BOOT_LOADER", "This function will get the checksum of an address window with gaps filled by a fill value", 'L', 4, "DDDB", "\000\000\000\001", {"start", "end", "fill", "checksum"}},
+    {"dllSetSha256", (CAPL_FARCALL)blSetSha256, "BOOT_LOADER", "This function will enable or disable SHA-256 digests of flash files", 'V', 1, "D", "", {"enable"}},
+    {"dllGetSha256", (CAPL_FARCALL)blGetSha256, "BOOT_LOADER", "This function will get the SHA-256 digests of all segments and of the whole image", 'L', 3, "DBB", "\000\002\001", {"length", "segmentDigest", "imageDigest"}},
+    {"dllSelectCrcProfile", (CAPL_FARCALL)blSelectCrcProfile, "BOOT_LOADER", "This function will select the CRC profile of crcspec used to open flash files", 'L', 1, "C", "\001", {"profileName"}},
+    {"dllSetLogLevel", (CAPL_FARCALL)blSetLogLevel, "BOOT_LOADER", "This function will set the level of messages written to capldlllog", 'V', 1, "D", "", {"level"}},
+    {"dllStartTrace", (CAPL_FARCALL)blStartTrace, "BOOT_LOADER", "This function will start recording a binary trace of PDUs to a file", 'L', 1, "C", "\001", {"fileName"}},
+    {"dllStopTrace", (CAPL_FARCALL)blStopTrace, "BOOT_LOADER", "This function will stop recording the binary trace", 'V', 0, "", "", {""}},
+    {"dllGetStats", (CAPL_FARCALL)blGetStats, "BOOT_LOADER", "This function will get the timing statistics of phases and blBuffer calls", 'L', 2, "DD", "\000\001", {"length", "stats"}},
+    {"dllResetStats", (CAPL_FARCALL)blResetStats, "BOOT_LOADER", "This function will clear the timing statistics", 'V', 0, "", "", {""}},
     {"dllRequest2Array", (CAPL_FARCALL)blRequest2Array, "BOOT_LOADER", "This function will cast a hex-coded string to an array", 'L', 3, {'C', 'D'-128, 'B'}, "\001\000\001", {"request", "requestLength", "data"}},
 
     {0, 0}};
@@ -2,15 +2,55 @@
 #define CAPLDLL_H
 #include <stdint.h>
 
+// The same API is exported by capl.dll on Windows and libbootloader.so on Linux.
+#if defined(_WIN32)
 #ifdef CAPLDLL_EXPORTS
 #define CAPLDLL_API __declspec(dllexport)
 #else
 #define CAPLDLL_API __declspec(dllimport)
 #endif
+#define CAPLDLL_CALL __stdcall
+#else
+#define CAPLDLL_API __attribute__((visibility("default")))
+#define CAPLDLL_CALL
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-int32_t CAPLDLL_API __stdcall blOpenFlashFile(const char *fileName,
-                                              uint32_t *segmentsCount, uint8_t addressAndSize[][8],
-                                              uint8_t checksum[][4]);
-int32_t CAPLDLL_API __stdcall blBuffer(uint32_t bufferLength,
+int32_t CAPLDLL_API CAPLDLL_CALL blOpenFlashFile(const char *fileName,
+                                                 uint32_t *segmentsCount, uint8_t addressAndSize[][8],
+                                                 uint8_t checksum[][4]);
+int32_t CAPLDLL_API CAPLDLL_CALL blOpenBinFile(const char *fileName, uint32_t baseAddress,
+                                               uint32_t *segmentsCount, uint8_t addressAndSize[][8],
+                                               uint8_t checksum[][4]);
+int32_t CAPLDLL_API CAPLDLL_CALL blOpenFlashFileAsync(uint32_t handle, const char *fileName);
+int32_t CAPLDLL_API CAPLDLL_CALL blPollFlashFile(uint32_t job,
+                                                 uint32_t *segmentsCount, uint8_t addressAndSize[][8],
+                                                 uint8_t checksum[][4]);
+int32_t CAPLDLL_API CAPLDLL_CALL blOpenFlashFileLazy(const char *fileName,
+                                                     uint32_t *segmentsCount, uint8_t addressAndSize[][8]);
+int32_t CAPLDLL_API CAPLDLL_CALL blGetSegmentChecksum(uint32_t segment, uint8_t checksum[4]);
+int32_t CAPLDLL_API CAPLDLL_CALL blGetWideChecksum(uint32_t segment, uint8_t checksum[8]);
+int32_t CAPLDLL_API CAPLDLL_CALL blSelectCrcProfile(const char *profileName);
+int32_t CAPLDLL_API CAPLDLL_CALL blSetDigests(const char *profileNames);
+int32_t CAPLDLL_API CAPLDLL_CALL blGetDigests(uint32_t segment, uint8_t digests[][8]);
+int32_t CAPLDLL_API CAPLDLL_CALL blGetBlockChecksum(uint32_t start, uint32_t end, uint32_t fill, uint8_t checksum[8]);
+int32_t CAPLDLL_API CAPLDLL_CALL blGetSha256(uint32_t length, uint8_t segmentDigest[][32], uint8_t imageDigest[32]);
+void CAPLDLL_API CAPLDLL_CALL blSetSha256(uint32_t enable);
+void CAPLDLL_API CAPLDLL_CALL blSetLogLevel(uint32_t level);
+int32_t CAPLDLL_API CAPLDLL_CALL blStartTrace(const char *fileName);
+void CAPLDLL_API CAPLDLL_CALL blStopTrace(void);
+int32_t CAPLDLL_API CAPLDLL_CALL blGetStats(uint32_t length, uint32_t stats[]);
+void CAPLDLL_API CAPLDLL_CALL blResetStats(void);
+void CAPLDLL_API CAPLDLL_CALL blSetImageCache(uint32_t enable);
+void CAPLDLL_API CAPLDLL_CALL blSetImageShare(uint32_t enable);
+void CAPLDLL_API CAPLDLL_CALL blSetMemoryCeiling(uint32_t megabytes);
+void CAPLDLL_API CAPLDLL_CALL blSetHugePages(uint32_t enable);
+int32_t CAPLDLL_API CAPLDLL_CALL blBuffer(uint32_t bufferLength,
 uint8_t *data, uint32_t *dataLength, uint32_t segment);
-#endif
\ No newline at end of file
+#ifdef __cplusplus
+}
+#endif
+#endif
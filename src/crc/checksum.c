@@ -0,0 +1,572 @@
+/**
+ * @file checksum.c
+ * @brief This file contains the additive checksums of legacy bootloaders:
+ * byte sum, word sum, Fletcher-16, Fletcher-32 and Adler-32.
+ *
+ * All of them are built from two sums of a block of n bytes or words x[i]:
+ * the plain sum of x[i] and the weighted sum of (n - i) * x[i]. Blocks are
+ * summed with AVX2 or SSE2 where available, otherwise by a scalar loop.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "checksum.h"
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CHECKSUM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CHECKSUM_TARGET_AVX2
+#define CHECKSUM_TARGET_XSAVE
+#else
+#include <cpuid.h>
+#define CHECKSUM_TARGET_AVX2 __attribute__((target("avx2")))
+#define CHECKSUM_TARGET_XSAVE __attribute__((target("xsave")))
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHECKSUM_SSE2 1
+#endif
+#endif
+
+// Bytes summed at a time, the 32 bit lanes of the vector kernels can't overflow.
+#define CHECKSUM_BLOCK_SIZE 0x4000
+
+static const struct
+{
+  const char *name;
+  checksumAlgorithm algorithm;
+  uint8_t bits; // Width of the checksum if the profile has no Width.
+} checksumAlgorithms[] = {
+    {"CRC", CHECKSUM_CRC, 0},
+    {"ByteSum", CHECKSUM_BYTE_SUM, 16},
+    {"WordSumBE", CHECKSUM_WORD_SUM_BE, 16},
+    {"WordSumLE", CHECKSUM_WORD_SUM_LE, 16},
+    {"Fletcher16", CHECKSUM_FLETCHER16, 16},
+    {"Fletcher32", CHECKSUM_FLETCHER32, 32},
+    {"Adler32", CHECKSUM_ADLER32, 32},
+};
+
+/**
+ * @brief Kernel used for blocks: -1 not detected yet, otherwise a checksumKernel.
+ *
+ */
+static atomic_int checksumKernelUsed = -1;
+
+/**
+ * @brief Sum a block of bytes or words with a scalar loop.
+ *
+ * @param data Binary data.
+ * @param length Length of binary data, a multiple of 2 for words.
+ * @param words 1 to sum 16 bit words.
+ * @param bigEndian 1 if the words are big endian.
+ * @param sum Sum of x[i] will be saved in this variable.
+ * @param weighted Sum of (n - i) * x[i] will be saved in this variable.
+ */
+static void SumBlockScalar(const uint8_t *data, size_t length, uint8_t words, uint8_t bigEndian,
+                           uint64_t *sum, uint64_t *weighted)
+{
+  uint64_t a = 0, b = 0;
+  if (words)
+  {
+    for (size_t i = 0; i + 1 < length; i += 2)
+    {
+      a += bigEndian ? (uint32_t)data[i] << 8 | data[i + 1] : (uint32_t)data[i + 1] << 8 | data[i];
+      b += a;
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < length; i++)
+    {
+      a += data[i];
+      b += a;
+    }
+  }
+  *sum = a;
+  *weighted = b;
+}
+
+#ifdef CHECKSUM_SSE2
+static uint64_t SumLanes64(__m128i value)
+{
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, value);
+  return lanes[0] + lanes[1];
+}
+
+static uint64_t SumLanes32(__m128i value)
+{
+  uint32_t lanes[4];
+  _mm_storeu_si128((__m128i *)lanes, value);
+  return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+/**
+ * @brief Sum a block of bytes or words with SSE2, 16 bytes per step.
+ * previous accumulates the sums of all earlier steps at each step,
+ * so the weight of step k is added as a multiple of its sum.
+ *
+ * @param data Binary data.
+ * @param length Length of binary data, a multiple of 16.
+ * @param words 1 to sum 16 bit words.
+ * @param bigEndian 1 if the words are big endian.
+ * @param sum Sum of x[i] will be saved in this variable.
+ * @param weighted Sum of (n - i) * x[i] will be saved in this variable.
+ */
+static void SumBlockSse2(const uint8_t *data, size_t length, uint8_t words, uint8_t bigEndian,
+                         uint64_t *sum, uint64_t *weighted)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sums = zero, previous = zero, weightedLow = zero, weightedHigh = zero;
+  if (words)
+  {
+    const __m128i lowMask = _mm_set1_epi16(0x00FF);
+    const __m128i weights = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    for (size_t offset = 0; offset < length; offset += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)(data + offset));
+      __m128i even = _mm_and_si128(v, lowMask);
+      __m128i odd = _mm_srli_epi16(v, 8);
+      __m128i low = bigEndian ? odd : even;
+      __m128i high = bigEndian ? even : odd;
+      previous = _mm_add_epi64(previous, sums);
+      sums = _mm_add_epi64(sums, _mm_add_epi64(_mm_sad_epu8(low, zero), _mm_slli_epi64(_mm_sad_epu8(high, zero), 8)));
+      weightedLow = _mm_add_epi32(weightedLow, _mm_madd_epi16(low, weights));
+      weightedHigh = _mm_add_epi32(weightedHigh, _mm_madd_epi16(high, weights));
+    }
+    *sum = SumLanes64(sums);
+    *weighted = 8 * SumLanes64(previous) + SumLanes32(weightedLow) + 256 * SumLanes32(weightedHigh);
+    return;
+  }
+  const __m128i lowWeights = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+  const __m128i highWeights = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+  for (size_t offset = 0; offset < length; offset += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(data + offset));
+    previous = _mm_add_epi64(previous, sums);
+    sums = _mm_add_epi64(sums, _mm_sad_epu8(v, zero));
+    weightedLow = _mm_add_epi32(weightedLow, _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(v, zero), lowWeights),
+                                                           _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), highWeights)));
+  }
+  *sum = SumLanes64(sums);
+  *weighted = 16 * SumLanes64(previous) + SumLanes32(weightedLow);
+}
+#endif
+
+#ifdef CHECKSUM_X86
+static CHECKSUM_TARGET_AVX2 uint64_t SumLanes64Avx2(__m256i value)
+{
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, value);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static CHECKSUM_TARGET_AVX2 uint64_t SumLanes32Avx2(__m256i value)
+{
+  uint32_t lanes[8];
+  uint64_t result = 0;
+  _mm256_storeu_si256((__m256i *)lanes, value);
+  for (uint32_t i = 0; i < 8; i++)
+  {
+    result += lanes[i];
+  }
+  return result;
+}
+
+/**
+ * @brief Sum a block of bytes or words with AVX2, 32 bytes per step.
+ * See SumBlockSse2.
+ *
+ * @param data Binary data.
+ * @param length Length of binary data, a multiple of 32.
+ * @param words 1 to sum 16 bit words.
+ * @param bigEndian 1 if the words are big endian.
+ * @param sum Sum of x[i] will be saved in this variable.
+ * @param weighted Sum of (n - i) * x[i] will be saved in this variable.
+ */
+static CHECKSUM_TARGET_AVX2 void SumBlockAvx2(const uint8_t *data, size_t length, uint8_t words, uint8_t bigEndian,
+                                              uint64_t *sum, uint64_t *weighted)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i sums = zero, previous = zero, weightedLow = zero, weightedHigh = zero;
+  if (words)
+  {
+    const __m256i lowMask = _mm256_set1_epi16(0x00FF);
+    const __m256i weights = _mm256_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    for (size_t offset = 0; offset < length; offset += 32)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(data + offset));
+      __m256i even = _mm256_and_si256(v, lowMask);
+      __m256i odd = _mm256_srli_epi16(v, 8);
+      __m256i low = bigEndian ? odd : even;
+      __m256i high = bigEndian ? even : odd;
+      previous = _mm256_add_epi64(previous, sums);
+      sums = _mm256_add_epi64(sums, _mm256_add_epi64(_mm256_sad_epu8(low, zero),
+                                                     _mm256_slli_epi64(_mm256_sad_epu8(high, zero), 8)));
+      weightedLow = _mm256_add_epi32(weightedLow, _mm256_madd_epi16(low, weights));
+      weightedHigh = _mm256_add_epi32(weightedHigh, _mm256_madd_epi16(high, weights));
+    }
+    *sum = SumLanes64Avx2(sums);
+    *weighted = 16 * SumLanes64Avx2(previous) + SumLanes32Avx2(weightedLow) + 256 * SumLanes32Avx2(weightedHigh);
+    return;
+  }
+  const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                           16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i ones = _mm256_set1_epi16(1);
+  for (size_t offset = 0; offset < length; offset += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(data + offset));
+    previous = _mm256_add_epi64(previous, sums);
+    sums = _mm256_add_epi64(sums, _mm256_sad_epu8(v, zero));
+    weightedLow = _mm256_add_epi32(weightedLow, _mm256_madd_epi16(_mm256_maddubs_epi16(v, weights), ones));
+  }
+  *sum = SumLanes64Avx2(sums);
+  *weighted = 32 * SumLanes64Avx2(previous) + SumLanes32Avx2(weightedLow);
+}
+
+static CHECKSUM_TARGET_XSAVE uint8_t DetectAvx2(void)
+{
+#ifdef _MSC_VER
+  int registers[4];
+  __cpuid(registers, 0);
+  if (registers[0] < 7)
+    return 0;
+  __cpuid(registers, 1);
+  // The operating system must save the AVX registers.
+  if (((registers[2] >> 27) & 1) == 0 || ((registers[2] >> 28) & 1) == 0 || (_xgetbv(0) & 6) != 6)
+    return 0;
+  __cpuidex(registers, 7, 0);
+  return (registers[1] >> 5) & 1;
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid_max(0, 0) < 7)
+    return 0;
+  __cpuid(1, eax, ebx, ecx, edx);
+  // The operating system must save the AVX registers.
+  if (((ecx >> 27) & 1) == 0 || ((ecx >> 28) & 1) == 0 || (_xgetbv(0) & 6) != 6)
+    return 0;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return (ebx >> 5) & 1;
+#endif
+}
+#endif
+
+/**
+ * @brief Detect the fastest kernel supported by the processor.
+ *
+ * @return checksumKernel The kernel.
+ */
+static checksumKernel DetectChecksumKernel(void)
+{
+#ifdef CHECKSUM_X86
+  if (DetectAvx2())
+    return CHECKSUM_KERNEL_AVX2;
+#endif
+#ifdef CHECKSUM_SSE2
+  return CHECKSUM_KERNEL_SSE2;
+#else
+  return CHECKSUM_KERNEL_SCALAR;
+#endif
+}
+
+/**
+ * @brief Get the kernel summing the data.
+ *
+ * @return checksumKernel The kernel in use.
+ */
+checksumKernel GetChecksumKernel(void)
+{
+  int kernel = atomic_load_explicit(&checksumKernelUsed, memory_order_relaxed);
+  if (kernel < 0)
+  {
+    kernel = DetectChecksumKernel();
+    atomic_store_explicit(&checksumKernelUsed, kernel, memory_order_relaxed);
+  }
+  return (checksumKernel)kernel;
+}
+
+/**
+ * @brief Limit the kernel summing the data, e.g. to compare all kernels.
+ *
+ * @param kernel The fastest kernel to be used, if the processor supports it.
+ */
+void SetChecksumKernel(checksumKernel kernel)
+{
+  checksumKernel supported = DetectChecksumKernel();
+  atomic_store_explicit(&checksumKernelUsed, kernel < supported ? kernel : supported, memory_order_relaxed);
+}
+
+/**
+ * @brief Sum a block of bytes or words with the fastest kernel. The vector
+ * part and the rest are combined: the weights of the vector part grow by
+ * the amount of elements after it.
+ *
+ * @param data Binary data.
+ * @param length Length of binary data, at most CHECKSUM_BLOCK_SIZE, a multiple of 2 for words.
+ * @param words 1 to sum 16 bit words.
+ * @param bigEndian 1 if the words are big endian.
+ * @param sum Sum of x[i] will be saved in this variable.
+ * @param weighted Sum of (n - i) * x[i] will be saved in this variable.
+ */
+static void SumBlock(const uint8_t *data, size_t length, uint8_t words, uint8_t bigEndian,
+                     uint64_t *sum, uint64_t *weighted)
+{
+  uint64_t vectorSum = 0, vectorWeighted = 0, restSum, restWeighted;
+  size_t vectorLength = 0;
+  switch (GetChecksumKernel())
+  {
+#ifdef CHECKSUM_X86
+  case CHECKSUM_KERNEL_AVX2:
+    vectorLength = length / 32 * 32;
+    SumBlockAvx2(data, vectorLength, words, bigEndian, &vectorSum, &vectorWeighted);
+    break;
+#endif
+#ifdef CHECKSUM_SSE2
+  case CHECKSUM_KERNEL_SSE2:
+    vectorLength = length / 16 * 16;
+    SumBlockSse2(data, vectorLength, words, bigEndian, &vectorSum, &vectorWeighted);
+    break;
+#endif
+  default:
+    break;
+  }
+  SumBlockScalar(data + vectorLength, length - vectorLength, words, bigEndian, &restSum, &restWeighted);
+  *sum = vectorSum + restSum;
+  *weighted = vectorWeighted + (uint64_t)((length - vectorLength) >> words) * vectorSum + restWeighted;
+}
+
+/**
+ * @brief Find a checksum algorithm by its name in crcspec.
+ *
+ * @param name Name of the algorithm, e.g. Fletcher16.
+ * @return checksumAlgorithm The algorithm, CHECKSUM_INVALID if the name is unknown.
+ */
+checksumAlgorithm FindChecksumAlgorithm(const char *name)
+{
+  for (uint32_t i = 0; i < sizeof(checksumAlgorithms) / sizeof(checksumAlgorithms[0]); i++)
+  {
+    if (strcmp(checksumAlgorithms[i].name, name) == 0)
+    {
+      return checksumAlgorithms[i].algorithm;
+    }
+  }
+  return CHECKSUM_INVALID;
+}
+
+/**
+ * @brief Get the width of a checksum if the profile has no Width.
+ * Fletcher and Adler checksums always have this width.
+ *
+ * @param algorithm A checksum algorithm.
+ * @return uint8_t Width in bits, 0 for a CRC.
+ */
+uint8_t ChecksumDefaultBits(checksumAlgorithm algorithm)
+{
+  return algorithm < CHECKSUM_INVALID ? checksumAlgorithms[algorithm].bits : 0;
+}
+
+/**
+ * @brief Start a checksum calculation.
+ *
+ * @param algorithm A checksum algorithm other than CHECKSUM_CRC.
+ * @param initialValue Start value of byte and word sums.
+ * @param state The state will be saved in this variable.
+ */
+void ChecksumStart(checksumAlgorithm algorithm, uint64_t initialValue, ChecksumState *state)
+{
+  state->sum = algorithm == CHECKSUM_ADLER32 ? 1 :
+               algorithm == CHECKSUM_FLETCHER16 || algorithm == CHECKSUM_FLETCHER32 ? 0 : initialValue;
+  state->sum2 = 0;
+  state->pending = 0;
+}
+
+/**
+ * @brief Check whether an algorithm sums 16 bit words.
+ *
+ * @param algorithm A checksum algorithm.
+ * @return uint8_t 1 for words, 0 for bytes.
+ */
+static uint8_t ChecksumOfWords(checksumAlgorithm algorithm)
+{
+  return algorithm == CHECKSUM_WORD_SUM_BE || algorithm == CHECKSUM_WORD_SUM_LE || algorithm == CHECKSUM_FLETCHER32;
+}
+
+/**
+ * @brief Get the modulus of the sums of Fletcher and Adler checksums.
+ *
+ * @param algorithm A checksum algorithm.
+ * @return uint64_t The modulus, 0 for byte and word sums.
+ */
+static uint64_t ChecksumModulus(checksumAlgorithm algorithm)
+{
+  return algorithm == CHECKSUM_FLETCHER16 ? 255 :
+         algorithm == CHECKSUM_FLETCHER32 ? 65535 :
+         algorithm == CHECKSUM_ADLER32 ? 65521 : 0;
+}
+
+/**
+ * @brief Feed an even amount of bytes into a checksum.
+ *
+ * @param algorithm A checksum algorithm other than CHECKSUM_CRC.
+ * @param state State of the calculation.
+ * @param buffer Binary data.
+ * @param length Length of binary data, a multiple of 2 for word checksums.
+ */
+static void ChecksumUpdateBlocks(checksumAlgorithm algorithm, ChecksumState *state, const uint8_t *buffer, size_t length)
+{
+  uint8_t words = ChecksumOfWords(algorithm);
+  uint8_t bigEndian = algorithm == CHECKSUM_WORD_SUM_BE;
+  uint64_t modulus = ChecksumModulus(algorithm);
+  while (length != 0)
+  {
+    size_t blockLength = length < CHECKSUM_BLOCK_SIZE ? length : CHECKSUM_BLOCK_SIZE;
+    uint64_t sum, weighted;
+    SumBlock(buffer, blockLength, words, bigEndian, &sum, &weighted);
+    if (modulus == 0)
+    {
+      // Byte and word sums wrap around at the width of the checksum.
+      state->sum += sum;
+    }
+    else
+    {
+      state->sum2 = (state->sum2 + (uint64_t)(blockLength >> words) * state->sum + weighted) % modulus;
+      state->sum = (state->sum + sum) % modulus;
+    }
+    buffer += blockLength;
+    length -= blockLength;
+  }
+}
+
+/**
+ * @brief Feed the next piece of data into a checksum.
+ *
+ * @param algorithm A checksum algorithm other than CHECKSUM_CRC.
+ * @param state State of the calculation.
+ * @param buffer Binary data.
+ * @param length Length of binary data.
+ */
+void ChecksumUpdate(checksumAlgorithm algorithm, ChecksumState *state, const uint8_t *buffer, size_t length)
+{
+  if (!ChecksumOfWords(algorithm))
+  {
+    ChecksumUpdateBlocks(algorithm, state, buffer, length);
+    return;
+  }
+  // Words may be split between pieces.
+  if (state->pending != 0 && length != 0)
+  {
+    uint8_t word[2] = {(uint8_t)state->pending, buffer[0]};
+    ChecksumUpdateBlocks(algorithm, state, word, 2);
+    state->pending = 0;
+    buffer++;
+    length--;
+  }
+  ChecksumUpdateBlocks(algorithm, state, buffer, length & ~(size_t)1);
+  if (length & 1)
+  {
+    state->pending = 0x100 | buffer[length - 1];
+  }
+}
+
+/**
+ * @brief Feed a run of identical bytes into a checksum without touching
+ * each of them. n elements x add n * x to the first sum and
+ * n * sum + x * n * (n + 1) / 2 to the second one.
+ *
+ * @param algorithm A checksum algorithm other than CHECKSUM_CRC.
+ * @param state State of the calculation.
+ * @param fill Value of each byte.
+ * @param count Amount of bytes.
+ */
+void ChecksumFill(checksumAlgorithm algorithm, ChecksumState *state, uint8_t fill, uint64_t count)
+{
+  uint64_t value = fill;
+  if (ChecksumOfWords(algorithm))
+  {
+    if (state->pending != 0 && count != 0)
+    {
+      uint8_t word[2] = {(uint8_t)state->pending, fill};
+      ChecksumUpdateBlocks(algorithm, state, word, 2);
+      state->pending = 0;
+      count--;
+    }
+    if (count & 1)
+    {
+      state->pending = 0x100 | fill;
+    }
+    // Both bytes of the word are the same, whatever the byte order is.
+    value = (uint64_t)fill << 8 | fill;
+    count >>= 1;
+  }
+  uint64_t modulus = ChecksumModulus(algorithm);
+  if (modulus == 0)
+  {
+    state->sum += count * value;
+    return;
+  }
+  // n * (n + 1) / 2 reduced before the product can overflow.
+  uint64_t triangle = count & 1 ? count % modulus * ((count + 1) / 2 % modulus) % modulus
+                                : count / 2 % modulus * ((count + 1) % modulus) % modulus;
+  state->sum2 = (state->sum2 + count % modulus * state->sum + value * triangle) % modulus;
+  state->sum = (state->sum + count % modulus * value) % modulus;
+}
+
+/**
+ * @brief Finish a checksum calculation. The last byte of an odd length
+ * is summed as a word padded with a zero byte.
+ *
+ * @param algorithm A checksum algorithm other than CHECKSUM_CRC.
+ * @param bits Width of byte and word sums, 1 to 64.
+ * @param finalXORValue Value XORed to the checksum, e.g. to get the complement.
+ * @param state State of the calculation.
+ * @return uint64_t Result checksum in the lowest bits bits.
+ */
+uint64_t ChecksumFinish(checksumAlgorithm algorithm, uint8_t bits, uint64_t finalXORValue, ChecksumState *state)
+{
+  if (state->pending != 0)
+  {
+    uint8_t word[2] = {(uint8_t)state->pending, 0};
+    ChecksumUpdateBlocks(algorithm, state, word, 2);
+    state->pending = 0;
+  }
+  uint64_t result;
+  switch (algorithm)
+  {
+  case CHECKSUM_FLETCHER16:
+    result = state->sum2 << 8 | state->sum;
+    bits = 16;
+    break;
+  case CHECKSUM_FLETCHER32:
+  case CHECKSUM_ADLER32:
+    result = state->sum2 << 16 | state->sum;
+    bits = 32;
+    break;
+  default:
+    result = state->sum;
+    break;
+  }
+  return (result ^ finalXORValue) & (bits >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1);
+}
+
+/**
+ * @brief Calculate the checksum of a buffer.
+ *
+ * @param algorithm A checksum algorithm other than CHECKSUM_CRC.
+ * @param bits Width of byte and word sums, 1 to 64.
+ * @param initialValue Start value of byte and word sums.
+ * @param finalXORValue Value XORed to the checksum.
+ * @param buffer Binary data.
+ * @param length Length of binary data.
+ * @return uint64_t Result checksum in the lowest bits bits.
+ */
+uint64_t CalculateChecksum(checksumAlgorithm algorithm, uint8_t bits, uint64_t initialValue,
+                           uint64_t finalXORValue, const uint8_t *buffer, size_t length)
+{
+  ChecksumState state;
+  ChecksumStart(algorithm, initialValue, &state);
+  ChecksumUpdate(algorithm, &state, buffer, length);
+  return ChecksumFinish(algorithm, bits, finalXORValue, &state);
+}
@@ -0,0 +1,61 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Checksum algorithms of a crcspec profile, selected by its line "Algorithm name".
+ *
+ */
+typedef enum
+{
+    CHECKSUM_CRC,         // CRC of the profile parameters.
+    CHECKSUM_BYTE_SUM,    // Sum of all bytes.
+    CHECKSUM_WORD_SUM_BE, // Sum of all big endian 16 bit words.
+    CHECKSUM_WORD_SUM_LE, // Sum of all little endian 16 bit words.
+    CHECKSUM_FLETCHER16,  // Fletcher-16 of bytes.
+    CHECKSUM_FLETCHER32,  // Fletcher-32 of little endian 16 bit words.
+    CHECKSUM_ADLER32,     // Adler-32 of bytes.
+    CHECKSUM_INVALID
+} checksumAlgorithm;
+
+/**
+ * @brief Kernels summing the data, the fastest one supported by the processor is used.
+ *
+ */
+typedef enum
+{
+    CHECKSUM_KERNEL_SCALAR,
+    CHECKSUM_KERNEL_SSE2,
+    CHECKSUM_KERNEL_AVX2
+} checksumKernel;
+
+/**
+ * @brief State of a checksum calculation over data passed in pieces.
+ *
+ */
+typedef struct
+{
+    uint64_t sum;      // Sum of bytes or words, or the first sum of Fletcher and Adler.
+    uint64_t sum2;     // Second sum of Fletcher and Adler.
+    uint16_t pending;  // 0x100 | byte of an incomplete word, 0 if there is none.
+} ChecksumState;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+checksumAlgorithm FindChecksumAlgorithm(const char *name);
+uint8_t ChecksumDefaultBits(checksumAlgorithm algorithm);
+void ChecksumStart(checksumAlgorithm algorithm, uint64_t initialValue, ChecksumState *state);
+void ChecksumUpdate(checksumAlgorithm algorithm, ChecksumState *state, const uint8_t *buffer, size_t length);
+void ChecksumFill(checksumAlgorithm algorithm, ChecksumState *state, uint8_t fill, uint64_t count);
+uint64_t ChecksumFinish(checksumAlgorithm algorithm, uint8_t bits, uint64_t finalXORValue, ChecksumState *state);
+uint64_t CalculateChecksum(checksumAlgorithm algorithm, uint8_t bits, uint64_t initialValue,
+                           uint64_t finalXORValue, const uint8_t *buffer, size_t length);
+checksumKernel GetChecksumKernel(void);
+void SetChecksumKernel(checksumKernel kernel);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -9,6 +9,12 @@
  * 
  */
 #include "crc.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "crccatalogue.h"
+#include "crcengine.h"
+#include "imagecache.h"
+#include "stats.h"
 
 //-------------------Handle CRC32 calculation-------------------------------
 /**
@@ -21,71 +27,506 @@ uint32_t polynomial = 0x04C11DB7;
 uint32_t initialValue = 0x0;
 uint32_t finalXORValue = 0x0;
 uint8_t inputReflected=0, resultReflected=0;
+// Algorithm of the CRC catalogue selected with the parameters above, or 0.
+const CrcPreset *crcPreset = 0;
+// Algorithm used if width is CRC_GENERIC.
+const CrcEngine *crcEngine = 0;
+// Additive checksum calculated instead of the CRC, CHECKSUM_CRC for a CRC.
+checksumAlgorithm algorithm = CHECKSUM_CRC;
+uint8_t checksumBits = 0;
 
-/*
-Read CRC algorithm specification form crcspec.
-*/
+/**
+ * @brief Profiles of the last loaded CRC specification file.
+ * Each profile keeps its look up table, so selecting a profile only
+ * copies it into the local variables above.
+ * 
+ */
+static CrcProfile crcProfiles[CRC_PROFILES_MAX];
+static uint32_t crcProfilesCount;
+static char crcProfileName[CRC_PROFILE_NAME_SIZE]; // Selected profile, empty for the first one.
+static char crcSpecName[260];
+static time_t crcSpecTime;
+static uint64_t crcSpecSize;
+static uint64_t crcSpecHash;
 
 /**
- * @brief Read CRC algorithm specification form crcspec file.
- * Local variables width, polynomial, initialValue, finalXORValue, inputReflected
- * and resultReflected will have the value defined in the crcspec file after this function call.
- * The crcspec file should be located in CANoe project root.
+ * @brief Copy a profile into the local variables used by the CRC calculation.
  * 
- * @return uint32_t 
+ * @param profile A CRC profile with a valid look up table.
  */
-uint32_t appSepcifyCRCParameters()
+static void ApplyCrcProfile(const CrcProfile *profile)
+{
+  width = profile->width;
+  polynomial = (uint32_t)profile->polynomial;
+  initialValue = (uint32_t)profile->initialValue;
+  finalXORValue = (uint32_t)profile->finalXORValue;
+  inputReflected = profile->inputReflected;
+  resultReflected = profile->resultReflected;
+  crcPreset = profile->preset;
+  crcEngine = profile->engine;
+  algorithm = profile->algorithm;
+  checksumBits = profile->bits;
+  memcpy(crcTable, profile->table, sizeof(crcTable));
+}
+
+/**
+ * @brief Find a profile of the loaded CRC specification.
+ * 
+ * @param name Name of the profile, an empty name is the first profile.
+ * @return const CrcProfile* The profile, 0 if there is no valid profile of this name.
+ */
+static const CrcProfile *FindCrcProfile(const char *name)
+{
+  for (uint32_t i = 0; i < crcProfilesCount; i++)
+  {
+    if ((name[0] == '\0' || strcmp(crcProfiles[i].name, name) == 0) && crcProfiles[i].valid)
+    {
+      return &crcProfiles[i];
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Create the CrcEngine of a CRC profile of any width.
+ * 
+ * @param profile A CRC profile, its engine will be saved in this variable.
+ * @return uint8_t 0 on success, 1 if the memory can't be allocated.
+ */
+static uint8_t CreateCrcEngine(CrcProfile *profile)
+{
+  profile->engine = (CrcEngine *)malloc(sizeof(CrcEngine));
+  if (profile->engine == 0)
+  {
+    return 1;
+  }
+  profile->engine->width = profile->bits;
+  profile->engine->polynomial = profile->polynomial;
+  profile->engine->initialValue = profile->initialValue;
+  profile->engine->finalXORValue = profile->finalXORValue;
+  profile->engine->inputReflected = profile->inputReflected;
+  profile->engine->resultReflected = profile->resultReflected;
+  CrcEngineInit(profile->engine);
+  return 0;
+}
+
+/**
+ * @brief Parse the text of a CRC specification file into crcProfiles.
+ * Each line holds a parameter name and a hexadecimal value. A line
+ * "Profile name" starts a new profile, parameters before the first
+ * such line belong to the profile "default". A line "Algorithm name"
+ * selects an additive checksum instead of the CRC, e.g. Fletcher16.
+ * 
+ * @param text Content of the file.
+ * @param length Length of the content.
+ */
+static void ParseCrcSpec(const char *text, size_t length)
 {
-  FILE * pFile;
-  pFile=fopen("crcspec","r");
-  LOG_INFO("Reading CRC parameters");
-  char parameterName[30];
-  uint32_t parameterValue;
-  while (fscanf(pFile,"%s%8x",parameterName,&parameterValue)!=EOF)
+  const char *end = text + length;
+  CrcProfile *profile = 0;
+  for (uint32_t i = 0; i < crcProfilesCount; i++)
+  {
+    free(crcProfiles[i].engine);
+  }
+  crcProfilesCount = 0;
+  crcEngine = 0;
+  if (width == CRC_GENERIC)
   {
-    if(strcmp(parameterName,"Polynomial")==0)
+    width = 0;
+  }
+  while (text < end)
+  {
+    char line[128], parameterName[30], parameterValue[CRC_PROFILE_NAME_SIZE];
+    const char *lineEnd = memchr(text, '\n', (size_t)(end - text));
+    size_t lineLength = (size_t)((lineEnd ? lineEnd : end) - text);
+    snprintf(line, sizeof(line), "%.*s", (int)(lineLength < sizeof(line) ? lineLength : sizeof(line) - 1), text);
+    text += lineLength + 1;
+    if (sscanf(line, "%29s %31s", parameterName, parameterValue) != 2 || parameterName[0] == '#')
+    {
+      continue;
+    }
+    if (strcmp(parameterName, "Profile") == 0 || profile == 0)
+    {
+      if (crcProfilesCount == CRC_PROFILES_MAX)
+      {
+        LOG_ERROR("Too many CRC profiles, %s is ignored", parameterValue);
+        break;
+      }
+      profile = &crcProfiles[crcProfilesCount++];
+      memset(profile, 0, sizeof(CrcProfile));
+      profile->polynomial = 0x04C11DB7;
+      snprintf(profile->name, sizeof(profile->name), "%s",
+               strcmp(parameterName, "Profile") == 0 ? parameterValue : "default");
+      if (strcmp(parameterName, "Profile") == 0)
+      {
+        continue;
+      }
+    }
+    uint64_t value = strtoull(parameterValue, 0, 16);
+    if(strcmp(parameterName,"Preset")==0)
+    {
+      const CrcPreset *preset = FindCrcPreset(parameterValue);
+      if (preset == 0)
+      {
+        LOG_ERROR("Unknown CRC preset: %s", parameterValue);
+        continue;
+      }
+      profile->bits = preset->width == CRC8 ? 8 : preset->width == CRC16 ? 16 : 32;
+      profile->polynomial = preset->polynomial;
+      profile->initialValue = preset->initialValue;
+      profile->finalXORValue = preset->finalXORValue;
+      profile->inputReflected = preset->inputReflected;
+      profile->resultReflected = preset->resultReflected;
+    }
+    else if(strcmp(parameterName,"Algorithm")==0)
     {
-      polynomial=parameterValue;
+      profile->algorithm = FindChecksumAlgorithm(parameterValue);
+      if (profile->algorithm == CHECKSUM_INVALID)
+      {
+        LOG_ERROR("Unknown checksum algorithm: %s", parameterValue);
+      }
+    }
+    else if(strcmp(parameterName,"Polynomial")==0)
+    {
+      profile->polynomial=value;
     }
     else if(strcmp(parameterName,"InitialValue")==0)
     {
-      initialValue=parameterValue;
+      profile->initialValue=value;
     }
     else if(strcmp(parameterName,"InputReflected")==0)
     {
-      inputReflected=parameterValue;
+      profile->inputReflected=(uint8_t)value;
     }
     else if(strcmp(parameterName,"ResultReflected")==0)
     {
-      resultReflected=parameterValue;
+      profile->resultReflected=(uint8_t)value;
     }
     else if(strcmp(parameterName,"FinalXORvalue")==0)
     {
-      finalXORValue=parameterValue;
+      profile->finalXORValue=value;
     }
     else if(strcmp(parameterName,"Width")==0)
     {
-      if(parameterValue==0x8)
-      width=CRC8;
-      else if(parameterValue==0x16)
-      width=CRC16;
-      else if(parameterValue==0x32)
-      width=CRC32;
+      // The width is a decimal amount of bits.
+      unsigned long bits = strtoul(parameterValue, 0, 10);
+      profile->bits = bits <= 64 ? (uint8_t)bits : 0;
     }
     else
     {
         LOG_ERROR("Invalid parameter: %s\n", parameterName);
     }
   }
-  LOG_INFO("Width: %.8x",width);
-  LOG_INFO("Polynomial: 0x%.8x",polynomial);
-  LOG_INFO("Initial Value: 0x%.8x",initialValue);
-  LOG_INFO("Input reflected: 0x%.8x",inputReflected);
-  LOG_INFO("Result reflected: 0x%.8x",resultReflected);
-  LOG_INFO("Final XOR value: 0x%.8x",finalXORValue);
+
+  // Look up tables of all profiles are calculated once per file content,
+  // profiles matching an algorithm of the CRC catalogue use its tables.
+  uint64_t start = StatsStart();
+  uint32_t calculated = 0;
+  for (uint32_t i = 0; i < crcProfilesCount; i++)
+  {
+    profile = &crcProfiles[i];
+    if (profile->algorithm != CHECKSUM_CRC)
+    {
+      // Fletcher and Adler checksums have a fixed width, sums default to 16 bits.
+      uint8_t defaultBits = ChecksumDefaultBits(profile->algorithm);
+      if (profile->bits == 0 || profile->algorithm >= CHECKSUM_FLETCHER16)
+      {
+        profile->bits = defaultBits;
+      }
+      profile->width = profile->bits == 8 ? CRC8 : profile->bits == 16 ? CRC16 : profile->bits == 32 ? CRC32 : 0;
+      profile->valid = profile->width != 0;
+      LOG_INFO("Profile: %s, checksum algorithm %u, width %u bits", profile->name, profile->algorithm, profile->bits);
+      LOG_INFO("Initial Value: 0x%.8x", (uint32_t)profile->initialValue);
+      LOG_INFO("Final XOR value: 0x%.8x", (uint32_t)profile->finalXORValue);
+      if (!profile->valid)
+      {
+        LOG_ERROR("Invalid width of checksum profile %s", profile->name);
+      }
+      continue;
+    }
+    profile->width = profile->bits == 8 ? CRC8 : profile->bits == 16 ? CRC16 : profile->bits == 32 ? CRC32 :
+                     profile->bits != 0 ? CRC_GENERIC : 0;
+    if (profile->width == CRC_GENERIC)
+    {
+      profile->valid = CreateCrcEngine(profile) == 0;
+      if (profile->valid)
+      {
+        calculated++;
+      }
+      LOG_INFO("Profile: %s, width %u bits", profile->name, profile->bits);
+      LOG_INFO("Polynomial: 0x%.16llx", (unsigned long long)profile->polynomial);
+      LOG_INFO("Initial Value: 0x%.16llx", (unsigned long long)profile->initialValue);
+      LOG_INFO("Input reflected: 0x%.8x", profile->inputReflected);
+      LOG_INFO("Result reflected: 0x%.8x", profile->resultReflected);
+      LOG_INFO("Final XOR value: 0x%.16llx", (unsigned long long)profile->finalXORValue);
+      continue;
+    }
+    profile->preset = MatchCrcPreset(profile->width, (uint32_t)profile->polynomial, (uint32_t)profile->initialValue,
+                                     (uint32_t)profile->finalXORValue, profile->inputReflected, profile->resultReflected);
+    if (profile->preset != 0)
+    {
+      profile->valid = 1;
+      memcpy(profile->table, profile->preset->table, sizeof(profile->table));
+      LOG_INFO("Profile: %s, preset %s", profile->name, profile->preset->name);
+      continue;
+    }
+    width = profile->width;
+    polynomial = (uint32_t)profile->polynomial;
+    profile->valid = CalculateCrcTable() == 0;
+    memcpy(profile->table, crcTable, sizeof(crcTable));
+    calculated++;
+    LOG_INFO("Profile: %s", profile->name);
+    LOG_INFO("Width: %.8x",profile->width);
+    LOG_INFO("Polynomial: 0x%.8x",(uint32_t)profile->polynomial);
+    LOG_INFO("Initial Value: 0x%.8x",(uint32_t)profile->initialValue);
+    LOG_INFO("Input reflected: 0x%.8x",profile->inputReflected);
+    LOG_INFO("Result reflected: 0x%.8x",profile->resultReflected);
+    LOG_INFO("Final XOR value: 0x%.8x",(uint32_t)profile->finalXORValue);
+    if (!profile->valid)
+    {
+      LOG_ERROR("Invalid width of CRC profile %s", profile->name);
+    }
+  }
+  if (calculated != 0)
+  {
+    StatsAddPhase(PHASE_CRC_TABLE, start);
+    TRACE_SPAN(start, "Calculate CRC tables of %u profiles", calculated);
+  }
+}
+
+/**
+ * @brief Load a CRC specification file and apply its selected profile.
+ * The file is parsed and its look up tables are calculated only if its
+ * modification time or size changed since the last call and its content
+ * hash differs, otherwise the cached profiles are used.
+ * 
+ * @param specName Path of the CRC specification file.
+ * @return uint8_t 0 on success, 1 if the file can't be read or has no valid profile.
+ */
+uint8_t LoadCrcSpec(const char *specName)
+{
+  struct stat status;
+  if (stat(specName, &status) != 0)
+  {
+    LOG_ERROR("Can't open CRC specification: %s", specName);
+    return 1;
+  }
+  uint8_t sameFile = strcmp(crcSpecName, specName) == 0;
+  if (!sameFile || status.st_mtime != crcSpecTime || (uint64_t)status.st_size != crcSpecSize)
+  {
+    size_t size;
+    char *text = (char *)MapFile(specName, &size);
+    uint64_t hash = HashBuffer((const uint8_t *)text, size, 0);
+    if (!sameFile || hash != crcSpecHash || crcProfilesCount == 0)
+    {
+      LOG_INFO("Reading CRC parameters");
+      ParseCrcSpec(text, size);
+      snprintf(crcSpecName, sizeof(crcSpecName), "%s", specName);
+      crcSpecHash = hash;
+    }
+    UnmapFile(text, size);
+    crcSpecTime = status.st_mtime;
+    crcSpecSize = (uint64_t)status.st_size;
+  }
+  const CrcProfile *profile = FindCrcProfile(crcProfileName);
+  if (profile == 0 && crcProfileName[0] != '\0')
+  {
+    LOG_ERROR("CRC profile %s not found, the first profile is used", crcProfileName);
+    profile = FindCrcProfile("");
+  }
+  if (profile == 0)
+  {
+    LOG_ERROR("No valid CRC profile in %s", specName);
+    return 1;
+  }
+  ApplyCrcProfile(profile);
+  return 0;
+}
+
+/**
+ * @brief Select a profile of the loaded CRC specification by name.
+ * The selection is kept when the specification file is loaded again.
+ * 
+ * @param name Name of the profile, an empty name selects the first profile.
+ * @return uint8_t 0 on success, 1 if there is no valid profile of this name.
+ */
+uint8_t SelectCrcProfile(const char *name)
+{
+  const CrcProfile *profile = FindCrcProfile(name);
+  if (profile == 0)
+  {
+    LOG_ERROR("CRC profile %s not found", name);
+    return 1;
+  }
+  snprintf(crcProfileName, sizeof(crcProfileName), "%s", name);
+  ApplyCrcProfile(profile);
+  LOG_INFO("CRC profile %s selected", profile->name);
+  return 0;
+}
+
+/**
+ * @brief Get the name of the selected CRC profile.
+ * 
+ * @return const char* Name of the profile, empty if the first profile is used.
+ */
+const char *GetCrcProfileName(void)
+{
+  return crcProfileName;
+}
+
+/**
+ * @brief Get the selected profile of the loaded CRC specification with a
+ * CrcEngine, so its CRC can be calculated in pieces.
+ * 
+ * @return const CrcProfile* The profile, 0 if there is no valid profile.
+ */
+const CrcProfile *GetCrcProfile(void)
+{
+  CrcProfile *profile = (CrcProfile *)FindCrcProfile(crcProfileName);
+  if (profile == 0)
+  {
+    profile = (CrcProfile *)FindCrcProfile("");
+  }
+  if (profile != 0 && profile->algorithm == CHECKSUM_CRC && profile->engine == 0)
+  {
+    uint64_t start = StatsStart();
+    if (CreateCrcEngine(profile) != 0)
+    {
+      return 0;
+    }
+    StatsAddPhase(PHASE_CRC_TABLE, start);
+  }
+  return profile;
+}
+
+/**
+ * @brief Start the CRC or checksum of a profile over data passed in pieces.
+ * 
+ * @param profile A profile with a CrcEngine if its algorithm is CRC.
+ * @param state The state will be saved in this variable.
+ */
+void CrcProfileStart(const CrcProfile *profile, CrcProfileState *state)
+{
+  if (profile->algorithm == CHECKSUM_CRC)
+    state->crc = CrcEngineStart(profile->engine);
+  else
+    ChecksumStart(profile->algorithm, profile->initialValue, &state->sums);
+}
+
+/**
+ * @brief Feed the next piece of data into the CRC or checksum of a profile.
+ * 
+ * @param profile A profile with a CrcEngine if its algorithm is CRC.
+ * @param state State of the calculation.
+ * @param buffer Binary data.
+ * @param length Length of binary data.
+ */
+void CrcProfileUpdate(const CrcProfile *profile, CrcProfileState *state, const uint8_t *buffer, size_t length)
+{
+  if (profile->algorithm == CHECKSUM_CRC)
+    state->crc = CrcEngineUpdate(profile->engine, state->crc, buffer, length);
+  else
+    ChecksumUpdate(profile->algorithm, &state->sums, buffer, length);
+}
+
+/**
+ * @brief Feed a run of identical bytes into the CRC or checksum of a profile,
+ * in logarithmic time of its length.
+ * 
+ * @param profile A profile with a CrcEngine if its algorithm is CRC.
+ * @param state State of the calculation.
+ * @param fill Value of each byte.
+ * @param count Amount of bytes.
+ */
+void CrcProfileFill(const CrcProfile *profile, CrcProfileState *state, uint8_t fill, uint64_t count)
+{
+  if (profile->algorithm == CHECKSUM_CRC)
+    state->crc = CrcEngineFill(profile->engine, state->crc, fill, count);
+  else
+    ChecksumFill(profile->algorithm, &state->sums, fill, count);
+}
+
+/**
+ * @brief Finish the CRC or checksum of a profile.
+ * 
+ * @param profile A profile with a CrcEngine if its algorithm is CRC.
+ * @param state State of the calculation.
+ * @return uint64_t Result value in the lowest bits bits of the profile.
+ */
+uint64_t CrcProfileFinish(const CrcProfile *profile, CrcProfileState *state)
+{
+  if (profile->algorithm == CHECKSUM_CRC)
+    return CrcEngineFinish(profile->engine, state->crc);
+  return ChecksumFinish(profile->algorithm, profile->bits, profile->finalXORValue, &state->sums);
+}
+
+/**
+ * @brief Look up the profiles of a digest set in the loaded CRC specification.
+ * Each CRC profile gets a CrcEngine, so its CRC can be calculated in pieces
+ * together with the others, additive checksums need no engine. Engines are kept until the file changes.
+ * 
+ * @param names Profile names separated by commas or spaces, e.g. "default,CCITT".
+ * @param digests The algorithms will be saved in this variable.
+ * @return uint8_t 0 on success, 1 if a profile doesn't exist or there are too many.
+ */
+uint8_t ResolveCrcDigests(const char *names, CrcDigestSet *digests)
+{
+  uint64_t start = StatsStart();
+  uint32_t calculated = 0;
+  digests->count = 0;
+  while (*names != '\0')
+  {
+    char name[CRC_PROFILE_NAME_SIZE];
+    size_t length = strcspn(names, ", ");
+    if (length == 0)
+    {
+      names++;
+      continue;
+    }
+    snprintf(name, sizeof(name), "%.*s", (int)length, names);
+    names += length;
+    CrcProfile *profile = (CrcProfile *)FindCrcProfile(name);
+    if (profile == 0 || digests->count == CRC_DIGESTS_MAX)
+    {
+      LOG_ERROR("Invalid CRC digest: %s", name);
+      digests->count = 0;
+      return 1;
+    }
+    if (profile->algorithm == CHECKSUM_CRC && profile->engine == 0)
+    {
+      if (CreateCrcEngine(profile) != 0)
+      {
+        digests->count = 0;
+        return 1;
+      }
+      calculated++;
+    }
+    digests->profiles[digests->count] = profile;
+    digests->bytes[digests->count] = (uint8_t)((profile->bits + 7) / 8);
+    digests->count++;
+  }
+  if (calculated != 0)
+  {
+    StatsAddPhase(PHASE_CRC_TABLE, start);
+    TRACE_SPAN(start, "Calculate CRC tables of %u digests", calculated);
+  }
   return 0;
 }
 
+/**
+ * @brief Read CRC algorithm specification form crcspec file.
+ * Local variables width, polynomial, initialValue, finalXORValue, inputReflected
+ * and resultReflected will have the value defined in the selected profile of
+ * the crcspec file after this function call, crcTable holds its look up table.
+ * The crcspec file should be located in CANoe project root.
+ * 
+ * @return uint32_t 0 on success.
+ */
+uint32_t appSepcifyCRCParameters()
+{
+  return LoadCrcSpec("crcspec");
+}
+
 /**
  * @brief Reflect an uint8 variable.
  * For example, an uint8 11001001(binary form) to uint8 10010011(binary form).
@@ -414,4 +855,133 @@ uint32_t CalculateCrc(const char* fileName)
   }
 
   return crc;
+}
+
+/**
+ * @brief Calculate CRC-* of a binary buffer.
+ * The result is aligned the same way as CalculateCrc,
+ * i.e. CRC8 and CRC16 values are saved in the most significant bytes.
+ * Additive checksums of the selected profile are aligned the same way.
+ * 
+ * @param buffer Binary data.
+ * @param length Length of binary data.
+ * @return uint32_t Result CRC value.
+ */
+uint32_t CalculateCrcOfBuffer(const uint8_t* buffer, uint32_t length)
+{
+  if (algorithm != CHECKSUM_CRC)
+  {
+    return (uint32_t)CalculateChecksum(algorithm, checksumBits, initialValue, finalXORValue, buffer, length)
+           << (32 - checksumBits);
+  }
+  // The kernel of a catalogue algorithm is used while the parameters still match it.
+  if (crcPreset != 0 && crcPreset->width == width && crcPreset->polynomial == polynomial &&
+      crcPreset->initialValue == initialValue && crcPreset->finalXORValue == finalXORValue &&
+      crcPreset->inputReflected == inputReflected && crcPreset->resultReflected == resultReflected)
+  {
+    return crcPreset->calculate(buffer, length);
+  }
+  uint32_t crc = initialValue;
+  switch (width)
+  {
+  case CRC8:
+    crc = (uint8_t)crc;
+    for (uint32_t i = 0; i < length; i++)
+    {
+      uint8_t tempChar = inputReflected == 1 ? Reflect8(buffer[i]) : buffer[i];
+      crc = crcTable[(uint8_t)(crc ^ tempChar)];
+    }
+    if (resultReflected == 1)
+    {
+      crc = Reflect8(crc);
+    }
+    crc = (uint8_t)(crc ^ finalXORValue);
+    crc = crc << 24;
+    break;
+
+  case CRC16:
+    crc = (uint16_t)crc;
+    for (uint32_t i = 0; i < length; i++)
+    {
+      uint8_t tempChar = inputReflected == 1 ? Reflect8(buffer[i]) : buffer[i];
+      uint8_t pos = (uint8_t)((crc >> 8) ^ tempChar);
+      crc = (uint16_t)((crc << 8) ^ crcTable[pos]);
+    }
+    if (resultReflected == 1)
+    {
+      crc = Reflect16(crc);
+    }
+    crc = (uint16_t)(crc ^ finalXORValue);
+    crc = crc << 16;
+    break;
+
+  case CRC32:
+    for (uint32_t i = 0; i < length; i++)
+    {
+      uint8_t tempChar = inputReflected == 1 ? Reflect8(buffer[i]) : buffer[i];
+      uint8_t pos = (uint8_t)((crc >> 24) ^ tempChar);
+      crc = (crc << 8) ^ crcTable[pos];
+    }
+    if (resultReflected == 1)
+    {
+      crc = Reflect32(crc);
+    }
+    crc ^= finalXORValue;
+    break;
+
+  case CRC_GENERIC:
+    // Only the 4 most significant bytes of a CRC wider than 32 bits.
+    crc = (uint32_t)(CalculateCrc64OfBuffer(buffer, length) >> 32);
+    break;
+
+  default:
+    break;
+  }
+
+  return crc;
+}
+
+/**
+ * @brief Get the amount of bytes of a CRC value of the selected algorithm.
+ * 
+ * @return uint8_t 1 to 8, 0 if no valid algorithm is selected.
+ */
+uint8_t GetCrcBytes(void)
+{
+  switch (width)
+  {
+  case CRC8:
+    return 1;
+  case CRC16:
+    return 2;
+  case CRC32:
+    return 4;
+  case CRC_GENERIC:
+    return crcEngine != 0 ? (uint8_t)((crcEngine->width + 7) / 8) : 0;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief Calculate CRC-* of a binary buffer with any width up to 64 bits.
+ * The CRC value is saved in the most significant GetCrcBytes bytes, so
+ * the 4 most significant bytes are the result of CalculateCrcOfBuffer
+ * for widths up to 32 bits.
+ * 
+ * @param buffer Binary data.
+ * @param length Length of binary data.
+ * @return uint64_t Result CRC value.
+ */
+uint64_t CalculateCrc64OfBuffer(const uint8_t* buffer, uint32_t length)
+{
+  if (width == CRC_GENERIC)
+  {
+    if (crcEngine == 0)
+    {
+      return 0;
+    }
+    return CrcEngineCalculate(crcEngine, buffer, length) << (64 - 8 * GetCrcBytes());
+  }
+  return (uint64_t)CalculateCrcOfBuffer(buffer, length) << 32;
 }
\ No newline at end of file
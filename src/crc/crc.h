@@ -5,17 +5,79 @@
 #include <stdio.h>
 #include <string.h>
 #include "minilogger.h"
+#include "checksum.h"
 
 typedef enum  {
 CRC8=0x8,
 CRC16=0x16,
-CRC32=0x32
+CRC32=0x32,
+CRC_GENERIC=0xff  // Any width from 1 to 64 bits, calculated by a CrcEngine.
 } crcWidth;
 
+typedef struct CrcPreset CrcPreset;
+typedef struct CrcEngine CrcEngine;
+
+#define CRC_PROFILES_MAX 16
+#define CRC_PROFILE_NAME_SIZE 32
+#define CRC_DIGESTS_MAX 8
+
+/**
+ * @brief A named CRC algorithm of the crcspec file with its look up table.
+ * A profile with an Algorithm other than CRC is a byte sum, word sum,
+ * Fletcher or Adler checksum of 8, 16 or 32 bits without a table.
+ * 
+ */
+typedef struct
+{
+    char name[CRC_PROFILE_NAME_SIZE];
+    checksumAlgorithm algorithm;
+    uint8_t bits;           // Width in bits, 1 to 64.
+    crcWidth width;
+    uint64_t polynomial;
+    uint64_t initialValue;
+    uint64_t finalXORValue;
+    uint8_t inputReflected;
+    uint8_t resultReflected;
+    uint8_t valid;          // The width is supported and table is calculated.
+    const CrcPreset *preset; // Algorithm of the CRC catalogue with these parameters, or 0.
+    CrcEngine *engine;      // Tables of a width other than 8, 16 and 32 bits, or 0.
+    uint32_t table[256];
+} CrcProfile;
+
+/**
+ * @brief CRC algorithms of several profiles calculated in the same pass over the data.
+ * 
+ */
+typedef struct
+{
+    uint32_t count;
+    const CrcProfile *profiles[CRC_DIGESTS_MAX]; // Profiles with an engine if their algorithm is CRC.
+    uint8_t bytes[CRC_DIGESTS_MAX]; // Bytes of the CRC value of each algorithm.
+} CrcDigestSet;
+
+/**
+ * @brief State of the CRC or checksum of a profile over data passed in pieces.
+ * 
+ */
+typedef struct
+{
+    uint64_t crc;        // CRC register of a CRC profile.
+    ChecksumState sums;  // Sums of an additive checksum profile.
+} CrcProfileState;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 uint32_t appSepcifyCRCParameters();
+uint8_t LoadCrcSpec(const char *specName);
+uint8_t SelectCrcProfile(const char *name);
+const char *GetCrcProfileName(void);
+uint8_t ResolveCrcDigests(const char *names, CrcDigestSet *digests);
+const CrcProfile *GetCrcProfile(void);
+void CrcProfileStart(const CrcProfile *profile, CrcProfileState *state);
+void CrcProfileUpdate(const CrcProfile *profile, CrcProfileState *state, const uint8_t *buffer, size_t length);
+void CrcProfileFill(const CrcProfile *profile, CrcProfileState *state, uint8_t fill, uint64_t count);
+uint64_t CrcProfileFinish(const CrcProfile *profile, CrcProfileState *state);
 uint8_t Reflect8(uint8_t val);
 uint16_t Reflect16(uint16_t val);
 uint32_t Reflect32(uint32_t val);
@@ -27,6 +89,9 @@ uint8_t Calculate_CRC8(const char* fileName);
 uint16_t Calculate_CRC16(const char* fileName);
 uint32_t Calculate_CRC32(const char* fileName);
 uint32_t CalculateCrc(const char* fileName);
+uint32_t CalculateCrcOfBuffer(const uint8_t* buffer, uint32_t length);
+uint64_t CalculateCrc64OfBuffer(const uint8_t* buffer, uint32_t length);
+uint8_t GetCrcBytes(void);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,282 @@
+/**
+ * @file crccatalogue.cpp
+ * @brief This file contains a catalogue of standard CRC algorithms.
+ * Their look up tables are generated at compile time and each algorithm
+ * has its own slicing-by-8 kernel with all parameters as constants.
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+#include <string.h>
+#include "crccatalogue.h"
+
+namespace
+{
+
+/**
+ * @brief Reflect the lowest bits of a value.
+ * 
+ * @param value Value to be reflected.
+ * @param bits Amount of bits to be reflected.
+ * @return uint32_t The reflected value.
+ */
+constexpr uint32_t ReflectBits(uint32_t value, unsigned bits)
+{
+  uint32_t result = 0;
+  for (unsigned i = 0; i < bits; i++)
+  {
+    result = (result << 1) | ((value >> i) & 1);
+  }
+  return result;
+}
+
+// Parameters of the catalogue entries, see the CRC catalogue of Greg Cook.
+// All of them have the same input and result reflection.
+struct Crc32IsoHdlc
+{
+  static constexpr const char *name = "CRC-32/ISO-HDLC";
+  static constexpr unsigned width = 32;
+  static constexpr uint32_t polynomial = 0x04C11DB7, initialValue = 0xFFFFFFFF, finalXORValue = 0xFFFFFFFF;
+  static constexpr bool reflected = true;
+  static constexpr uint32_t check = 0xCBF43926;
+};
+
+struct Crc32C
+{
+  static constexpr const char *name = "CRC-32C";
+  static constexpr unsigned width = 32;
+  static constexpr uint32_t polynomial = 0x1EDC6F41, initialValue = 0xFFFFFFFF, finalXORValue = 0xFFFFFFFF;
+  static constexpr bool reflected = true;
+  static constexpr uint32_t check = 0xE3069283;
+};
+
+struct Crc32Mpeg2
+{
+  static constexpr const char *name = "CRC-32/MPEG-2";
+  static constexpr unsigned width = 32;
+  static constexpr uint32_t polynomial = 0x04C11DB7, initialValue = 0xFFFFFFFF, finalXORValue = 0x0;
+  static constexpr bool reflected = false;
+  static constexpr uint32_t check = 0x0376E6E7;
+};
+
+struct Crc16CcittFalse
+{
+  static constexpr const char *name = "CRC-16/CCITT-FALSE";
+  static constexpr unsigned width = 16;
+  static constexpr uint32_t polynomial = 0x1021, initialValue = 0xFFFF, finalXORValue = 0x0;
+  static constexpr bool reflected = false;
+  static constexpr uint32_t check = 0x29B1;
+};
+
+struct Crc8SaeJ1850
+{
+  static constexpr const char *name = "CRC-8/SAE-J1850";
+  static constexpr unsigned width = 8;
+  static constexpr uint32_t polynomial = 0x1D, initialValue = 0xFF, finalXORValue = 0xFF;
+  static constexpr bool reflected = false;
+  static constexpr uint32_t check = 0x4B;
+};
+
+template <class Model>
+struct CrcConstants
+{
+  static constexpr uint32_t mask = Model::width == 32 ? 0xFFFFFFFF : (1u << Model::width) - 1;
+  static constexpr uint32_t topBit = 1u << (Model::width - 1);
+  // Register value before the first byte.
+  static constexpr uint32_t start = Model::reflected ? ReflectBits(Model::initialValue, Model::width) : Model::initialValue;
+};
+
+struct CrcTable
+{
+  uint32_t values[256];
+};
+
+struct CrcSliceTables
+{
+  uint32_t values[8][256]; // values[k][b] is the CRC of byte b followed by k zero bytes.
+};
+
+/**
+ * @brief Generate the look up table in the layout of crcTable:
+ * not reflected, the CRC in the lowest width bits.
+ */
+template <class Model>
+constexpr CrcTable MakeGenericTable()
+{
+  CrcTable table{};
+  for (uint32_t divident = 0; divident < 256; divident++)
+  {
+    uint32_t crc = divident << (Model::width - 8);
+    for (unsigned bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & CrcConstants<Model>::topBit) ? ((crc << 1) ^ Model::polynomial) : (crc << 1);
+      crc &= CrcConstants<Model>::mask;
+    }
+    table.values[divident] = crc;
+  }
+  return table;
+}
+
+/**
+ * @brief Generate the slicing-by-8 tables in the bit order of the model.
+ */
+template <class Model>
+constexpr CrcSliceTables MakeSliceTables()
+{
+  CrcSliceTables tables{};
+  constexpr uint32_t mask = CrcConstants<Model>::mask;
+  for (uint32_t divident = 0; divident < 256; divident++)
+  {
+    uint32_t crc = Model::reflected ? divident : divident << (Model::width - 8);
+    for (unsigned bit = 0; bit < 8; bit++)
+    {
+      if (Model::reflected)
+        crc = (crc & 1) ? ((crc >> 1) ^ ReflectBits(Model::polynomial, Model::width)) : (crc >> 1);
+      else
+        crc = ((crc & CrcConstants<Model>::topBit) ? ((crc << 1) ^ Model::polynomial) : (crc << 1)) & mask;
+    }
+    tables.values[0][divident] = crc;
+  }
+  for (unsigned k = 1; k < 8; k++)
+  {
+    for (uint32_t divident = 0; divident < 256; divident++)
+    {
+      uint32_t previous = tables.values[k - 1][divident];
+      tables.values[k][divident] = Model::reflected
+                                       ? (previous >> 8) ^ tables.values[0][previous & 0xFF]
+                                       : ((previous << 8) & mask) ^ tables.values[0][(previous >> (Model::width - 8)) & 0xFF];
+    }
+  }
+  return tables;
+}
+
+template <class Model>
+constexpr CrcTable genericTable = MakeGenericTable<Model>();
+
+template <class Model>
+constexpr CrcSliceTables sliceTables = MakeSliceTables<Model>();
+
+/**
+ * @brief Calculate the CRC of "123456789" bit by bit, to check the tables at compile time.
+ */
+template <class Model>
+constexpr uint32_t CheckValue()
+{
+  uint32_t crc = CrcConstants<Model>::start;
+  const char text[] = "123456789";
+  for (unsigned i = 0; i < 9; i++)
+  {
+    uint8_t byte = (uint8_t)text[i];
+    crc = Model::reflected
+              ? (crc >> 8) ^ sliceTables<Model>.values[0][(crc ^ byte) & 0xFF]
+              : ((crc << 8) & CrcConstants<Model>::mask) ^ sliceTables<Model>.values[0][((crc >> (Model::width - 8)) ^ byte) & 0xFF];
+  }
+  return (crc ^ Model::finalXORValue) & CrcConstants<Model>::mask;
+}
+
+static_assert(CheckValue<Crc32IsoHdlc>() == Crc32IsoHdlc::check, "CRC-32/ISO-HDLC table");
+static_assert(CheckValue<Crc32C>() == Crc32C::check, "CRC-32C table");
+static_assert(CheckValue<Crc32Mpeg2>() == Crc32Mpeg2::check, "CRC-32/MPEG-2 table");
+static_assert(CheckValue<Crc16CcittFalse>() == Crc16CcittFalse::check, "CRC-16/CCITT-FALSE table");
+static_assert(CheckValue<Crc8SaeJ1850>() == Crc8SaeJ1850::check, "CRC-8/SAE-J1850 table");
+
+/**
+ * @brief Calculate the CRC of a buffer, 8 bytes per step.
+ * The first width / 8 bytes of each step are combined with the CRC
+ * register, then each byte is looked up in its own table.
+ * 
+ * @param buffer Binary data.
+ * @param length Length of binary data.
+ * @return uint32_t Result CRC value, CRC8 and CRC16 values are saved in the most significant bytes.
+ */
+template <class Model>
+uint32_t CalculatePresetCrc(const uint8_t *buffer, uint32_t length)
+{
+  constexpr unsigned width = Model::width;
+  constexpr uint32_t mask = CrcConstants<Model>::mask;
+  const uint32_t(&table)[8][256] = sliceTables<Model>.values;
+  uint32_t crc = CrcConstants<Model>::start;
+  while (length >= 8)
+  {
+    uint8_t bytes[8];
+    memcpy(bytes, buffer, 8);
+    for (unsigned i = 0; i < width / 8; i++)
+    {
+      bytes[i] ^= (uint8_t)(Model::reflected ? crc >> (8 * i) : crc >> (width - 8 * (i + 1)));
+    }
+    crc = table[7][bytes[0]] ^ table[6][bytes[1]] ^ table[5][bytes[2]] ^ table[4][bytes[3]] ^
+          table[3][bytes[4]] ^ table[2][bytes[5]] ^ table[1][bytes[6]] ^ table[0][bytes[7]];
+    buffer += 8;
+    length -= 8;
+  }
+  for (uint32_t i = 0; i < length; i++)
+  {
+    crc = Model::reflected
+              ? (crc >> 8) ^ table[0][(crc ^ buffer[i]) & 0xFF]
+              : ((crc << 8) & mask) ^ table[0][((crc >> (width - 8)) ^ buffer[i]) & 0xFF];
+  }
+  return ((crc ^ Model::finalXORValue) & mask) << (32 - width);
+}
+
+template <class Model>
+constexpr CrcPreset MakePreset()
+{
+  return {Model::name,
+          Model::width == 8 ? CRC8 : Model::width == 16 ? CRC16 : CRC32,
+          Model::polynomial,
+          Model::initialValue,
+          Model::finalXORValue,
+          Model::reflected,
+          Model::reflected,
+          Model::check,
+          genericTable<Model>.values,
+          CalculatePresetCrc<Model>};
+}
+
+const CrcPreset crcPresets[] = {
+    MakePreset<Crc32IsoHdlc>(),
+    MakePreset<Crc32C>(),
+    MakePreset<Crc32Mpeg2>(),
+    MakePreset<Crc16CcittFalse>(),
+    MakePreset<Crc8SaeJ1850>(),
+};
+
+} // namespace
+
+/**
+ * @brief Find a CRC algorithm of the catalogue by name.
+ * 
+ * @param name Name of the algorithm, e.g. CRC-32/ISO-HDLC.
+ * @return const CrcPreset* The algorithm, 0 if it isn't in the catalogue.
+ */
+const CrcPreset *FindCrcPreset(const char *name)
+{
+  for (const CrcPreset &preset : crcPresets)
+  {
+    if (strcmp(preset.name, name) == 0)
+    {
+      return &preset;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Find a CRC algorithm of the catalogue by its parameters.
+ * 
+ * @return const CrcPreset* The algorithm, 0 if no algorithm of the catalogue has these parameters.
+ */
+const CrcPreset *MatchCrcPreset(crcWidth width, uint32_t polynomial, uint32_t initialValue,
+                                uint32_t finalXORValue, uint8_t inputReflected, uint8_t resultReflected)
+{
+  for (const CrcPreset &preset : crcPresets)
+  {
+    if (preset.width == width && preset.polynomial == polynomial &&
+        preset.initialValue == initialValue && preset.finalXORValue == finalXORValue &&
+        preset.inputReflected == inputReflected && preset.resultReflected == resultReflected)
+    {
+      return &preset;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef CRCCATALOGUE_H
+#define CRCCATALOGUE_H
+
+#include <stdint.h>
+#include "crc.h"
+
+/**
+ * @brief A standard CRC algorithm with look up tables generated at compile time.
+ * 
+ */
+struct CrcPreset
+{
+    const char *name;       // Name in the CRC catalogue, e.g. CRC-32/ISO-HDLC.
+    crcWidth width;
+    uint32_t polynomial;
+    uint32_t initialValue;
+    uint32_t finalXORValue;
+    uint8_t inputReflected;
+    uint8_t resultReflected;
+    uint32_t check;         // CRC of "123456789".
+    const uint32_t *table;  // Look up table in the layout of crcTable.
+    // CRC of a buffer, aligned the same way as CalculateCrcOfBuffer.
+    uint32_t (*calculate)(const uint8_t *buffer, uint32_t length);
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+const CrcPreset *FindCrcPreset(const char *name);
+const CrcPreset *MatchCrcPreset(crcWidth width, uint32_t polynomial, uint32_t initialValue,
+                                uint32_t finalXORValue, uint8_t inputReflected, uint8_t resultReflected);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,443 @@
+/**
+ * @file crcengine.c
+ * @brief This file contains a table driven CRC calculation for any
+ * width from 1 to 64 bits, e.g. CRC-15/CAN, CRC-24 or CRC-64/XZ.
+ * Long buffers are folded 64 bytes at a time with PCLMULQDQ where the
+ * processor supports it, otherwise slicing-by-8 tables are used.
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+#include "crcengine.h"
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CRC_ENGINE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC_ENGINE_TARGET_CLMUL
+#else
+#include <cpuid.h>
+#define CRC_ENGINE_TARGET_CLMUL __attribute__((target("pclmul,ssse3")))
+#endif
+#endif
+
+// Shortest buffer folded by the CLMUL kernel, shorter ones are faster with the tables.
+#define CRC_ENGINE_FOLD_MIN 128
+
+/**
+ * @brief Kernel used for long buffers: -1 not detected yet, otherwise a crcEngineKernel.
+ * 
+ */
+static atomic_int crcEngineKernelUsed = -1;
+
+/**
+ * @brief Reflect the lowest bits of a value.
+ * 
+ * @param value Value to be reflected.
+ * @param bits Amount of bits to be reflected.
+ * @return uint64_t The reflected value.
+ */
+static uint64_t Reflect64(uint64_t value, uint8_t bits)
+{
+  uint64_t result = 0;
+  for (uint8_t i = 0; i < bits; i++)
+  {
+    result = (result << 1) | ((value >> i) & 1);
+  }
+  return result;
+}
+
+static uint64_t WidthMask(uint8_t width)
+{
+  return width >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+}
+
+/**
+ * @brief Calculate x^n modulo the polynomial of a CRC algorithm, which is
+ * left aligned in 64 bits like the register, so the result is too.
+ * 
+ * @param polynomial The polynomial without its top bit, left aligned in 64 bits.
+ * @param n The exponent.
+ * @return uint64_t Coefficients of x^0 to x^63 in bits 0 to 63.
+ */
+static uint64_t PowerModulo(uint64_t polynomial, uint32_t n)
+{
+  uint64_t result = 1;
+  for (uint32_t i = 0; i < n; i++)
+  {
+    result = (result >> 63) ? (result << 1) ^ polynomial : result << 1;
+  }
+  return result;
+}
+
+/**
+ * @brief Calculate the slicing-by-8 tables of a CRC algorithm.
+ * A reflected register holds the CRC in its lowest bits, otherwise the CRC
+ * is left aligned in 64 bits, so each byte is combined with the top byte
+ * of the register whatever the width is.
+ * 
+ * @param engine A CRC algorithm, its tables will be saved in this variable.
+ */
+void CrcEngineInit(CrcEngine *engine)
+{
+  uint64_t polynomial = engine->polynomial & WidthMask(engine->width);
+  uint64_t aligned = polynomial << (64 - engine->width);
+  // Folding d bits multiplies the upper half of 128 bits with x^(d + 64) and the lower half with x^d.
+  // Reflected products of CLMUL are one bit short, which x^(n - 1) makes up for.
+  static const uint32_t distances[2] = {128, 512};
+  for (uint32_t i = 0; i < 2; i++)
+  {
+    if (engine->inputReflected)
+    {
+      engine->fold[2 * i] = Reflect64(PowerModulo(aligned, distances[i] + 63), 64);
+      engine->fold[2 * i + 1] = Reflect64(PowerModulo(aligned, distances[i] - 1), 64);
+    }
+    else
+    {
+      engine->fold[2 * i] = PowerModulo(aligned, distances[i]);
+      engine->fold[2 * i + 1] = PowerModulo(aligned, distances[i] + 64);
+    }
+  }
+  polynomial = engine->inputReflected ? Reflect64(polynomial, engine->width) : aligned;
+  for (uint32_t divident = 0; divident < 256; divident++)
+  {
+    uint64_t crc = engine->inputReflected ? divident : (uint64_t)divident << 56;
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      if (engine->inputReflected)
+        crc = (crc & 1) ? (crc >> 1) ^ polynomial : crc >> 1;
+      else
+        crc = (crc >> 63) ? (crc << 1) ^ polynomial : crc << 1;
+    }
+    engine->table[0][divident] = crc;
+  }
+  for (uint32_t k = 1; k < 8; k++)
+  {
+    for (uint32_t divident = 0; divident < 256; divident++)
+    {
+      uint64_t previous = engine->table[k - 1][divident];
+      engine->table[k][divident] = engine->inputReflected
+                                       ? (previous >> 8) ^ engine->table[0][previous & 0xFF]
+                                       : (previous << 8) ^ engine->table[0][previous >> 56];
+    }
+  }
+}
+
+/**
+ * @brief Start a CRC calculation over data passed in pieces.
+ * 
+ * @param engine A CRC algorithm initialized by CrcEngineInit.
+ * @return uint64_t The CRC register before the first byte.
+ */
+uint64_t CrcEngineStart(const CrcEngine *engine)
+{
+  uint64_t initial = engine->initialValue & WidthMask(engine->width);
+  return engine->inputReflected ? Reflect64(initial, engine->width) : initial << (64 - engine->width);
+}
+
+/**
+ * @brief Feed data into the CRC register with the slicing-by-8 tables, 8 bytes per step.
+ * 
+ * @param engine A CRC algorithm initialized by CrcEngineInit.
+ * @param crc The CRC register after the previous piece.
+ * @param buffer Binary data.
+ * @param length Length of binary data.
+ * @return uint64_t The CRC register after this piece.
+ */
+static uint64_t UpdateTable(const CrcEngine *engine, uint64_t crc, const uint8_t *buffer, size_t length)
+{
+  const uint64_t(*table)[256] = engine->table;
+  if (engine->inputReflected)
+  {
+    for (; length >= 8; buffer += 8, length -= 8)
+    {
+      uint64_t x = crc ^ ((uint64_t)buffer[0] | (uint64_t)buffer[1] << 8 | (uint64_t)buffer[2] << 16 |
+                          (uint64_t)buffer[3] << 24 | (uint64_t)buffer[4] << 32 | (uint64_t)buffer[5] << 40 |
+                          (uint64_t)buffer[6] << 48 | (uint64_t)buffer[7] << 56);
+      crc = table[7][x & 0xFF] ^ table[6][(x >> 8) & 0xFF] ^ table[5][(x >> 16) & 0xFF] ^
+            table[4][(x >> 24) & 0xFF] ^ table[3][(x >> 32) & 0xFF] ^ table[2][(x >> 40) & 0xFF] ^
+            table[1][(x >> 48) & 0xFF] ^ table[0][x >> 56];
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+      crc = (crc >> 8) ^ table[0][(crc ^ buffer[i]) & 0xFF];
+    }
+  }
+  else
+  {
+    for (; length >= 8; buffer += 8, length -= 8)
+    {
+      uint64_t x = crc ^ ((uint64_t)buffer[0] << 56 | (uint64_t)buffer[1] << 48 | (uint64_t)buffer[2] << 40 |
+                          (uint64_t)buffer[3] << 32 | (uint64_t)buffer[4] << 24 | (uint64_t)buffer[5] << 16 |
+                          (uint64_t)buffer[6] << 8 | (uint64_t)buffer[7]);
+      crc = table[7][x >> 56] ^ table[6][(x >> 48) & 0xFF] ^ table[5][(x >> 40) & 0xFF] ^
+            table[4][(x >> 32) & 0xFF] ^ table[3][(x >> 24) & 0xFF] ^ table[2][(x >> 16) & 0xFF] ^
+            table[1][(x >> 8) & 0xFF] ^ table[0][x & 0xFF];
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+      crc = (crc << 8) ^ table[0][(crc >> 56) ^ buffer[i]];
+    }
+  }
+  return crc;
+}
+
+#ifdef CRC_ENGINE_X86
+/**
+ * @brief Fold a 128 bit value d bits forward, the result is congruent to
+ * the value times x^d modulo the polynomial and shorter than 128 bits.
+ * 
+ * @param value The value.
+ * @param constants Constants of the distance d.
+ * @return __m128i The folded value.
+ */
+static CRC_ENGINE_TARGET_CLMUL __m128i Fold(__m128i value, __m128i constants)
+{
+  return _mm_xor_si128(_mm_clmulepi64_si128(value, constants, 0x00), _mm_clmulepi64_si128(value, constants, 0x11));
+}
+
+/**
+ * @brief Load 16 bytes as a polynomial, the first byte in the upper bits
+ * unless the input is reflected, which keeps the bit order of the register.
+ * 
+ * @param buffer Binary data.
+ * @param reflected 1 if the input is reflected.
+ * @return __m128i The polynomial.
+ */
+static CRC_ENGINE_TARGET_CLMUL __m128i LoadBlock(const uint8_t *buffer, uint8_t reflected)
+{
+  __m128i block = _mm_loadu_si128((const __m128i *)buffer);
+  return reflected ? block : _mm_shuffle_epi8(block, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+/**
+ * @brief Feed data into the CRC register by folding it with carry-less
+ * multiplication. The register is added to the first 8 bytes, then four
+ * 128 bit accumulators are folded over 64 bytes, merged into one and
+ * folded over the remaining 16 byte blocks. The CRC of the data equals the
+ * CRC of the last accumulator from a zero register, which the tables finish.
+ * 
+ * @param engine A CRC algorithm initialized by CrcEngineInit.
+ * @param crc The CRC register after the previous piece.
+ * @param buffer Binary data.
+ * @param length Length of binary data, a multiple of 16 and at least 64.
+ * @return uint64_t The CRC register after this piece.
+ */
+static CRC_ENGINE_TARGET_CLMUL uint64_t UpdateClmul(const CrcEngine *engine, uint64_t crc, const uint8_t *buffer, size_t length)
+{
+  uint8_t reflected = engine->inputReflected;
+  const __m128i fold16 = _mm_loadu_si128((const __m128i *)&engine->fold[0]);
+  const __m128i fold64 = _mm_loadu_si128((const __m128i *)&engine->fold[2]);
+  __m128i x0 = _mm_xor_si128(LoadBlock(buffer, reflected),
+                             reflected ? _mm_set_epi64x(0, (long long)crc) : _mm_set_epi64x((long long)crc, 0));
+  __m128i x1 = LoadBlock(buffer + 16, reflected);
+  __m128i x2 = LoadBlock(buffer + 32, reflected);
+  __m128i x3 = LoadBlock(buffer + 48, reflected);
+  size_t offset = 64;
+  for (; offset + 64 <= length; offset += 64)
+  {
+    x0 = _mm_xor_si128(Fold(x0, fold64), LoadBlock(buffer + offset, reflected));
+    x1 = _mm_xor_si128(Fold(x1, fold64), LoadBlock(buffer + offset + 16, reflected));
+    x2 = _mm_xor_si128(Fold(x2, fold64), LoadBlock(buffer + offset + 32, reflected));
+    x3 = _mm_xor_si128(Fold(x3, fold64), LoadBlock(buffer + offset + 48, reflected));
+  }
+  x1 = _mm_xor_si128(Fold(x0, fold16), x1);
+  x2 = _mm_xor_si128(Fold(x1, fold16), x2);
+  x3 = _mm_xor_si128(Fold(x2, fold16), x3);
+  for (; offset < length; offset += 16)
+  {
+    x3 = _mm_xor_si128(Fold(x3, fold16), LoadBlock(buffer + offset, reflected));
+  }
+  uint8_t rest[16];
+  // Stored in the order of the data again, loading twice restores it.
+  _mm_storeu_si128((__m128i *)rest, x3);
+  _mm_storeu_si128((__m128i *)rest, LoadBlock(rest, reflected));
+  return UpdateTable(engine, 0, rest, sizeof(rest));
+}
+
+static uint8_t DetectClmul(void)
+{
+#ifdef _MSC_VER
+  int registers[4];
+  __cpuid(registers, 1);
+  return ((registers[2] >> 1) & 1) && ((registers[2] >> 9) & 1);
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+  // PCLMULQDQ and SSSE3 for the byte shuffle.
+  return ((ecx >> 1) & 1) && ((ecx >> 9) & 1);
+#endif
+}
+#endif
+
+/**
+ * @brief Detect the fastest kernel supported by the processor.
+ * 
+ * @return crcEngineKernel The kernel.
+ */
+static crcEngineKernel DetectCrcEngineKernel(void)
+{
+#ifdef CRC_ENGINE_X86
+  if (DetectClmul())
+    return CRC_ENGINE_KERNEL_CLMUL;
+#endif
+  return CRC_ENGINE_KERNEL_TABLE;
+}
+
+/**
+ * @brief Get the kernel feeding long buffers into the CRC register.
+ * 
+ * @return crcEngineKernel The kernel in use.
+ */
+crcEngineKernel GetCrcEngineKernel(void)
+{
+  int kernel = atomic_load_explicit(&crcEngineKernelUsed, memory_order_relaxed);
+  if (kernel < 0)
+  {
+    kernel = DetectCrcEngineKernel();
+    atomic_store_explicit(&crcEngineKernelUsed, kernel, memory_order_relaxed);
+  }
+  return (crcEngineKernel)kernel;
+}
+
+/**
+ * @brief Limit the kernel feeding long buffers into the CRC register, e.g. to compare all kernels.
+ * 
+ * @param kernel The fastest kernel to be used, if the processor supports it.
+ */
+void SetCrcEngineKernel(crcEngineKernel kernel)
+{
+  crcEngineKernel supported = DetectCrcEngineKernel();
+  atomic_store_explicit(&crcEngineKernelUsed, kernel < supported ? kernel : supported, memory_order_relaxed);
+}
+
+/**
+ * @brief Feed the next piece of data into the CRC register with the fastest kernel.
+ * 
+ * @param engine A CRC algorithm initialized by CrcEngineInit.
+ * @param crc The CRC register after the previous piece.
+ * @param buffer Binary data.
+ * @param length Length of binary data.
+ * @return uint64_t The CRC register after this piece.
+ */
+uint64_t CrcEngineUpdate(const CrcEngine *engine, uint64_t crc, const uint8_t *buffer, size_t length)
+{
+#ifdef CRC_ENGINE_X86
+  if (length >= CRC_ENGINE_FOLD_MIN && GetCrcEngineKernel() == CRC_ENGINE_KERNEL_CLMUL)
+  {
+    size_t folded = length / 16 * 16;
+    crc = UpdateClmul(engine, crc, buffer, folded);
+    buffer += folded;
+    length -= folded;
+  }
+#endif
+  return UpdateTable(engine, crc, buffer, length);
+}
+
+/**
+ * @brief Multiply a 64x64 matrix over GF(2) with a vector.
+ * 
+ * @param matrix Columns of the matrix, column i is the image of bit i.
+ * @param vector The vector.
+ * @return uint64_t The product.
+ */
+static uint64_t MultiplyMatrix(const uint64_t matrix[64], uint64_t vector)
+{
+  uint64_t result = 0;
+  for (uint32_t i = 0; vector != 0; i++, vector >>= 1)
+  {
+    if (vector & 1)
+    {
+      result ^= matrix[i];
+    }
+  }
+  return result;
+}
+
+/**
+ * @brief Feed a run of identical bytes into the CRC register without
+ * touching each of them. One byte maps the register r to A r ^ b, A being
+ * linear over GF(2), so count bytes are applied by squaring this map,
+ * with about 64 * 64 * log2(count) operations.
+ * 
+ * @param engine A CRC algorithm initialized by CrcEngineInit.
+ * @param crc The CRC register after the previous piece.
+ * @param fill Value of each byte.
+ * @param count Amount of bytes.
+ * @return uint64_t The CRC register after the run.
+ */
+uint64_t CrcEngineFill(const CrcEngine *engine, uint64_t crc, uint8_t fill, uint64_t count)
+{
+  uint64_t matrix[64], square[64];
+  uint64_t constant = engine->table[0][fill];
+  if (count < 256)
+  {
+    uint8_t bytes[256];
+    memset(bytes, fill, (size_t)count);
+    return CrcEngineUpdate(engine, crc, bytes, (size_t)count);
+  }
+  // A is the register after a zero byte.
+  for (uint32_t i = 0; i < 64; i++)
+  {
+    uint64_t bit = (uint64_t)1 << i;
+    matrix[i] = engine->inputReflected ? (bit >> 8) ^ engine->table[0][bit & 0xFF]
+                                       : (bit << 8) ^ engine->table[0][bit >> 56];
+  }
+  for (;;)
+  {
+    if (count & 1)
+    {
+      crc = MultiplyMatrix(matrix, crc) ^ constant;
+    }
+    count >>= 1;
+    if (count == 0)
+    {
+      break;
+    }
+    // (A, b) applied twice is (A A, A b ^ b).
+    constant ^= MultiplyMatrix(matrix, constant);
+    for (uint32_t i = 0; i < 64; i++)
+    {
+      square[i] = MultiplyMatrix(matrix, matrix[i]);
+    }
+    memcpy(matrix, square, sizeof(matrix));
+  }
+  return crc;
+}
+
+/**
+ * @brief Finish a CRC calculation over data passed in pieces.
+ * 
+ * @param engine A CRC algorithm initialized by CrcEngineInit.
+ * @param crc The CRC register after the last piece.
+ * @return uint64_t Result CRC value in the lowest width bits.
+ */
+uint64_t CrcEngineFinish(const CrcEngine *engine, uint64_t crc)
+{
+  if (!engine->inputReflected)
+  {
+    crc >>= 64 - engine->width;
+  }
+  if (engine->inputReflected != engine->resultReflected)
+  {
+    crc = Reflect64(crc, engine->width);
+  }
+  return (crc ^ engine->finalXORValue) & WidthMask(engine->width);
+}
+
+/**
+ * @brief Calculate the CRC of a buffer.
+ * 
+ * @param engine A CRC algorithm initialized by CrcEngineInit.
+ * @param buffer Binary data.
+ * @param length Length of binary data.
+ * @return uint64_t Result CRC value in the lowest width bits.
+ */
+uint64_t CrcEngineCalculate(const CrcEngine *engine, const uint8_t *buffer, size_t length)
+{
+  return CrcEngineFinish(engine, CrcEngineUpdate(engine, CrcEngineStart(engine), buffer, length));
+}
@@ -0,0 +1,51 @@
+#ifndef CRCENGINE_H
+#define CRCENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "crc.h"
+
+/**
+ * @brief A CRC algorithm of any width from 1 to 64 bits with its slicing-by-8 tables.
+ * 
+ */
+struct CrcEngine
+{
+    uint8_t width;            // Width of the CRC in bits.
+    uint8_t inputReflected;
+    uint8_t resultReflected;
+    uint64_t polynomial;
+    uint64_t initialValue;
+    uint64_t finalXORValue;
+    // table[k][b] is the CRC register after byte b and k zero bytes.
+    // The register is left aligned in 64 bits unless the input is reflected.
+    uint64_t table[8][256];
+    // Constants of the CLMUL kernel folding 16 and 64 bytes, in the order of the 64 bit lanes.
+    uint64_t fold[4];
+};
+
+/**
+ * @brief Kernels feeding data into the CRC register, the fastest one supported by the processor is used.
+ * 
+ */
+typedef enum
+{
+    CRC_ENGINE_KERNEL_TABLE,
+    CRC_ENGINE_KERNEL_CLMUL
+} crcEngineKernel;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void CrcEngineInit(CrcEngine *engine);
+uint64_t CrcEngineCalculate(const CrcEngine *engine, const uint8_t *buffer, size_t length);
+uint64_t CrcEngineStart(const CrcEngine *engine);
+uint64_t CrcEngineUpdate(const CrcEngine *engine, uint64_t crc, const uint8_t *buffer, size_t length);
+uint64_t CrcEngineFill(const CrcEngine *engine, uint64_t crc, uint8_t fill, uint64_t count);
+uint64_t CrcEngineFinish(const CrcEngine *engine, uint64_t crc);
+crcEngineKernel GetCrcEngineKernel(void);
+void SetCrcEngineKernel(crcEngineKernel kernel);
+#ifdef __cplusplus
+}
+#endif
+#endif
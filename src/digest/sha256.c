@@ -0,0 +1,332 @@
+/**
+ * @file sha256.c
+ * @brief This file contains the SHA-256 hash of FIPS 180-4.
+ * Blocks are hashed with the SHA extensions of x86 processors where
+ * available, otherwise with a portable implementation.
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+#include "sha256.h"
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SHA256_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHA256_TARGET
+#else
+#include <cpuid.h>
+#define SHA256_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/**
+ * @brief Kernel used for whole blocks: -1 not detected yet, 0 portable, 1 SHA extensions.
+ * 
+ */
+static atomic_int sha256Kernel = -1;
+
+static uint32_t Rotr32(uint32_t value, uint8_t bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+/**
+ * @brief Hash whole blocks with the portable implementation.
+ * 
+ * @param state Hash state.
+ * @param data Blocks to be hashed.
+ * @param blocks Amount of blocks.
+ */
+static void Sha256BlocksPortable(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    for (; blocks != 0; blocks--, data += SHA256_BLOCK_SIZE)
+    {
+        uint32_t w[64];
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (uint32_t t = 0; t < 16; t++)
+        {
+            w[t] = (uint32_t)data[4 * t] << 24 | (uint32_t)data[4 * t + 1] << 16 |
+                   (uint32_t)data[4 * t + 2] << 8 | data[4 * t + 3];
+        }
+        for (uint32_t t = 16; t < 64; t++)
+        {
+            uint32_t s0 = Rotr32(w[t - 15], 7) ^ Rotr32(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = Rotr32(w[t - 2], 17) ^ Rotr32(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        for (uint32_t t = 0; t < 64; t++)
+        {
+            uint32_t t1 = h + (Rotr32(e, 6) ^ Rotr32(e, 11) ^ Rotr32(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[t] + w[t];
+            uint32_t t2 = (Rotr32(a, 2) ^ Rotr32(a, 13) ^ Rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA256_X86
+// Rounds 4 * i to 4 * i + 3, message words w of these rounds.
+#define SHA256_ROUNDS(i, w)                                                                  \
+    do                                                                                       \
+    {                                                                                        \
+        __m128i k = _mm_add_epi32(w, _mm_loadu_si128((const __m128i *)&sha256K[4 * (i)])); \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, k);                                   \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(k, 0x0E));         \
+    } while (0)
+
+// Message words of the next 4 rounds from the last 16 words w0 to w3, saved in w0.
+#define SHA256_SCHEDULE(w0, w1, w2, w3) \
+    w0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), _mm_alignr_epi8(w3, w2, 4)), w3)
+
+/**
+ * @brief Hash whole blocks with the SHA extensions.
+ * The state is kept as ABEF and CDGH in two registers.
+ * 
+ * @param state Hash state.
+ * @param data Blocks to be hashed.
+ * @param blocks Amount of blocks.
+ */
+static SHA256_TARGET void Sha256BlocksShaNi(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i cdab = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+    __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(cdab, efgh, 8);     // ABEF
+    __m128i state1 = _mm_blend_epi16(efgh, cdab, 0xF0);  // CDGH
+    for (; blocks != 0; blocks--, data += SHA256_BLOCK_SIZE)
+    {
+        __m128i abefSaved = state0, cdghSaved = state1;
+        __m128i w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), byteSwap);
+        __m128i w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), byteSwap);
+        __m128i w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), byteSwap);
+        __m128i w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), byteSwap);
+        SHA256_ROUNDS(0, w0);
+        SHA256_ROUNDS(1, w1);
+        SHA256_ROUNDS(2, w2);
+        SHA256_ROUNDS(3, w3);
+        for (uint32_t i = 4; i < 16; i += 4)
+        {
+            SHA256_SCHEDULE(w0, w1, w2, w3);
+            SHA256_ROUNDS(i, w0);
+            SHA256_SCHEDULE(w1, w2, w3, w0);
+            SHA256_ROUNDS(i + 1, w1);
+            SHA256_SCHEDULE(w2, w3, w0, w1);
+            SHA256_ROUNDS(i + 2, w2);
+            SHA256_SCHEDULE(w3, w0, w1, w2);
+            SHA256_ROUNDS(i + 3, w3);
+        }
+        state0 = _mm_add_epi32(state0, abefSaved);
+        state1 = _mm_add_epi32(state1, cdghSaved);
+    }
+    __m128i feba = _mm_shuffle_epi32(state0, 0x1B);
+    __m128i dchg = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(feba, dchg, 0xF0)); // DCBA
+    _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(dchg, feba, 8));    // HGFE
+}
+
+/**
+ * @brief Check if the processor has the SHA extensions and SSE4.1.
+ * 
+ * @return uint8_t 1 if Sha256BlocksShaNi can be used.
+ */
+static uint8_t DetectShaExtensions(void)
+{
+#ifdef _MSC_VER
+    int registers[4];
+    __cpuid(registers, 0);
+    if (registers[0] < 7)
+        return 0;
+    __cpuidex(registers, 7, 0);
+    uint8_t sha = (registers[1] >> 29) & 1;
+    __cpuid(registers, 1);
+    return sha && ((registers[2] >> 19) & 1) && ((registers[2] >> 9) & 1);
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, 0) < 7)
+        return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    uint8_t sha = (ebx >> 29) & 1;
+    __cpuid(1, eax, ebx, ecx, edx);
+    return sha && ((ecx >> 19) & 1) && ((ecx >> 9) & 1);
+#endif
+}
+#endif
+
+/**
+ * @brief Hash whole blocks with the fastest kernel of this processor.
+ * 
+ * @param state Hash state.
+ * @param data Blocks to be hashed.
+ * @param blocks Amount of blocks.
+ */
+static void Sha256Blocks(uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+#ifdef SHA256_X86
+    int kernel = atomic_load_explicit(&sha256Kernel, memory_order_relaxed);
+    if (kernel < 0)
+    {
+        kernel = DetectShaExtensions();
+        atomic_store_explicit(&sha256Kernel, kernel, memory_order_relaxed);
+    }
+    if (kernel == 1)
+    {
+        Sha256BlocksShaNi(state, data, blocks);
+        return;
+    }
+#endif
+    Sha256BlocksPortable(state, data, blocks);
+}
+
+/**
+ * @brief Check if blocks are hashed with the SHA extensions.
+ * 
+ * @return uint8_t 1 if the SHA extensions are used.
+ */
+uint8_t Sha256Accelerated(void)
+{
+#ifdef SHA256_X86
+    int kernel = atomic_load_explicit(&sha256Kernel, memory_order_relaxed);
+    if (kernel < 0)
+    {
+        kernel = DetectShaExtensions();
+        atomic_store_explicit(&sha256Kernel, kernel, memory_order_relaxed);
+    }
+    return kernel == 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Enable or disable the SHA extensions, e.g. to compare both kernels.
+ * They are used only if the processor has them.
+ * 
+ * @param enable 0 to use the portable implementation.
+ */
+void Sha256SetAcceleration(uint8_t enable)
+{
+#ifdef SHA256_X86
+    atomic_store_explicit(&sha256Kernel, enable ? DetectShaExtensions() : 0, memory_order_relaxed);
+#else
+    (void)enable;
+#endif
+}
+
+/**
+ * @brief Start a SHA-256 calculation.
+ * 
+ * @param context The state will be saved in this variable.
+ */
+void Sha256Init(Sha256Context *context)
+{
+    static const uint32_t initialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(context->state, initialState, sizeof(initialState));
+    context->length = 0;
+    context->blockLength = 0;
+}
+
+/**
+ * @brief Hash the next piece of data.
+ * 
+ * @param context State of the calculation.
+ * @param data Binary data.
+ * @param length Length of binary data.
+ */
+void Sha256Update(Sha256Context *context, const uint8_t *data, size_t length)
+{
+    context->length += length;
+    if (context->blockLength != 0)
+    {
+        size_t part = SHA256_BLOCK_SIZE - context->blockLength;
+        part = part < length ? part : length;
+        memcpy(context->block + context->blockLength, data, part);
+        context->blockLength += (uint32_t)part;
+        data += part;
+        length -= part;
+        if (context->blockLength < SHA256_BLOCK_SIZE)
+        {
+            return;
+        }
+        Sha256Blocks(context->state, context->block, 1);
+        context->blockLength = 0;
+    }
+    if (length >= SHA256_BLOCK_SIZE)
+    {
+        Sha256Blocks(context->state, data, length / SHA256_BLOCK_SIZE);
+        data += length / SHA256_BLOCK_SIZE * SHA256_BLOCK_SIZE;
+        length %= SHA256_BLOCK_SIZE;
+    }
+    memcpy(context->block, data, length);
+    context->blockLength = (uint32_t)length;
+}
+
+/**
+ * @brief Finish a SHA-256 calculation.
+ * 
+ * @param context State of the calculation.
+ * @param digest The hash will be saved in this array.
+ */
+void Sha256Final(Sha256Context *context, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bits = context->length * 8;
+    uint8_t padding[2 * SHA256_BLOCK_SIZE] = {0x80};
+    // Pad to 56 bytes of the last block, followed by the length in bits.
+    size_t padLength = (context->blockLength < 56 ? 56 : 120) - context->blockLength;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        padding[padLength + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    Sha256Update(context, padding, padLength + 8);
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        digest[4 * i] = (uint8_t)(context->state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(context->state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(context->state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)context->state[i];
+    }
+}
+
+/**
+ * @brief Calculate the SHA-256 of a buffer.
+ * 
+ * @param data Binary data.
+ * @param length Length of binary data.
+ * @param digest The hash will be saved in this array.
+ */
+void Sha256(const uint8_t *data, size_t length, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    Sha256Context context;
+    Sha256Init(&context);
+    Sha256Update(&context, data, length);
+    Sha256Final(&context, digest);
+}
@@ -0,0 +1,33 @@
+#ifndef SHA256_H
+#define SHA256_H
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+/**
+ * @brief State of a SHA-256 calculation over data passed in pieces.
+ * 
+ */
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length;                  // Bytes hashed so far.
+    uint8_t block[SHA256_BLOCK_SIZE]; // Bytes of an incomplete block.
+    uint32_t blockLength;
+} Sha256Context;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void Sha256Init(Sha256Context *context);
+void Sha256Update(Sha256Context *context, const uint8_t *data, size_t length);
+void Sha256Final(Sha256Context *context, uint8_t digest[SHA256_DIGEST_SIZE]);
+void Sha256(const uint8_t *data, size_t length, uint8_t digest[SHA256_DIGEST_SIZE]);
+uint8_t Sha256Accelerated(void);
+void Sha256SetAcceleration(uint8_t enable);
+#ifdef __cplusplus
+}
+#endif
+#endif
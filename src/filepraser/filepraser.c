@@ -1,7 +1,7 @@
 /**
  * @file filepraser.c
  * @author Huang Dong (dohuang@borgwarner.com)
- * @brief This file contain functions to parse the Hex or SREC file.
+ * @brief This file contain functions to parse the Hex, SREC, ELF or raw binary file.
  * @version 0.1
  * @date 2023-05-24
  * 
@@ -9,6 +9,17 @@
  * 
  */
 #include "filepraser.h"
+#include <ctype.h>
+#include <limits.h>
+#include "imagecache.h"
+
+// Text of a streamed flash file is read in chunks of at most this size.
+#define STREAM_CHUNK_MAX 0x1000000
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RECORD_SUM_SSE2 1
+#include <emmintrin.h>
+#endif
 
 /**
  * @brief This function convert a string containning hex data to a char array.
@@ -48,248 +59,1108 @@ uint8_t Uint2Array(uint32_t *targetUint, uint8_t *destinationArray)
 }
 
 /**
- * @brief This function can parse a Hex file.
+ * @brief Convert a nibble coded as an ASCII hex digit to its value.
  * 
- * @param fileName A Hex file path.
- * @param segmentsCount The amount of blocks in a Hex file will be saved in this buffer.
- * @param addressAndSize The start address and size of each block will be saved in this buffer.
- * @param checksum The crc-* checksum of each block will be saved in this buffer.
- * @return uint8_t 
+ * @param c An ASCII hex digit.
+ * @return int32_t Value of the digit, -1 if c is not a hex digit.
  */
-uint8_t HandleHex(const char *fileName, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4])
+static int32_t HexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/**
+ * @brief Convert the data field of a record to binary data.
+ * Conversion stops at the first character that is not a hex digit.
+ * 
+ * @param ascCodedHex A hex data string.
+ * @param destinationBuffer A buffer to save the result data.
+ * @param length Maximum amount of bytes to be converted.
+ * @return uint32_t Amount of bytes converted.
+ */
+static uint32_t RecordData2Buffer(const char *ascCodedHex, uint8_t *destinationBuffer, uint32_t length)
+{
+    uint32_t i;
+    for (i = 0; i < length; i++)
+    {
+        int32_t high = HexDigit(ascCodedHex[2 * i]);
+        if (high < 0)
+            break;
+        int32_t low = HexDigit(ascCodedHex[2 * i + 1]);
+        if (low < 0)
+            break;
+        destinationBuffer[i] = (uint8_t)(high << 4 | low);
+    }
+    return i;
+}
+
+/**
+ * @brief Check the format of a flash file by its first bytes.
+ * 
+ * @param fileName A flash file path.
+ * @return flashFileFormat FORMAT_UNKNOWN if the file can't be opened.
+ */
+flashFileFormat DetectFlashFileFormat(const char *fileName)
 {
     FILE *pFile;
-    FILE *tempFile = 0;
-    char string[256];
-    uint32_t extendedLinearAddress = 0x0;
-    uint32_t accumulatedAddress = 0xffffffff, startAddress;
-    char tempName[12] = "hex000"; // Temp file name.
-    *segmentsCount = 0;
-    // Start reading lines from SREC file until EOF.
-    LOG_INFO("Open Intel HEX file: %s", fileName);
-    pFile = fopen(fileName, "r");
-    LOG_INFO("Reading lines from Intel Hex file");
-    while (fscanf(pFile, "%s", string) != EOF)
-    {
-        uint32_t length, address, recordType;
-        char tempString[256];
-        sscanf(string, ":%2x%4x%2x%s", &length, &address, &recordType, tempString);
+    uint8_t magic[16];
+    size_t length, i = 0;
+    pFile = fopen(fileName, "rb");
+    if (pFile == 0)
+    {
+        LOG_ERROR("Can't open flash file: %s", fileName);
+        return FORMAT_UNKNOWN;
+    }
+    length = fread(magic, 1, sizeof(magic), pFile);
+    fclose(pFile);
+    if (length >= 4 && memcmp(magic, "\x7f" "ELF", 4) == 0)
+        return FORMAT_ELF;
+    // Text formats may start with blank lines.
+    while (i < length && (magic[i] == ' ' || magic[i] == '\t' || magic[i] == '\r' || magic[i] == '\n'))
+        i++;
+    if (i < length && magic[i] == ':')
+        return FORMAT_HEX;
+    if (i + 1 < length && magic[i] == 'S' && magic[i + 1] >= '0' && magic[i + 1] <= '9')
+        return FORMAT_SREC;
+    return FORMAT_BIN;
+}
+
+/**
+ * @brief Kinds of records in Intel HEX and SREC files.
+ * 
+ */
+typedef enum
+{
+    RECORD_OTHER,
+    RECORD_DATA,
+    RECORD_EXTENDED_ADDRESS,
+    RECORD_HEADER,
+    RECORD_END
+} recordKind;
+
+/**
+ * @brief Header fields of one record. The data field is not decoded.
+ * 
+ */
+typedef struct
+{
+    recordKind kind;
+    uint32_t address; // Address of a data record, or the new extended address.
+    uint32_t length;  // Bytes in the data field of a data record.
+    const char *data; // Data field of a data record.
+} FlashRecord;
+
+/**
+ * @brief Convert a field of hex digits to its value.
+ * 
+ * @param text The field.
+ * @param digits Amount of digits in the field, at most 8.
+ * @return int64_t Value of the field, -1 if it contains a character that is not a hex digit.
+ */
+static int64_t HexField(const char *text, uint8_t digits)
+{
+    int64_t value = 0;
+    for (uint8_t i = 0; i < digits; i++)
+    {
+        int32_t digit = HexDigit(text[i]);
+        if (digit < 0)
+            return -1;
+        value = value << 4 | digit;
+    }
+    return value;
+}
+
+/**
+ * @brief Find the next line of a text, skipping blank lines.
+ * 
+ * @param cursor Start of the remaining text, moved behind the line.
+ * @param end End of the text.
+ * @param lineEnd End of the line without trailing white space.
+ * @return const char* Start of the line, 0 at the end of the text.
+ */
+static const char *NextLine(const char **cursor, const char *end, const char **lineEnd)
+{
+    const char *line = *cursor;
+    const char *next;
+    while (line < end && isspace((unsigned char)*line))
+        line++;
+    if (line == end)
+        return 0;
+    next = (const char *)memchr(line, '\n', end - line);
+    if (next == 0)
+        next = end;
+    *cursor = next;
+    while (next > line && isspace((unsigned char)next[-1]))
+        next--;
+    *lineEnd = next;
+    return line;
+}
+
+/**
+ * @brief Sum the bytes of a field of hex digits, 8 bytes per step with SSE2.
+ * Each character is converted to its nibble, the nibbles at even positions
+ * are the high nibbles of the bytes.
+ * 
+ * @param hex The field.
+ * @param bytes Amount of bytes in the field, i.e. half the amount of digits.
+ * @return int64_t Sum of the bytes, -1 if the field contains a character that is not a hex digit.
+ */
+static int64_t HexByteSum(const char *hex, uint32_t bytes)
+{
+    int64_t sum = 0;
+    uint32_t i = 0;
+#ifdef RECORD_SUM_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums = zero;
+    for (; i + 8 <= bytes; i += 8)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *)(hex + 2 * i));
+        __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+        // Characters above 0x7F are negative, so they are neither digits nor letters.
+        __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                        _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+        __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                         _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+        if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xFFFF)
+            return -1;
+        __m128i nibbles = _mm_or_si128(_mm_and_si128(_mm_sub_epi8(c, _mm_set1_epi8('0')), isDigit),
+                                       _mm_and_si128(_mm_sub_epi8(lower, _mm_set1_epi8('a' - 10)), isLetter));
+        __m128i high = _mm_and_si128(nibbles, _mm_set1_epi16(0x00FF));
+        __m128i low = _mm_srli_epi16(nibbles, 8);
+        sums = _mm_add_epi64(sums, _mm_add_epi64(_mm_slli_epi64(_mm_sad_epu8(high, zero), 4), _mm_sad_epu8(low, zero)));
+    }
+    sum = _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+#endif
+    for (; i < bytes; i++)
+    {
+        int64_t value = HexField(hex + 2 * i, 2);
+        if (value < 0)
+            return -1;
+        sum += value;
+    }
+    return sum;
+}
+
+/**
+ * @brief Check the length and the checksum of a record. A HEX record holds
+ * the amount of data bytes, its bytes sum up to 0 modulo 256. A SREC record
+ * holds the amount of bytes after the length field, its bytes sum up to 0xFF.
+ * 
+ * @param format FORMAT_HEX or FORMAT_SREC.
+ * @param line Start of the record.
+ * @param lineEnd End of the record.
+ * @return const char* 0 if the record is valid, otherwise a description of the error.
+ */
+static const char *CheckRecord(flashFileFormat format, const char *line, const char *lineEnd)
+{
+    // Start code ':' or type 'Sn' followed by pairs of hex digits.
+    uint32_t prefix = format == FORMAT_HEX ? 1 : 2;
+    size_t digits = (size_t)(lineEnd - line) - prefix;
+    if ((size_t)(lineEnd - line) < prefix + 2 || digits % 2 != 0)
+        return "wrong length";
+    uint32_t bytes = (uint32_t)(digits / 2);
+    int64_t sum = HexByteSum(line + prefix, bytes);
+    if (sum < 0)
+        return "invalid character";
+    int64_t length = HexField(line + prefix, 2);
+    if (format == FORMAT_HEX ? bytes != length + 5 : bytes != length + 1)
+        return "wrong length";
+    if ((sum & 0xFF) != (format == FORMAT_HEX ? 0x00 : 0xFF))
+        return "wrong checksum";
+    return 0;
+}
+
+/**
+ * @brief Get the line number of a position in a text, for error messages.
+ * 
+ * @param text Start of the text.
+ * @param position A position in the text.
+ * @return uint32_t Number of the line, starting at 1.
+ */
+static uint32_t LineNumber(const char *text, const char *position)
+{
+    uint32_t number = 1;
+    while ((text = (const char *)memchr(text, '\n', (size_t)(position - text))) != 0)
+    {
+        text++;
+        number++;
+    }
+    return number;
+}
+
+/**
+ * @brief Read the header fields of a record.
+ * The length of a data record is limited to the data present in the line.
+ * 
+ * @param format FORMAT_HEX or FORMAT_SREC.
+ * @param line Start of the record.
+ * @param lineEnd End of the record.
+ * @param record The header fields will be saved here.
+ * @return uint8_t 0 if the line is a record.
+ */
+static uint8_t ReadRecord(flashFileFormat format, const char *line, const char *lineEnd, FlashRecord *record)
+{
+    int64_t length, address, recordType;
+    uint32_t available;
+    record->kind = RECORD_OTHER;
+    if (format == FORMAT_HEX)
+    {
+        // :LLAAAATT followed by data and checksum.
+        if (lineEnd - line < 9 || line[0] != ':')
+            return 1;
+        length = HexField(line + 1, 2);
+        address = HexField(line + 3, 4);
+        recordType = HexField(line + 7, 2);
+        if (length < 0 || address < 0 || recordType < 0)
+            return 1;
+        record->data = line + 9;
         switch (recordType)
         {
         case 0x00: // Data line
-            address = extendedLinearAddress + address;
-            if (address != accumulatedAddress)
-            {
-                // new segment begins. last segment ended.
-                // accumulatedAddress is initialised as 0xffffffff
-                // which means code here will not be executed when first segment begins.
-                // Save current segment's start adress.
-                if (accumulatedAddress != 0xffffffff)
-                {
-                lable1:
-                    // When a segment ended.
-                    // Close the open temp file for this segment.
-                    // All data in this segment has been written to this file.
-                    LOG_INFO("Close temp file: %s", tempName);
-                    fclose(tempFile);
-                    // Last segment's size equals to the difference of accumulatedAddress and startAddress of last segment.
-                    uint32_t size = accumulatedAddress - startAddress;
-                    // Save last segment's size to addressAndSize array.
-                    // Code here saves a uint32_t to a uint8_t array
-                    // with big endianness(Numerical data is saved as little endianness on Windows).
-                    // Uint2Array(&size, addressAndSize[(*segmentsCount)] + 7);
-                    Uint2Array(&size, addressAndSize[(*segmentsCount)] + 4);
-                    //...
-                    uint32_t crc = CalculateCrc(tempName); /* CRC value is 32bit */
-
-                    // AscCodedHex2Buffer("31010202", checksum[(*segmentsCount)]);
-                    // Uint2Array(&crc, checksum[(*segmentsCount)] + 4);
-                    Uint2Array(&crc, checksum[(*segmentsCount)]);
-                    // Print segment info to log file.
-                    LOG_INFO("Address: 0x%.8x-%.8x Size: %.8x Checksum: %.8x",
-                             startAddress, accumulatedAddress - 1, size, crc);
-
-                    LOG_INFO("Segment %d completed", *segmentsCount);
-                    
-                    if (recordType == 0x01)
-                        goto lable2;
-                    // Increase segementsCount by 1 for every segment.
-                    // Parentheses is necessary here because of high priority of ++.
-                    (*segmentsCount)++;
-                    sprintf(tempName+3,"%03.3d",*segmentsCount);
-                    // tempName[5]++;
-                }
-
-                // When new segment begins.
-                LOG_INFO("Segment %d started", *segmentsCount);
-                // Save current segment's start address to addressAndSize array.
-                // Code here saves a uint32_t to a uint8_t array
-                // with big endianness(Numerical data is saved as little endianness on Windows).
-                startAddress = address;
-                // Reset accumulated address as start address.
-                accumulatedAddress = address;
-                // AscCodedHex2Buffer("340044", addressAndSize[*segmentsCount]);
-                // Uint2Array(&address, addressAndSize[*segmentsCount] + 3);
-                Uint2Array(&address, addressAndSize[*segmentsCount]);
-                //...
-                // Open a new temp file.
-                LOG_INFO("Open temp file: %s", tempName);
-                tempFile = fopen(tempName, "w");
-            }
-            // Write the data field of a data line to temp file.
-            fprintf(tempFile, "%.*s", length * 2, tempString);
-            // Increase accumulatedAddress by (length -5)(Address and checksum in data line consume 5 bytes).
-            accumulatedAddress = address + length;
+            record->kind = RECORD_DATA;
+            record->address = (uint32_t)address;
+            record->length = (uint32_t)length;
             break;
         case 0x01: // End of File
-            goto lable1;
-        lable2:
+            record->kind = RECORD_END;
             break;
         case 0x02: // Extended Segment Address
-            sscanf(tempString, "%4x", &address);
-            extendedLinearAddress = address * 16;
-            LOG_INFO("extendedSegmentAddress :%x", extendedLinearAddress);
+        case 0x04: // Extended linear address
+            address = lineEnd - record->data >= 4 ? HexField(record->data, 4) : -1;
+            if (address < 0)
+                return 1;
+            record->kind = RECORD_EXTENDED_ADDRESS;
+            record->address = recordType == 0x02 ? (uint32_t)address * 16 : (uint32_t)address * 0x10000;
             break;
-        case 0x03: // Start Segment Address, Not used here.
+        default: // Start Segment Address and Start linear address, not used here.
             break;
-        case 0x04: // Extended linear address
-            sscanf(tempString, "%4x", &address);
-            extendedLinearAddress = address * 0x10000;
-            LOG_INFO("extendedLinearAddress :%x", extendedLinearAddress);
+        }
+    }
+    else
+    {
+        // STLL followed by address, data and checksum.
+        if (lineEnd - line < 4 || line[0] != 'S')
+            return 1;
+        recordType = HexDigit(line[1]);
+        length = HexField(line + 2, 2);
+        if (recordType < 0 || recordType > 9 || length < 0)
+            return 1;
+        switch (recordType)
+        {
+        case 0x00:
+            record->kind = RECORD_HEADER;
+            break;
+        case 0x01:
+        case 0x02:
+        case 0x03:
+            // Address field has recordType + 1 bytes.
+            if (lineEnd - line < 4 + 2 * (recordType + 1) || length < recordType + 2)
+                return 1;
+            address = HexField(line + 4, (uint8_t)(2 * (recordType + 1)));
+            if (address < 0)
+                return 1;
+            record->kind = RECORD_DATA;
+            record->address = (uint32_t)address;
+            record->data = line + 4 + 2 * (recordType + 1);
+            // Length field counts address, data and checksum(1 byte).
+            record->length = (uint32_t)(length - recordType - 2);
             break;
-        case 0x05: // Start linear address
+        case 0x07:
+        case 0x08:
+        case 0x09:
+            record->kind = RECORD_END;
             break;
         default:
             break;
         }
     }
-    LOG_INFO("Close Intel HEX file: %s", fileName);
-    fclose(pFile);
+    if (record->kind == RECORD_DATA)
+    {
+        available = (uint32_t)((lineEnd - record->data) / 2);
+        if (record->length > available)
+            record->length = available;
+    }
     return 0;
 }
 
 /**
- * @brief This function can parse a SREC file.
+ * @brief Build the segment table of a Intel HEX or SREC file by scanning
+ * the record headers. The segments get their address, size and the
+ * range of their records in the text, data stays 0 until DecodeFlashSegment.
+ * The length and the checksum of every record are verified on the way.
  * 
- * @param fileName A SREC file path.
- * @param segmentsCount The amount of blocks in a Hex file will be saved in this buffer.
- * @param addressAndSize The start address and size of each block will be saved in this buffer.
- * @param checksum The crc-* checksum of each block will be saved in this buffer.
- * @return uint8_t 
+ * @param text Content of the flash file.
+ * @param length Length of the content.
+ * @param format FORMAT_HEX or FORMAT_SREC.
+ * @param image The segment table will be saved in this image.
+ * @return uint8_t 0 on success, 1 if a record is corrupted.
  */
-uint8_t HandleSREC(const char *fileName, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4])
+uint8_t IndexFlashText(const char *text, size_t length, flashFileFormat format, FlashImage *image)
 {
-    FILE *tempFile = 0, *pFile;
-    char string[256];
-    uint32_t accumulatedAddress = 0xffffffff, startAddress;
-    char tempName[12] = "hex000"; // Temp file name.
-    *segmentsCount = 0;
-    // Start reading lines from SREC file until EOF.
-    LOG_INFO("Open SREC file: %s", fileName);
-    pFile = fopen(fileName, "r");
-    LOG_INFO("Reading lines from SREC file %s",fileName);
-    while (fscanf(pFile, "%s", string) != EOF)
-    {
-        uint32_t address, length, recordType; // Save length in the data line.
-        char tempString[255];                 // String buffer to save data read from a line.
-        // Get address, length and data field from a data line.
-        sscanf(string, "S%1x%2x", &recordType, &length);
-        switch (recordType)
+    const char *cursor = text;
+    const char *end = text + length;
+    const char *line, *lineEnd;
+    FlashSegment *segment = 0;
+    FlashRecord record;
+    size_t stop = length;
+    uint32_t extendedAddress = 0x0;
+    uint32_t accumulatedAddress = 0xffffffff;
+    ImageClear(image);
+    while ((line = NextLine(&cursor, end, &lineEnd)) != 0)
+    {
+        // Every record is verified here, so a corrupted file fails to open.
+        const char *error = line[0] == (format == FORMAT_HEX ? ':' : 'S') ? CheckRecord(format, line, lineEnd) : 0;
+        if (error != 0)
         {
-        case 0x00:
-            LOG_INFO("First line: %s", string);
+            uint8_t addressKnown = ReadRecord(format, line, lineEnd, &record) == 0 && record.kind == RECORD_DATA;
+            LOG_ERROR("Corrupted record in line %u at address 0x%.8x: %s", LineNumber(text, line),
+                      addressKnown ? record.address + extendedAddress : accumulatedAddress, error);
+            ImageClear(image);
+            return 1;
+        }
+        if (ReadRecord(format, line, lineEnd, &record) != 0)
+            continue;
+        if (record.kind == RECORD_END)
+        {
+            stop = line - text;
             break;
-        case 0x01:
-        case 0x02:
-        case 0x03:
-            if (recordType == 0x1)
+        }
+        switch (record.kind)
+        {
+        case RECORD_DATA:
+            record.address += extendedAddress;
+            if (record.address != accumulatedAddress)
             {
-                sscanf(string, "S%*1x%*2x%4x%s", &address, tempString);
+                // new segment begins. last segment ended.
+                // accumulatedAddress is initialised as 0xffffffff
+                // so the first data line always begins a segment.
+                LOG_INFO("Segment %d started", image->count);
+                if (segment != 0)
+                    segment->sourceEnd = line - text;
+                segment = ImageAddSegment(image, record.address);
+                if (segment == 0)
+                    return 1;
+                segment->sourceOffset = line - text;
             }
-            else if (recordType == 0x2)
+            segment->size += record.length;
+            // Increase accumulatedAddress by length of data field.
+            accumulatedAddress = record.address + record.length;
+            break;
+        case RECORD_EXTENDED_ADDRESS:
+            extendedAddress = record.address;
+            LOG_DEBUG("extendedAddress :%x", extendedAddress);
+            break;
+        case RECORD_HEADER:
+            LOG_INFO("First line: %.*s", (int)(lineEnd - line), line);
+            break;
+        default:
+            break;
+        }
+    }
+    if (segment != 0)
+        segment->sourceEnd = stop;
+    return 0;
+}
+
+/**
+ * @brief Decode the data of a segment indexed by IndexFlashText.
+ * Each segment can be decoded independently, in any order. The data is
+ * allocated from the arena of the image, so only one thread at a time
+ * decodes the segments of an image.
+ * 
+ * @param text Content of the flash file passed to IndexFlashText.
+ * @param format FORMAT_HEX or FORMAT_SREC.
+ * @param image The image of the segment.
+ * @param segment The segment to be decoded.
+ * @return uint8_t 0 on success.
+ */
+uint8_t DecodeFlashSegment(const char *text, flashFileFormat format, FlashImage *image, FlashSegment *segment)
+{
+    const char *cursor = text + segment->sourceOffset;
+    const char *end = text + segment->sourceEnd;
+    const char *line, *lineEnd;
+    FlashRecord record;
+    uint32_t offset = 0;
+    uint64_t start = TraceTimestamp();
+    uint8_t *data = (uint8_t *)ArenaAlloc(&image->arena, segment->size);
+    if (data == 0)
+    {
+        LOG_ERROR("Out of memory when decoding segment at 0x%.8x", segment->address);
+        return 1;
+    }
+    // All data records in the range of the segment are contiguous.
+    while ((line = NextLine(&cursor, end, &lineEnd)) != 0 && offset < segment->size)
+    {
+        if (ReadRecord(format, line, lineEnd, &record) != 0 || record.kind != RECORD_DATA)
+            continue;
+        if (record.length > segment->size - offset)
+            record.length = segment->size - offset;
+        uint32_t decoded = RecordData2Buffer(record.data, data + offset, record.length);
+        if (decoded < record.length)
+        {
+            LOG_ERROR("Invalid data at address 0x%.8x", segment->address + offset + decoded);
+            memset(data + offset + decoded, 0xff, record.length - decoded);
+        }
+        offset += record.length;
+    }
+    segment->data = data;
+    segment->capacity = segment->size;
+    TRACE_SPAN(start, "Decode segment at 0x%.8x, %u bytes", segment->address, segment->size);
+    return 0;
+}
+
+/**
+ * @brief Parse a Intel HEX or SREC file into an image.
+ * The file is mapped, indexed and then all segments are decoded.
+ * 
+ * @param fileName A flash file path.
+ * @param format FORMAT_HEX or FORMAT_SREC.
+ * @param formatName Name of the format for logging.
+ * @param image The segments of the file will be saved in this image.
+ * @return uint8_t 0 on success.
+ */
+static uint8_t ParseFlashText(const char *fileName, flashFileFormat format, const char *formatName, FlashImage *image)
+{
+    size_t length;
+    uint8_t result;
+    const char *text;
+    ImageClear(image);
+    LOG_INFO("Open %s file: %s", formatName, fileName);
+    text = (const char *)MapFile(fileName, &length);
+    if (text == 0)
+    {
+        // An empty file can't be mapped and has no segments.
+        FILE *pFile = fopen(fileName, "rb");
+        if (pFile == 0)
+        {
+            LOG_ERROR("Can't open %s file: %s", formatName, fileName);
+            return 1;
+        }
+        fclose(pFile);
+        return 0;
+    }
+    LOG_INFO("Reading lines from %s file", formatName);
+    result = IndexFlashText(text, length, format, image);
+    for (uint32_t i = 0; result == 0 && i < image->count; i++)
+    {
+        result = DecodeFlashSegment(text, format, image, &image->segments[i]);
+    }
+    LOG_INFO("Close %s file: %s", formatName, fileName);
+    UnmapFile((void *)text, length);
+    return result;
+}
+
+/**
+ * @brief This function can parse a Hex file into an image.
+ * 
+ * @param fileName A Hex file path.
+ * @param image The segments of the Hex file will be saved in this image.
+ * @return uint8_t 0 on success.
+ */
+uint8_t ParseHex(const char *fileName, FlashImage *image)
+{
+    return ParseFlashText(fileName, FORMAT_HEX, "Intel HEX", image);
+}
+
+/**
+ * @brief This function can parse a SREC file into an image.
+ * 
+ * @param fileName A SREC file path.
+ * @param image The segments of the SREC file will be saved in this image.
+ * @return uint8_t 0 on success.
+ */
+uint8_t ParseSREC(const char *fileName, FlashImage *image)
+{
+    return ParseFlashText(fileName, FORMAT_SREC, "SREC", image);
+}
+
+/**
+ * @brief Checksums of the segment being streamed, fed record by record.
+ * 
+ */
+typedef struct
+{
+    const CrcProfile *profile; // Profile of the checksum, 0 if no crcspec is loaded.
+    const CrcDigestSet *digests;
+    uint8_t sha256;
+    CrcProfileState checksum;
+    CrcProfileState states[CRC_DIGESTS_MAX];
+    Sha256Context context;
+    Sha256Context imageContext; // SHA-256 of the data of all segments in order.
+} StreamDigests;
+
+static void StreamDigestsStart(StreamDigests *stream)
+{
+    uint32_t count = stream->digests != 0 ? stream->digests->count : 0;
+    if (stream->profile != 0)
+        CrcProfileStart(stream->profile, &stream->checksum);
+    for (uint32_t i = 0; i < count; i++)
+        CrcProfileStart(stream->digests->profiles[i], &stream->states[i]);
+    if (stream->sha256)
+        Sha256Init(&stream->context);
+}
+
+static void StreamDigestsUpdate(StreamDigests *stream, const uint8_t *data, uint32_t length)
+{
+    uint32_t count = stream->digests != 0 ? stream->digests->count : 0;
+    if (stream->profile != 0)
+        CrcProfileUpdate(stream->profile, &stream->checksum, data, length);
+    for (uint32_t i = 0; i < count; i++)
+        CrcProfileUpdate(stream->digests->profiles[i], &stream->states[i], data, length);
+    if (stream->sha256)
+    {
+        Sha256Update(&stream->context, data, length);
+        Sha256Update(&stream->imageContext, data, length);
+    }
+}
+
+/**
+ * @brief Save the checksums of a streamed segment, aligned like the
+ * checksums calculated from decoded data.
+ * 
+ * @param stream Checksums fed with all data of the segment.
+ * @param segment The segment.
+ */
+static void StreamDigestsFinish(StreamDigests *stream, FlashSegment *segment)
+{
+    uint32_t count = stream->digests != 0 ? stream->digests->count : 0;
+    if (stream->profile != 0)
+    {
+        uint8_t bytes = (uint8_t)((stream->profile->bits + 7) / 8);
+        uint64_t crc = CrcProfileFinish(stream->profile, &stream->checksum) << (64 - 8 * bytes);
+        segment->checksum = (uint32_t)(crc >> 32);
+        segment->checksumExtension = (uint32_t)crc;
+    }
+    for (uint32_t i = 0; i < count; i++)
+        segment->digests[i] = CrcProfileFinish(stream->digests->profiles[i], &stream->states[i])
+                              << (64 - 8 * stream->digests->bytes[i]);
+    if (stream->sha256)
+        Sha256Final(&stream->context, segment->sha256);
+}
+
+/**
+ * @brief Read the records of a Intel HEX or SREC file chunk by chunk, build
+ * the segment table and feed the decoded data to the spill and the checksums.
+ * 
+ * @param pFile The open flash file.
+ * @param text Buffer of chunkSize bytes for the text of the file.
+ * @param chunkSize Bytes read at a time, longer than any line.
+ * @param format FORMAT_HEX or FORMAT_SREC.
+ * @param stream Checksums of the segments.
+ * @param image The segment table will be saved in this image, its spill is written.
+ * @return uint8_t 0 on success, 1 if a record is corrupted or the spill can't be written.
+ */
+static uint8_t StreamFlashRecords(FILE *pFile, char *text, uint32_t chunkSize, flashFileFormat format,
+                                  StreamDigests *stream, FlashImage *image)
+{
+    FlashSegment *segment = 0;
+    FlashRecord record;
+    uint8_t data[256];
+    uint8_t done = 0;
+    uint64_t chunkOffset = 0; // Offset of the start of the text buffer in the file.
+    uint64_t stop = 0;        // End of the records of the last segment.
+    uint32_t lines = 0;       // Lines before the text buffer.
+    size_t kept = 0;          // Bytes of an incomplete line kept at the start of the text buffer.
+    uint32_t extendedAddress = 0x0;
+    uint32_t accumulatedAddress = 0xffffffff;
+    while (!done)
+    {
+        size_t length = kept + fread(text + kept, 1, chunkSize - kept, pFile);
+        const char *end = text + length;
+        const char *cursor = text;
+        const char *line, *lineEnd;
+        stop = chunkOffset + length;
+        if (length < chunkSize)
+        {
+            // The rest of the file is in the buffer.
+            done = 1;
+        }
+        else
+        {
+            // Only complete lines are parsed, the incomplete last line is kept for the next chunk.
+            while (end > text && end[-1] != '\n')
+                end--;
+            if (end == text)
             {
-                sscanf(string, "S%*1x%*2x%6x%s", &address, tempString);
+                LOG_ERROR("Line %u is longer than %u bytes", lines + 1, chunkSize);
+                return 1;
             }
-            else if (recordType == 0x3)
+        }
+        while ((line = NextLine(&cursor, end, &lineEnd)) != 0)
+        {
+            const char *error = line[0] == (format == FORMAT_HEX ? ':' : 'S') ? CheckRecord(format, line, lineEnd) : 0;
+            if (error != 0)
             {
-                sscanf(string, "S%*1x%*2x%8x%s", &address, tempString);
+                uint8_t addressKnown = ReadRecord(format, line, lineEnd, &record) == 0 && record.kind == RECORD_DATA;
+                LOG_ERROR("Corrupted record in line %u at address 0x%.8x: %s", lines + LineNumber(text, line),
+                          addressKnown ? record.address + extendedAddress : accumulatedAddress, error);
+                return 1;
             }
-            if (address != accumulatedAddress)
+            if (ReadRecord(format, line, lineEnd, &record) != 0)
+                continue;
+            if (record.kind == RECORD_END)
             {
-                // new segment begins. last segment ended.
-                // accumulatedAddress is initialised as 0xffffffff
-                // which means code here will not be executed when first segment begins.
-                // Save current segment's start adress.
-                if (accumulatedAddress != 0xffffffff)
+                stop = chunkOffset + (uint64_t)(line - text);
+                done = 1;
+                break;
+            }
+            switch (record.kind)
+            {
+            case RECORD_DATA:
+                record.address += extendedAddress;
+                if (record.address != accumulatedAddress)
                 {
-                lable1:
-                    // When a segment ended.
-                    // Close the open temp file for this segment.
-                    // All data in this segment has been written to this file.
-                    LOG_INFO("Close temp file: %s", tempName);
-                    fclose(tempFile);
-                    // Last segment's size equals to the difference of accumulatedAddress and startAddress of last segment.
-                    uint32_t size = accumulatedAddress - startAddress;
-                    // Save last segment's size to addressAndSize array.
-                    // Code here saves a uint32_t to a uint8_t array
-                    // with big endianness(Numerical data is saved as little endianness on Windows).
-                    // Uint2Array(&size, addressAndSize[(*segmentsCount)] + 7);
-                    Uint2Array(&size, addressAndSize[(*segmentsCount)] + 4);
-                    //...
-                    uint32_t crc = CalculateCrc(tempName); /* CRC value is 32bit */
-
-                    // AscCodedHex2Buffer("31010202", checksum[(*segmentsCount)]);
-                    // Uint2Array(&crc, checksum[(*segmentsCount)] + 4);
-                    Uint2Array(&crc, checksum[(*segmentsCount)]);
-                    // Print segment info to log file.
-                    LOG_INFO("Address: 0x%.8x-%.8x Size: %.8x Checksum: %.8x",
-                             startAddress, accumulatedAddress - 1, size, crc);
-
-                    LOG_INFO("Segment %d completed", *segmentsCount);
-
-                    if (recordType == 0x07 ||
-                        recordType == 0x08 ||
-                        recordType == 0x09)
-                        goto lable2;
-                    // Increase segementsCount by 1 for every segment.
-                    // Parentheses is necessary here because of high priority of ++.
-                    (*segmentsCount)++;
-                    sprintf(tempName+3,"%03.3d",*segmentsCount);
-                    // tempName[5]++;
+                    LOG_INFO("Segment %d started", image->count);
+                    if (segment != 0)
+                    {
+                        segment->sourceEnd = chunkOffset + (uint64_t)(line - text);
+                        StreamDigestsFinish(stream, segment);
+                    }
+                    segment = ImageAddSegment(image, record.address);
+                    if (segment == 0 || SpillAddSegment(image->spill) != 0)
+                        return 1;
+                    segment->sourceOffset = chunkOffset + (uint64_t)(line - text);
+                    StreamDigestsStart(stream);
                 }
+                // Records are verified, so all of the data is decoded.
+                RecordData2Buffer(record.data, data, record.length);
+                if (SpillWrite(image->spill, data, record.length) != 0)
+                    return 1;
+                StreamDigestsUpdate(stream, data, record.length);
+                segment->size += record.length;
+                accumulatedAddress = record.address + record.length;
+                break;
+            case RECORD_EXTENDED_ADDRESS:
+                extendedAddress = record.address;
+                LOG_DEBUG("extendedAddress :%x", extendedAddress);
+                break;
+            case RECORD_HEADER:
+                LOG_INFO("First line: %.*s", (int)(lineEnd - line), line);
+                break;
+            default:
+                break;
+            }
+        }
+        lines += LineNumber(text, end) - 1;
+        kept = (size_t)(text + length - end);
+        memmove(text, end, kept);
+        chunkOffset += (uint64_t)(end - text);
+    }
+    if (segment != 0)
+    {
+        segment->sourceEnd = stop;
+        StreamDigestsFinish(stream, segment);
+    }
+    return ferror(pFile) != 0;
+}
+
+/**
+ * @brief Parse a Intel HEX or SREC file of any size with bounded memory.
+ * The file is read in chunks and each record is decoded, checksummed and
+ * written to a binary spill file in one pass. Only the segment table, the
+ * chunk of text and a window of the spill stay in memory. Segment data is 0,
+ * it is read through image->spill, e.g. sequentially while it is transferred.
+ * The checksums of the selected CRC profile and of the digest set and the
+ * SHA-256 digests are valid afterwards, as if the image had been checksummed.
+ * 
+ * @param fileName A flash file path.
+ * @param format FORMAT_HEX or FORMAT_SREC.
+ * @param ceiling Bytes of the chunk of text and of the window together, at least STREAM_CEILING_MIN.
+ * @param spillName Path of the spill file, removed when the image is cleared.
+ * @param digests CRC algorithms of the digest set, 0 for none.
+ * @param sha256 1 to calculate the SHA-256 digests as well.
+ * @param image The segment table of the file will be saved in this image.
+ * @return uint8_t 0 on success.
+ */
+uint8_t StreamFlashText(const char *fileName, flashFileFormat format, uint32_t ceiling, const char *spillName,
+                        const CrcDigestSet *digests, uint8_t sha256, FlashImage *image)
+{
+    StreamDigests stream;
+    uint8_t result = 1;
+    if (ceiling < STREAM_CEILING_MIN)
+    {
+        ceiling = STREAM_CEILING_MIN;
+    }
+    uint32_t chunkSize = ceiling / 2 < STREAM_CHUNK_MAX ? ceiling / 2 : STREAM_CHUNK_MAX;
+    ImageClear(image);
+    stream.profile = GetCrcProfile();
+    stream.digests = digests;
+    stream.sha256 = sha256;
+    if (sha256)
+    {
+        Sha256Init(&stream.imageContext);
+    }
+    LOG_INFO("Stream flash file: %s, memory ceiling %u bytes", fileName, ceiling);
+    FILE *pFile = fopen(fileName, "rb");
+    char *text = (char *)malloc(chunkSize);
+    image->spill = (FlashSpill *)calloc(1, sizeof(FlashSpill));
+    if (pFile == 0 || text == 0 || image->spill == 0)
+    {
+        LOG_ERROR("Can't stream flash file: %s", fileName);
+    }
+    else if (SpillOpen(image->spill, spillName, ceiling - chunkSize) == 0)
+    {
+        result = StreamFlashRecords(pFile, text, chunkSize, format, &stream, image);
+        result = result != 0 || SpillFinish(image->spill) != 0;
+    }
+    if (result == 0)
+    {
+        if (sha256)
+        {
+            Sha256Final(&stream.imageContext, image->sha256);
+        }
+        image->checksumsValid = 1;
+        image->sha256Valid = sha256;
+    }
+    else
+    {
+        ImageClear(image);
+    }
+    if (pFile != 0)
+    {
+        fclose(pFile);
+    }
+    free(text);
+    LOG_INFO("Streamed %u segments of %s", image->count, fileName);
+    return result;
+}
+
+/**
+ * @brief Read an unsigned field of an ELF header.
+ * 
+ * @param field Pointer to the field.
+ * @param size Size of the field in bytes.
+ * @param bigEndian 1 if the ELF file is big endian.
+ * @return uint64_t Value of the field.
+ */
+static uint64_t ElfField(const uint8_t *field, uint8_t size, uint8_t bigEndian)
+{
+    uint64_t value = 0;
+    for (uint8_t i = 0; i < size; i++)
+    {
+        value |= (uint64_t)field[bigEndian ? i : size - 1 - i] << (8 * (size - 1 - i));
+    }
+    return value;
+}
 
-                // When new segment begins.
-                LOG_INFO("Segment %d started", *segmentsCount);
-                // Save current segment's start address to addressAndSize array.
-                // Code here saves a uint32_t to a uint8_t array
-                // with big endianness(Numerical data is saved as little endianness on Windows).
-                startAddress = address;
-                // Reset accumulated address as start address.
-                accumulatedAddress = address;
-                // AscCodedHex2Buffer("340044", addressAndSize[*segmentsCount]);
-                // Uint2Array(&address, addressAndSize[*segmentsCount] + 3);
-                Uint2Array(&address, addressAndSize[*segmentsCount]);
-                //...
-                // Open a new temp file.
-                LOG_INFO("Open temp file: %s", tempName);
-                tempFile = fopen(tempName, "w");
+/**
+ * @brief This function can parse an ELF32 or ELF64 file.
+ * Each PT_LOAD program header with file content becomes a segment
+ * located at its physical address. Adjacent program headers are merged.
+ * 
+ * @param fileName An ELF file path.
+ * @param image The segments of the ELF file will be saved in this image.
+ * @return uint8_t 0 on success.
+ */
+uint8_t ParseElf(const char *fileName, FlashImage *image)
+{
+    FILE *pFile;
+    FlashSegment *segment = 0;
+    uint8_t header[64];
+    uint8_t programHeader[56];
+    uint64_t accumulatedAddress = 0xffffffffffffffff;
+    ImageClear(image);
+    LOG_INFO("Open ELF file: %s", fileName);
+    pFile = fopen(fileName, "rb");
+    if (pFile == 0)
+    {
+        LOG_ERROR("Can't open ELF file: %s", fileName);
+        return 1;
+    }
+    if (fread(header, 1, 52, pFile) != 52 || memcmp(header, "\x7f" "ELF", 4) != 0 ||
+        (header[4] != 1 && header[4] != 2))
+    {
+        LOG_ERROR("Invalid ELF header");
+        fclose(pFile);
+        return 1;
+    }
+    // header[4] is 1 for ELF32 and 2 for ELF64. header[5] is 2 for big endian.
+    uint8_t elf64 = header[4] == 2;
+    uint8_t bigEndian = header[5] == 2;
+    if (elf64 && fread(header + 52, 1, 12, pFile) != 12)
+    {
+        LOG_ERROR("Invalid ELF header");
+        fclose(pFile);
+        return 1;
+    }
+    uint64_t programHeaderOffset = elf64 ? ElfField(header + 32, 8, bigEndian) : ElfField(header + 28, 4, bigEndian);
+    uint32_t programHeaderSize = (uint32_t)ElfField(header + (elf64 ? 54 : 42), 2, bigEndian);
+    uint32_t programHeaderCount = (uint32_t)ElfField(header + (elf64 ? 56 : 44), 2, bigEndian);
+    LOG_INFO("ELF%d %s endian, %d program headers", elf64 ? 64 : 32, bigEndian ? "big" : "little", programHeaderCount);
+    if (programHeaderSize < (elf64 ? 56u : 32u))
+    {
+        LOG_ERROR("Invalid ELF program header size: %d", programHeaderSize);
+        fclose(pFile);
+        return 1;
+    }
+    for (uint32_t i = 0; i < programHeaderCount; i++)
+    {
+        uint64_t type, offset, address, size;
+        uint64_t headerOffset = programHeaderOffset + (uint64_t)i * programHeaderSize;
+        // fseek takes a long, which is 32 bits on Windows.
+        if (headerOffset > LONG_MAX || fseek(pFile, (long)headerOffset, SEEK_SET) != 0 ||
+            fread(programHeader, 1, elf64 ? 56 : 32, pFile) != (elf64 ? 56u : 32u))
+        {
+            LOG_ERROR("Can't read ELF program header %d", i);
+            fclose(pFile);
+            return 1;
+        }
+        type = ElfField(programHeader, 4, bigEndian);
+        offset = elf64 ? ElfField(programHeader + 8, 8, bigEndian) : ElfField(programHeader + 4, 4, bigEndian);
+        address = elf64 ? ElfField(programHeader + 24, 8, bigEndian) : ElfField(programHeader + 12, 4, bigEndian);
+        size = elf64 ? ElfField(programHeader + 32, 8, bigEndian) : ElfField(programHeader + 16, 4, bigEndian);
+        // Only PT_LOAD(1) with file content is flashed. .bss like segments have no file content.
+        if (type != 1 || size == 0)
+            continue;
+        LOG_INFO("PT_LOAD offset: 0x%.8x physical address: 0x%.8x size: 0x%.8x",
+                 (uint32_t)offset, (uint32_t)address, (uint32_t)size);
+        // Checked each before the sum, which may wrap around for ELF64.
+        if (size > UINT32_MAX || address > UINT32_MAX || address + size > 0x100000000)
+        {
+            LOG_ERROR("PT_LOAD exceeds 32bit address space");
+            fclose(pFile);
+            return 1;
+        }
+        if (address != accumulatedAddress)
+        {
+            LOG_INFO("Segment %d started", image->count);
+            segment = ImageAddSegment(image, (uint32_t)address);
+            if (segment == 0)
+            {
+                fclose(pFile);
+                return 1;
             }
-            // Write the data field of a data line to temp file.
-            fprintf(tempFile, "%.*s", length * 2 - 2 * (recordType + 2), tempString);
-            // Increase accumulatedAddress by (length -5)(Address and checksum in data line consume 5 bytes).
-            accumulatedAddress = address + length - (recordType + 2);
-            break;
-        case 0x07:
-        case 0x08:
-        case 0x09:
-            goto lable1;
-        lable2:
-            break;
-        default:
-            break;
         }
+        if (offset > LONG_MAX)
+        {
+            LOG_ERROR("PT_LOAD offset 0x%.16llx exceeds the file size supported", (unsigned long long)offset);
+            fclose(pFile);
+            return 1;
+        }
+        uint8_t *data = SegmentExtend(image, segment, (uint32_t)size);
+        if (data == 0 || fseek(pFile, (long)offset, SEEK_SET) != 0 ||
+            fread(data, 1, (size_t)size, pFile) != size)
+        {
+            LOG_ERROR("Can't read PT_LOAD content at offset 0x%.8x", (uint32_t)offset);
+            fclose(pFile);
+            return 1;
+        }
+        accumulatedAddress = address + size;
+    }
+    LOG_INFO("Close ELF file: %s", fileName);
+    fclose(pFile);
+    return 0;
+}
+
+/**
+ * @brief This function can load a raw binary file as a single segment.
+ * 
+ * @param fileName A binary file path.
+ * @param baseAddress Address of the first byte in the file.
+ * @param image The segment of the binary file will be saved in this image.
+ * @return uint8_t 0 on success.
+ */
+uint8_t ParseBin(const char *fileName, uint32_t baseAddress, FlashImage *image)
+{
+    FILE *pFile;
+    long size;
+    ImageClear(image);
+    LOG_INFO("Open binary file: %s", fileName);
+    pFile = fopen(fileName, "rb");
+    if (pFile == 0)
+    {
+        LOG_ERROR("Can't open binary file: %s", fileName);
+        return 1;
     }
-    LOG_INFO("Close SREC file: %s", fileName);
+    if (fseek(pFile, 0, SEEK_END) != 0 || (size = ftell(pFile)) < 0 || fseek(pFile, 0, SEEK_SET) != 0)
+    {
+        LOG_ERROR("Can't get the size of binary file: %s", fileName);
+        fclose(pFile);
+        return 1;
+    }
+    if ((uint64_t)size > UINT32_MAX - baseAddress)
+    {
+        LOG_ERROR("Binary file of 0x%llx bytes exceeds 32bit address space at 0x%.8x", (unsigned long long)size, baseAddress);
+        fclose(pFile);
+        return 1;
+    }
+    LOG_INFO("Base address: 0x%.8x Size: %.8x", baseAddress, (uint32_t)size);
+    if (size > 0)
+    {
+        FlashSegment *segment = ImageAddSegment(image, baseAddress);
+        uint8_t *data = segment ? SegmentExtend(image, segment, (uint32_t)size) : 0;
+        if (data == 0 || fread(data, 1, (size_t)size, pFile) != (size_t)size)
+        {
+            LOG_ERROR("Can't read binary file: %s", fileName);
+            fclose(pFile);
+            return 1;
+        }
+    }
+    LOG_INFO("Close binary file: %s", fileName);
     fclose(pFile);
     return 0;
 }
+
+/**
+ * @brief This function can parse a Hex file.
+ * 
+ * @param fileName A Hex file path.
+ * @param segmentsCount The amount of blocks in a Hex file will be saved in this buffer.
+ * @param addressAndSize The start address and size of each block will be saved in this buffer.
+ * @param checksum The crc-* checksum of each block will be saved in this buffer.
+ * @return uint8_t 
+ */
+uint8_t HandleHex(const char *fileName, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4])
+{
+    *segmentsCount = 0;
+    if (ParseHex(fileName, &flashImage) != 0)
+        return 1;
+    return ImageExport(&flashImage, segmentsCount, addressAndSize, checksum);
+}
+
+/**
+ * @brief This function can parse a SREC file.
+ * 
+ * @param fileName A SREC file path.
+ * @param segmentsCount The amount of blocks in a Hex file will be saved in this buffer.
+ * @param addressAndSize The start address and size of each block will be saved in this buffer.
+ * @param checksum The crc-* checksum of each block will be saved in this buffer.
+ * @return uint8_t 
+ */
+uint8_t HandleSREC(const char *fileName, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4])
+{
+    *segmentsCount = 0;
+    if (ParseSREC(fileName, &flashImage) != 0)
+        return 1;
+    return ImageExport(&flashImage, segmentsCount, addressAndSize, checksum);
+}
+
+/**
+ * @brief This function can parse an ELF32 or ELF64 file.
+ * 
+ * @param fileName An ELF file path.
+ * @param segmentsCount The amount of blocks in an ELF file will be saved in this buffer.
+ * @param addressAndSize The start address and size of each block will be saved in this buffer.
+ * @param checksum The crc-* checksum of each block will be saved in this buffer.
+ * @return uint8_t 
+ */
+uint8_t HandleElf(const char *fileName, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4])
+{
+    *segmentsCount = 0;
+    if (ParseElf(fileName, &flashImage) != 0)
+        return 1;
+    return ImageExport(&flashImage, segmentsCount, addressAndSize, checksum);
+}
+
+/**
+ * @brief This function can load a raw binary file as a single segment.
+ * 
+ * @param fileName A binary file path.
+ * @param baseAddress Address of the first byte in the file.
+ * @param segmentsCount The index of the last block will be saved in this buffer.
+ * @param addressAndSize The start address and size of the block will be saved in this buffer.
+ * @param checksum The crc-* checksum of the block will be saved in this buffer.
+ * @return uint8_t 
+ */
+uint8_t HandleBin(const char *fileName, uint32_t baseAddress, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4])
+{
+    *segmentsCount = 0;
+    if (ParseBin(fileName, baseAddress, &flashImage) != 0)
+        return 1;
+    return ImageExport(&flashImage, segmentsCount, addressAndSize, checksum);
+}
+
+/**
+ * @brief Write an Intel HEX record with its checksum.
+ * The record is formatted into a line buffer and written at once.
+ * 
+ * @param pFile The HEX file.
+ * @param type Record type.
+ * @param address 16 bit address field.
+ * @param data Data of the record.
+ * @param length Amount of data bytes, up to 255.
+ */
+static void WriteHexRecord(FILE *pFile, uint8_t type, uint16_t address, const uint8_t *data, uint8_t length)
+{
+    static const char hexDigits[] = "0123456789ABCDEF";
+    char line[1 + 2 * (4 + 255 + 1) + 1];
+    uint8_t header[4] = {length, (uint8_t)(address >> 8), (uint8_t)address, type};
+    uint8_t sum = 0;
+    char *c = line;
+    *c++ = ':';
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        *c++ = hexDigits[header[i] >> 4];
+        *c++ = hexDigits[header[i] & 0xF];
+        sum += header[i];
+    }
+    for (uint32_t i = 0; i < length; i++)
+    {
+        *c++ = hexDigits[data[i] >> 4];
+        *c++ = hexDigits[data[i] & 0xF];
+        sum += data[i];
+    }
+    sum = (uint8_t)(0x100 - sum);
+    *c++ = hexDigits[sum >> 4];
+    *c++ = hexDigits[sum & 0xF];
+    *c++ = '\n';
+    fwrite(line, 1, (size_t)(c - line), pFile);
+}
+
+/**
+ * @brief Write an image to an Intel HEX file with 32 bytes per data record.
+ * An extended linear address record starts each segment and each 64 KB
+ * page a record crosses into.
+ * 
+ * @param fileName The HEX file to be written.
+ * @param image The image to be written.
+ * @return uint8_t 0 on success.
+ */
+uint8_t WriteHex(const char *fileName, const FlashImage *image)
+{
+    FILE *pFile = fopen(fileName, "w");
+    uint8_t failed;
+    if (pFile == 0)
+    {
+        LOG_ERROR("Can't create Hex file: %s", fileName);
+        return 1;
+    }
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        const FlashSegment *segment = &image->segments[i];
+        uint32_t page = 0xFFFFFFFF;
+        for (uint32_t offset = 0; offset < segment->size;)
+        {
+            uint32_t address = segment->address + offset;
+            uint32_t length = segment->size - offset;
+            if (length > 32)
+                length = 32;
+            // A record must not cross a 64 KB page.
+            if (length > 0x10000 - (address & 0xFFFF))
+                length = 0x10000 - (address & 0xFFFF);
+            if (address >> 16 != page)
+            {
+                uint8_t upper[2] = {(uint8_t)(address >> 24), (uint8_t)(address >> 16)};
+                page = address >> 16;
+                WriteHexRecord(pFile, 0x04, 0, upper, 2);
+            }
+            WriteHexRecord(pFile, 0x00, (uint16_t)address, segment->data + offset, (uint8_t)length);
+            offset += length;
+        }
+    }
+    WriteHexRecord(pFile, 0x01, 0, 0, 0);
+    failed = ferror(pFile) != 0;
+    if (fclose(pFile) != 0 || failed)
+    {
+        LOG_ERROR("Can't write Hex file: %s", fileName);
+        return 1;
+    }
+    LOG_INFO("Hex file written: %s Segments: %d", fileName, image->count);
+    return 0;
+}
@@ -4,13 +4,38 @@
 #include <stdio.h>
 #include "minilogger.h"
 #include "crc.h"
+#include "flashimage.h"
+
+typedef enum {
+FORMAT_UNKNOWN,
+FORMAT_BIN,
+FORMAT_HEX,
+FORMAT_SREC,
+FORMAT_ELF
+} flashFileFormat;
+
+// Smallest memory ceiling of StreamFlashText, for a chunk of text and a window of the spill.
+#define STREAM_CEILING_MIN 0x10000
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 uint8_t AscCodedHex2Buffer(const char * ascCodedHex, uint8_t * destinationBuffer);
 uint8_t Uint2Array(uint32_t * targetUint, uint8_t * destinationArray);
+uint8_t ParseHex(const char *fileName, FlashImage *image);
+uint8_t ParseSREC(const char *fileName, FlashImage *image);
+uint8_t IndexFlashText(const char *text, size_t length, flashFileFormat format, FlashImage *image);
+uint8_t DecodeFlashSegment(const char *text, flashFileFormat format, FlashImage *image, FlashSegment *segment);
+uint8_t StreamFlashText(const char *fileName, flashFileFormat format, uint32_t ceiling, const char *spillName,
+                        const CrcDigestSet *digests, uint8_t sha256, FlashImage *image);
+uint8_t ParseElf(const char *fileName, FlashImage *image);
+uint8_t ParseBin(const char *fileName, uint32_t baseAddress, FlashImage *image);
+uint8_t WriteHex(const char *fileName, const FlashImage *image);
 uint8_t HandleHex(const char *fileName, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4]);
 uint8_t HandleSREC(const char *fileName, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4]);
+uint8_t HandleElf(const char *fileName, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4]);
+uint8_t HandleBin(const char *fileName, uint32_t baseAddress, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4]);
+flashFileFormat DetectFlashFileFormat(const char *fileName);
 #ifdef __cplusplus
 }
 #endif
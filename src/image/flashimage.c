@@ -0,0 +1,464 @@
+/**
+ * @file flashimage.c
+ * @author Huang Dong (dohuang@borgwarner.com)
+ * @brief This file contains the in-memory segment model shared by all file parsers.
+ * @version 0.1
+ * @date 2023-05-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+#include "flashimage.h"
+#include "filepraser.h"
+
+// Bytes fed to all digests of a segment at a time, small enough to stay in the L1 cache.
+#define DIGEST_CHUNK_SIZE 0x1000
+
+/**
+ * @brief The image opened by the last blOpenFlashFile call.
+ * blBuffer reads its PDU data from here.
+ * 
+ */
+FlashImage flashImage = {0, 0, 0, 0, 0, 0, 0};
+
+/**
+ * @brief SHA-256 digests are calculated together with the checksums if set.
+ * 
+ */
+uint8_t sha256Enabled = 0;
+
+/**
+ * @brief Release all segments of an image.
+ * 
+ * @param image The image to be cleared.
+ */
+void ImageClear(FlashImage *image)
+{
+    if (image->mapping != 0)
+    {
+        // Segment data points into a mapped cache file or shared memory.
+        image->releaseMapping(image->mapping, image->mappingSize);
+        image->mapping = 0;
+        image->mappingSize = 0;
+        image->releaseMapping = 0;
+    }
+    if (image->spill != 0)
+    {
+        SpillClose(image->spill);
+        free(image->spill);
+        image->spill = 0;
+    }
+    // The segment table and the data of all segments are freed with the arena.
+    ArenaRelease(&image->arena);
+    image->segments = 0;
+    image->count = 0;
+    image->capacity = 0;
+    image->checksumsValid = 0;
+    image->sha256Valid = 0;
+}
+
+/**
+ * @brief Start a new empty segment at the end of an image.
+ * 
+ * @param image The image the segment is added to.
+ * @param address Start address of the new segment.
+ * @return FlashSegment* The new segment, 0 if out of memory.
+ */
+FlashSegment *ImageAddSegment(FlashImage *image, uint32_t address)
+{
+    FlashSegment *last = image->count != 0 ? &image->segments[image->count - 1] : 0;
+    if (last != 0 && ArenaResize(&image->arena, last->data, last->size) == 0)
+    {
+        // The room reserved for appends to the previous segment is given back.
+        last->capacity = last->size;
+    }
+    if (image->count == image->capacity)
+    {
+        uint32_t capacity = image->capacity ? image->capacity * 2 : 8;
+        FlashSegment *segments = (FlashSegment *)ArenaGrow(&image->arena, image->segments,
+                                                           image->capacity * sizeof(FlashSegment),
+                                                           capacity * sizeof(FlashSegment));
+        if (segments == 0)
+        {
+            LOG_ERROR("Out of memory when adding segment at 0x%.8x", address);
+            return 0;
+        }
+        image->segments = segments;
+        image->capacity = capacity;
+    }
+    FlashSegment *segment = &image->segments[image->count++];
+    segment->address = address;
+    segment->size = 0;
+    segment->capacity = 0;
+    segment->checksum = 0;
+    segment->checksumExtension = 0;
+    segment->data = 0;
+    segment->sourceOffset = 0;
+    segment->sourceEnd = 0;
+    return segment;
+}
+
+/**
+ * @brief Reserve space at the end of a segment.
+ * The segment size is increased by length and the caller writes the data
+ * to the returned pointer, e.g. with fread. The data of the segment
+ * allocated last grows in place in the arena of the image, the capacity
+ * doubles, so a segment growing by many appends is copied a logarithmic
+ * number of times.
+ * 
+ * @param image The image of the segment.
+ * @param segment The segment to be extended.
+ * @param length Bytes to be reserved.
+ * @return uint8_t* Start of the reserved space, 0 if out of memory.
+ */
+uint8_t *SegmentExtend(FlashImage *image, FlashSegment *segment, uint32_t length)
+{
+    if (length > UINT32_MAX - segment->size)
+    {
+        LOG_ERROR("Segment at 0x%.8x exceeds 4 GB", segment->address);
+        return 0;
+    }
+    uint32_t needed = segment->size + length;
+    if (needed > segment->capacity)
+    {
+        uint32_t capacity = segment->capacity ? segment->capacity : 0x1000;
+        while (capacity < needed && capacity < 0x80000000)
+        {
+            capacity *= 2;
+        }
+        if (capacity < needed)
+        {
+            capacity = needed;
+        }
+        uint8_t *buffer = segment->data;
+        if (ArenaResize(&image->arena, buffer, capacity) != 0)
+        {
+            // The rest of the chunk is used before the data is moved.
+            if (ArenaResize(&image->arena, buffer, needed) == 0)
+            {
+                capacity = needed;
+            }
+            else
+            {
+                buffer = (uint8_t *)ArenaGrow(&image->arena, segment->data, segment->size, capacity);
+            }
+        }
+        if (buffer == 0)
+        {
+            LOG_ERROR("Out of memory when extending segment at 0x%.8x", segment->address);
+            return 0;
+        }
+        segment->data = buffer;
+        segment->capacity = capacity;
+    }
+    uint8_t *tail = segment->data + segment->size;
+    segment->size += length;
+    return tail;
+}
+
+/**
+ * @brief Append data to the end of a segment.
+ * 
+ * @param image The image of the segment.
+ * @param segment The segment to be extended.
+ * @param data Data to be appended.
+ * @param length Length of data.
+ * @return uint8_t 0 on success, 1 if out of memory.
+ */
+uint8_t SegmentAppend(FlashImage *image, FlashSegment *segment, const uint8_t *data, uint32_t length)
+{
+    uint8_t *tail = SegmentExtend(image, segment, length);
+    if (tail == 0)
+    {
+        return 1;
+    }
+    memcpy(tail, data, length);
+    return 0;
+}
+
+/**
+ * @brief Calculate the CRC-* of the data of a segment. The 4 most significant
+ * bytes are saved in checksum, the rest of a CRC wider than 32 bits in
+ * checksumExtension.
+ * 
+ * @param segment A decoded segment.
+ */
+void SegmentCalculateChecksum(FlashSegment *segment)
+{
+    uint64_t crc = CalculateCrc64OfBuffer(segment->data, segment->size);
+    segment->checksum = (uint32_t)(crc >> 32);
+    segment->checksumExtension = (uint32_t)crc;
+}
+
+/**
+ * @brief Calculate the CRCs and checksums of a digest set and the SHA-256
+ * of the data of a segment in one pass. Each chunk of data is fed to all
+ * of them while it is still in the L1 cache.
+ * 
+ * @param segment A decoded segment.
+ * @param digests CRC algorithms to be calculated, 0 for none.
+ * @param sha256 1 to calculate the SHA-256 as well.
+ */
+void SegmentCalculateDigests(FlashSegment *segment, const CrcDigestSet *digests, uint8_t sha256)
+{
+    CrcProfileState states[CRC_DIGESTS_MAX];
+    uint32_t count = digests != 0 ? digests->count : 0;
+    Sha256Context context;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        CrcProfileStart(digests->profiles[i], &states[i]);
+    }
+    if (sha256)
+    {
+        Sha256Init(&context);
+    }
+    for (uint32_t offset = 0; offset < segment->size; offset += DIGEST_CHUNK_SIZE)
+    {
+        const uint8_t *chunk = segment->data + offset;
+        uint32_t length = segment->size - offset < DIGEST_CHUNK_SIZE ? segment->size - offset : DIGEST_CHUNK_SIZE;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            CrcProfileUpdate(digests->profiles[i], &states[i], chunk, length);
+        }
+        if (sha256)
+        {
+            Sha256Update(&context, chunk, length);
+        }
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        segment->digests[i] = CrcProfileFinish(digests->profiles[i], &states[i]) << (64 - 8 * digests->bytes[i]);
+    }
+    if (sha256)
+    {
+        Sha256Final(&context, segment->sha256);
+    }
+}
+
+/**
+ * @brief Calculate the SHA-256 of the data of all segments in order,
+ * as verified over the whole image by a secure boot ECU.
+ * 
+ * @param image A decoded image.
+ */
+void ImageCalculateSha256(FlashImage *image)
+{
+    Sha256Context context;
+    Sha256Init(&context);
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        Sha256Update(&context, image->segments[i].data, image->segments[i].size);
+    }
+    Sha256Final(&context, image->sha256);
+}
+
+static int CompareSegmentAddress(const void *a, const void *b)
+{
+    uint32_t first = (*(const FlashSegment *const *)a)->address;
+    uint32_t second = (*(const FlashSegment *const *)b)->address;
+    return first < second ? -1 : first > second;
+}
+
+/**
+ * @brief Calculate the CRC or checksum of a profile over an address window
+ * of an image, e.g. a logical block verified by the ECU. Bytes of the window
+ * not covered by a segment count as fill bytes, a gap is fed to the checksum
+ * in logarithmic time of its length instead of being filled in memory.
+ * 
+ * @param image A decoded image.
+ * @param profile A profile with a CrcEngine if its algorithm is CRC.
+ * @param start First address of the window.
+ * @param end Address after the window, at least start.
+ * @param fill Value of the bytes in gaps, e.g. 0xFF for erased flash.
+ * @param checksum Result value in the lowest bits bits of the profile will be saved in this variable.
+ * @return uint8_t 0 on success, 1 if segments overlap in the window or the spill can't be read.
+ */
+uint8_t ImageCalculateBlockChecksum(const FlashImage *image, const CrcProfile *profile, uint64_t start, uint64_t end,
+                                    uint8_t fill, uint64_t *checksum)
+{
+    const FlashSegment **segments = (const FlashSegment **)malloc((image->count + 1) * sizeof(FlashSegment *));
+    uint32_t count = 0;
+    uint64_t position = start;
+    CrcProfileState state;
+    if (segments == 0)
+    {
+        return 1;
+    }
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        const FlashSegment *segment = &image->segments[i];
+        if (segment->size != 0 && segment->address < end && segment->address + (uint64_t)segment->size > start)
+        {
+            segments[count++] = segment;
+        }
+    }
+    qsort(segments, count, sizeof(FlashSegment *), CompareSegmentAddress);
+    CrcProfileStart(profile, &state);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t segmentStart = segments[i]->address;
+        uint64_t segmentEnd = segmentStart + segments[i]->size;
+        if (segmentStart < position && i != 0)
+        {
+            LOG_ERROR("Segments at 0x%.8x and 0x%.8x overlap", segments[i - 1]->address, segments[i]->address);
+            free(segments);
+            return 1;
+        }
+        if (segmentStart > position)
+        {
+            CrcProfileFill(profile, &state, fill, segmentStart - position);
+            position = segmentStart;
+        }
+        uint64_t dataEnd = segmentEnd < end ? segmentEnd : end;
+        if (image->spill != 0)
+        {
+            // The data of a streamed image is read through the window of its spill.
+            uint32_t index = (uint32_t)(segments[i] - image->segments);
+            while (position < dataEnd)
+            {
+                uint32_t length = (uint32_t)(dataEnd - position < DIGEST_CHUNK_SIZE ? dataEnd - position : DIGEST_CHUNK_SIZE);
+                const uint8_t *data = SpillRead(image->spill, index, (uint32_t)(position - segmentStart), &length);
+                if (data == 0)
+                {
+                    free(segments);
+                    return 1;
+                }
+                CrcProfileUpdate(profile, &state, data, length);
+                position += length;
+            }
+            continue;
+        }
+        CrcProfileUpdate(profile, &state, segments[i]->data + (position - segmentStart), (size_t)(dataEnd - position));
+        position = dataEnd;
+    }
+    CrcProfileFill(profile, &state, fill, end - position);
+    *checksum = CrcProfileFinish(profile, &state);
+    free(segments);
+    return 0;
+}
+
+/**
+ * @brief Merge the segments of several images into one image, e.g. a
+ * bootloader and an application. Segments are sorted by address and
+ * adjacent segments are joined, the data is copied.
+ * 
+ * @param target The merged image, cleared first.
+ * @param images The images to be merged, their data must be in memory.
+ * @param count Amount of images.
+ * @return uint8_t 0 on success, 1 if segments overlap, an image is streamed or out of memory.
+ */
+uint8_t ImageMerge(FlashImage *target, const FlashImage *images, uint32_t count)
+{
+    const FlashSegment **segments;
+    uint32_t total = 0, sorted = 0;
+    FlashSegment *segment = 0;
+    ImageClear(target);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        total += images[i].count;
+    }
+    segments = (const FlashSegment **)malloc((total + 1) * sizeof(FlashSegment *));
+    if (segments == 0)
+    {
+        return 1;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        for (uint32_t j = 0; j < images[i].count; j++)
+        {
+            if (images[i].segments[j].size != 0 && images[i].segments[j].data == 0)
+            {
+                // Streamed through a spill file or not decoded yet.
+                LOG_ERROR("Can't merge segment at 0x%.8x, its data isn't in memory", images[i].segments[j].address);
+                free(segments);
+                return 1;
+            }
+            if (images[i].segments[j].size != 0)
+                segments[sorted++] = &images[i].segments[j];
+        }
+    }
+    qsort(segments, sorted, sizeof(FlashSegment *), CompareSegmentAddress);
+    for (uint32_t i = 0; i < sorted; i++)
+    {
+        uint64_t segmentEnd = segment != 0 ? segment->address + (uint64_t)segment->size : 0;
+        if (segment != 0 && segments[i]->address < segmentEnd)
+        {
+            LOG_ERROR("Segments at 0x%.8x and 0x%.8x overlap", segment->address, segments[i]->address);
+            free(segments);
+            ImageClear(target);
+            return 1;
+        }
+        if (segment == 0 || segments[i]->address != segmentEnd)
+        {
+            segment = ImageAddSegment(target, segments[i]->address);
+        }
+        if (segment == 0 || SegmentAppend(target, segment, segments[i]->data, segments[i]->size) != 0)
+        {
+            free(segments);
+            ImageClear(target);
+            return 1;
+        }
+    }
+    free(segments);
+    return 0;
+}
+
+/**
+ * @brief Calculate the checksum of each segment and save the segment info
+ * to the arrays returned to CAPL. Checksums already known, e.g. loaded from
+ * the image cache, are not calculated again.
+ * Numerical data is saved with big endianness.
+ * 
+ * @param image A parsed image.
+ * @param segmentsCount The index of the last segment will be saved in this buffer.
+ * @param addressAndSize The start address and size of each segment will be saved in this buffer.
+ * @param checksum The crc-* checksum of each segment will be saved in this buffer.
+ * @return uint8_t 
+ */
+uint8_t ImageExport(FlashImage *image, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4])
+{
+    *segmentsCount = image->count ? image->count - 1 : 0;
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        FlashSegment *segment = &image->segments[i];
+        uint32_t address = segment->address;
+        uint32_t size = segment->size;
+        if (!image->checksumsValid)
+        {
+            SegmentCalculateChecksum(segment);
+        }
+        uint32_t crc = segment->checksum;
+        Uint2Array(&address, addressAndSize[i]);
+        Uint2Array(&size, addressAndSize[i] + 4);
+        Uint2Array(&crc, checksum[i]);
+        LOG_INFO("Address: 0x%.8x-%.8x Size: %.8x Checksum: %.8x",
+                 address, address + size - 1, size, crc);
+        LOG_INFO("Segment %d completed", i);
+    }
+    image->checksumsValid = 1;
+    return 0;
+}
+
+/**
+ * @brief Save the segment info without checksums to the arrays returned to CAPL.
+ * Used when the segment data is decoded later, numerical data is saved
+ * with big endianness.
+ * 
+ * @param image An indexed or parsed image.
+ * @param segmentsCount The index of the last segment will be saved in this buffer.
+ * @param addressAndSize The start address and size of each segment will be saved in this buffer.
+ * @return uint8_t 
+ */
+uint8_t ImageExportLayout(FlashImage *image, uint32_t *segmentsCount, uint8_t addressAndSize[][8])
+{
+    *segmentsCount = image->count ? image->count - 1 : 0;
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        uint32_t address = image->segments[i].address;
+        uint32_t size = image->segments[i].size;
+        Uint2Array(&address, addressAndSize[i]);
+        Uint2Array(&size, addressAndSize[i] + 4);
+        LOG_INFO("Address: 0x%.8x-%.8x Size: %.8x", address, address + size - 1, size);
+    }
+    return 0;
+}
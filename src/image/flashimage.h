@@ -0,0 +1,72 @@
+#ifndef FLASHIMAGE_H
+#define FLASHIMAGE_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minilogger.h"
+#include "crc.h"
+#include "sha256.h"
+#include "imagespill.h"
+#include "imagearena.h"
+
+/**
+ * @brief One contiguous block of decoded flash data.
+ * 
+ */
+typedef struct
+{
+    uint32_t address;  // Start address of this segment.
+    uint32_t size;     // Bytes of data in this segment.
+    uint32_t capacity; // Bytes allocated for data in the arena of the image.
+    uint32_t checksum; // CRC-* of data, valid if checksumsValid of the image is set.
+    uint32_t checksumExtension; // Bytes 5 to 8 of a CRC wider than 32 bits.
+    uint8_t *data;     // Decoded binary data of this segment, 0 if the image is streamed.
+    uint64_t sourceOffset; // Start of the records of this segment in a HEX or SREC file.
+    uint64_t sourceEnd;    // End of the records of this segment in a HEX or SREC file.
+    uint8_t sha256[SHA256_DIGEST_SIZE]; // SHA-256 of data, valid if sha256Valid of the image is set.
+    uint64_t digests[CRC_DIGESTS_MAX];  // CRCs of the digest set, aligned like the checksum.
+} FlashSegment;
+
+/**
+ * @brief A decoded flash file. All file parsers feed this segment model.
+ * 
+ */
+typedef struct
+{
+    uint32_t count;    // Amount of segments in this image.
+    uint32_t capacity; // Amount of segments allocated.
+    FlashSegment *segments;
+    uint8_t checksumsValid; // Checksums of all segments have been calculated.
+    void *mapping;          // Mapped memory holding segment data, 0 if data is allocated.
+    size_t mappingSize;
+    void (*releaseMapping)(void *mapping, size_t size);
+    uint8_t checksumBytes;  // Bytes of the CRC of each segment, 1 to 8.
+    uint8_t sha256Valid;    // SHA-256 digests of all segments and of the image have been calculated.
+    uint8_t sha256[SHA256_DIGEST_SIZE]; // SHA-256 of the data of all segments in order.
+    uint8_t digestsCount;   // Amount of CRCs of the digest set of each segment.
+    uint8_t digestBytes[CRC_DIGESTS_MAX]; // Bytes of each CRC of the digest set.
+    FlashSpill *spill;      // Spill file holding the segment data of a streamed image, 0 if data is in memory.
+    ImageArena arena;       // Chunks holding the segment table and the segment data not in a mapping.
+} FlashImage;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern FlashImage flashImage;
+extern uint8_t sha256Enabled;
+void ImageClear(FlashImage *image);
+FlashSegment *ImageAddSegment(FlashImage *image, uint32_t address);
+uint8_t *SegmentExtend(FlashImage *image, FlashSegment *segment, uint32_t length);
+uint8_t SegmentAppend(FlashImage *image, FlashSegment *segment, const uint8_t *data, uint32_t length);
+void SegmentCalculateChecksum(FlashSegment *segment);
+void SegmentCalculateDigests(FlashSegment *segment, const CrcDigestSet *digests, uint8_t sha256);
+void ImageCalculateSha256(FlashImage *image);
+uint8_t ImageCalculateBlockChecksum(const FlashImage *image, const CrcProfile *profile, uint64_t start, uint64_t end,
+                                    uint8_t fill, uint64_t *checksum);
+uint8_t ImageMerge(FlashImage *target, const FlashImage *images, uint32_t count);
+uint8_t ImageExportLayout(FlashImage *image, uint32_t *segmentsCount, uint8_t addressAndSize[][8]);
+uint8_t ImageExport(FlashImage *image, uint32_t *segmentsCount, uint8_t addressAndSize[][8], uint8_t checksum[][4]);
+#ifdef __cplusplus
+}
+#endif
+#endif
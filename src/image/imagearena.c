@@ -0,0 +1,274 @@
+/**
+ * @file imagearena.c
+ * @author Huang Dong (dohuang@borgwarner.com)
+ * @brief This file contains the arena allocator of parsed images. The segment
+ * table and the data of all segments are bump allocated from a few large
+ * chunks, so parsing doesn't call malloc per segment or copy segments growing
+ * record by record, and closing an image frees a handful of chunks.
+ * @version 0.1
+ * @date 2023-05-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "imagearena.h"
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/**
+ * @brief Chunks of at least ARENA_HUGE_PAGE_SIZE bytes are backed by huge
+ * pages if set, falling back to normal pages if the system has none available.
+ *
+ */
+uint8_t arenaHugePages = 0;
+
+/**
+ * @brief Header at the start of each chunk, followed by the blocks.
+ *
+ */
+struct ArenaChunk
+{
+    ArenaChunk *next; // Chunk allocated before this one.
+    size_t size;      // Bytes of the chunk including this header.
+    size_t used;      // Bytes from the start of the chunk to the end of the newest block.
+    uint8_t mapped;   // The chunk is mapped from the system instead of allocated with malloc.
+};
+
+/**
+ * @brief Map memory for a chunk, with huge pages if possible.
+ *
+ * @param size Bytes wanted, rounded up to a multiple of ARENA_HUGE_PAGE_SIZE.
+ * @return void* The memory, 0 if it can't be mapped.
+ */
+static void *MapHugeChunk(size_t *size)
+{
+    *size = (*size + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+#ifdef _WIN32
+    // Large pages need the "Lock pages in memory" privilege.
+    SIZE_T large = GetLargePageMinimum();
+    void *chunk = 0;
+    if (large != 0 && *size % large == 0)
+    {
+        chunk = VirtualAlloc(0, *size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    }
+    if (chunk == 0)
+    {
+        chunk = VirtualAlloc(0, *size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+    return chunk;
+#else
+    void *chunk = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    chunk = mmap(0, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (chunk == MAP_FAILED)
+    {
+        // No reserved huge pages, transparent huge pages are used where the kernel can.
+        chunk = mmap(0, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED)
+        {
+            return 0;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(chunk, *size, MADV_HUGEPAGE);
+#endif
+    }
+    return chunk;
+#endif
+}
+
+/**
+ * @brief Return the memory of a chunk to the system.
+ *
+ * @param chunk A chunk, no longer linked to its arena.
+ */
+static void FreeChunk(ArenaChunk *chunk)
+{
+    if (chunk->mapped)
+    {
+#ifdef _WIN32
+        VirtualFree(chunk, 0, MEM_RELEASE);
+#else
+        munmap(chunk, chunk->size);
+#endif
+    }
+    else
+    {
+        free(chunk);
+    }
+}
+
+/**
+ * @brief Get the start of the first block of a chunk.
+ *
+ * @param chunk A chunk.
+ * @return uint8_t* Start of the chunk after its header aligned to ARENA_ALIGNMENT.
+ */
+static uint8_t *ChunkFirst(ArenaChunk *chunk)
+{
+    uintptr_t first = (uintptr_t)chunk + sizeof(ArenaChunk);
+    return (uint8_t *)((first + ARENA_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_ALIGNMENT - 1));
+}
+
+/**
+ * @brief Get the start of the next block of a chunk.
+ *
+ * @param chunk A chunk.
+ * @return uint8_t* End of the newest block aligned to ARENA_ALIGNMENT.
+ */
+static uint8_t *ChunkFree(ArenaChunk *chunk)
+{
+    uintptr_t next = (uintptr_t)chunk + chunk->used;
+    return (uint8_t *)((next + ARENA_ALIGNMENT - 1) & ~(uintptr_t)(ARENA_ALIGNMENT - 1));
+}
+
+/**
+ * @brief Add a chunk holding at least one block of a size to an arena.
+ * Each chunk is twice as large as the one before up to ARENA_CHUNK_MAX.
+ *
+ * @param arena An arena.
+ * @param size Bytes of the block.
+ * @return ArenaChunk* The new chunk, 0 if out of memory.
+ */
+static ArenaChunk *AddChunk(ImageArena *arena, size_t size)
+{
+    size_t chunkSize = arena->chunks != 0 ? arena->chunks->size * 2 : ARENA_CHUNK_MIN;
+    size_t needed = sizeof(ArenaChunk) + 2 * ARENA_ALIGNMENT + size;
+    ArenaChunk *chunk;
+    uint8_t mapped = 0;
+    if (chunkSize > ARENA_CHUNK_MAX)
+    {
+        chunkSize = ARENA_CHUNK_MAX;
+    }
+    // A block larger than a chunk gets a chunk of twice the size until it
+    // fits, so the room left after a growing block takes its next growth.
+    while (chunkSize < needed)
+    {
+        chunkSize *= 2;
+    }
+    if (arenaHugePages && chunkSize >= ARENA_HUGE_PAGE_SIZE)
+    {
+        chunk = (ArenaChunk *)MapHugeChunk(&chunkSize);
+        mapped = 1;
+    }
+    else
+    {
+        chunk = (ArenaChunk *)malloc(chunkSize);
+    }
+    if (chunk == 0)
+    {
+        LOG_ERROR("Out of memory when allocating %llu bytes for an image", (unsigned long long)size);
+        return 0;
+    }
+    chunk->next = arena->chunks;
+    chunk->size = chunkSize;
+    chunk->used = sizeof(ArenaChunk);
+    chunk->mapped = mapped;
+    arena->chunks = chunk;
+    arena->reserved += chunkSize;
+    return chunk;
+}
+
+/**
+ * @brief Allocate a block aligned to ARENA_ALIGNMENT from an arena.
+ *
+ * @param arena An arena.
+ * @param size Bytes of the block, may be 0.
+ * @return void* The block, 0 if out of memory.
+ */
+void *ArenaAlloc(ImageArena *arena, size_t size)
+{
+    ArenaChunk *chunk = arena->chunks;
+    uint8_t *block = chunk != 0 ? ChunkFree(chunk) : 0;
+    if (chunk == 0 || size > (size_t)((uint8_t *)chunk + chunk->size - block))
+    {
+        chunk = AddChunk(arena, size);
+        if (chunk == 0)
+        {
+            return 0;
+        }
+        block = ChunkFree(chunk);
+    }
+    chunk->used = (size_t)(block - (uint8_t *)chunk) + size;
+    arena->last = block;
+    return block;
+}
+
+/**
+ * @brief Resize the newest block of an arena in place, it may also shrink.
+ *
+ * @param arena The arena of the block.
+ * @param block A block of the arena.
+ * @param newSize Bytes wanted.
+ * @return uint8_t 0 on success, 1 if the block isn't the newest or its chunk has no room.
+ */
+uint8_t ArenaResize(ImageArena *arena, void *block, size_t newSize)
+{
+    ArenaChunk *chunk = arena->chunks;
+    if (block == 0 || block != arena->last ||
+        newSize > (size_t)((uint8_t *)chunk + chunk->size - (uint8_t *)block))
+    {
+        return 1;
+    }
+    chunk->used = (size_t)((uint8_t *)block - (uint8_t *)chunk) + newSize;
+    return 0;
+}
+
+/**
+ * @brief Resize a block of an arena. The newest block grows in place while
+ * its chunk has room, other blocks are copied to a new block and their old
+ * space is released with the arena. A chunk holding nothing but the moved
+ * block is freed at once, so a large growing block doesn't leave its old
+ * copies behind.
+ *
+ * @param arena The arena of the block.
+ * @param block A block of the arena, 0 to allocate a new one.
+ * @param size Bytes of the block.
+ * @param newSize Bytes wanted.
+ * @return void* The resized block, 0 if out of memory, the old block stays valid then.
+ */
+void *ArenaGrow(ImageArena *arena, void *block, size_t size, size_t newSize)
+{
+    if (ArenaResize(arena, block, newSize) == 0)
+    {
+        return block;
+    }
+    ArenaChunk *chunk = arena->chunks;
+    uint8_t alone = block != 0 && block == arena->last && block == ChunkFirst(chunk);
+    void *grown = ArenaAlloc(arena, newSize);
+    if (grown != 0 && block != 0)
+    {
+        memcpy(grown, block, size < newSize ? size : newSize);
+    }
+    if (grown != 0 && alone && arena->chunks->next == chunk)
+    {
+        arena->chunks->next = chunk->next;
+        arena->reserved -= chunk->size;
+        FreeChunk(chunk);
+    }
+    return grown;
+}
+
+/**
+ * @brief Free all chunks of an arena at once.
+ *
+ * @param arena An arena, it is empty afterwards.
+ */
+void ArenaRelease(ImageArena *arena)
+{
+    ArenaChunk *chunk = arena->chunks;
+    while (chunk != 0)
+    {
+        ArenaChunk *next = chunk->next;
+        FreeChunk(chunk);
+        chunk = next;
+    }
+    arena->chunks = 0;
+    arena->last = 0;
+    arena->reserved = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef IMAGEARENA_H
+#define IMAGEARENA_H
+#include <stdint.h>
+#include <stddef.h>
+#include "minilogger.h"
+
+#define ARENA_ALIGNMENT 64          // Alignment of each block, a cache line.
+#define ARENA_CHUNK_MIN 0x10000     // Size of the first chunk of an arena.
+#define ARENA_CHUNK_MAX 0x4000000   // Chunks double up to this size, and further only for larger blocks.
+#define ARENA_HUGE_PAGE_SIZE 0x200000 // Chunks of at least this size are backed by huge pages if enabled.
+
+typedef struct ArenaChunk ArenaChunk;
+
+/**
+ * @brief Chunked bump allocator of the segment table and the segment data
+ * of an image. Blocks are taken from the end of the newest chunk and are
+ * never freed one by one, all chunks are released at once with the image.
+ * An arena is used by one thread at a time.
+ *
+ */
+typedef struct
+{
+    ArenaChunk *chunks; // Newest chunk first, 0 if nothing is allocated.
+    uint8_t *last;      // Newest block, it can grow in place.
+    uint64_t reserved;  // Bytes of all chunks.
+} ImageArena;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern uint8_t arenaHugePages;
+void *ArenaAlloc(ImageArena *arena, size_t size);
+uint8_t ArenaResize(ImageArena *arena, void *block, size_t newSize);
+void *ArenaGrow(ImageArena *arena, void *block, size_t size, size_t newSize);
+void ArenaRelease(ImageArena *arena);
+#ifdef __cplusplus
+}
+#endif
+#endif
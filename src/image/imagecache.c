@@ -0,0 +1,537 @@
+/**
+ * @file imagecache.c
+ * @author Huang Dong (dohuang@borgwarner.com)
+ * @brief This file contains the persistent cache of parsed flash images.
+ * A cache file holds the segment table, the checksums and the raw payload
+ * of a parsed image and is memory mapped when the same flash file is opened
+ * again with the same CRC specification.
+ * @version 0.1
+ * @date 2023-05-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+#include "imagecache.h"
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Local variables definition.
+ * Cache files are saved in imageCacheDirectory relative to the CANoe project root.
+ * The cache is disabled by default, it writes a copy of each image opened.
+ * 
+ */
+uint8_t imageCacheEnabled = 0;
+const char *imageCacheDirectory = "blcache";
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t Rotl64(uint64_t value, uint8_t bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t Read64(const uint8_t *buffer)
+{
+    uint64_t value;
+    memcpy(&value, buffer, 8);
+    return value;
+}
+
+static uint32_t Read32(const uint8_t *buffer)
+{
+    uint32_t value;
+    memcpy(&value, buffer, 4);
+    return value;
+}
+
+static uint64_t HashRound(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * PRIME64_2;
+    accumulator = Rotl64(accumulator, 31);
+    return accumulator * PRIME64_1;
+}
+
+static uint64_t HashMerge(uint64_t accumulator, uint64_t value)
+{
+    accumulator ^= HashRound(0, value);
+    return accumulator * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * @brief Calculate the 64bit hash of a buffer.
+ * This is the XXH64 algorithm, which hashes four independent lanes
+ * of 8 bytes at a time and runs close to memory bandwidth.
+ * 
+ * @param buffer Data to be hashed.
+ * @param length Length of data.
+ * @param seed Hash seed.
+ * @return uint64_t Hash value.
+ */
+uint64_t HashBuffer(const uint8_t *buffer, size_t length, uint64_t seed)
+{
+    const uint8_t *end = buffer + length;
+    uint64_t hash;
+    if (length >= 32)
+    {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        const uint8_t *limit = end - 32;
+        do
+        {
+            v1 = HashRound(v1, Read64(buffer));
+            v2 = HashRound(v2, Read64(buffer + 8));
+            v3 = HashRound(v3, Read64(buffer + 16));
+            v4 = HashRound(v4, Read64(buffer + 24));
+            buffer += 32;
+        } while (buffer <= limit);
+        hash = Rotl64(v1, 1) + Rotl64(v2, 7) + Rotl64(v3, 12) + Rotl64(v4, 18);
+        hash = HashMerge(hash, v1);
+        hash = HashMerge(hash, v2);
+        hash = HashMerge(hash, v3);
+        hash = HashMerge(hash, v4);
+    }
+    else
+    {
+        hash = seed + PRIME64_5;
+    }
+    hash += (uint64_t)length;
+    while (buffer + 8 <= end)
+    {
+        hash ^= HashRound(0, Read64(buffer));
+        hash = Rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+        buffer += 8;
+    }
+    if (buffer + 4 <= end)
+    {
+        hash ^= (uint64_t)Read32(buffer) * PRIME64_1;
+        hash = Rotl64(hash, 23) * PRIME64_2 + PRIME64_3;
+        buffer += 4;
+    }
+    while (buffer < end)
+    {
+        hash ^= (*buffer) * PRIME64_5;
+        hash = Rotl64(hash, 11) * PRIME64_1;
+        buffer++;
+    }
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/**
+ * @brief Map a whole file read only into memory.
+ * 
+ * @param fileName Path to a file.
+ * @param size Size of the file will be saved in this variable.
+ * @return void* Start of the mapped file, 0 on failure or if the file is empty.
+ */
+void *MapFile(const char *fileName, size_t *size)
+{
+    void *mapping = 0;
+    *size = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return 0;
+    }
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+    {
+        HANDLE view = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        if (view != 0)
+        {
+            mapping = MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(view);
+            if (mapping != 0)
+            {
+                *size = (size_t)fileSize.QuadPart;
+            }
+        }
+    }
+    CloseHandle(file);
+#else
+    struct stat fileStat;
+    int file = open(fileName, O_RDONLY);
+    if (file < 0)
+    {
+        return 0;
+    }
+    if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        mapping = mmap(0, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, file, 0);
+        if (mapping == MAP_FAILED)
+        {
+            mapping = 0;
+        }
+        else
+        {
+            *size = (size_t)fileStat.st_size;
+        }
+    }
+    close(file);
+#endif
+    return mapping;
+}
+
+/**
+ * @brief Unmap a file mapped by MapFile.
+ * 
+ * @param mapping Start of the mapped file.
+ * @param size Size of the mapped file.
+ */
+void UnmapFile(void *mapping, size_t size)
+{
+    if (mapping == 0)
+    {
+        return;
+    }
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, size);
+#endif
+}
+
+/**
+ * @brief Hash the content of a file.
+ * A missing or empty file hashes as empty content.
+ * 
+ * @param fileName Path to a file.
+ * @param hash Hash of the file content will be saved in this variable.
+ * @param size Size of the file will be saved in this variable.
+ * @return uint8_t 0 if the file exists.
+ */
+static uint8_t HashFile(const char *fileName, uint64_t *hash, uint64_t *size)
+{
+    size_t mappingSize;
+    uint8_t *mapping = (uint8_t *)MapFile(fileName, &mappingSize);
+    *hash = HashBuffer(mapping, mappingSize, 0);
+    *size = mappingSize;
+    UnmapFile(mapping, mappingSize);
+    if (mapping == 0)
+    {
+        FILE *pFile = fopen(fileName, "rb");
+        if (pFile == 0)
+        {
+            return 1;
+        }
+        fclose(pFile);
+    }
+    return 0;
+}
+
+/**
+ * @brief Build the cache file path of a key.
+ * 
+ * @param key Cache key.
+ * @param path Buffer to save the path.
+ * @param length Length of the buffer.
+ */
+static void ImageCachePath(const ImageCacheKey *key, char *path, size_t length)
+{
+    snprintf(path, length, "%s/%.16llx%.16llx.blc", imageCacheDirectory,
+             (unsigned long long)key->sourceHash, (unsigned long long)key->specHash);
+}
+
+/**
+ * @brief Calculate the cache key of a flash file.
+ * 
+ * @param fileName A flash file path.
+ * @param specName The CRC specification file path.
+ * @param key The cache key will be saved in this variable.
+ * @return uint8_t 0 on success, 1 if the flash file can't be read.
+ */
+uint8_t ImageCacheKeyOf(const char *fileName, const char *specName, ImageCacheKey *key)
+{
+    uint64_t specSize;
+    if (HashFile(fileName, &key->sourceHash, &key->sourceSize) != 0)
+    {
+        return 1;
+    }
+    HashFile(specName, &key->specHash, &specSize);
+    return 0;
+}
+
+/**
+ * @brief Populate an image from a block of memory in cache file format.
+ * Segment data points into the memory block, so nothing is copied.
+ * The block is used only if its header matches the key and all segments
+ * lie inside the block, otherwise it is stale.
+ * 
+ * @param key Cache key of the flash file.
+ * @param image The image will be saved in this variable.
+ * @param mapping Start of the memory block.
+ * @param size Size of the memory block.
+ * @param releaseMapping Function to release the memory block when the image is cleared.
+ * @return uint8_t 0 on success, 1 if the memory block is stale.
+ */
+uint8_t ImageCacheAttach(const ImageCacheKey *key, FlashImage *image, uint8_t *mapping, size_t size,
+                         void (*releaseMapping)(void *mapping, size_t size))
+{
+    const ImageCacheHeader *header = (const ImageCacheHeader *)mapping;
+    const ImageCacheSegment *index = (const ImageCacheSegment *)(header + 1);
+    uint8_t valid = size >= sizeof(ImageCacheHeader) &&
+                    memcmp(header->magic, IMAGE_CACHE_MAGIC, 4) == 0 &&
+                    header->version == IMAGE_CACHE_VERSION &&
+                    header->sourceHash == key->sourceHash &&
+                    header->specHash == key->specHash &&
+                    header->sourceSize == key->sourceSize &&
+                    header->fileSize <= size &&
+                    header->segmentsCount <= (size - sizeof(ImageCacheHeader)) / sizeof(ImageCacheSegment);
+    for (uint32_t i = 0; valid && i < header->segmentsCount; i++)
+    {
+        valid = index[i].offset <= size && index[i].size <= size - index[i].offset;
+    }
+    if (!valid)
+    {
+        return 1;
+    }
+    ImageClear(image);
+    image->segments = (FlashSegment *)ArenaAlloc(&image->arena, header->segmentsCount * sizeof(FlashSegment));
+    if (image->segments == 0)
+    {
+        return 1;
+    }
+    for (uint32_t i = 0; i < header->segmentsCount; i++)
+    {
+        image->segments[i].address = index[i].address;
+        image->segments[i].size = index[i].size;
+        image->segments[i].capacity = index[i].size;
+        image->segments[i].checksum = index[i].checksum;
+        image->segments[i].checksumExtension = index[i].checksumExtension;
+        memcpy(image->segments[i].sha256, index[i].sha256, SHA256_DIGEST_SIZE);
+        memcpy(image->segments[i].digests, index[i].digests, sizeof(index[i].digests));
+        image->segments[i].data = mapping + index[i].offset;
+        image->segments[i].sourceOffset = 0;
+        image->segments[i].sourceEnd = 0;
+    }
+    image->count = header->segmentsCount;
+    image->capacity = header->segmentsCount;
+    image->checksumsValid = 1;
+    image->sha256Valid = (header->flags & IMAGE_CACHE_SHA256) != 0;
+    memcpy(image->sha256, header->sha256, SHA256_DIGEST_SIZE);
+    image->mapping = mapping;
+    image->mappingSize = size;
+    image->releaseMapping = releaseMapping;
+    return 0;
+}
+
+/**
+ * @brief Calculate the payload hash of an image in cache file format,
+ * chained over the segment index and the data of each segment.
+ * 
+ * @param index The segment index.
+ * @param segments The segments of the image, their data in index order.
+ * @param count Amount of segments.
+ * @return uint64_t Hash value.
+ */
+static uint64_t ImageCachePayloadHash(const ImageCacheSegment *index, const FlashSegment *segments, uint32_t count)
+{
+    uint64_t hash = HashBuffer((const uint8_t *)index, count * sizeof(ImageCacheSegment), 0);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        hash = HashBuffer(segments[i].data, segments[i].size, hash);
+    }
+    return hash;
+}
+
+/**
+ * @brief Verify the payload hash of an image attached to a memory block in
+ * cache file format, so corrupted data is never flashed. The hash runs
+ * close to memory bandwidth, the checksums aren't calculated again.
+ * 
+ * @param image An image attached by ImageCacheAttach.
+ * @return uint8_t 0 if the hash matches, 1 otherwise.
+ */
+uint8_t ImageCacheVerify(const FlashImage *image)
+{
+    const ImageCacheHeader *header = (const ImageCacheHeader *)image->mapping;
+    if (ImageCachePayloadHash((const ImageCacheSegment *)(header + 1), image->segments, image->count) != header->payloadHash)
+    {
+        LOG_WARN("Payload hash mismatch of image with %u segments", image->count);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Load a parsed image from the cache.
+ * The cache file is memory mapped, see ImageCacheAttach, and its payload
+ * hash is verified.
+ * 
+ * @param key Cache key of the flash file.
+ * @param image The loaded image will be saved in this variable.
+ * @return uint8_t 0 on cache hit, 1 on cache miss.
+ */
+uint8_t ImageCacheLoad(const ImageCacheKey *key, FlashImage *image)
+{
+    char path[256];
+    size_t size;
+    if (!imageCacheEnabled)
+    {
+        return 1;
+    }
+    ImageCachePath(key, path, sizeof(path));
+    uint8_t *mapping = (uint8_t *)MapFile(path, &size);
+    if (mapping == 0)
+    {
+        LOG_INFO("Image cache miss: %s", path);
+        return 1;
+    }
+    if (size < sizeof(ImageCacheHeader) || ((const ImageCacheHeader *)mapping)->fileSize != size ||
+        ImageCacheAttach(key, image, mapping, size, UnmapFile) != 0)
+    {
+        LOG_WARN("Stale image cache entry: %s", path);
+        UnmapFile(mapping, size);
+        return 1;
+    }
+    if (ImageCacheVerify(image) != 0)
+    {
+        LOG_WARN("Corrupted image cache entry: %s", path);
+        ImageClear(image);
+        remove(path);
+        return 1;
+    }
+    LOG_INFO("Image cache hit: %s", path);
+    return 0;
+}
+
+/**
+ * @brief Build the header and the segment index of an image in cache file format.
+ * Payload starts after the segment index, each segment aligned to IMAGE_CACHE_ALIGNMENT.
+ * 
+ * @param key Cache key of the flash file.
+ * @param image A parsed image with valid checksums.
+ * @param header The header will be saved in this variable.
+ * @param index The segment index will be saved in this array, image->count entries.
+ * @return uint64_t Total size in cache file format.
+ */
+uint64_t ImageCacheLayout(const ImageCacheKey *key, const FlashImage *image, ImageCacheHeader *header, ImageCacheSegment *index)
+{
+    uint64_t offset = sizeof(ImageCacheHeader) + (uint64_t)image->count * sizeof(ImageCacheSegment);
+    memset(header, 0, sizeof(ImageCacheHeader));
+    memcpy(header->magic, IMAGE_CACHE_MAGIC, 4);
+    header->version = IMAGE_CACHE_VERSION;
+    header->sourceHash = key->sourceHash;
+    header->specHash = key->specHash;
+    header->sourceSize = key->sourceSize;
+    header->segmentsCount = image->count;
+    if (image->sha256Valid)
+    {
+        header->flags |= IMAGE_CACHE_SHA256;
+        memcpy(header->sha256, image->sha256, SHA256_DIGEST_SIZE);
+    }
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        offset = (offset + IMAGE_CACHE_ALIGNMENT - 1) & ~(uint64_t)(IMAGE_CACHE_ALIGNMENT - 1);
+        memset(&index[i], 0, sizeof(ImageCacheSegment));
+        index[i].address = image->segments[i].address;
+        index[i].size = image->segments[i].size;
+        index[i].offset = offset;
+        index[i].checksum = image->segments[i].checksum;
+        index[i].checksumExtension = image->segments[i].checksumExtension;
+        memcpy(index[i].sha256, image->segments[i].sha256, SHA256_DIGEST_SIZE);
+        memcpy(index[i].digests, image->segments[i].digests, sizeof(index[i].digests));
+        offset += image->segments[i].size;
+    }
+    header->fileSize = offset;
+    header->payloadHash = ImageCachePayloadHash(index, image->segments, image->count);
+    return offset;
+}
+
+/**
+ * @brief Save a parsed image to the cache.
+ * The file is written under a temporary name and renamed when complete,
+ * so a concurrent ImageCacheLoad never maps a partial file.
+ * 
+ * @param key Cache key of the flash file.
+ * @param image A parsed image with valid checksums.
+ * @return uint8_t 0 on success.
+ */
+uint8_t ImageCacheStore(const ImageCacheKey *key, const FlashImage *image)
+{
+    char path[256], tempPath[272];
+    static const uint8_t padding[IMAGE_CACHE_ALIGNMENT] = {0};
+    ImageCacheHeader header;
+    FILE *pFile;
+    if (!imageCacheEnabled || !image->checksumsValid)
+    {
+        return 1;
+    }
+    ImageCacheSegment *index = (ImageCacheSegment *)malloc((image->count ? image->count : 1) * sizeof(ImageCacheSegment));
+    if (index == 0)
+    {
+        return 1;
+    }
+    ImageCacheLayout(key, image, &header, index);
+#ifdef _WIN32
+    _mkdir(imageCacheDirectory);
+#else
+    mkdir(imageCacheDirectory, 0700);
+#endif
+    ImageCachePath(key, path, sizeof(path));
+#ifdef _WIN32
+    snprintf(tempPath, sizeof(tempPath), "%s.%lu", path, (unsigned long)GetCurrentProcessId());
+#else
+    snprintf(tempPath, sizeof(tempPath), "%s.%lu", path, (unsigned long)getpid());
+#endif
+    pFile = fopen(tempPath, "wb");
+    if (pFile == 0)
+    {
+        LOG_WARN("Can't create image cache file: %s", tempPath);
+        free(index);
+        return 1;
+    }
+    uint8_t failed = fwrite(&header, sizeof(header), 1, pFile) != 1 ||
+                     (image->count != 0 && fwrite(index, sizeof(ImageCacheSegment), image->count, pFile) != image->count);
+    uint64_t offset = sizeof(ImageCacheHeader) + (uint64_t)image->count * sizeof(ImageCacheSegment);
+    for (uint32_t i = 0; i < image->count && !failed; i++)
+    {
+        // Pad up to the start of this segment.
+        size_t pad = (size_t)(index[i].offset - offset);
+        failed = pad != 0 && fwrite(padding, 1, pad, pFile) != pad;
+        failed |= index[i].size != 0 && fwrite(image->segments[i].data, 1, index[i].size, pFile) != index[i].size;
+        offset = index[i].offset + index[i].size;
+    }
+    free(index);
+    failed |= fclose(pFile) != 0;
+    if (failed)
+    {
+        LOG_WARN("Can't write image cache file: %s", tempPath);
+        remove(tempPath);
+        return 1;
+    }
+#ifdef _WIN32
+    // rename doesn't replace an existing file on Windows.
+    remove(path);
+#endif
+    if (rename(tempPath, path) != 0)
+    {
+        remove(tempPath);
+        return 1;
+    }
+    LOG_INFO("Image cache saved: %s", path);
+    return 0;
+}
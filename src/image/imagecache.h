@@ -0,0 +1,78 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+#include <stdint.h>
+#include <stdio.h>
+#include "minilogger.h"
+#include "flashimage.h"
+
+#define IMAGE_CACHE_MAGIC "BLIC"
+#define IMAGE_CACHE_VERSION 4
+#define IMAGE_CACHE_ALIGNMENT 64
+#define IMAGE_CACHE_SHA256 0x1 // The SHA-256 digests are valid.
+
+/**
+ * @brief Header of an image cache file.
+ * The header is followed by segmentsCount ImageCacheSegment entries and
+ * the raw payload of all segments, each aligned to IMAGE_CACHE_ALIGNMENT.
+ * The same format is used for images published in shared memory.
+ * 
+ */
+typedef struct
+{
+    char magic[4];          // IMAGE_CACHE_MAGIC
+    uint32_t version;       // IMAGE_CACHE_VERSION
+    uint64_t sourceHash;    // Hash of the flash file content.
+    uint64_t specHash;      // Hash of the crcspec content.
+    uint64_t sourceSize;    // Size of the flash file.
+    uint64_t fileSize;      // Size of this cache file.
+    uint32_t segmentsCount; // Amount of segments.
+    uint32_t flags;         // IMAGE_CACHE_* flags.
+    uint8_t sha256[SHA256_DIGEST_SIZE]; // SHA-256 of the data of all segments.
+    uint64_t payloadHash;   // Hash of the segment index and the data of all segments.
+} ImageCacheHeader;
+
+/**
+ * @brief Segment index entry of an image cache file.
+ * 
+ */
+typedef struct
+{
+    uint32_t address;  // Start address of the segment.
+    uint32_t size;     // Bytes of data in the segment.
+    uint64_t offset;   // Offset of the segment data from the start of the cache file.
+    uint32_t checksum; // CRC-* of the segment data.
+    uint32_t checksumExtension; // Bytes 5 to 8 of a CRC wider than 32 bits.
+    uint8_t sha256[SHA256_DIGEST_SIZE]; // SHA-256 of the segment data.
+    uint64_t digests[CRC_DIGESTS_MAX];  // CRCs of the digest set the image was opened with.
+} ImageCacheSegment;
+
+/**
+ * @brief Identifies a flash file content together with the CRC specification.
+ * 
+ */
+typedef struct
+{
+    uint64_t sourceHash;
+    uint64_t specHash;
+    uint64_t sourceSize;
+} ImageCacheKey;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern uint8_t imageCacheEnabled;
+extern const char *imageCacheDirectory;
+uint64_t HashBuffer(const uint8_t *buffer, size_t length, uint64_t seed);
+void *MapFile(const char *fileName, size_t *size);
+void UnmapFile(void *mapping, size_t size);
+uint8_t ImageCacheKeyOf(const char *fileName, const char *specName, ImageCacheKey *key);
+uint8_t ImageCacheAttach(const ImageCacheKey *key, FlashImage *image, uint8_t *mapping, size_t size,
+                         void (*releaseMapping)(void *mapping, size_t size));
+uint8_t ImageCacheVerify(const FlashImage *image);
+uint64_t ImageCacheLayout(const ImageCacheKey *key, const FlashImage *image, ImageCacheHeader *header, ImageCacheSegment *index);
+uint8_t ImageCacheLoad(const ImageCacheKey *key, FlashImage *image);
+uint8_t ImageCacheStore(const ImageCacheKey *key, const FlashImage *image);
+#ifdef __cplusplus
+}
+#endif
+#endif
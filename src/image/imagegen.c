@@ -0,0 +1,342 @@
+/**
+ * @file imagegen.c
+ * @brief This file writes synthetic Intel HEX and SREC files of any size
+ * for benchmarks and regression tests. The data is pseudo random, so it
+ * can't be compressed, with runs of erased flash. The same parameters
+ * and seed always give the same file.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "imagegen.h"
+
+#define IMAGEGEN_CHUNK 16
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+/**
+ * @brief Get the next value of a splitmix64 generator.
+ *
+ * @param state State of the generator.
+ * @return uint64_t A pseudo random value.
+ */
+static uint64_t NextRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Get a pseudo random value between 0 and 1.
+ *
+ * @param state State of the generator.
+ * @return double A value in [0, 1).
+ */
+static double NextUniform(uint64_t *state)
+{
+    return (NextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief Fill the data of a segment from its own generator, so it doesn't
+ * depend on the order the segments are written in.
+ *
+ * @param state State of the generator of the segment.
+ * @param fillDensity Ratio of chunks of 0xFF.
+ * @param buffer The data will be saved in this buffer.
+ * @param length Length of the buffer, a multiple of IMAGEGEN_CHUNK.
+ */
+static void FillSegmentData(uint64_t *state, double fillDensity, uint8_t *buffer, size_t length)
+{
+    for (size_t i = 0; i < length; i += IMAGEGEN_CHUNK)
+    {
+        if (fillDensity > 0 && NextUniform(state) < fillDensity)
+        {
+            memset(buffer + i, 0xFF, IMAGEGEN_CHUNK);
+            continue;
+        }
+        for (size_t j = 0; j < IMAGEGEN_CHUNK; j += 8)
+        {
+            uint64_t value = NextRandom(state);
+            memcpy(buffer + i + j, &value, 8);
+        }
+    }
+}
+
+/**
+ * @brief Format a HEX or SREC record with its checksum.
+ *
+ * @param line The record and a line feed will be saved in this buffer of at least 600 bytes.
+ * @param format FORMAT_HEX or FORMAT_SREC.
+ * @param type Record type, e.g. 0x04 for HEX or 3 for an S3 record.
+ * @param address Address field of the record.
+ * @param addressBytes Bytes of the address field, 2 for HEX.
+ * @param data Data of the record.
+ * @param length Amount of data bytes.
+ * @return size_t Length of the line.
+ */
+static size_t FormatRecord(char *line, flashFileFormat format, uint8_t type, uint32_t address,
+                           uint8_t addressBytes, const uint8_t *data, uint32_t length)
+{
+    uint8_t header[6];
+    uint32_t headerLength = 0, sum = 0;
+    char *c = line;
+    if (format == FORMAT_HEX)
+    {
+        *c++ = ':';
+        header[headerLength++] = (uint8_t)length;
+    }
+    else
+    {
+        *c++ = 'S';
+        *c++ = hexDigits[type];
+        header[headerLength++] = (uint8_t)(addressBytes + length + 1);
+    }
+    for (uint8_t i = addressBytes; i-- > 0;)
+    {
+        header[headerLength++] = (uint8_t)(address >> (8 * i));
+    }
+    if (format == FORMAT_HEX)
+    {
+        header[headerLength++] = type;
+    }
+    for (uint32_t i = 0; i < headerLength; i++)
+    {
+        *c++ = hexDigits[header[i] >> 4];
+        *c++ = hexDigits[header[i] & 0xF];
+        sum += header[i];
+    }
+    for (uint32_t i = 0; i < length; i++)
+    {
+        *c++ = hexDigits[data[i] >> 4];
+        *c++ = hexDigits[data[i] & 0xF];
+        sum += data[i];
+    }
+    // HEX uses the two's complement of the sum, SREC the one's complement.
+    uint8_t checksum = format == FORMAT_HEX ? (uint8_t)(0x100 - (sum & 0xFF)) : (uint8_t)~sum;
+    *c++ = hexDigits[checksum >> 4];
+    *c++ = hexDigits[checksum & 0xF];
+    *c++ = '\n';
+    return (size_t)(c - line);
+}
+
+/**
+ * @brief Get a gap between two segments.
+ *
+ * @param spec Parameters of the image.
+ * @param gapMin Smallest gap, at least 1.
+ * @param state State of the generator.
+ * @return uint64_t The gap in bytes.
+ */
+static uint64_t NextGap(const ImageGenSpec *spec, uint32_t gapMin, uint64_t *state)
+{
+    uint32_t gapMax = spec->gapMax > gapMin ? spec->gapMax : gapMin;
+    if (spec->gap == IMAGEGEN_GAP_EXPONENTIAL)
+    {
+        double gap = -log(1.0 - NextUniform(state)) * (gapMax - gapMin) / 2.0;
+        return gapMin + (gap < gapMax - gapMin ? (uint64_t)gap : gapMax - gapMin);
+    }
+    return gapMin + NextRandom(state) % ((uint64_t)gapMax - gapMin + 1);
+}
+
+/**
+ * @brief Set the parameters of a 16 MB Intel HEX file of 8 segments.
+ *
+ * @param spec The parameters will be saved in this variable.
+ */
+void ImageGenDefaults(ImageGenSpec *spec)
+{
+    memset(spec, 0, sizeof(ImageGenSpec));
+    spec->format = FORMAT_HEX;
+    spec->size = 16 << 20;
+    spec->recordLength = 32;
+    spec->segments = 8;
+    spec->baseAddress = 0x01000000;
+    spec->gap = IMAGEGEN_GAP_UNIFORM;
+    spec->gapMin = 0x100;
+    spec->gapMax = 0x10000;
+    spec->seed = 1;
+}
+
+/**
+ * @brief Write a synthetic Intel HEX or SREC file. Segments are laid out
+ * from the base address with gaps between them, then some are moved out
+ * of address order, each is written in records of the record length.
+ * HEX files get an extended linear address record for each 64 KB page.
+ *
+ * @param fileName The flash file to be written.
+ * @param spec Parameters of the file.
+ * @param profile A CRC profile, or 0.
+ * @param checksums The CRC of the profile of each segment, in the order of the file, is saved in this array of spec->segments values.
+ * @return uint8_t 0 on success, 1 if the parameters are invalid or the file can't be written.
+ */
+uint8_t GenerateFlashFile(const char *fileName, const ImageGenSpec *spec, const CrcProfile *profile,
+                          uint64_t *checksums)
+{
+    uint32_t count = spec->segments;
+    uint32_t gapMin = spec->gapMin != 0 ? spec->gapMin : 1;
+    uint64_t state = spec->seed;
+    uint64_t *sizes, *addresses, end, weights = 0;
+    uint32_t *order;
+    uint8_t srecType = spec->srecType, addressBytes = 2, result = 0;
+    uint32_t maxLength;
+    if ((spec->format != FORMAT_HEX && spec->format != FORMAT_SREC) || count == 0 || spec->size < count ||
+        srecType > 3)
+    {
+        LOG_ERROR("Invalid parameters of synthetic image %s", fileName);
+        return 1;
+    }
+    sizes = (uint64_t *)malloc(count * sizeof(uint64_t));
+    addresses = (uint64_t *)malloc(count * sizeof(uint64_t));
+    order = (uint32_t *)malloc(count * sizeof(uint32_t));
+    if (sizes == 0 || addresses == 0 || order == 0)
+    {
+        free(sizes);
+        free(addresses);
+        free(order);
+        return 1;
+    }
+
+    // Sizes vary by weights of 750 to 1250, the last segment takes the rest.
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sizes[i] = 750 + NextRandom(&state) % 501;
+        weights += sizes[i];
+    }
+    end = spec->baseAddress;
+    uint64_t remaining = spec->size;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t size = i + 1 < count ? spec->size / weights * sizes[i] + spec->size % weights * sizes[i] / weights : remaining;
+        if (size == 0)
+            size = 1;
+        if (size > remaining - (count - 1 - i))
+            size = remaining - (count - 1 - i);
+        remaining -= size;
+        sizes[i] = size;
+        addresses[i] = end;
+        end += size + (i + 1 < count ? NextGap(spec, gapMin, &state) : 0);
+        order[i] = i;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (spec->outOfOrder > 0 && NextUniform(&state) < spec->outOfOrder)
+        {
+            uint32_t j = (uint32_t)(NextRandom(&state) % count);
+            uint32_t swap = order[i];
+            order[i] = order[j];
+            order[j] = swap;
+        }
+    }
+
+    if (spec->format == FORMAT_SREC)
+    {
+        if (srecType == 0)
+            srecType = end <= 0x10000 ? 1 : end <= 0x1000000 ? 2 : 3;
+        addressBytes = srecType + 1;
+        maxLength = 255 - addressBytes - 1;
+    }
+    else
+    {
+        maxLength = 255;
+    }
+    if (end > ((uint64_t)1 << (8 * (spec->format == FORMAT_SREC ? addressBytes : 4))) ||
+        spec->recordLength == 0 || spec->recordLength > maxLength)
+    {
+        LOG_ERROR("Synthetic image %s doesn't fit its address space or record length", fileName);
+        free(sizes);
+        free(addresses);
+        free(order);
+        return 1;
+    }
+
+    FILE *pFile = fopen(fileName, "wb");
+    uint32_t bufferLength = 1 << 16;
+    uint8_t *data = (uint8_t *)malloc(bufferLength);
+    char line[600];
+    if (pFile == 0 || data == 0)
+    {
+        LOG_ERROR("Can't create synthetic image %s", fileName);
+        if (pFile != 0)
+            fclose(pFile);
+        free(data);
+        free(sizes);
+        free(addresses);
+        free(order);
+        return 1;
+    }
+    setvbuf(pFile, 0, _IOFBF, 1 << 20);
+    if (spec->format == FORMAT_SREC)
+    {
+        const uint8_t header[] = "imagegen";
+        fwrite(line, 1, FormatRecord(line, FORMAT_SREC, 0, 0, 2, header, 8), pFile);
+    }
+    uint32_t page = 0xFFFFFFFF;
+    for (uint32_t k = 0; k < count; k++)
+    {
+        uint32_t i = order[k];
+        uint64_t segmentState = spec->seed ^ (0xD1B54A32D192ED03ULL * (i + 1));
+        CrcProfileState crc;
+        if (profile != 0)
+            CrcProfileStart(profile, &crc);
+        for (uint64_t offset = 0; offset < sizes[i]; offset += bufferLength)
+        {
+            uint32_t length = sizes[i] - offset < bufferLength ? (uint32_t)(sizes[i] - offset) : bufferLength;
+            FillSegmentData(&segmentState, spec->fillDensity, data, bufferLength);
+            if (profile != 0)
+                CrcProfileUpdate(profile, &crc, data, length);
+            for (uint32_t position = 0; position < length;)
+            {
+                uint32_t address = (uint32_t)(addresses[i] + offset + position);
+                uint32_t recordLength = length - position < spec->recordLength ? length - position : spec->recordLength;
+                if (spec->format == FORMAT_HEX)
+                {
+                    // A record must not cross a 64 KB page.
+                    if (recordLength > 0x10000 - (address & 0xFFFF))
+                        recordLength = 0x10000 - (address & 0xFFFF);
+                    if (address >> 16 != page)
+                    {
+                        uint8_t upper[2] = {(uint8_t)(address >> 24), (uint8_t)(address >> 16)};
+                        page = address >> 16;
+                        fwrite(line, 1, FormatRecord(line, FORMAT_HEX, 0x04, 0, 2, upper, 2), pFile);
+                    }
+                    fwrite(line, 1, FormatRecord(line, FORMAT_HEX, 0x00, address & 0xFFFF, 2,
+                                                 data + position, recordLength), pFile);
+                }
+                else
+                {
+                    fwrite(line, 1, FormatRecord(line, FORMAT_SREC, srecType, address, addressBytes,
+                                                 data + position, recordLength), pFile);
+                }
+                position += recordLength;
+            }
+        }
+        if (profile != 0 && checksums != 0)
+            checksums[k] = CrcProfileFinish(profile, &crc);
+    }
+    if (spec->format == FORMAT_HEX)
+        fwrite(line, 1, FormatRecord(line, FORMAT_HEX, 0x01, 0, 2, 0, 0), pFile);
+    else
+        fwrite(line, 1, FormatRecord(line, FORMAT_SREC, 10 - srecType, 0, addressBytes, 0, 0), pFile);
+    result = ferror(pFile) != 0;
+    if (fclose(pFile) != 0 || result)
+    {
+        LOG_ERROR("Can't write synthetic image %s", fileName);
+        result = 1;
+    }
+    else
+    {
+        LOG_INFO("Synthetic image %s: %u segments, %u bytes of data", fileName, count, (uint32_t)spec->size);
+    }
+    free(data);
+    free(sizes);
+    free(addresses);
+    free(order);
+    return result;
+}
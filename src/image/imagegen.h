@@ -0,0 +1,48 @@
+#ifndef IMAGEGEN_H
+#define IMAGEGEN_H
+#include <stdint.h>
+#include "minilogger.h"
+#include "crc.h"
+#include "filepraser.h"
+
+/**
+ * @brief Distribution of the gaps between the segments of a synthetic image.
+ *
+ */
+typedef enum
+{
+    IMAGEGEN_GAP_UNIFORM,     // Uniform between gapMin and gapMax.
+    IMAGEGEN_GAP_EXPONENTIAL  // gapMin plus an exponential part with mean (gapMax - gapMin) / 2, at most gapMax.
+} imageGenGap;
+
+/**
+ * @brief Parameters of a synthetic flash file. The same parameters and seed
+ * always give the same file.
+ *
+ */
+typedef struct
+{
+    flashFileFormat format;  // FORMAT_HEX or FORMAT_SREC.
+    uint8_t srecType;        // 1, 2 or 3 for S1, S2 or S3 data records, 0 for the shortest fitting all addresses.
+    uint64_t size;           // Bytes of data of all segments.
+    uint32_t recordLength;   // Data bytes per record, 1 to 255 for HEX, to 250 for SREC.
+    uint32_t segments;       // Amount of segments, their sizes vary by up to 25 %.
+    uint32_t baseAddress;    // Address of the lowest segment.
+    imageGenGap gap;
+    uint32_t gapMin;         // Bytes between two segments, at least 1 so segments stay apart.
+    uint32_t gapMax;
+    double outOfOrder;       // Ratio of segments written out of address order, 0 to 1.
+    double fillDensity;      // Ratio of 16 byte chunks of erased flash 0xFF, 0 to 1.
+    uint64_t seed;
+} ImageGenSpec;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void ImageGenDefaults(ImageGenSpec *spec);
+uint8_t GenerateFlashFile(const char *fileName, const ImageGenSpec *spec, const CrcProfile *profile,
+                          uint64_t *checksums);
+#ifdef __cplusplus
+}
+#endif
+#endif
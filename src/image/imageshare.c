@@ -0,0 +1,467 @@
+/**
+ * @file imageshare.c
+ * @author Huang Dong (dohuang@borgwarner.com)
+ * @brief This file publishes parsed images in named shared memory, so all
+ * CAPL nodes and processes opening the same flash file with the same CRC
+ * specification use one read only copy of the image.
+ * A region starts with an ImageShareHeader holding a reference count and
+ * the process id of each attached image, followed by the image in cache
+ * file format. References of processes which exited without detaching are
+ * dropped by the next node attaching, so a region left by crashed nodes is
+ * removed. Regions are only accessible by the user who created them, the
+ * image is mapped read only and its payload hash is verified before it is used.
+ * @version 0.1
+ * @date 2023-05-24
+ * 
+ * @copyright Copyright (c) 2023
+ * 
+ */
+#include "imageshare.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#endif
+
+_Static_assert(sizeof(ImageShareHeader) <= IMAGE_SHARE_HEADER_SIZE, "ImageShareHeader size");
+
+/**
+ * @brief Local variables definition.
+ * 
+ */
+uint8_t imageShareEnabled = 0;
+
+/**
+ * @brief Build the name of the shared memory region of a key.
+ * 
+ * @param key Cache key of the flash file.
+ * @param name Buffer to save the name, 48 bytes.
+ */
+static void ImageShareName(const ImageCacheKey *key, char *name)
+{
+#ifdef _WIN32
+    snprintf(name, 48, "Local\\blimg_%.16llx%.16llx",
+#else
+    snprintf(name, 48, "/blimg_%.16llx%.16llx",
+#endif
+             (unsigned long long)key->sourceHash, (unsigned long long)key->specHash);
+}
+
+/**
+ * @brief Get the id of this process.
+ * 
+ * @return uint32_t Process id.
+ */
+static uint32_t ImageShareProcessId(void)
+{
+#ifdef _WIN32
+    return (uint32_t)GetCurrentProcessId();
+#else
+    return (uint32_t)getpid();
+#endif
+}
+
+/**
+ * @brief Check if a process is still running.
+ * 
+ * @param pid Process id.
+ * @return uint8_t 1 if the process is running, or can't be checked.
+ */
+static uint8_t ImageShareProcessAlive(uint32_t pid)
+{
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)pid);
+    if (process == 0)
+    {
+        return GetLastError() == ERROR_INVALID_PARAMETER ? 0 : 1;
+    }
+    uint8_t alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+#endif
+}
+
+/**
+ * @brief Remove the name of a region, its memory is freed by the OS when the
+ * last mapping is gone. A named file mapping on Windows is removed with its
+ * last handle.
+ * 
+ * @param name Name of the region.
+ */
+static void ImageShareUnlink(const char *name)
+{
+#ifdef _WIN32
+    (void)name;
+#else
+    shm_unlink(name);
+#endif
+}
+
+/**
+ * @brief Record this process as the owner of a new reference.
+ * 
+ * @param header Header of the region.
+ * @return uint8_t 0 on success, 1 if all slots are used.
+ */
+static uint8_t ImageShareClaim(ImageShareHeader *header)
+{
+    uint32_t pid = ImageShareProcessId();
+    for (uint32_t i = 0; i < IMAGE_SHARE_OWNERS; i++)
+    {
+        uint32_t none = 0;
+        if (atomic_compare_exchange_strong(&header->owners[i], &none, pid))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Drop a reference of a process.
+ * The last reference dropped removes the region name.
+ * 
+ * @param header Header of the region.
+ * @param slot Slot of the reference.
+ * @param pid Process id saved in the slot.
+ * @return uint8_t 0 on success, 1 if the slot has been dropped by another node.
+ */
+static uint8_t ImageShareDrop(ImageShareHeader *header, uint32_t slot, uint32_t pid)
+{
+    if (!atomic_compare_exchange_strong(&header->owners[slot], &pid, 0))
+    {
+        return 1;
+    }
+    if (atomic_fetch_sub(&header->refCount, 1) == 1)
+    {
+        ImageShareUnlink(header->name);
+    }
+    return 0;
+}
+
+/**
+ * @brief Drop the references of processes which exited without detaching.
+ * 
+ * @param header Header of the region.
+ * @return uint32_t Amount of references dropped.
+ */
+static uint32_t ImageShareReap(ImageShareHeader *header)
+{
+    uint32_t dropped = 0;
+    for (uint32_t i = 0; i < IMAGE_SHARE_OWNERS; i++)
+    {
+        uint32_t pid = atomic_load(&header->owners[i]);
+        if (pid != 0 && !ImageShareProcessAlive(pid) && ImageShareDrop(header, i, pid) == 0)
+        {
+            dropped++;
+        }
+    }
+    return dropped;
+}
+
+/**
+ * @brief Release an image attached to a shared memory region.
+ * The last image released removes the region name, the memory itself is
+ * freed by the OS when the last mapping is gone.
+ * 
+ * @param mapping Start of the image data, IMAGE_SHARE_HEADER_SIZE bytes after the region start.
+ * @param size Size of the image data.
+ */
+static void ImageShareRelease(void *mapping, size_t size)
+{
+    ImageShareHeader *header = (ImageShareHeader *)((uint8_t *)mapping - IMAGE_SHARE_HEADER_SIZE);
+    uint32_t pid = ImageShareProcessId();
+    // Any slot of this process will do, a slot is only dropped by another node if this process is gone.
+    for (uint32_t i = 0; i < IMAGE_SHARE_OWNERS; i++)
+    {
+        if (atomic_load(&header->owners[i]) == pid && ImageShareDrop(header, i, pid) == 0)
+        {
+            break;
+        }
+    }
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(header);
+#else
+    munmap(header, size + IMAGE_SHARE_HEADER_SIZE);
+#endif
+}
+
+/**
+ * @brief Map a shared memory region.
+ * 
+ * @param name Name of the region.
+ * @param size Size of the region, 0 to open an existing region.
+ * @return uint8_t* Start of the region, 0 if it can't be created or doesn't exist.
+ */
+static uint8_t *ImageShareMap(const char *name, size_t *size)
+{
+    uint8_t *region = 0;
+#ifdef _WIN32
+    HANDLE section;
+    if (*size != 0)
+    {
+        section = CreateFileMappingA(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE,
+                                     (DWORD)((uint64_t)*size >> 32), (DWORD)*size, name);
+        if (section != 0 && GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(section);
+            return 0;
+        }
+    }
+    else
+    {
+        section = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+    }
+    if (section == 0)
+    {
+        return 0;
+    }
+    // The view keeps the section alive after its handle is closed.
+    region = (uint8_t *)MapViewOfFile(section, FILE_MAP_ALL_ACCESS, 0, 0, *size);
+    CloseHandle(section);
+    if (region != 0 && *size == 0)
+    {
+        MEMORY_BASIC_INFORMATION info;
+        VirtualQuery(region, &info, sizeof(info));
+        *size = info.RegionSize;
+    }
+#else
+    int file;
+    if (*size != 0)
+    {
+        file = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (file >= 0 && ftruncate(file, (off_t)*size) != 0)
+        {
+            close(file);
+            shm_unlink(name);
+            return 0;
+        }
+    }
+    else
+    {
+        struct stat fileStat;
+        file = shm_open(name, O_RDWR, 0);
+        if (file >= 0 && fstat(file, &fileStat) == 0)
+        {
+            // A region created by another user may have been prepared to be flashed.
+            if (fileStat.st_uid != geteuid() || (fileStat.st_mode & 077) != 0)
+            {
+                LOG_WARN("Shared image isn't private to this user: %s", name);
+                close(file);
+                return 0;
+            }
+            *size = (size_t)fileStat.st_size;
+        }
+    }
+    if (file < 0)
+    {
+        return 0;
+    }
+    if (*size >= IMAGE_SHARE_HEADER_SIZE)
+    {
+        region = (uint8_t *)mmap(0, *size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        if (region == MAP_FAILED)
+        {
+            region = 0;
+        }
+    }
+    close(file);
+#endif
+    return region;
+}
+
+/**
+ * @brief Make the image of a region read only, only the header holding the
+ * reference count stays writable.
+ * 
+ * @param region Start of the region.
+ * @param size Size of the region.
+ * @return uint8_t 0 on success.
+ */
+static uint8_t ImageShareProtect(uint8_t *region, size_t size)
+{
+    if (size <= IMAGE_SHARE_HEADER_SIZE)
+    {
+        return 0;
+    }
+#ifdef _WIN32
+    DWORD protect;
+    return VirtualProtect(region + IMAGE_SHARE_HEADER_SIZE, size - IMAGE_SHARE_HEADER_SIZE, PAGE_READONLY, &protect) ? 0 : 1;
+#else
+    return mprotect(region + IMAGE_SHARE_HEADER_SIZE, size - IMAGE_SHARE_HEADER_SIZE, PROT_READ) == 0 ? 0 : 1;
+#endif
+}
+
+static void ImageShareUnmap(uint8_t *region, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(region);
+#else
+    munmap(region, size);
+#endif
+}
+
+/**
+ * @brief Attach to an image published by another CAPL node or process.
+ * 
+ * @param key Cache key of the flash file.
+ * @param image The shared image will be saved in this variable.
+ * @return uint8_t 0 on success, 1 if no complete and valid image has been published.
+ */
+uint8_t ImageShareAttach(const ImageCacheKey *key, FlashImage *image)
+{
+    char name[48];
+    size_t size = 0;
+    if (!imageShareEnabled)
+    {
+        return 1;
+    }
+    ImageShareName(key, name);
+    uint8_t *region = ImageShareMap(name, &size);
+    if (region == 0)
+    {
+        return 1;
+    }
+    ImageShareHeader *header = (ImageShareHeader *)region;
+    if (size < sizeof(ImageShareHeader) || memcmp(header->magic, IMAGE_SHARE_MAGIC, 4) != 0)
+    {
+        ImageShareUnmap(region, size);
+        return 1;
+    }
+    // A region left by crashed nodes, or by a publisher which crashed while writing it, is removed.
+    if (ImageShareReap(header) != 0)
+    {
+        LOG_WARN("Dropped references of exited processes to shared image: %s", name);
+    }
+    uint32_t refCount = atomic_load(&header->refCount);
+    uint8_t valid = atomic_load_explicit(&header->ready, memory_order_acquire) == 1;
+    // A region whose last reference is gone is about to be removed.
+    while (valid && refCount != 0 &&
+           !atomic_compare_exchange_weak(&header->refCount, &refCount, refCount + 1))
+    {
+    }
+    if (!valid || refCount == 0)
+    {
+        ImageShareUnmap(region, size);
+        return 1;
+    }
+    if (ImageShareClaim(header) != 0)
+    {
+        if (atomic_fetch_sub(&header->refCount, 1) == 1)
+        {
+            ImageShareUnlink(header->name);
+        }
+        ImageShareUnmap(region, size);
+        return 1;
+    }
+    FlashImage shared = {0, 0, 0, 0, 0, 0, 0};
+    if (ImageShareProtect(region, size) != 0 ||
+        ImageCacheAttach(key, &shared, region + IMAGE_SHARE_HEADER_SIZE, size - IMAGE_SHARE_HEADER_SIZE, ImageShareRelease) != 0)
+    {
+        LOG_WARN("Invalid shared image: %s", name);
+        ImageShareRelease(region + IMAGE_SHARE_HEADER_SIZE, size - IMAGE_SHARE_HEADER_SIZE);
+        return 1;
+    }
+    if (ImageCacheVerify(&shared) != 0)
+    {
+        LOG_WARN("Corrupted shared image: %s", name);
+        ImageClear(&shared);
+        return 1;
+    }
+    shared.checksumBytes = image->checksumBytes;
+    shared.digestsCount = image->digestsCount;
+    memcpy(shared.digestBytes, image->digestBytes, sizeof(shared.digestBytes));
+    ImageClear(image);
+    *image = shared;
+    LOG_INFO("Attached to shared image: %s references: %d", name, refCount + 1);
+    return 0;
+}
+
+/**
+ * @brief Publish a parsed image in shared memory.
+ * The image is copied to a new region and then attached to it,
+ * so the private copy of the image is freed.
+ * 
+ * @param key Cache key of the flash file.
+ * @param image A parsed image with valid checksums.
+ * @return uint8_t 0 on success, 1 if the region exists already or can't be created.
+ */
+uint8_t ImageSharePublish(const ImageCacheKey *key, FlashImage *image)
+{
+    char name[48];
+    ImageCacheHeader cacheHeader;
+    if (!imageShareEnabled || !image->checksumsValid || image->releaseMapping == ImageShareRelease)
+    {
+        return 1;
+    }
+    ImageCacheSegment *index = (ImageCacheSegment *)malloc((image->count ? image->count : 1) * sizeof(ImageCacheSegment));
+    if (index == 0)
+    {
+        return 1;
+    }
+    size_t size = (size_t)ImageCacheLayout(key, image, &cacheHeader, index) + IMAGE_SHARE_HEADER_SIZE;
+    ImageShareName(key, name);
+    uint8_t *region = ImageShareMap(name, &size);
+    if (region == 0)
+    {
+        free(index);
+        return 1;
+    }
+    ImageShareHeader *header = (ImageShareHeader *)region;
+    uint8_t *data = region + IMAGE_SHARE_HEADER_SIZE;
+    // Claimed before writing, so a region left by a crash while writing is removed by the next node.
+    memcpy(header->magic, IMAGE_SHARE_MAGIC, 4);
+    memcpy(header->name, name, sizeof(header->name));
+    atomic_store(&header->refCount, 1);
+    ImageShareClaim(header);
+    memcpy(data, &cacheHeader, sizeof(cacheHeader));
+    memcpy(data + sizeof(cacheHeader), index, image->count * sizeof(ImageCacheSegment));
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        memcpy(data + index[i].offset, image->segments[i].data, index[i].size);
+    }
+    free(index);
+    atomic_store_explicit(&header->ready, 1, memory_order_release);
+    FlashImage shared = {0, 0, 0, 0, 0, 0, 0};
+    if (ImageShareProtect(region, size) != 0 ||
+        ImageCacheAttach(key, &shared, data, size - IMAGE_SHARE_HEADER_SIZE, ImageShareRelease) != 0)
+    {
+        ImageShareRelease(data, size - IMAGE_SHARE_HEADER_SIZE);
+        return 1;
+    }
+    shared.checksumBytes = image->checksumBytes;
+    shared.digestsCount = image->digestsCount;
+    memcpy(shared.digestBytes, image->digestBytes, sizeof(shared.digestBytes));
+    ImageClear(image);
+    *image = shared;
+    LOG_INFO("Published shared image: %s", name);
+    return 0;
+}
+
+/**
+ * @brief Get the amount of images attached to the shared region of an image.
+ * 
+ * @param image An image.
+ * @return uint32_t Reference count, 0 if the image isn't shared.
+ */
+uint32_t ImageShareReferences(const FlashImage *image)
+{
+    if (image->releaseMapping != ImageShareRelease)
+    {
+        return 0;
+    }
+    const ImageShareHeader *header = (const ImageShareHeader *)((const uint8_t *)image->mapping - IMAGE_SHARE_HEADER_SIZE);
+    return atomic_load((atomic_uint *)&header->refCount);
+}
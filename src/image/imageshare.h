@@ -0,0 +1,44 @@
+#ifndef IMAGESHARE_H
+#define IMAGESHARE_H
+#include <stdint.h>
+#ifdef __cplusplus
+#include <atomic>
+#define IMAGE_SHARE_ATOMIC std::atomic_uint
+#else
+#include <stdatomic.h>
+#define IMAGE_SHARE_ATOMIC atomic_uint
+#endif
+#include "minilogger.h"
+#include "flashimage.h"
+#include "imagecache.h"
+
+#define IMAGE_SHARE_MAGIC "BLIS"
+#define IMAGE_SHARE_HEADER_SIZE 0x10000 // Covers the page size and the allocation granularity of the OS.
+#define IMAGE_SHARE_OWNERS 256          // Maximum amount of images attached to a region.
+
+/**
+ * @brief Header of a shared memory region, padded to IMAGE_SHARE_HEADER_SIZE
+ * bytes, so the image starts on a page of its own.
+ * 
+ */
+typedef struct
+{
+    char magic[4];                                 // IMAGE_SHARE_MAGIC
+    IMAGE_SHARE_ATOMIC ready;                      // Set when the image has been written completely.
+    IMAGE_SHARE_ATOMIC refCount;                   // Amount of images attached to this region.
+    uint32_t reserved;
+    char name[48];                                 // Name of this region.
+    IMAGE_SHARE_ATOMIC owners[IMAGE_SHARE_OWNERS]; // Process id of each attached image, 0 for a free slot.
+} ImageShareHeader;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern uint8_t imageShareEnabled;
+uint8_t ImageShareAttach(const ImageCacheKey *key, FlashImage *image);
+uint8_t ImageSharePublish(const ImageCacheKey *key, FlashImage *image);
+uint32_t ImageShareReferences(const FlashImage *image);
+#ifdef __cplusplus
+}
+#endif
+#endif
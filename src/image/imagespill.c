@@ -0,0 +1,276 @@
+/**
+ * @file imagespill.c
+ * @author Huang Dong (dohuang@borgwarner.com)
+ * @brief This file contains the spill file of images streamed with a memory
+ * ceiling. The data decoded from a flash file is written to a binary file
+ * in one pass and read back sequentially through a window of fixed size
+ * while it is transferred, so the resident memory doesn't grow with the image.
+ * @version 0.1
+ * @date 2023-05-24
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include "imagespill.h"
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Seek to a position of a file larger than 2 GB.
+ *
+ * @param pFile An open file.
+ * @param position Offset from the start of the file.
+ * @return int 0 on success.
+ */
+static int SpillSeek(FILE *pFile, uint64_t position)
+{
+#ifdef _WIN32
+    return _fseeki64(pFile, (__int64)position, SEEK_SET);
+#else
+    return fseeko(pFile, (off_t)position, SEEK_SET);
+#endif
+}
+
+/**
+ * @brief Create a file for reading and writing, only if it doesn't exist,
+ * so the spill file of another process is never truncated.
+ *
+ * @param fileName Path of the file.
+ * @return FILE* The new file, 0 if it exists or can't be created.
+ */
+static FILE *SpillCreate(const char *fileName)
+{
+#ifdef _WIN32
+    int file = _open(fileName, _O_RDWR | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+    FILE *pFile = file >= 0 ? _fdopen(file, "w+b") : 0;
+    if (file >= 0 && pFile == 0)
+    {
+        _close(file);
+    }
+#else
+    int file = open(fileName, O_RDWR | O_CREAT | O_EXCL, 0600);
+    FILE *pFile = file >= 0 ? fdopen(file, "w+b") : 0;
+    if (file >= 0 && pFile == 0)
+    {
+        close(file);
+    }
+#endif
+    return pFile;
+}
+
+/**
+ * @brief Build the name of a spill file unique to this process, so CANoe
+ * processes sharing a project directory don't use the same spill file.
+ *
+ * @param name Buffer to save the name.
+ * @param length Length of the buffer.
+ * @param prefix Path and start of the file name.
+ * @param number Number of the spill file in this process.
+ */
+void SpillFileName(char *name, size_t length, const char *prefix, uint32_t number)
+{
+#ifdef _WIN32
+    unsigned long processId = (unsigned long)_getpid();
+#else
+    unsigned long processId = (unsigned long)getpid();
+#endif
+    snprintf(name, length, "%s%lu_%u", prefix, processId, number);
+}
+
+/**
+ * @brief Write the data buffered in the window to the spill file.
+ *
+ * @param spill A spill being written.
+ * @return uint8_t 0 on success, 1 if the file can't be written.
+ */
+static uint8_t SpillFlush(FlashSpill *spill)
+{
+    if (spill->windowLength != 0 && fwrite(spill->window, 1, spill->windowLength, spill->file) != spill->windowLength)
+    {
+        LOG_ERROR("Can't write spill file: %s", spill->fileName);
+        return 1;
+    }
+    spill->windowPosition += spill->windowLength;
+    spill->windowLength = 0;
+    return 0;
+}
+
+/**
+ * @brief Create a spill file. It fails if a file of the same name exists.
+ *
+ * @param spill The spill to be opened, its content is overwritten.
+ * @param fileName Path of the spill file.
+ * @param windowSize Bytes of data held in memory, at least 1.
+ * @return uint8_t 0 on success.
+ */
+uint8_t SpillOpen(FlashSpill *spill, const char *fileName, uint32_t windowSize)
+{
+    size_t nameLength = strlen(fileName) + 1;
+    memset(spill, 0, sizeof(FlashSpill));
+    spill->fileName = (char *)malloc(nameLength);
+    spill->window = (uint8_t *)malloc(windowSize);
+    if (spill->fileName == 0 || spill->window == 0)
+    {
+        LOG_ERROR("Out of memory when opening spill file: %s", fileName);
+        SpillClose(spill);
+        return 1;
+    }
+    memcpy(spill->fileName, fileName, nameLength);
+    spill->windowSize = windowSize;
+    spill->writing = 1;
+    spill->file = SpillCreate(fileName);
+    if (spill->file == 0)
+    {
+        LOG_ERROR("Can't create spill file: %s", fileName);
+        SpillClose(spill);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Start the data of the next segment at the current end of the spill.
+ *
+ * @param spill A spill being written.
+ * @return uint8_t 0 on success, 1 if out of memory.
+ */
+uint8_t SpillAddSegment(FlashSpill *spill)
+{
+    if (spill->count == spill->capacity)
+    {
+        uint32_t capacity = spill->capacity ? spill->capacity * 2 : 8;
+        uint64_t *offsets = (uint64_t *)realloc(spill->offsets, capacity * sizeof(uint64_t));
+        if (offsets == 0)
+        {
+            LOG_ERROR("Out of memory when adding segment %u to spill file", spill->count);
+            return 1;
+        }
+        spill->offsets = offsets;
+        spill->capacity = capacity;
+    }
+    spill->offsets[spill->count++] = spill->size;
+    return 0;
+}
+
+/**
+ * @brief Append data to the last segment of a spill.
+ * The data is buffered in the window and written when the window is full.
+ *
+ * @param spill A spill being written.
+ * @param data Data to be appended.
+ * @param length Length of data.
+ * @return uint8_t 0 on success, 1 if the file can't be written.
+ */
+uint8_t SpillWrite(FlashSpill *spill, const uint8_t *data, uint32_t length)
+{
+    while (length != 0)
+    {
+        uint32_t room = spill->windowSize - spill->windowLength;
+        if (room == 0)
+        {
+            if (SpillFlush(spill) != 0)
+            {
+                return 1;
+            }
+            room = spill->windowSize;
+        }
+        if (room > length)
+        {
+            room = length;
+        }
+        memcpy(spill->window + spill->windowLength, data, room);
+        spill->windowLength += room;
+        spill->size += room;
+        data += room;
+        length -= room;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write the rest of the data to the spill file, it is read from the
+ * file from now on.
+ *
+ * @param spill A spill being written.
+ * @return uint8_t 0 on success, 1 if the file can't be written.
+ */
+uint8_t SpillFinish(FlashSpill *spill)
+{
+    if (SpillFlush(spill) != 0 || fflush(spill->file) != 0)
+    {
+        LOG_ERROR("Can't write spill file: %s", spill->fileName);
+        return 1;
+    }
+    spill->writing = 0;
+    spill->windowPosition = 0;
+    return 0;
+}
+
+/**
+ * @brief Read data of a segment through the window. The window is refilled
+ * from the spill file when the data isn't in it, so reading a segment from
+ * its start to its end reads the file once.
+ *
+ * @param spill A finished spill.
+ * @param segment Index of the segment.
+ * @param offset Offset of the data in the segment.
+ * @param length Bytes wanted, the bytes available at the returned pointer
+ * are saved in this variable, at most the window size.
+ * @return const uint8_t* The data, 0 if it can't be read.
+ */
+const uint8_t *SpillRead(FlashSpill *spill, uint32_t segment, uint32_t offset, uint32_t *length)
+{
+    if (spill->writing || segment >= spill->count)
+    {
+        return 0;
+    }
+    uint64_t position = spill->offsets[segment] + offset;
+    if (position + *length > spill->size)
+    {
+        return 0;
+    }
+    if (*length > spill->windowSize)
+    {
+        *length = spill->windowSize;
+    }
+    if (position < spill->windowPosition || position + *length > spill->windowPosition + spill->windowLength)
+    {
+        uint64_t rest = spill->size - position;
+        uint32_t fill = rest < spill->windowSize ? (uint32_t)rest : spill->windowSize;
+        spill->windowPosition = position;
+        spill->windowLength = 0;
+        if (SpillSeek(spill->file, position) != 0 || fread(spill->window, 1, fill, spill->file) != fill)
+        {
+            LOG_ERROR("Can't read spill file: %s", spill->fileName);
+            return 0;
+        }
+        spill->windowLength = fill;
+    }
+    return spill->window + (position - spill->windowPosition);
+}
+
+/**
+ * @brief Close and remove the spill file and free the window.
+ *
+ * @param spill A spill, opened or not.
+ */
+void SpillClose(FlashSpill *spill)
+{
+    if (spill->file != 0)
+    {
+        fclose(spill->file);
+        remove(spill->fileName);
+    }
+    free(spill->fileName);
+    free(spill->offsets);
+    free(spill->window);
+    memset(spill, 0, sizeof(FlashSpill));
+}
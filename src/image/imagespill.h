@@ -0,0 +1,41 @@
+#ifndef IMAGESPILL_H
+#define IMAGESPILL_H
+#include <stdint.h>
+#include <stdio.h>
+#include "minilogger.h"
+
+/**
+ * @brief Binary spill file of a streamed image. The decoded data of all
+ * segments is written to the file in segment order, only a window of it
+ * stays in memory and is refilled from the file when it is read.
+ *
+ */
+typedef struct
+{
+    FILE *file;
+    char *fileName;           // Removed when the spill is closed.
+    uint64_t *offsets;        // Offset of the data of each segment in the file.
+    uint32_t count;           // Amount of segments.
+    uint32_t capacity;        // Amount of offsets allocated.
+    uint64_t size;            // Bytes written to the file.
+    uint8_t *window;          // Write buffer while streaming, read cache afterwards.
+    uint32_t windowSize;
+    uint32_t windowLength;    // Valid bytes in the window.
+    uint64_t windowPosition;  // Offset of the first byte of the window in the file.
+    uint8_t writing;          // The window holds data not written to the file yet.
+} FlashSpill;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void SpillFileName(char *name, size_t length, const char *prefix, uint32_t number);
+uint8_t SpillOpen(FlashSpill *spill, const char *fileName, uint32_t windowSize);
+uint8_t SpillAddSegment(FlashSpill *spill);
+uint8_t SpillWrite(FlashSpill *spill, const uint8_t *data, uint32_t length);
+uint8_t SpillFinish(FlashSpill *spill);
+const uint8_t *SpillRead(FlashSpill *spill, uint32_t segment, uint32_t offset, uint32_t *length);
+void SpillClose(FlashSpill *spill);
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,13 +1,278 @@
 #include "minilogger.h"
+#include "tracelog.h"
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
 
+/**
+ * FileLogger formats each message into a slot of a ring buffer and returns.
+ * The ring is drained to the log file in large writes by a background
+ * thread every LOG_FLUSH_INTERVAL ms, or by a caller of FileLogger when
+ * the ring is full, so the memory used by the logger is bounded.
+ * Slot i serves the positions i, i + LOG_SLOT_COUNT, ... of the ring.
+ * Its turn is 2 * lap while the slot is free for lap, and 2 * lap + 1
+ * when the message of lap can be written to the log file.
+ */
+#define LOG_SLOT_COUNT 512
+#define LOG_MESSAGE_SIZE 480
+#define LOG_WRITE_BUFFER_SIZE 0x10000
+#define LOG_FLUSH_INTERVAL 50
 
-const char * logFileName;
+typedef struct
+{
+    atomic_ullong turn;
+    time_t time;
+    const char *tag;
+    char message[LOG_MESSAGE_SIZE];
+} LogSlot;
+
+/**
+ * @brief Runtime log level, messages of a lower level are not logged.
+ *
+ */
+unsigned char logLevel = LOG_LEVEL_INFO;
+
+static LogSlot logSlots[LOG_SLOT_COUNT];
+static atomic_ullong logTail;     // Next position to be written by FileLogger.
+static unsigned long long logHead; // Next position to be drained, guarded by the drain lock.
+static char logFileName[260];
+static FILE *logFile;
+static time_t logStampTime = (time_t)-1;
+static char logStamp[32];
 
+#ifdef _WIN32
+static SRWLOCK logDrainLock = SRWLOCK_INIT;
+static SRWLOCK logThreadLock = SRWLOCK_INIT;
+static HANDLE logThread;
+static HANDLE logStopEvent;
+#define LockDrain() AcquireSRWLockExclusive(&logDrainLock)
+#define UnlockDrain() ReleaseSRWLockExclusive(&logDrainLock)
+#else
+static pthread_mutex_t logDrainLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t logThreadLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logStopCondition = PTHREAD_COND_INITIALIZER;
+static pthread_t logThread;
+static uint8_t logThreadRunning;
+static uint8_t logStop;
+#define LockDrain() pthread_mutex_lock(&logDrainLock)
+#define UnlockDrain() pthread_mutex_unlock(&logDrainLock)
+#endif
 
+/**
+ * @brief Write all complete messages of the ring to the log file.
+ * The drain lock must be held. Messages are dropped if no log file is set.
+ *
+ */
+static void DrainLog(void)
+{
+    for (;;)
+    {
+        LogSlot *slot = &logSlots[logHead % LOG_SLOT_COUNT];
+        unsigned long long lap = logHead / LOG_SLOT_COUNT;
+        if (atomic_load_explicit(&slot->turn, memory_order_acquire) != 2 * lap + 1)
+            break;
+        if (logFile == 0 && logFileName[0] != '\0')
+        {
+            logFile = fopen(logFileName, "a");
+            if (logFile != 0)
+                setvbuf(logFile, 0, _IOFBF, LOG_WRITE_BUFFER_SIZE);
+        }
+        if (logFile != 0)
+        {
+            // Messages of the same second share one time stamp.
+            if (slot->time != logStampTime)
+            {
+                logStampTime = slot->time;
+#ifdef _WIN32
+                ctime_s(logStamp, sizeof(logStamp), &logStampTime);
+#else
+                ctime_r(&logStampTime, logStamp);
+#endif
+                logStamp[24] = '\0';
+            }
+            fprintf(logFile, "%s [%s]: %s\n", logStamp, slot->tag, slot->message);
+        }
+        atomic_store_explicit(&slot->turn, 2 * lap + 2, memory_order_release);
+        logHead++;
+    }
+    if (logFile != 0)
+        fflush(logFile);
+}
 
+/**
+ * @brief Write all messages logged so far to the log file.
+ *
+ */
+void FileLoggerFlush(void)
+{
+    LockDrain();
+    DrainLog();
+    UnlockDrain();
+}
+
+#ifdef _WIN32
+static DWORD WINAPI LogFlusher(LPVOID parameter)
+{
+    while (WaitForSingleObject(logStopEvent, LOG_FLUSH_INTERVAL) == WAIT_TIMEOUT)
+    {
+        FileLoggerFlush();
+        TraceFlush();
+    }
+    return 0;
+}
+
+/**
+ * @brief Start the thread writing log messages and trace events.
+ *
+ */
+void FileLoggerStartFlusher(void)
+{
+    AcquireSRWLockExclusive(&logThreadLock);
+    if (logThread == 0)
+    {
+        logStopEvent = CreateEventA(0, TRUE, FALSE, 0);
+        if (logStopEvent != 0)
+            logThread = CreateThread(0, 0, LogFlusher, 0, 0, 0);
+        if (logThread == 0 && logStopEvent != 0)
+        {
+            CloseHandle(logStopEvent);
+            logStopEvent = 0;
+        }
+    }
+    ReleaseSRWLockExclusive(&logThreadLock);
+}
+
+static void StopLogFlusher(void)
+{
+    AcquireSRWLockExclusive(&logThreadLock);
+    if (logThread != 0)
+    {
+        SetEvent(logStopEvent);
+        WaitForSingleObject(logThread, INFINITE);
+        CloseHandle(logThread);
+        CloseHandle(logStopEvent);
+        logThread = 0;
+        logStopEvent = 0;
+    }
+    ReleaseSRWLockExclusive(&logThreadLock);
+}
+#else
+static void *LogFlusher(void *parameter)
+{
+    pthread_mutex_lock(&logThreadLock);
+    while (!logStop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += LOG_FLUSH_INTERVAL * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&logStopCondition, &logThreadLock, &deadline);
+        pthread_mutex_unlock(&logThreadLock);
+        FileLoggerFlush();
+        TraceFlush();
+        pthread_mutex_lock(&logThreadLock);
+    }
+    pthread_mutex_unlock(&logThreadLock);
+    return 0;
+}
+
+/**
+ * @brief Start the thread writing log messages and trace events.
+ *
+ */
+void FileLoggerStartFlusher(void)
+{
+    pthread_mutex_lock(&logThreadLock);
+    if (!logThreadRunning)
+    {
+        logStop = 0;
+        logThreadRunning = pthread_create(&logThread, 0, LogFlusher, 0) == 0;
+    }
+    pthread_mutex_unlock(&logThreadLock);
+}
+
+static void StopLogFlusher(void)
+{
+    pthread_mutex_lock(&logThreadLock);
+    if (!logThreadRunning)
+    {
+        pthread_mutex_unlock(&logThreadLock);
+        return;
+    }
+    logStop = 1;
+    pthread_cond_signal(&logStopCondition);
+    pthread_mutex_unlock(&logThreadLock);
+    pthread_join(logThread, 0);
+    logThreadRunning = 0;
+}
+#endif
+
+/**
+ * @brief Messages and events still in the rings are written when the process exits.
+ * Only drains the ring, the flusher thread may already be gone.
+ *
+ */
+static void FlushLogAtExit(void)
+{
+    FileLoggerFlush();
+    TraceFlush();
+}
+
+/**
+ * @brief Set the log file of FileLogger and start the flusher thread.
+ * Messages logged before are written to the previous log file.
+ *
+ * @param fileName Path of the log file, messages are appended.
+ */
 void FileLoggerInit(const char *fileName)
 {
-    logFileName=fileName;
+    static uint8_t atExitRegistered = 0;
+    LockDrain();
+    if (strncmp(logFileName, fileName, sizeof(logFileName) - 1) != 0)
+    {
+        DrainLog();
+        if (logFile != 0)
+        {
+            fclose(logFile);
+            logFile = 0;
+        }
+        snprintf(logFileName, sizeof(logFileName), "%s", fileName);
+    }
+    if (!atExitRegistered)
+    {
+        atExitRegistered = 1;
+        atexit(FlushLogAtExit);
+    }
+    UnlockDrain();
+    FileLoggerStartFlusher();
+}
+
+/**
+ * @brief Stop the flusher thread, write all messages and close the log file.
+ * Logging afterwards still works, the ring is drained when it's full or
+ * the next FileLoggerInit starts the flusher again.
+ *
+ */
+void FileLoggerClose(void)
+{
+    StopLogFlusher();
+    LockDrain();
+    DrainLog();
+    if (logFile != 0)
+    {
+        fclose(logFile);
+        logFile = 0;
+    }
+    UnlockDrain();
 }
 
 void Logger(const char* tag, const char* message,...) {
@@ -22,14 +287,37 @@ void Logger(const char* tag, const char* message,...) {
 }
 
 void FileLogger(const char* tag, const char* message,...) {
-   time_t now;
-   time(&now);
+   unsigned long long position = atomic_load_explicit(&logTail, memory_order_relaxed);
+   LogSlot *slot;
    va_list args;
+   // Reserve the slot of the next position.
+   for (;;)
+   {
+      unsigned long long lap = position / LOG_SLOT_COUNT;
+      unsigned long long turn;
+      slot = &logSlots[position % LOG_SLOT_COUNT];
+      turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+      if (turn == 2 * lap)
+      {
+         if (atomic_compare_exchange_weak_explicit(&logTail, &position, position + 1,
+                                                   memory_order_relaxed, memory_order_relaxed))
+            break;
+      }
+      else if (turn < 2 * lap)
+      {
+         // The ring is full, drain it on this thread.
+         FileLoggerFlush();
+         position = atomic_load_explicit(&logTail, memory_order_relaxed);
+      }
+      else
+      {
+         position = atomic_load_explicit(&logTail, memory_order_relaxed);
+      }
+   }
+   time(&slot->time);
+   slot->tag = tag;
    va_start(args,message);
-   FILE * pFile=fopen(logFileName,"a");
-   fprintf(pFile,"%.24s [%s]: ", ctime(&now), tag);
-   vfprintf(pFile,message,args);
-   fprintf(pFile,"\n");
-   fclose(pFile);
+   vsnprintf(slot->message, sizeof(slot->message), message, args);
    va_end(args);
+   atomic_store_explicit(&slot->turn, 2 * (position / LOG_SLOT_COUNT) + 1, memory_order_release);
 }
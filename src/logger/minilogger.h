@@ -3,13 +3,31 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <time.h>
+#include <stdlib.h>
 
-#define LOG_INFO(...) FileLogger("I",__VA_ARGS__)
-#define LOG_DEBUG(...) FileLogger("D",__VA_ARGS__)
-#define LOG_ERROR(...) FileLogger("E",__VA_ARGS__)
-#define LOG_TRACE(...) FileLogger("T",__VA_ARGS__)
-#define LOG_WARN(...) FileLogger("W",__VA_ARGS__)
-#define LOG_FATAL(...) FileLogger("F",__VA_ARGS__)
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_FATAL 5
+#define LOG_LEVEL_OFF 6
+
+// Messages below LOG_COMPILE_LEVEL are removed at build time, e.g. with
+// -DLOG_COMPILE_LEVEL=LOG_LEVEL_INFO. Messages below the runtime level
+// logLevel are skipped before their arguments are evaluated.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+#define LOG_AT(level, tag, ...) do { if ((level) >= LOG_COMPILE_LEVEL && (level) >= logLevel) FileLogger(tag,__VA_ARGS__); } while (0)
+
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO,"I",__VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG,"D",__VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR,"E",__VA_ARGS__)
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE,"T",__VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN,"W",__VA_ARGS__)
+#define LOG_FATAL(...) LOG_AT(LOG_LEVEL_FATAL,"F",__VA_ARGS__)
 
 #define log_info(...) Logger("I",__VA_ARGS__)
 #define log_debug(...) Logger("D",__VA_ARGS__)
@@ -18,10 +36,16 @@
 #define log_warn(...) Logger("W",__VA_ARGS__)
 #define log_fatal(...) Logger("F",__VA_ARGS__)
 
+#include "tracelog.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+extern unsigned char logLevel;
 void FileLoggerInit(const char *fileName);
+void FileLoggerFlush(void);
+void FileLoggerStartFlusher(void);
+void FileLoggerClose(void);
 void Logger(const char* tag, const char* messages,...);
 void FileLogger(const char* tag, const char* message,...);
 #ifdef __cplusplus
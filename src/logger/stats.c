@@ -0,0 +1,181 @@
+#include "stats.h"
+#include "tracelog.h"
+#include <stdatomic.h>
+
+/**
+ * Phase times and blBuffer latencies are accumulated with relaxed atomic
+ * operations, so any thread can add to them without a lock.
+ * Latencies are counted in a log-linear histogram: values below
+ * STATS_SUB_BUCKETS nanoseconds have a bucket each, every power of two
+ * above is split into STATS_SUB_BUCKETS buckets, so a percentile is
+ * reported with an error below 1 / STATS_SUB_BUCKETS.
+ */
+#define STATS_SUB_BUCKETS 8
+#define STATS_SUB_BITS 3
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+typedef struct
+{
+    atomic_ullong calls;
+    atomic_ullong total; // Nanoseconds.
+    atomic_ullong max;   // Nanoseconds.
+} StatsCounter;
+
+static StatsCounter statsPhases[PHASE_COUNT];
+static StatsCounter statsBuffer;
+static atomic_ullong statsBufferBytes;
+static atomic_ullong statsBufferHistogram[STATS_BUCKETS];
+
+static uint64_t StatsNanoseconds(uint64_t ticks)
+{
+    uint64_t ticksPerSecond = TraceTicksPerSecond();
+    return ticks / ticksPerSecond * 1000000000ULL + ticks % ticksPerSecond * 1000000000ULL / ticksPerSecond;
+}
+
+static uint32_t StatsBucket(uint64_t value)
+{
+    uint32_t exponent = 0;
+    if (value < STATS_SUB_BUCKETS)
+        return (uint32_t)value;
+    while ((value >> exponent) >= 2 * STATS_SUB_BUCKETS)
+        exponent++;
+    // value >> exponent is in [STATS_SUB_BUCKETS, 2 * STATS_SUB_BUCKETS).
+    return (exponent + 1) * STATS_SUB_BUCKETS + (uint32_t)(value >> exponent) - STATS_SUB_BUCKETS;
+}
+
+static uint64_t StatsBucketLimit(uint32_t bucket)
+{
+    uint32_t exponent;
+    if (bucket < STATS_SUB_BUCKETS)
+        return bucket;
+    exponent = bucket / STATS_SUB_BUCKETS - 1;
+    // Largest value of the bucket.
+    return ((uint64_t)(bucket % STATS_SUB_BUCKETS + STATS_SUB_BUCKETS + 1) << exponent) - 1;
+}
+
+static void StatsCount(StatsCounter *counter, uint64_t nanoseconds)
+{
+    uint64_t max = atomic_load_explicit(&counter->max, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counter->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counter->total, nanoseconds, memory_order_relaxed);
+    while (nanoseconds > max &&
+           !atomic_compare_exchange_weak_explicit(&counter->max, &max, nanoseconds,
+                                                  memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+/**
+ * @brief Get the start time of a timed phase or call.
+ *
+ * @return uint64_t Ticks of the monotonic clock of the trace log.
+ */
+uint64_t StatsStart(void)
+{
+    return TraceTimestamp();
+}
+
+/**
+ * @brief Add the time since start to a phase.
+ *
+ * @param phase The phase which has ended.
+ * @param start Returned by StatsStart when the phase began.
+ */
+void StatsAddPhase(statsPhase phase, uint64_t start)
+{
+    StatsCount(&statsPhases[phase], StatsNanoseconds(TraceTimestamp() - start));
+}
+
+/**
+ * @brief Add a blBuffer call to the latency histogram.
+ *
+ * @param start Returned by StatsStart when the call began.
+ * @param bytes Bytes of data filled into the PDU.
+ */
+void StatsAddBuffer(uint64_t start, uint32_t bytes)
+{
+    uint64_t nanoseconds = StatsNanoseconds(TraceTimestamp() - start);
+    StatsCount(&statsBuffer, nanoseconds);
+    atomic_fetch_add_explicit(&statsBufferBytes, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&statsBufferHistogram[StatsBucket(nanoseconds)], 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Get a percentile of the blBuffer latency.
+ *
+ * @param percent The percentile, 50 for the median.
+ * @return uint64_t Nanoseconds, upper limit of the histogram bucket of the percentile.
+ */
+uint64_t StatsBufferPercentile(uint32_t percent)
+{
+    uint64_t calls = 0, rank, counted = 0;
+    for (uint32_t i = 0; i < STATS_BUCKETS; i++)
+        calls += atomic_load_explicit(&statsBufferHistogram[i], memory_order_relaxed);
+    if (calls == 0)
+        return 0;
+    // Rank of the percentile, rounded up.
+    rank = (calls * percent + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+    for (uint32_t i = 0; i < STATS_BUCKETS; i++)
+    {
+        counted += atomic_load_explicit(&statsBufferHistogram[i], memory_order_relaxed);
+        if (counted >= rank)
+            return StatsBucketLimit(i);
+    }
+    return atomic_load_explicit(&statsBuffer.max, memory_order_relaxed);
+}
+
+/**
+ * @brief Clear all counters, e.g. before opening the next image.
+ *
+ */
+void StatsReset(void)
+{
+    for (uint32_t i = 0; i < PHASE_COUNT; i++)
+    {
+        atomic_store_explicit(&statsPhases[i].calls, 0, memory_order_relaxed);
+        atomic_store_explicit(&statsPhases[i].total, 0, memory_order_relaxed);
+        atomic_store_explicit(&statsPhases[i].max, 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&statsBuffer.calls, 0, memory_order_relaxed);
+    atomic_store_explicit(&statsBuffer.total, 0, memory_order_relaxed);
+    atomic_store_explicit(&statsBuffer.max, 0, memory_order_relaxed);
+    atomic_store_explicit(&statsBufferBytes, 0, memory_order_relaxed);
+    for (uint32_t i = 0; i < STATS_BUCKETS; i++)
+        atomic_store_explicit(&statsBufferHistogram[i], 0, memory_order_relaxed);
+}
+
+static uint32_t StatsClamp(uint64_t value)
+{
+    return value > 0xffffffffULL ? 0xffffffff : (uint32_t)value;
+}
+
+/**
+ * @brief Save the counters to an array, laid out as statsIndex.
+ *
+ * @param length Entries available in stats.
+ * @param stats The counters will be saved in this array.
+ * @return uint32_t Entries saved.
+ */
+uint32_t StatsExport(uint32_t length, uint32_t stats[])
+{
+    uint32_t values[STATS_COUNT];
+    for (uint32_t i = 0; i < PHASE_COUNT; i++)
+    {
+        values[3 * i + STATS_PHASE_CALLS] = StatsClamp(atomic_load_explicit(&statsPhases[i].calls, memory_order_relaxed));
+        values[3 * i + STATS_PHASE_TOTAL] = StatsClamp(atomic_load_explicit(&statsPhases[i].total, memory_order_relaxed) / 1000);
+        values[3 * i + STATS_PHASE_MAX] = StatsClamp(atomic_load_explicit(&statsPhases[i].max, memory_order_relaxed) / 1000);
+    }
+    values[STATS_BUFFER_CALLS] = StatsClamp(atomic_load_explicit(&statsBuffer.calls, memory_order_relaxed));
+    values[STATS_BUFFER_BYTES] = StatsClamp(atomic_load_explicit(&statsBufferBytes, memory_order_relaxed));
+    values[STATS_BUFFER_P50] = StatsClamp(StatsBufferPercentile(50));
+    values[STATS_BUFFER_P90] = StatsClamp(StatsBufferPercentile(90));
+    values[STATS_BUFFER_P99] = StatsClamp(StatsBufferPercentile(99));
+    values[STATS_BUFFER_MAX] = StatsClamp(atomic_load_explicit(&statsBuffer.max, memory_order_relaxed));
+    if (length > STATS_COUNT)
+        length = STATS_COUNT;
+    for (uint32_t i = 0; i < length; i++)
+        stats[i] = values[i];
+    return length;
+}
@@ -0,0 +1,51 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdint.h>
+
+/**
+ * @brief Phases of opening a flash file and transferring it, timed by
+ * StatsAddPhase.
+ *
+ */
+typedef enum
+{
+    PHASE_CONFIG_LOAD, // Reading crcspec.
+    PHASE_CRC_TABLE,   // Calculating the CRC look up table.
+    PHASE_PARSE,       // Parsing, indexing or decoding a flash file.
+    PHASE_CHECKSUM,    // Calculating segment checksums.
+    PHASE_PDU_FILL,    // Filling Transfer Data PDUs.
+    PHASE_COUNT
+} statsPhase;
+
+/**
+ * @brief Layout of the array filled by StatsExport. Times are in microseconds,
+ * blBuffer latencies in nanoseconds.
+ *
+ */
+typedef enum
+{
+    STATS_PHASE_CALLS = 0, // Per phase: calls, total time and longest call,
+    STATS_PHASE_TOTAL = 1, // at index 3 * phase + STATS_PHASE_*.
+    STATS_PHASE_MAX = 2,
+    STATS_BUFFER_CALLS = 3 * PHASE_COUNT,
+    STATS_BUFFER_BYTES,
+    STATS_BUFFER_P50,
+    STATS_BUFFER_P90,
+    STATS_BUFFER_P99,
+    STATS_BUFFER_MAX,
+    STATS_COUNT
+} statsIndex;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint64_t StatsStart(void);
+void StatsAddPhase(statsPhase phase, uint64_t start);
+void StatsAddBuffer(uint64_t start, uint32_t bytes);
+uint64_t StatsBufferPercentile(uint32_t percent);
+void StatsReset(void);
+uint32_t StatsExport(uint32_t length, uint32_t stats[]);
+#ifdef __cplusplus
+}
+#endif
+#endif
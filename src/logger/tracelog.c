@@ -0,0 +1,348 @@
+#include "tracelog.h"
+#include "minilogger.h"
+#include <string.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+ * TraceEvent saves a fixed-size record in a ring buffer, using the same
+ * slot protocol as FileLogger. The flusher thread of the logger writes
+ * the ring to the trace file together with the format strings used.
+ */
+#define TRACE_SLOT_COUNT 4096
+#define TRACE_WRITE_BUFFER_SIZE 0x10000
+
+typedef struct
+{
+    atomic_ullong turn;
+    TraceRecord record;
+} TraceSlot;
+
+_Static_assert(sizeof(TraceFileHeader) == TRACE_RECORD_SIZE, "Trace file header must have the size of a record");
+_Static_assert(sizeof(TraceRecord) == TRACE_RECORD_SIZE, "Trace record must be TRACE_RECORD_SIZE bytes");
+
+/**
+ * @brief Events are recorded while a trace file is open.
+ *
+ */
+uint8_t traceEnabled = 0;
+
+static TraceSlot traceSlots[TRACE_SLOT_COUNT];
+static atomic_ullong traceTail;     // Next position to be written by TraceEvent.
+static unsigned long long traceHead; // Next position to be drained, guarded by the drain lock.
+static const char *traceFormats[TRACE_FORMATS_MAX];
+static atomic_uint traceFormatsCount = 1; // Id 0 is TRACE_FORMAT_DEFINITION.
+static uint16_t traceFormatsWritten = 1;  // Formats defined in the trace file, guarded by the drain lock.
+static FILE *traceFile;
+static _Thread_local uint32_t traceThreadId;
+
+#ifdef _WIN32
+static SRWLOCK traceDrainLock = SRWLOCK_INIT;
+static SRWLOCK traceFormatLock = SRWLOCK_INIT;
+#define LockTrace(lock) AcquireSRWLockExclusive(&lock)
+#define UnlockTrace(lock) ReleaseSRWLockExclusive(&lock)
+#else
+static pthread_mutex_t traceDrainLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t traceFormatLock = PTHREAD_MUTEX_INITIALIZER;
+#define LockTrace(lock) pthread_mutex_lock(&lock)
+#define UnlockTrace(lock) pthread_mutex_unlock(&lock)
+#endif
+
+/**
+ * @brief Read the monotonic clock used for the time stamps of the records.
+ *
+ * @return uint64_t Ticks, see TraceTicksPerSecond.
+ */
+uint64_t TraceTimestamp(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)counter.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Get the frequency of the clock read by TraceTimestamp.
+ *
+ * @return uint64_t Ticks per second.
+ */
+uint64_t TraceTicksPerSecond(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)frequency.QuadPart;
+#else
+    return 1000000000ULL;
+#endif
+}
+
+static uint32_t TraceThreadId(void)
+{
+    if (traceThreadId == 0)
+    {
+#ifdef _WIN32
+        traceThreadId = (uint32_t)GetCurrentThreadId();
+#else
+        traceThreadId = (uint32_t)syscall(SYS_gettid);
+#endif
+    }
+    return traceThreadId;
+}
+
+/**
+ * @brief Add a format to the string table.
+ *
+ * @param format A printf format string literal.
+ * @return uint16_t Id of the format, 0 if the string table is full.
+ */
+static uint16_t TraceRegisterFormat(const char *format)
+{
+    uint16_t id = 0;
+    LockTrace(traceFormatLock);
+    uint32_t count = atomic_load_explicit(&traceFormatsCount, memory_order_relaxed);
+    for (uint32_t i = 1; i < count && id == 0; i++)
+    {
+        if (traceFormats[i] == format)
+            id = (uint16_t)i;
+    }
+    if (id == 0 && count < TRACE_FORMATS_MAX)
+    {
+        traceFormats[count] = format;
+        id = (uint16_t)count;
+        atomic_store_explicit(&traceFormatsCount, count + 1, memory_order_release);
+    }
+    UnlockTrace(traceFormatLock);
+    return id;
+}
+
+/**
+ * @brief Write the definitions of all formats not written yet to the trace file.
+ * The drain lock must be held.
+ *
+ */
+static void WriteTraceFormats(void)
+{
+    uint32_t count = atomic_load_explicit(&traceFormatsCount, memory_order_acquire);
+    for (; traceFormatsWritten < count; traceFormatsWritten++)
+    {
+        const char *format = traceFormats[traceFormatsWritten];
+        uint32_t length = (uint32_t)strlen(format);
+        if (length > TRACE_FORMAT_LENGTH_MAX)
+            length = TRACE_FORMAT_LENGTH_MAX;
+        TraceRecord definition;
+        char padding[TRACE_RECORD_SIZE] = {0};
+        memset(&definition, 0, sizeof(definition));
+        definition.formatId = TRACE_FORMAT_DEFINITION;
+        definition.arguments[0] = traceFormatsWritten;
+        definition.arguments[1] = length;
+        fwrite(&definition, sizeof(definition), 1, traceFile);
+        fwrite(format, 1, length, traceFile);
+        fwrite(padding, 1, (TRACE_RECORD_SIZE - length % TRACE_RECORD_SIZE) % TRACE_RECORD_SIZE, traceFile);
+    }
+}
+
+/**
+ * @brief Write all complete records of the ring to the trace file.
+ * The drain lock must be held. Records are dropped if no trace file is open.
+ *
+ */
+static void DrainTrace(void)
+{
+    for (;;)
+    {
+        TraceSlot *slot = &traceSlots[traceHead % TRACE_SLOT_COUNT];
+        unsigned long long lap = traceHead / TRACE_SLOT_COUNT;
+        if (atomic_load_explicit(&slot->turn, memory_order_acquire) != 2 * lap + 1)
+            break;
+        if (traceFile != 0)
+        {
+            if (slot->record.formatId >= traceFormatsWritten)
+                WriteTraceFormats();
+            fwrite(&slot->record, sizeof(slot->record), 1, traceFile);
+        }
+        atomic_store_explicit(&slot->turn, 2 * lap + 2, memory_order_release);
+        traceHead++;
+    }
+    if (traceFile != 0)
+        fflush(traceFile);
+}
+
+/**
+ * @brief Write all events recorded so far to the trace file.
+ *
+ */
+void TraceFlush(void)
+{
+    LockTrace(traceDrainLock);
+    DrainTrace();
+    UnlockTrace(traceDrainLock);
+}
+
+/**
+ * @brief Start recording events to a trace file, which is overwritten.
+ * Events still recorded for a previous trace file are written there first.
+ *
+ * @param fileName Path of the trace file.
+ * @return uint8_t 0 on success.
+ */
+uint8_t TraceOpen(const char *fileName)
+{
+    TraceFileHeader header;
+    LockTrace(traceDrainLock);
+    DrainTrace();
+    if (traceFile != 0)
+        fclose(traceFile);
+    traceFile = fopen(fileName, "wb");
+    if (traceFile == 0)
+    {
+        traceEnabled = 0;
+        UnlockTrace(traceDrainLock);
+        LOG_ERROR("Can't create trace file: %s", fileName);
+        return 1;
+    }
+    setvbuf(traceFile, 0, _IOFBF, TRACE_WRITE_BUFFER_SIZE);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, 4);
+    header.version = TRACE_VERSION;
+    header.ticksPerSecond = TraceTicksPerSecond();
+    header.recordSize = TRACE_RECORD_SIZE;
+    fwrite(&header, sizeof(header), 1, traceFile);
+    // Every trace file defines the formats it uses.
+    traceFormatsWritten = 1;
+    traceEnabled = 1;
+    UnlockTrace(traceDrainLock);
+    FileLoggerStartFlusher();
+    LOG_INFO("Trace file: %s", fileName);
+    return 0;
+}
+
+/**
+ * @brief Stop recording events, write all recorded events and close the trace file.
+ *
+ */
+void TraceClose(void)
+{
+    traceEnabled = 0;
+    LockTrace(traceDrainLock);
+    DrainTrace();
+    if (traceFile != 0)
+    {
+        fclose(traceFile);
+        traceFile = 0;
+    }
+    UnlockTrace(traceDrainLock);
+}
+
+/**
+ * @brief Reserve the slot of the next position of the ring and fill the
+ * header of its record.
+ *
+ * @param formatId Id of the format, registered at the first call if 0.
+ * @param format A printf format string literal.
+ * @param position The position of the slot will be saved here.
+ * @return TraceSlot* The slot to be completed and published by TracePublish, 0 if the format can't be registered.
+ */
+static TraceSlot *TraceReserve(uint16_t *formatId, const char *format, unsigned long long *position)
+{
+    TraceSlot *slot;
+    if (*formatId == 0)
+    {
+        *formatId = TraceRegisterFormat(format);
+        if (*formatId == 0)
+            return 0;
+    }
+    *position = atomic_load_explicit(&traceTail, memory_order_relaxed);
+    for (;;)
+    {
+        unsigned long long lap = *position / TRACE_SLOT_COUNT;
+        unsigned long long turn;
+        slot = &traceSlots[*position % TRACE_SLOT_COUNT];
+        turn = atomic_load_explicit(&slot->turn, memory_order_acquire);
+        if (turn == 2 * lap)
+        {
+            if (atomic_compare_exchange_weak_explicit(&traceTail, position, *position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (turn < 2 * lap)
+        {
+            // The ring is full, drain it on this thread.
+            TraceFlush();
+            *position = atomic_load_explicit(&traceTail, memory_order_relaxed);
+        }
+        else
+        {
+            *position = atomic_load_explicit(&traceTail, memory_order_relaxed);
+        }
+    }
+    slot->record.threadId = TraceThreadId();
+    slot->record.formatId = *formatId;
+    return slot;
+}
+
+static void TracePublish(TraceSlot *slot, unsigned long long position)
+{
+    atomic_store_explicit(&slot->turn, 2 * (position / TRACE_SLOT_COUNT) + 1, memory_order_release);
+}
+
+/**
+ * @brief Record an event, called by TRACE_EVENT.
+ *
+ * @param formatId Id of the format, registered at the first call if 0.
+ * @param format A printf format string literal.
+ * @param a First argument of the format.
+ * @param b Second argument of the format.
+ * @param c Third argument of the format.
+ * @param d Fourth argument of the format.
+ */
+void TraceEvent(uint16_t *formatId, const char *format, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    unsigned long long position;
+    TraceSlot *slot = TraceReserve(formatId, format, &position);
+    if (slot == 0)
+        return;
+    slot->record.timestamp = TraceTimestamp();
+    slot->record.kind = TRACE_KIND_EVENT;
+    slot->record.arguments[0] = a;
+    slot->record.arguments[1] = b;
+    slot->record.arguments[2] = c;
+    slot->record.arguments[3] = d;
+    TracePublish(slot, position);
+}
+
+/**
+ * @brief Record a span ending now, called by TRACE_SPAN.
+ *
+ * @param formatId Id of the format, registered at the first call if 0.
+ * @param start Start of the span, returned by TraceTimestamp.
+ * @param format A printf format string literal.
+ * @param a First argument of the format.
+ * @param b Second argument of the format.
+ */
+void TraceSpan(uint16_t *formatId, uint64_t start, const char *format, uint32_t a, uint32_t b)
+{
+    unsigned long long position;
+    uint64_t duration = TraceTimestamp() - start;
+    TraceSlot *slot = TraceReserve(formatId, format, &position);
+    if (slot == 0)
+        return;
+    slot->record.timestamp = start;
+    slot->record.kind = TRACE_KIND_SPAN;
+    slot->record.arguments[0] = a;
+    slot->record.arguments[1] = b;
+    slot->record.arguments[2] = (uint32_t)duration;
+    slot->record.arguments[3] = (uint32_t)(duration >> 32);
+    TracePublish(slot, position);
+}
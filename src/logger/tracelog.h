@@ -0,0 +1,65 @@
+#ifndef TRACELOG_H
+#define TRACELOG_H
+#include <stdint.h>
+
+/**
+ * A trace file starts with a TraceFileHeader followed by TraceRecords.
+ * A record with formatId TRACE_FORMAT_DEFINITION defines the format string
+ * of id arguments[0] with a length of arguments[1] bytes, the string follows
+ * in the next records, padded with zeros to a multiple of TRACE_RECORD_SIZE.
+ * A format is always defined before the first record using it.
+ * A record of kind TRACE_KIND_SPAN starts at its time stamp and lasts for
+ * arguments[2] | arguments[3] << 32 ticks, its format takes 2 arguments.
+ */
+#define TRACE_MAGIC "BLTR"
+#define TRACE_VERSION 1
+#define TRACE_RECORD_SIZE 32
+#define TRACE_FORMAT_DEFINITION 0
+#define TRACE_FORMATS_MAX 1024
+#define TRACE_FORMAT_LENGTH_MAX 4096 // Longer format strings are cut when they are written.
+#define TRACE_KIND_EVENT 0
+#define TRACE_KIND_SPAN 1
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t ticksPerSecond; // Unit of the time stamps of the records.
+    uint32_t recordSize;
+    uint32_t reserved[3];
+} TraceFileHeader;
+
+typedef struct
+{
+    uint64_t timestamp;     // Ticks of a monotonic clock.
+    uint32_t threadId;
+    uint16_t formatId;      // Index in the string table of printf formats.
+    uint16_t kind;          // TRACE_KIND_*.
+    uint32_t arguments[4];  // Arguments of the format.
+} TraceRecord;
+
+// Record an event with a printf format taking 0 to 4 unsigned int arguments.
+// The format must be a string literal, it is saved once in the trace file.
+// Events are removed at build time unless LOG_COMPILE_LEVEL is LOG_LEVEL_TRACE.
+#define TRACE_ARGUMENTS(format, a, b, c, d, ...) format, (uint32_t)(a), (uint32_t)(b), (uint32_t)(c), (uint32_t)(d)
+#define TRACE_EVENT(...) do { if (LOG_COMPILE_LEVEL <= LOG_LEVEL_TRACE && traceEnabled) { static uint16_t traceFormatId = 0; TraceEvent(&traceFormatId, TRACE_ARGUMENTS(__VA_ARGS__, 0, 0, 0, 0, 0)); } } while (0)
+
+// Record a span from start, a TraceTimestamp, until now, with a format taking 0 to 2 arguments.
+#define TRACE_SPAN_ARGUMENTS(format, a, b, ...) format, (uint32_t)(a), (uint32_t)(b)
+#define TRACE_SPAN(start, ...) do { if (LOG_COMPILE_LEVEL <= LOG_LEVEL_TRACE && traceEnabled) { static uint16_t traceFormatId = 0; TraceSpan(&traceFormatId, start, TRACE_SPAN_ARGUMENTS(__VA_ARGS__, 0, 0, 0)); } } while (0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+extern uint8_t traceEnabled;
+uint8_t TraceOpen(const char *fileName);
+void TraceFlush(void);
+void TraceClose(void);
+uint64_t TraceTimestamp(void);
+uint64_t TraceTicksPerSecond(void);
+void TraceEvent(uint16_t *formatId, const char *format, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
+void TraceSpan(uint16_t *formatId, uint64_t start, const char *format, uint32_t a, uint32_t b);
+#ifdef __cplusplus
+}
+#endif
+#endif
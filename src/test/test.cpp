@@ -1,9 +1,26 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <string>
 #include "minilogger.h"
 #include "crc.h"
+#include "crccatalogue.h"
+#include "crcengine.h"
+#include "sha256.h"
+#include "checksum.h"
 #include "filepraser.h"
+#include "imagecache.h"
+#include "imageshare.h"
+#include "stats.h"
 #include "capldll.h"
+#include "batch.h"
+#include "imagegen.h"
+
+// Failed test cases are counted, the test binary returns 1 if there are any.
+static uint32_t failedCases = 0;
+#define log_fail(...) (failedCases++, log_info(__VA_ARGS__))
 
 uint8_t TestSepcifyCRCParameters()
 {
@@ -23,7 +40,441 @@ uint8_t TestSepcifyCRCParameters()
         resultReflected == 0x1)
         log_info("TestSepcifyCRCParameters: pass");
     else
-        log_info("TestSepcifyCRCParameters: fail");
+        log_fail("TestSepcifyCRCParameters: fail");
+    return 0;
+}
+
+uint8_t TestLoadCrcSpec()
+{
+    const uint8_t check[] = "123456789";
+    FILE *pFile = fopen("crcspectest", "w");
+    fprintf(pFile, "Width 32\nPolynomial 04C11DB7\nInitialValue FFFFFFFF\n"
+                   "InputReflected 1\nResultReflected 1\nFinalXORvalue FFFFFFFF\n"
+                   "Profile CCITT\nWidth 16\nPolynomial 1021\nInitialValue FFFF\n");
+    fclose(pFile);
+
+    if (LoadCrcSpec("crcspectest") == 0 && CalculateCrcOfBuffer(check, 9) == 0xCBF43926)
+        log_info("TestLoadCrcSpec TC1: pass");
+    else
+        log_fail("TestLoadCrcSpec TC1: fail");
+
+    if (SelectCrcProfile("CCITT") == 0 && CalculateCrcOfBuffer(check, 9) == 0x29B10000 &&
+        SelectCrcProfile("Unknown") == 1 && CalculateCrcOfBuffer(check, 9) == 0x29B10000)
+        log_info("TestLoadCrcSpec TC2: pass");
+    else
+        log_fail("TestLoadCrcSpec TC2: fail");
+
+    // The selection is kept, a changed file is parsed again.
+    pFile = fopen("crcspectest", "w");
+    fprintf(pFile, "Width 8\nPolynomial 07\nProfile CCITT\nWidth 16\nPolynomial 1021\nInitialValue 1D0F\n");
+    fclose(pFile);
+    if (LoadCrcSpec("crcspectest") == 0 && CalculateCrcOfBuffer(check, 9) == 0xE5CC0000 &&
+        SelectCrcProfile("") == 0 && CalculateCrcOfBuffer(check, 9) == 0xF4000000)
+        log_info("TestLoadCrcSpec TC3: pass");
+    else
+        log_fail("TestLoadCrcSpec TC3: fail");
+
+    remove("crcspectest");
+    LoadCrcSpec("crcspec");
+    return 0;
+}
+
+uint8_t TestCrcPresets()
+{
+    extern crcWidth width;
+    extern uint32_t polynomial;
+    extern uint32_t initialValue;
+    extern uint32_t finalXORValue;
+    extern uint8_t inputReflected;
+    extern uint8_t resultReflected;
+    extern const CrcPreset *crcPreset;
+    extern uint32_t crcTable[256];
+    const char *names[] = {"CRC-32/ISO-HDLC", "CRC-32C", "CRC-32/MPEG-2", "CRC-16/CCITT-FALSE", "CRC-8/SAE-J1850"};
+    const uint8_t check[] = "123456789";
+    uint8_t buffer[1000];
+    uint8_t checked = 1, same = 1;
+    for (uint32_t i = 0; i < sizeof(buffer); i++)
+        buffer[i] = (uint8_t)(i * 7 + (i >> 3));
+    for (const char *name : names)
+    {
+        const CrcPreset *preset = FindCrcPreset(name);
+        uint32_t shift = preset == 0 ? 0 : preset->width == CRC8 ? 24 : preset->width == CRC16 ? 16 : 0;
+        if (preset == 0 || preset->calculate(check, 9) != preset->check << shift)
+        {
+            checked = 0;
+            continue;
+        }
+        // The generic calculation with the same parameters has the same result for every length.
+        width = preset->width;
+        polynomial = preset->polynomial;
+        initialValue = preset->initialValue;
+        finalXORValue = preset->finalXORValue;
+        inputReflected = preset->inputReflected;
+        resultReflected = preset->resultReflected;
+        crcPreset = 0;
+        CalculateCrcTable();
+        if (memcmp(crcTable, preset->table, sizeof(crcTable)) != 0)
+            same = 0;
+        for (uint32_t length = 0; length < 20; length++)
+        {
+            if (CalculateCrcOfBuffer(buffer + length, (uint32_t)sizeof(buffer) - 2 * length) !=
+                preset->calculate(buffer + length, (uint32_t)sizeof(buffer) - 2 * length))
+                same = 0;
+        }
+    }
+    if (checked && FindCrcPreset("CRC-99") == 0)
+        log_info("TestCrcPresets TC1: pass");
+    else
+        log_fail("TestCrcPresets TC1: fail");
+    if (same)
+        log_info("TestCrcPresets TC2: pass");
+    else
+        log_fail("TestCrcPresets TC2: fail");
+
+    // A preset in crcspec, or matching parameters, select the catalogue kernel.
+    FILE *pFile = fopen("crcspectest", "w");
+    fprintf(pFile, "Preset CRC-32C\nProfile SAE\nWidth 8\nPolynomial 1D\nInitialValue FF\nFinalXORvalue FF\n");
+    fclose(pFile);
+    if (LoadCrcSpec("crcspectest") == 0 && crcPreset == FindCrcPreset("CRC-32C") &&
+        CalculateCrcOfBuffer(check, 9) == 0xE3069283 &&
+        SelectCrcProfile("SAE") == 0 && crcPreset == FindCrcPreset("CRC-8/SAE-J1850") &&
+        CalculateCrcOfBuffer(check, 9) == 0x4B000000)
+        log_info("TestCrcPresets TC3: pass");
+    else
+        log_fail("TestCrcPresets TC3: fail");
+    remove("crcspectest");
+    SelectCrcProfile("");
+    LoadCrcSpec("crcspec");
+    return 0;
+}
+
+uint8_t TestCrcEngine()
+{
+    struct
+    {
+        uint8_t width;
+        uint64_t polynomial, initialValue;
+        uint8_t inputReflected, resultReflected;
+        uint64_t finalXORValue, check;
+    } models[] = {
+        {64, 0x42F0E1EBA9EA3693, 0xFFFFFFFFFFFFFFFF, 1, 1, 0xFFFFFFFFFFFFFFFF, 0x995DC9BBDF1939FA}, // CRC-64/XZ
+        {64, 0x42F0E1EBA9EA3693, 0x0, 0, 0, 0x0, 0x6C40DF5F0B497347},                               // CRC-64/ECMA-182
+        {40, 0x0004820009, 0x0, 0, 0, 0xFFFFFFFFFF, 0xD4164FC646},                                  // CRC-40/GSM
+        {24, 0x864CFB, 0xB704CE, 0, 0, 0x0, 0x21CF02},                                              // CRC-24/OPENPGP
+        {15, 0x4599, 0x0, 0, 0, 0x0, 0x059E},                                                       // CRC-15/CAN
+        {12, 0x80F, 0x0, 0, 1, 0x0, 0xDAF},                                                         // CRC-12/UMTS
+        {5, 0x05, 0x1F, 1, 1, 0x1F, 0x19},                                                          // CRC-5/USB
+        {3, 0x3, 0x7, 1, 1, 0x0, 0x6},                                                              // CRC-3/ROHC
+        {32, 0x04C11DB7, 0xFFFFFFFF, 1, 1, 0xFFFFFFFF, 0xCBF43926},                                 // CRC-32/ISO-HDLC
+    };
+    const uint8_t check[] = "123456789";
+    uint8_t buffer[100];
+    uint8_t checked = 1, same = 1;
+    static CrcEngine engine;
+    for (uint32_t i = 0; i < sizeof(buffer); i++)
+        buffer[i] = (uint8_t)(i * 13 + 5);
+    for (const auto &model : models)
+    {
+        engine.width = model.width;
+        engine.polynomial = model.polynomial;
+        engine.initialValue = model.initialValue;
+        engine.inputReflected = model.inputReflected;
+        engine.resultReflected = model.resultReflected;
+        engine.finalXORValue = model.finalXORValue;
+        CrcEngineInit(&engine);
+        if (CrcEngineCalculate(&engine, check, 9) != model.check)
+            checked = 0;
+    }
+    if (checked)
+        log_info("TestCrcEngine TC1: pass");
+    else
+        log_fail("TestCrcEngine TC1: fail");
+
+    // The engine has the results of the 8, 16 and 32 bit calculation for every length.
+    const char *names[] = {"CRC-8/SAE-J1850", "CRC-16/CCITT-FALSE", "CRC-32/MPEG-2", "CRC-32C"};
+    for (const char *name : names)
+    {
+        const CrcPreset *preset = FindCrcPreset(name);
+        uint8_t bits = preset->width == CRC8 ? 8 : preset->width == CRC16 ? 16 : 32;
+        engine.width = bits;
+        engine.polynomial = preset->polynomial;
+        engine.initialValue = preset->initialValue;
+        engine.inputReflected = preset->inputReflected;
+        engine.resultReflected = preset->resultReflected;
+        engine.finalXORValue = preset->finalXORValue;
+        CrcEngineInit(&engine);
+        for (uint32_t length = 0; length < 40; length++)
+        {
+            if ((uint32_t)(CrcEngineCalculate(&engine, buffer + length, length) << (32 - bits)) !=
+                preset->calculate(buffer + length, length))
+                same = 0;
+        }
+    }
+    if (same)
+        log_info("TestCrcEngine TC2: pass");
+    else
+        log_fail("TestCrcEngine TC2: fail");
+
+    // A crcspec profile of another width uses the engine, the CRC is saved in the first bytes.
+    FILE *pFile = fopen("crcspectest", "w");
+    fprintf(pFile, "Profile CAN\nWidth 15\nPolynomial 4599\n"
+                   "Profile XZ\nWidth 64\nPolynomial 42F0E1EBA9EA3693\nInitialValue FFFFFFFFFFFFFFFF\n"
+                   "InputReflected 1\nResultReflected 1\nFinalXORvalue FFFFFFFFFFFFFFFF\n");
+    fclose(pFile);
+    if (LoadCrcSpec("crcspectest") == 0 && GetCrcBytes() == 2 &&
+        CalculateCrc64OfBuffer(check, 9) == 0x059EULL << 48 &&
+        CalculateCrcOfBuffer(check, 9) == 0x059E0000 &&
+        SelectCrcProfile("XZ") == 0 && GetCrcBytes() == 8 &&
+        CalculateCrc64OfBuffer(check, 9) == 0x995DC9BBDF1939FA &&
+        CalculateCrcOfBuffer(check, 9) == 0x995DC9BB)
+        log_info("TestCrcEngine TC3: pass");
+    else
+        log_fail("TestCrcEngine TC3: fail");
+    remove("crcspectest");
+    SelectCrcProfile("");
+    LoadCrcSpec("crcspec");
+
+    // Pieces of any length give the CRC of the whole buffer.
+    uint8_t streamed = 1;
+    for (const auto &model : models)
+    {
+        engine.width = model.width;
+        engine.polynomial = model.polynomial;
+        engine.initialValue = model.initialValue;
+        engine.inputReflected = model.inputReflected;
+        engine.resultReflected = model.resultReflected;
+        engine.finalXORValue = model.finalXORValue;
+        CrcEngineInit(&engine);
+        uint64_t crc = CrcEngineStart(&engine);
+        for (uint32_t offset = 0, piece = 1; offset < sizeof(buffer); offset += piece, piece = piece % 11 + 1)
+        {
+            crc = CrcEngineUpdate(&engine, crc, buffer + offset,
+                                  piece < sizeof(buffer) - offset ? piece : sizeof(buffer) - offset);
+        }
+        if (CrcEngineFinish(&engine, crc) != CrcEngineCalculate(&engine, buffer, sizeof(buffer)))
+            streamed = 0;
+    }
+    if (streamed)
+        log_info("TestCrcEngine TC4: pass");
+    else
+        log_fail("TestCrcEngine TC4: fail");
+
+    // A run of fill bytes gives the CRC of the bytes written out.
+    uint8_t filled = 1;
+    std::vector<uint8_t> run(100000, 0xFF);
+    for (const auto &model : models)
+    {
+        engine.width = model.width;
+        engine.polynomial = model.polynomial;
+        engine.initialValue = model.initialValue;
+        engine.inputReflected = model.inputReflected;
+        engine.resultReflected = model.resultReflected;
+        engine.finalXORValue = model.finalXORValue;
+        CrcEngineInit(&engine);
+        for (uint32_t count : {0u, 1u, 255u, 256u, 4097u, 100000u})
+        {
+            uint64_t crc = CrcEngineUpdate(&engine, CrcEngineStart(&engine), buffer, 5);
+            crc = CrcEngineFill(&engine, crc, 0xFF, count);
+            uint64_t expected = CrcEngineUpdate(&engine, CrcEngineStart(&engine), buffer, 5);
+            expected = CrcEngineUpdate(&engine, expected, run.data(), count);
+            if (CrcEngineFinish(&engine, crc) != CrcEngineFinish(&engine, expected))
+                filled = 0;
+        }
+    }
+    if (filled)
+        log_info("TestCrcEngine TC5: pass");
+    else
+        log_fail("TestCrcEngine TC5: fail");
+
+    // The CLMUL kernel gives the CRC of the tables for every width, length and alignment.
+    uint8_t folded = 1;
+    std::vector<uint8_t> data(1200);
+    for (uint32_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 131 + (i >> 8) * 7 + 1);
+    crcEngineKernel best = GetCrcEngineKernel();
+    for (const auto &model : models)
+    {
+        engine.width = model.width;
+        engine.polynomial = model.polynomial;
+        engine.initialValue = model.initialValue;
+        engine.inputReflected = model.inputReflected;
+        engine.resultReflected = model.resultReflected;
+        engine.finalXORValue = model.finalXORValue;
+        CrcEngineInit(&engine);
+        for (uint32_t length = 0; length + 3 <= data.size(); length += length < 200 ? 1 : 97)
+        {
+            SetCrcEngineKernel(CRC_ENGINE_KERNEL_TABLE);
+            uint64_t expected = CrcEngineCalculate(&engine, data.data() + length % 3, length);
+            SetCrcEngineKernel(CRC_ENGINE_KERNEL_CLMUL);
+            if (CrcEngineCalculate(&engine, data.data() + length % 3, length) != expected)
+                folded = 0;
+        }
+    }
+    SetCrcEngineKernel(best);
+    if (folded)
+        log_info("TestCrcEngine TC6: pass");
+    else
+        log_fail("TestCrcEngine TC6: fail");
+    return 0;
+}
+
+uint8_t TestSha256()
+{
+    static const char *messages[] = {"abc", "",
+                                     "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"};
+    static const uint8_t digests[][32] = {
+        {0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+         0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad},
+        {0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+         0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55},
+        {0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+         0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1}};
+    // One million times 'a'.
+    static const uint8_t million[32] = {
+        0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92, 0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+        0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e, 0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0};
+    uint8_t digest[32];
+    uint8_t result = 0;
+    std::vector<uint8_t> buffer(1000000, 'a');
+    // Both kernels, the portable one is used if the processor has no SHA extensions.
+    for (uint8_t accelerated = 0; accelerated < 2; accelerated++)
+    {
+        Sha256SetAcceleration(accelerated);
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            Sha256((const uint8_t *)messages[i], strlen(messages[i]), digest);
+            result |= memcmp(digest, digests[i], 32) != 0;
+        }
+        Sha256(buffer.data(), buffer.size(), digest);
+        result |= memcmp(digest, million, 32) != 0;
+    }
+    if (result == 0)
+        log_info("TestSha256 TC1: pass");
+    else
+        log_fail("TestSha256 TC1: fail");
+    // Pieces of any length give the same digest.
+    Sha256Context context;
+    Sha256Init(&context);
+    for (size_t offset = 0, piece = 1; offset < buffer.size(); offset += piece, piece = piece * 3 % 997 + 1)
+    {
+        Sha256Update(&context, buffer.data() + offset, piece < buffer.size() - offset ? piece : buffer.size() - offset);
+    }
+    Sha256Final(&context, digest);
+    if (memcmp(digest, million, 32) == 0)
+        log_info("TestSha256 TC2: pass");
+    else
+        log_fail("TestSha256 TC2: fail");
+    return 0;
+}
+
+uint8_t TestChecksumAlgorithms()
+{
+    static const checksumKernel kernels[] = {CHECKSUM_KERNEL_SCALAR, CHECKSUM_KERNEL_SSE2, CHECKSUM_KERNEL_AVX2};
+    const uint8_t *check = (const uint8_t *)"123456789";
+    uint8_t result = 0;
+    // Check values of each kernel, the fastest supported one is used for a kernel the processor lacks.
+    for (checksumKernel kernel : kernels)
+    {
+        SetChecksumKernel(kernel);
+        result |= CalculateChecksum(CHECKSUM_FLETCHER16, 16, 0, 0, (const uint8_t *)"abcde", 5) != 0xC8F0;
+        result |= CalculateChecksum(CHECKSUM_FLETCHER16, 16, 0, 0, (const uint8_t *)"abcdef", 6) != 0x2057;
+        result |= CalculateChecksum(CHECKSUM_FLETCHER16, 16, 0, 0, (const uint8_t *)"abcdefgh", 8) != 0x0627;
+        result |= CalculateChecksum(CHECKSUM_FLETCHER32, 32, 0, 0, (const uint8_t *)"abcde", 5) != 0xF04FC729;
+        result |= CalculateChecksum(CHECKSUM_FLETCHER32, 32, 0, 0, (const uint8_t *)"abcdef", 6) != 0x56502D2A;
+        result |= CalculateChecksum(CHECKSUM_FLETCHER32, 32, 0, 0, (const uint8_t *)"abcdefgh", 8) != 0xEBE19591;
+        result |= CalculateChecksum(CHECKSUM_ADLER32, 32, 0, 0, (const uint8_t *)"Wikipedia", 9) != 0x11E60398;
+        result |= CalculateChecksum(CHECKSUM_BYTE_SUM, 16, 0, 0, check, 9) != 0x01DD;
+        result |= CalculateChecksum(CHECKSUM_BYTE_SUM, 8, 0, 0xFF, check, 9) != 0x22;
+        result |= CalculateChecksum(CHECKSUM_WORD_SUM_BE, 16, 0, 0, check, 9) != 0x09D4;
+        result |= CalculateChecksum(CHECKSUM_WORD_SUM_LE, 16, 0, 0, check, 9) != 0xD509;
+    }
+    if (result == 0)
+        log_info("TestChecksumAlgorithms TC1: pass");
+    else
+        log_fail("TestChecksumAlgorithms TC1: fail");
+
+    // All kernels agree with a plain loop on long buffers passed in pieces of any length.
+    std::vector<uint8_t> buffer(100000);
+    uint32_t seed = 1;
+    for (uint8_t &value : buffer)
+    {
+        seed = seed * 1103515245 + 12345;
+        value = (uint8_t)(seed >> 16);
+    }
+    uint32_t a = 1, b = 0, f1 = 0, f2 = 0;
+    for (size_t i = 0; i < buffer.size(); i++)
+    {
+        a = (a + buffer[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    for (size_t i = 0; i < buffer.size(); i += 2)
+    {
+        f1 = (f1 + (buffer[i] | buffer[i + 1] << 8)) % 65535;
+        f2 = (f2 + f1) % 65535;
+    }
+    result = 0;
+    for (checksumKernel kernel : kernels)
+    {
+        SetChecksumKernel(kernel);
+        ChecksumState adler, fletcher;
+        ChecksumStart(CHECKSUM_ADLER32, 0, &adler);
+        ChecksumStart(CHECKSUM_FLETCHER32, 0, &fletcher);
+        for (size_t offset = 0, piece = 1; offset < buffer.size(); offset += piece, piece = piece * 7 % 40009 + 1)
+        {
+            size_t length = piece < buffer.size() - offset ? piece : buffer.size() - offset;
+            ChecksumUpdate(CHECKSUM_ADLER32, &adler, buffer.data() + offset, length);
+            ChecksumUpdate(CHECKSUM_FLETCHER32, &fletcher, buffer.data() + offset, length);
+        }
+        result |= ChecksumFinish(CHECKSUM_ADLER32, 32, 0, &adler) != (b << 16 | a);
+        result |= ChecksumFinish(CHECKSUM_FLETCHER32, 32, 0, &fletcher) != (f2 << 16 | f1);
+    }
+    SetChecksumKernel(CHECKSUM_KERNEL_AVX2);
+    if (result == 0)
+        log_info("TestChecksumAlgorithms TC2: pass");
+    else
+        log_fail("TestChecksumAlgorithms TC2: fail");
+
+    // A crcspec profile selects a checksum, it is aligned like a CRC of the same width.
+    FILE *pFile = fopen("crcspectest", "w");
+    fprintf(pFile, "Profile Fletcher\nAlgorithm Fletcher16\n"
+                   "Profile Sum\nAlgorithm ByteSum\nWidth 32\nInitialValue 10\n");
+    fclose(pFile);
+    if (LoadCrcSpec("crcspectest") == 0 && GetCrcBytes() == 2 &&
+        CalculateCrcOfBuffer((const uint8_t *)"abcde", 5) == 0xC8F00000 &&
+        SelectCrcProfile("Sum") == 0 && GetCrcBytes() == 4 &&
+        CalculateCrc64OfBuffer(check, 9) == 0x1EDULL << 32)
+        log_info("TestChecksumAlgorithms TC3: pass");
+    else
+        log_fail("TestChecksumAlgorithms TC3: fail");
+    remove("crcspectest");
+    SelectCrcProfile("");
+    LoadCrcSpec("crcspec");
+
+    // A run of fill bytes gives the checksum of the bytes written out, also after an odd length.
+    static const checksumAlgorithm algorithms[] = {CHECKSUM_BYTE_SUM, CHECKSUM_WORD_SUM_BE, CHECKSUM_WORD_SUM_LE,
+                                                   CHECKSUM_FLETCHER16, CHECKSUM_FLETCHER32, CHECKSUM_ADLER32};
+    result = 0;
+    for (checksumAlgorithm algorithm : algorithms)
+    {
+        for (uint32_t count : {0u, 1u, 2u, 255u, 65536u, 99999u})
+        {
+            ChecksumState filled, expected;
+            ChecksumStart(algorithm, 0, &filled);
+            ChecksumStart(algorithm, 0, &expected);
+            ChecksumUpdate(algorithm, &filled, check, 3);
+            ChecksumUpdate(algorithm, &expected, check, 3);
+            ChecksumFill(algorithm, &filled, 0xA5, count);
+            memset(buffer.data(), 0xA5, count);
+            ChecksumUpdate(algorithm, &expected, buffer.data(), count);
+            ChecksumUpdate(algorithm, &filled, check, 9);
+            ChecksumUpdate(algorithm, &expected, check, 9);
+            result |= ChecksumFinish(algorithm, 32, 0, &filled) != ChecksumFinish(algorithm, 32, 0, &expected);
+        }
+    }
+    if (result == 0)
+        log_info("TestChecksumAlgorithms TC4: pass");
+    else
+        log_fail("TestChecksumAlgorithms TC4: fail");
     return 0;
 }
 
@@ -37,7 +488,7 @@ uint8_t TestCalculateCrcTable_CRC8()
     if (crcTable[1] == polynomial)
         log_info("TestCalculateCrcTable_CRC8: pass");
     else
-        log_info("TestCalculateCrcTable_CRC8: fail");
+        log_fail("TestCalculateCrcTable_CRC8: fail");
     return 0;
 }
 
@@ -51,7 +502,7 @@ uint8_t TestCalculateCrcTable_CRC16()
     if (crcTable[1] == polynomial)
         log_info("TestCalculateCrcTable_CRC16: pass");
     else
-        log_info("TestCalculateCrcTable_CRC16: fail");
+        log_fail("TestCalculateCrcTable_CRC16: fail");
     return 0;
 }
 
@@ -65,7 +516,7 @@ uint8_t TestCalculateCrcTable_CRC32()
     if (crcTable[1] == polynomial)
         log_info("TestCalculateCrcTable_CRC32: pass");
     else
-        log_info("TestCalculateCrcTable_CRC32: fail");
+        log_fail("TestCalculateCrcTable_CRC32: fail");
     return 0;
 }
 
@@ -74,7 +525,7 @@ uint8_t TestReflect8()
     if (Reflect8(0xee) == 0x77)
         log_info("TestReflect8: pass");
     else
-        log_info("TestReflect8: fail");
+        log_fail("TestReflect8: fail");
     return 0;
 }
 
@@ -83,7 +534,7 @@ uint8_t TestReflect16()
     if (Reflect16(0xeeee) == 0x7777)
         log_info("TestReflect16: pass");
     else
-        log_info("TestReflect16: fail");
+        log_fail("TestReflect16: fail");
     return 0;
 }
 
@@ -92,7 +543,7 @@ uint8_t TestReflect32()
     if (Reflect32(0xeeeeeeee) == 0x77777777)
         log_info("TestReflect32: pass");
     else
-        log_info("TestReflect32: fail");
+        log_fail("TestReflect32: fail");
     //    log_info("%.8X",Reflect32(0xeeee));
     return 0;
 }
@@ -116,7 +567,7 @@ uint8_t TestCalculate_CRC8()
     if (CalculateCrc("crccheckdata") == 0xF4000000)
         log_info("TestCalculate_CRC8 TC1: pass");
     else
-        log_info("TestCalculate_CRC8 TC1: fail");
+        log_fail("TestCalculate_CRC8 TC1: fail");
     // CRC-32/BZIP2
     width=CRC8;
     polynomial = 0x9B;
@@ -128,7 +579,7 @@ uint8_t TestCalculate_CRC8()
     if (CalculateCrc("crccheckdata") == 0xDA000000)
         log_info("TestCalculate_CRC8 TC2: pass");
     else
-        log_info("TestCalculate_CRC8 TC2: fail");
+        log_fail("TestCalculate_CRC8 TC2: fail");
     // CRC-32C
     width=CRC8;
     polynomial = 0x39;
@@ -140,7 +591,7 @@ uint8_t TestCalculate_CRC8()
     if (CalculateCrc("crccheckdata") == 0x15000000)
         log_info("TestCalculate_CRC8 TC3: pass");
     else
-        log_info("TestCalculate_CRC8 TC3: fail");
+        log_fail("TestCalculate_CRC8 TC3: fail");
     // CRC-32D
     width=CRC8;
     polynomial = 0xD5;
@@ -152,7 +603,7 @@ uint8_t TestCalculate_CRC8()
     if (CalculateCrc("crccheckdata") == 0xBC000000)
         log_info("TestCalculate_CRC8 TC4: pass");
     else
-        log_info("TestCalculate_CRC8 TC4: fail");
+        log_fail("TestCalculate_CRC8 TC4: fail");
 
     return 0;
 }
@@ -176,7 +627,7 @@ uint8_t TestCalculate_CRC16()
     if (CalculateCrc("crccheckdata") == 0x29B10000)
         log_info("TestCalculate_CRC16 TC1: pass");
     else
-        log_info("TestCalculate_CRC16 TC1: fail");
+        log_fail("TestCalculate_CRC16 TC1: fail");
     // CRC-32/BZIP2
     width=CRC16;
     polynomial = 0x8005;
@@ -188,7 +639,7 @@ uint8_t TestCalculate_CRC16()
     if (CalculateCrc("crccheckdata") == 0xBB3D0000)
         log_info("TestCalculate_CRC16 TC2: pass");
     else
-        log_info("TestCalculate_CRC16 TC2: fail");
+        log_fail("TestCalculate_CRC16 TC2: fail");
     // CRC-32C
     width=CRC16;
     polynomial = 0x1021;
@@ -200,7 +651,7 @@ uint8_t TestCalculate_CRC16()
     if (CalculateCrc("crccheckdata") == 0xE5CC0000)
         log_info("TestCalculate_CRC16 TC3: pass");
     else
-        log_info("TestCalculate_CRC16 TC3: fail");
+        log_fail("TestCalculate_CRC16 TC3: fail");
     // CRC-32D
     width=CRC16;
     polynomial = 0x8005;
@@ -212,7 +663,7 @@ uint8_t TestCalculate_CRC16()
     if (CalculateCrc("crccheckdata") == 0xFEE80000)
         log_info("TestCalculate_CRC16 TC4: pass");
     else
-        log_info("TestCalculate_CRC16 TC4: fail");
+        log_fail("TestCalculate_CRC16 TC4: fail");
 
     return 0;
 }
@@ -236,7 +687,7 @@ uint8_t TestCalculate_CRC32()
     if (CalculateCrc("crccheckdata") == 0xCBF43926)
         log_info("TestCalculate_CRC32 TC1: pass");
     else
-        log_info("TestCalculate_CRC32 TC1: fail");
+        log_fail("TestCalculate_CRC32 TC1: fail");
     // CRC-32/BZIP2
     width=CRC32;
     polynomial = 0x04C11DB7;
@@ -248,7 +699,7 @@ uint8_t TestCalculate_CRC32()
     if (CalculateCrc("crccheckdata") == 0xFC891918)
         log_info("TestCalculate_CRC32 TC2: pass");
     else
-        log_info("TestCalculate_CRC32 TC2: fail");
+        log_fail("TestCalculate_CRC32 TC2: fail");
     // CRC-32C
     width=CRC32;
     polynomial = 0x1EDC6F41;
@@ -260,7 +711,7 @@ uint8_t TestCalculate_CRC32()
     if (CalculateCrc("crccheckdata") == 0xE3069283)
         log_info("TestCalculate_CRC32 TC3: pass");
     else
-        log_info("TestCalculate_CRC32 TC3: fail");
+        log_fail("TestCalculate_CRC32 TC3: fail");
     // CRC-32D
     width=CRC32;
     polynomial = 0xA833982B;
@@ -272,7 +723,7 @@ uint8_t TestCalculate_CRC32()
     if (CalculateCrc("crccheckdata") == 0x87315576)
         log_info("TestCalculate_CRC32 TC4: pass");
     else
-        log_info("TestCalculate_CRC32 TC4: fail");
+        log_fail("TestCalculate_CRC32 TC4: fail");
 
     return 0;
 }
@@ -299,19 +750,19 @@ uint8_t TestHandleHex()
     if (segmentsCount == 3)
         log_info("TestHandleHex TC1: pass");
     else
-        log_info("TestHandleHex TC1: fail");
+        log_fail("TestHandleHex TC1: fail");
     if (addressAndSize[0][1] == 0x03 &&
         addressAndSize[0][7] == 0x40 &&
         addressAndSize[3][1] == 0x13 &&
         addressAndSize[3][7] == 0x70)
         log_info("TestHandleHex TC2: pass");
     else
-        log_info("TestHandleHex TC2: fail");
+        log_fail("TestHandleHex TC2: fail");
     if(checksum[0][3]==0x86 &&
     checksum[3][3]==0xcd)
         log_info("TestHandleHex TC3: pass");
     else
-        log_info("TestHandleHex TC3: fail");
+        log_fail("TestHandleHex TC3: fail");
 
     return 0;
 }
@@ -338,19 +789,109 @@ uint8_t TestHandleSREC()
     if (segmentsCount == 3)
         log_info("TestHandleSREC TC1: pass");
     else
-        log_info("TestHandleSREC TC1: fail");
+        log_fail("TestHandleSREC TC1: fail");
     if (addressAndSize[0][1] == 0x03 &&
         addressAndSize[0][7] == 0x80 &&
         addressAndSize[3][1] == 0x0f &&
         addressAndSize[3][7] == 0x10)
         log_info("TestHandleSREC TC2: pass");
     else
-        log_info("TestHandleSREC TC2: fail");
+        log_fail("TestHandleSREC TC2: fail");
     if(checksum[0][3]==0x69 &&
     checksum[3][3]==0x8a)
         log_info("TestHandleSREC TC3: pass");
     else
-        log_info("TestHandleSREC TC3: fail");
+        log_fail("TestHandleSREC TC3: fail");
+    return 0;
+}
+
+uint8_t TestHandleElf()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    extern uint32_t polynomial;
+    extern uint32_t initialValue;
+    extern uint32_t finalXORValue;
+    extern uint8_t inputReflected;
+    extern uint8_t resultReflected;
+    // CRC-32
+    polynomial = 0x04C11DB7;
+    initialValue = 0xFFFFFFFF;
+    finalXORValue = 0xFFFFFFFF;
+    inputReflected = 0x1;
+    resultReflected = 0x1;
+    CalculateCrcTable_CRC32();
+    HandleElf("test.elf", &segmentsCount,
+              addressAndSize, checksum);
+    if (segmentsCount == 1)
+        log_info("TestHandleElf TC1: pass");
+    else
+        log_fail("TestHandleElf TC1: fail");
+    if (addressAndSize[0][2] == 0x10 &&
+        addressAndSize[0][6] == 0x01 &&
+        addressAndSize[0][7] == 0x80 &&
+        addressAndSize[1][2] == 0x80 &&
+        addressAndSize[1][7] == 0x40)
+        log_info("TestHandleElf TC2: pass");
+    else
+        log_fail("TestHandleElf TC2: fail");
+    if(checksum[0][0]==0x21 && checksum[0][3]==0xa6 &&
+    checksum[1][0]==0xa8 && checksum[1][3]==0xd3)
+        log_info("TestHandleElf TC3: pass");
+    else
+        log_fail("TestHandleElf TC3: fail");
+    // A PT_LOAD of 4 GB at address 0 is rejected before its size is cut to 32 bits.
+    uint8_t elf[64 + 56] = {0x7f, 'E', 'L', 'F', 2, 1, 1};
+    elf[32] = 64;     // e_phoff
+    elf[54] = 56;     // e_phentsize
+    elf[56] = 1;      // e_phnum
+    elf[64] = 1;      // p_type PT_LOAD
+    elf[64 + 36] = 1; // p_filesz 0x100000000
+    FILE *pFile = fopen("testhuge.elf", "wb");
+    fwrite(elf, 1, sizeof(elf), pFile);
+    fclose(pFile);
+    FlashImage image = {0, 0, 0, 0, 0, 0, 0};
+    if (ParseElf("testhuge.elf", &image) != 0 && image.count == 0)
+        log_info("TestHandleElf TC4: pass");
+    else
+        log_fail("TestHandleElf TC4: fail");
+    ImageClear(&image);
+    remove("testhuge.elf");
+    return 0;
+}
+
+uint8_t TestHandleBin()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    HandleBin("test.bin", 0x1000, &segmentsCount,
+              addressAndSize, checksum);
+    if (segmentsCount == 0 &&
+        addressAndSize[0][2] == 0x10 &&
+        addressAndSize[0][6] == 0x01 &&
+        addressAndSize[0][7] == 0x80)
+        log_info("TestHandleBin TC1: pass");
+    else
+        log_fail("TestHandleBin TC1: fail");
+    if(checksum[0][0]==0x21 && checksum[0][3]==0xa6)
+        log_info("TestHandleBin TC2: pass");
+    else
+        log_fail("TestHandleBin TC2: fail");
+    return 0;
+}
+
+uint8_t TestDetectFlashFileFormat()
+{
+    if (DetectFlashFileFormat("test.HEX") == FORMAT_HEX &&
+        DetectFlashFileFormat("test.S19") == FORMAT_SREC &&
+        DetectFlashFileFormat("test.elf") == FORMAT_ELF &&
+        DetectFlashFileFormat("test.bin") == FORMAT_BIN &&
+        DetectFlashFileFormat("nonexistent") == FORMAT_UNKNOWN)
+        log_info("TestDetectFlashFileFormat: pass");
+    else
+        log_fail("TestDetectFlashFileFormat: fail");
     return 0;
 }
 
@@ -363,7 +904,7 @@ uint8_t TestAscCodedHex2Buffer()
         data[2] == 0x44)
         log_info("TestAscCodedHex2Buffer: pass");
     else
-        log_info("TestAscCodedHex2Buffer: fail");
+        log_fail("TestAscCodedHex2Buffer: fail");
     return 0;
 }
 
@@ -378,7 +919,7 @@ uint8_t TestUint2Array()
         data[3] == 0x44)
         log_info("TestUint2Array: pass");
     else
-        log_info("TestUint2Array: fail");
+        log_fail("TestUint2Array: fail");
     return 0;
 }
 
@@ -391,40 +932,1017 @@ uint8_t TestblOpenFlashFile()
     if (segmentsCount == 3)
         log_info("TestblOpenFlashFile TC1: pass");
     else
-        log_info("TestblOpenFlashFile TC1: fail");
+        log_fail("TestblOpenFlashFile TC1: fail");
     if (addressAndSize[0][1] == 0x03 &&
         addressAndSize[0][7] == 0x40 &&
         addressAndSize[3][1] == 0x13 &&
         addressAndSize[3][7] == 0x70)
         log_info("TestblOpenFlashFile TC2: pass");
     else
-        log_info("TestblOpenFlashFile TC2: fail");
+        log_fail("TestblOpenFlashFile TC2: fail");
     if(checksum[0][3]==0x86 &&
     checksum[3][3]==0xcd)
         log_info("TestblOpenFlashFile TC3: pass");
     else
-        log_info("TestblOpenFlashFile TC3: fail");
+        log_fail("TestblOpenFlashFile TC3: fail");
     blOpenFlashFile("test.S19",&segmentsCount,addressAndSize,checksum);
     if (segmentsCount == 3)
         log_info("TestblOpenFlashFile TC4: pass");
     else
-        log_info("TestblOpenFlashFile TC4: fail");
+        log_fail("TestblOpenFlashFile TC4: fail");
     if (addressAndSize[0][1] == 0x03 &&
         addressAndSize[0][7] == 0x80 &&
         addressAndSize[3][1] == 0x0f &&
         addressAndSize[3][7] == 0x10)
         log_info("TestblOpenFlashFile TC5: pass");
     else
-        log_info("TestblOpenFlashFile TC5: fail");
+        log_fail("TestblOpenFlashFile TC5: fail");
     if(checksum[0][3]==0x69 &&
     checksum[3][3]==0x8a)
         log_info("TestblOpenFlashFile TC6: pass");
     else
-        log_info("TestblOpenFlashFile TC6: fail");
+        log_fail("TestblOpenFlashFile TC6: fail");
+    blOpenFlashFile("test.elf",&segmentsCount,addressAndSize,checksum);
+    if (segmentsCount == 1 &&
+        addressAndSize[1][2] == 0x80 &&
+        checksum[1][3] == 0xd3)
+        log_info("TestblOpenFlashFile TC7: pass");
+    else
+        log_fail("TestblOpenFlashFile TC7: fail");
     return 0;
 
 }
 
+uint8_t TestHashBuffer()
+{
+    const char *text = "Nobody inspects the spammish repetition";
+    if (HashBuffer((const uint8_t *)"", 0, 0) == 0xEF46DB3751D8E999ULL &&
+        HashBuffer((const uint8_t *)"abc", 3, 0) == 0x44BC2CF5AD770999ULL &&
+        HashBuffer((const uint8_t *)text, strlen(text), 0) == 0xFBCEA83C8A378BF1ULL)
+        log_info("TestHashBuffer: pass");
+    else
+        log_fail("TestHashBuffer: fail");
+    return 0;
+}
+
+uint8_t TestImageCache()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    ImageCacheKey key;
+    char path[256];
+    // First open parses the file and saves it to the cache.
+    blSetImageShare(0);
+    blSetImageCache(1);
+    blOpenFlashFile("test.S19",&segmentsCount,addressAndSize,checksum);
+    ImageCacheKeyOf("test.S19", "crcspec", &key);
+    snprintf(path, sizeof(path), "%s/%.16llx%.16llx.blc", imageCacheDirectory,
+             (unsigned long long)key.sourceHash, (unsigned long long)key.specHash);
+    FILE *pFile = fopen(path, "rb");
+    if (pFile != 0)
+    {
+        fclose(pFile);
+        log_info("TestImageCache TC1: pass");
+    }
+    else
+        log_fail("TestImageCache TC1: fail");
+    // Second open maps the cache file.
+    memset(checksum, 0, sizeof(checksum));
+    blOpenFlashFile("test.S19",&segmentsCount,addressAndSize,checksum);
+    if (flashImage.mapping != 0 &&
+        segmentsCount == 3 &&
+        addressAndSize[3][1] == 0x0f &&
+        addressAndSize[3][7] == 0x10 &&
+        checksum[0][3]==0x69 &&
+        checksum[3][3]==0x8a)
+        log_info("TestImageCache TC2: pass");
+    else
+        log_fail("TestImageCache TC2: fail");
+    // A corrupted cache file is stale and the flash file is parsed again.
+    ImageClear(&flashImage);
+    pFile = fopen(path, "wb");
+    fputs("BLIC", pFile);
+    fclose(pFile);
+    memset(checksum, 0, sizeof(checksum));
+    blOpenFlashFile("test.S19",&segmentsCount,addressAndSize,checksum);
+    if (flashImage.mapping == 0 &&
+        segmentsCount == 3 &&
+        checksum[3][3]==0x8a)
+        log_info("TestImageCache TC3: pass");
+    else
+        log_fail("TestImageCache TC3: fail");
+    // A cache file with corrupted data fails its checksums and is parsed again.
+    ImageClear(&flashImage);
+    pFile = fopen(path, "r+b");
+    fseek(pFile, -1, SEEK_END);
+    int last = fgetc(pFile);
+    fseek(pFile, -1, SEEK_END);
+    fputc(last ^ 0xff, pFile);
+    fclose(pFile);
+    memset(checksum, 0, sizeof(checksum));
+    blOpenFlashFile("test.S19",&segmentsCount,addressAndSize,checksum);
+    if (flashImage.mapping == 0 &&
+        segmentsCount == 3 &&
+        checksum[3][3]==0x8a)
+        log_info("TestImageCache TC4: pass");
+    else
+        log_fail("TestImageCache TC4: fail");
+    // Disabled cache always parses.
+    blSetImageCache(0);
+    blOpenFlashFile("test.S19",&segmentsCount,addressAndSize,checksum);
+    if (flashImage.mapping == 0)
+        log_info("TestImageCache TC5: pass");
+    else
+        log_fail("TestImageCache TC5: fail");
+    return 0;
+}
+
+uint8_t TestImageShare()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    ImageCacheKey key;
+    FlashImage other = {0, 0, 0, 0, 0, 0, 0};
+    // First open publishes the image, or attaches if it has been published.
+    blSetImageShare(1);
+    blOpenFlashFile("test.HEX",&segmentsCount,addressAndSize,checksum);
+    ImageCacheKeyOf("test.HEX", "crcspec", &key);
+    uint32_t references = ImageShareReferences(&flashImage);
+    if (references >= 1 &&
+        segmentsCount == 3 &&
+        checksum[3][3]==0xcd)
+        log_info("TestImageShare TC1: pass");
+    else
+        log_fail("TestImageShare TC1: fail");
+    // Another node attaches to the same memory.
+    if (ImageShareAttach(&key, &other) == 0 &&
+        ImageShareReferences(&other) == references + 1 &&
+        other.count == 4 &&
+        memcmp(other.segments[3].data, flashImage.segments[3].data, other.segments[3].size) == 0)
+        log_info("TestImageShare TC2: pass");
+    else
+        log_fail("TestImageShare TC2: fail");
+    ImageClear(&other);
+    if (ImageShareReferences(&flashImage) == references)
+        log_info("TestImageShare TC3: pass");
+    else
+        log_fail("TestImageShare TC3: fail");
+    // A reference of a node which exited without detaching is dropped by the next node attaching.
+    const uint32_t exited = 0x7ffffffe;
+    ImageShareHeader *header = (ImageShareHeader *)((uint8_t *)flashImage.mapping - IMAGE_SHARE_HEADER_SIZE);
+    header->owners[IMAGE_SHARE_OWNERS - 1] = exited;
+    header->refCount++;
+    if (ImageShareAttach(&key, &other) == 0 &&
+        ImageShareReferences(&other) == references + 1 &&
+        header->owners[IMAGE_SHARE_OWNERS - 1] == 0)
+        log_info("TestImageShare TC4: pass");
+    else
+        log_fail("TestImageShare TC4: fail");
+    ImageClear(&other);
+    // A region only referenced by exited nodes is removed, the next open publishes it again.
+    for (uint32_t i = 0; i < IMAGE_SHARE_OWNERS; i++)
+    {
+        if (header->owners[i] != 0)
+        {
+            header->owners[i] = exited;
+        }
+    }
+    if (ImageShareAttach(&key, &other) == 1 &&
+        ImageShareReferences(&flashImage) == 0)
+        log_info("TestImageShare TC5: pass");
+    else
+        log_fail("TestImageShare TC5: fail");
+    blOpenFlashFile("test.S19",&segmentsCount,addressAndSize,checksum);
+    blOpenFlashFile("test.HEX",&segmentsCount,addressAndSize,checksum);
+    if (ImageShareReferences(&flashImage) == 1 &&
+        segmentsCount == 3 &&
+        checksum[3][3]==0xcd)
+        log_info("TestImageShare TC6: pass");
+    else
+        log_fail("TestImageShare TC6: fail");
+    blSetImageShare(0);
+    return 0;
+}
+
+uint8_t TestblOpenFlashFileAsync()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    int32_t result;
+    int32_t job = blOpenFlashFileAsync(0, "test.S19");
+    if (job > 0)
+        log_info("TestblOpenFlashFileAsync TC1: pass");
+    else
+        log_fail("TestblOpenFlashFileAsync TC1: fail");
+    while ((result = blPollFlashFile(job, &segmentsCount, addressAndSize, checksum)) == 1)
+    {
+    }
+    if (result == 0 &&
+        segmentsCount == 3 &&
+        addressAndSize[3][1] == 0x0f &&
+        checksum[0][3]==0x69 &&
+        checksum[3][3]==0x8a)
+        log_info("TestblOpenFlashFileAsync TC2: pass");
+    else
+        log_fail("TestblOpenFlashFileAsync TC2: fail");
+    // A completed job is freed.
+    if (blPollFlashFile(job, &segmentsCount, addressAndSize, checksum) == -1)
+        log_info("TestblOpenFlashFileAsync TC3: pass");
+    else
+        log_fail("TestblOpenFlashFileAsync TC3: fail");
+    job = blOpenFlashFileAsync(0, "nonexistent");
+    while ((result = blPollFlashFile(job, &segmentsCount, addressAndSize, checksum)) == 1)
+    {
+    }
+    if (result == -1)
+        log_info("TestblOpenFlashFileAsync TC4: pass");
+    else
+        log_fail("TestblOpenFlashFileAsync TC4: fail");
+    return 0;
+}
+
+uint8_t TestIndexFlashText()
+{
+    const char *text = ":0200000400F00A\n:0400000001020304F2\n:020004000506EF\n:02001000AABB89\n:00000001FF\n";
+    FlashImage image = {0, 0, 0, 0, 0, 0, 0};
+    IndexFlashText(text, strlen(text), FORMAT_HEX, &image);
+    if (image.count == 2 &&
+        image.segments[0].address == 0x00f00000 &&
+        image.segments[0].size == 6 &&
+        image.segments[0].data == 0 &&
+        image.segments[1].address == 0x00f00010 &&
+        image.segments[1].size == 2)
+        log_info("TestIndexFlashText TC1: pass");
+    else
+        log_fail("TestIndexFlashText TC1: fail");
+    // Segments are decoded independently, in any order.
+    if (image.count == 2 &&
+        DecodeFlashSegment(text, FORMAT_HEX, &image, &image.segments[1]) == 0 &&
+        DecodeFlashSegment(text, FORMAT_HEX, &image, &image.segments[0]) == 0 &&
+        memcmp(image.segments[0].data, "\x01\x02\x03\x04\x05\x06", 6) == 0 &&
+        memcmp(image.segments[1].data, "\xaa\xbb", 2) == 0)
+        log_info("TestIndexFlashText TC2: pass");
+    else
+        log_fail("TestIndexFlashText TC2: fail");
+    // Records with a wrong checksum, length or character are rejected, lower case digits are valid.
+    static const char *valid[] = {":14010000101112131415161718191a1b1c1d1e1f20212223ed\n",
+                                  "S1170100101112131415161718191A1B1C1D1E1F20212223E9\n"};
+    static const char *corrupted[] = {":14010000101112131415161718191A1B1C1D1E1F20212224ED\n",
+                                      ":14010000101112131415161718191A1B1C1D1E1F202122ED\n",
+                                      ":14010000101112131415161718191A1B1C1D1E1F202122G3ED\n",
+                                      ":0400000001020304F2\n:00000001F\n",
+                                      "S1170100101112131415161718191A1B1C1D1E1F20212223E8\n",
+                                      "S1180100101112131415161718191A1B1C1D1E1F20212223E9\n"};
+    uint8_t result = 0;
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        result |= IndexFlashText(valid[i], strlen(valid[i]), i == 0 ? FORMAT_HEX : FORMAT_SREC, &image) != 0 ||
+                  image.count != 1 || image.segments[0].size != 20;
+    }
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        result |= IndexFlashText(corrupted[i], strlen(corrupted[i]), i < 4 ? FORMAT_HEX : FORMAT_SREC, &image) != 1 ||
+                  image.count != 0;
+    }
+    if (result == 0)
+        log_info("TestIndexFlashText TC3: pass");
+    else
+        log_fail("TestIndexFlashText TC3: fail");
+    ImageClear(&image);
+    return 0;
+}
+
+uint8_t TestImageMerge()
+{
+    FlashImage images[2] = {{0, 0, 0, 0, 0, 0, 0}, {0, 0, 0, 0, 0, 0, 0}};
+    FlashImage merged = {0, 0, 0, 0, 0, 0, 0};
+    FlashImage reread = {0, 0, 0, 0, 0, 0, 0};
+    uint8_t data[0x30];
+    for (uint32_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)i;
+    // An application in the second image continues the bootloader at 0x1FFF0, another segment follows a gap.
+    SegmentAppend(&images[1], ImageAddSegment(&images[1], 0x1FFF0), data, 0x10);
+    SegmentAppend(&images[1], ImageAddSegment(&images[1], 0x30000), data, 0x30);
+    SegmentAppend(&images[0], ImageAddSegment(&images[0], 0x20000), data + 0x10, 0x20);
+    if (ImageMerge(&merged, images, 2) == 0 && merged.count == 2 &&
+        merged.segments[0].address == 0x1FFF0 && merged.segments[0].size == 0x30 &&
+        memcmp(merged.segments[0].data, data, 0x30) == 0 && merged.segments[1].address == 0x30000)
+        log_info("TestImageMerge TC1: pass");
+    else
+        log_fail("TestImageMerge TC1: fail");
+    // The merged image written as HEX across a 64 KB page reads back the same.
+    if (WriteHex("testmerge.hex", &merged) == 0 && ParseHex("testmerge.hex", &reread) == 0 &&
+        reread.count == 2 && reread.segments[0].address == 0x1FFF0 && reread.segments[0].size == 0x30 &&
+        memcmp(reread.segments[0].data, data, 0x30) == 0 && reread.segments[1].size == 0x30)
+        log_info("TestImageMerge TC2: pass");
+    else
+        log_fail("TestImageMerge TC2: fail");
+    remove("testmerge.hex");
+    // Overlapping segments can't be merged.
+    SegmentAppend(&images[0], ImageAddSegment(&images[0], 0x3002F), data, 1);
+    if (ImageMerge(&merged, images, 2) == 1 && merged.count == 0)
+        log_info("TestImageMerge TC3: pass");
+    else
+        log_fail("TestImageMerge TC3: fail");
+    // A segment whose data isn't in memory, e.g. of a streamed image, can't be merged.
+    FlashImage streamed = {0, 0, 0, 0, 0, 0, 0};
+    ImageAddSegment(&streamed, 0x40000)->size = 0x10;
+    if (ImageMerge(&merged, &streamed, 1) == 1 && merged.count == 0)
+        log_info("TestImageMerge TC4: pass");
+    else
+        log_fail("TestImageMerge TC4: fail");
+    ImageClear(&streamed);
+    ImageClear(&images[0]);
+    ImageClear(&images[1]);
+    ImageClear(&merged);
+    ImageClear(&reread);
+    return 0;
+}
+
+uint8_t TestImageArena()
+{
+    ImageArena arena = {0, 0, 0};
+    FlashImage image = {0, 0, 0, 0, 0, 0, 0};
+    // Blocks are aligned, the newest block grows in place and an older one is copied.
+    uint8_t *first = (uint8_t *)ArenaAlloc(&arena, 100);
+    if (first != 0)
+        memset(first, 0x5A, 100);
+    uint8_t *grown = (uint8_t *)ArenaGrow(&arena, first, 100, 1000);
+    uint8_t *second = (uint8_t *)ArenaAlloc(&arena, 10);
+    uint8_t *moved = (uint8_t *)ArenaGrow(&arena, first, 100, 2000);
+    uint8_t *large = (uint8_t *)ArenaAlloc(&arena, ARENA_CHUNK_MAX + 1);
+    if (first != 0 && (uintptr_t)first % ARENA_ALIGNMENT == 0 && grown == first &&
+        second >= first + 1000 && (uintptr_t)second % ARENA_ALIGNMENT == 0 &&
+        moved > second && memcmp(moved, first, 100) == 0 && arena.last == large && large != 0 &&
+        arena.reserved > ARENA_CHUNK_MAX + ARENA_CHUNK_MIN)
+        log_info("TestImageArena TC1: pass");
+    else
+        log_fail("TestImageArena TC1: fail");
+    ArenaRelease(&arena);
+    // A large image is backed by huge pages where available, all chunks are freed with the image.
+    std::vector<uint8_t> data(3 << 20);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 7);
+    FILE *pFile = fopen("testarena.bin", "wb");
+    if (pFile != 0)
+    {
+        fwrite(data.data(), 1, data.size(), pFile);
+        fclose(pFile);
+    }
+    arenaHugePages = 1;
+    uint8_t result = ParseBin("testarena.bin", 0x80000000, &image) == 0 && image.count == 1 &&
+                     image.segments[0].size == data.size() &&
+                     memcmp(image.segments[0].data, data.data(), data.size()) == 0 &&
+                     image.arena.reserved >= data.size();
+    ImageClear(&image);
+    // A file not fitting above the base address is rejected instead of wrapping around.
+    result = result && ParseBin("testarena.bin", 0xfff00000, &image) != 0 && image.count == 0;
+    ImageClear(&image);
+    if (result && arena.chunks == 0 && image.arena.chunks == 0 && image.arena.reserved == 0)
+        log_info("TestImageArena TC2: pass");
+    else
+        log_fail("TestImageArena TC2: fail");
+    arenaHugePages = 0;
+    remove("testarena.bin");
+    // Merging many contiguous segments past the largest chunk keeps the arena within twice the data.
+    std::vector<FlashImage> parts(96);
+    for (uint32_t i = 0; i < parts.size(); i++)
+    {
+        parts[i] = {0, 0, 0, 0, 0, 0, 0};
+        FlashSegment *segment = ImageAddSegment(&parts[i], i << 20);
+        uint8_t *partData = segment ? SegmentExtend(&parts[i], segment, 1 << 20) : 0;
+        if (partData != 0)
+            memset(partData, (int)i, 1 << 20);
+    }
+    result = ImageMerge(&image, parts.data(), (uint32_t)parts.size()) == 0 && image.count == 1 &&
+             image.segments[0].size == parts.size() << 20 && image.segments[0].data[95 << 20] == 95 &&
+             image.arena.reserved <= 2 * (parts.size() << 20);
+    ImageClear(&image);
+    for (FlashImage &part : parts)
+        ImageClear(&part);
+    if (result)
+        log_info("TestImageArena TC3: pass");
+    else
+        log_fail("TestImageArena TC3: fail");
+    return 0;
+}
+
+uint8_t TestBatch()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    Batch batch = {0, 0, 0, 0, 0, 0, 0};
+    // Expected checksums are those of a single open.
+    blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum);
+    FILE *pFile = fopen("testmanifest", "w");
+    fprintf(pFile, "# file and checksums\n\ntest.HEX");
+    for (uint32_t i = 0; i <= segmentsCount; i++)
+        fprintf(pFile, " %.2X%.2X%.2X%.2X", checksum[i][0], checksum[i][1], checksum[i][2], checksum[i][3]);
+    fprintf(pFile, "\ntest.S19 D4A3FD86\nmissing.hex\n");
+    fclose(pFile);
+    uint8_t result = BatchLoadManifest(&batch, "testmanifest");
+    BatchAddFile(&batch, "test.S19", 0, 0);
+    BatchRun(&batch, 3);
+    pFile = fopen("testreport", "w");
+    if (result == 0 && batch.count == 4 && batch.entries[0].status == BATCH_OK &&
+        batch.entries[0].segmentsCount == segmentsCount + 1 && batch.entries[1].status == BATCH_MISMATCH &&
+        batch.entries[2].status == BATCH_ERROR && batch.entries[3].status == BATCH_UNCHECKED &&
+        batch.entries[3].segmentsCount == 4 && BatchWriteReport(&batch, pFile) == 2)
+        log_info("TestBatch TC1: pass");
+    else
+        log_fail("TestBatch TC1: fail");
+    fclose(pFile);
+    BatchClear(&batch);
+    remove("testmanifest");
+    remove("testreport");
+    // Many files on more threads than files of each size give the same checksums.
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        uint64_t expected[4];
+        for (uint32_t j = 0; j <= segmentsCount; j++)
+            expected[j] = (uint64_t)checksum[j][0] << 24 | checksum[j][1] << 16 | checksum[j][2] << 8 | checksum[j][3];
+        BatchAddFile(&batch, "test.HEX", expected, segmentsCount + 1);
+        BatchAddFile(&batch, "test.S19", 0, 0);
+    }
+    BatchRun(&batch, 8);
+    result = 0;
+    for (uint32_t i = 0; i < batch.count; i++)
+    {
+        const BatchEntry *entry = &batch.entries[i];
+        if (entry->status != (i % 2 == 0 ? BATCH_OK : BATCH_UNCHECKED) ||
+            entry->segments[0].checksum != batch.entries[i % 2].segments[0].checksum)
+            result = 1;
+    }
+    if (result == 0)
+        log_info("TestBatch TC2: pass");
+    else
+        log_fail("TestBatch TC2: fail");
+    BatchClear(&batch);
+    return 0;
+}
+
+/**
+ * @brief Check that a parsed synthetic image has the segments and CRCs it was generated with.
+ */
+static uint8_t CheckGeneratedImage(const FlashImage *image, const ImageGenSpec *spec, const uint64_t *checksums)
+{
+    uint64_t size = 0;
+    if (image->count != spec->segments)
+        return 1;
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        SegmentCalculateChecksum(&image->segments[i]);
+        uint64_t crc = (uint64_t)image->segments[i].checksum << 32 | image->segments[i].checksumExtension;
+        if (crc >> (64 - 8 * GetCrcBytes()) != checksums[i])
+            return 1;
+        size += image->segments[i].size;
+    }
+    return size != spec->size;
+}
+
+static std::string ReadWholeFile(const char *fileName)
+{
+    std::string content;
+    FILE *pFile = fopen(fileName, "rb");
+    if (pFile == 0)
+        return content;
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), pFile)) != 0)
+        content.append(buffer, length);
+    fclose(pFile);
+    return content;
+}
+
+uint8_t TestGenerateFlashFile()
+{
+    ImageGenSpec spec;
+    FlashImage image = {0, 0, 0, 0, 0, 0, 0};
+    uint64_t checksums[12];
+    LoadCrcSpec("crcspec");
+    ImageGenDefaults(&spec);
+    spec.size = 1 << 20;
+    spec.segments = 12;
+    spec.recordLength = 64;
+    spec.outOfOrder = 0.5;
+    spec.fillDensity = 0.3;
+    spec.gap = IMAGEGEN_GAP_EXPONENTIAL;
+    spec.seed = 7;
+    // Segments written out of order are parsed in the order of the file with the generated CRCs.
+    if (GenerateFlashFile("testgen.hex", &spec, GetCrcProfile(), checksums) == 0 &&
+        ParseHex("testgen.hex", &image) == 0 && CheckGeneratedImage(&image, &spec, checksums) == 0)
+        log_info("TestGenerateFlashFile TC1: pass");
+    else
+        log_fail("TestGenerateFlashFile TC1: fail");
+    // The shortest SREC address fitting all segments is used, S1 is too short.
+    spec.format = FORMAT_SREC;
+    spec.baseAddress = 0x1000;
+    spec.size = 0x20000;
+    spec.segments = 3;
+    spec.srecType = 1;
+    uint8_t result = GenerateFlashFile("testgen.s19", &spec, GetCrcProfile(), checksums) == 1;
+    spec.srecType = 0;
+    std::string content;
+    if (result && GenerateFlashFile("testgen.s19", &spec, GetCrcProfile(), checksums) == 0 &&
+        ParseSREC("testgen.s19", &image) == 0 && CheckGeneratedImage(&image, &spec, checksums) == 0)
+    {
+        content = ReadWholeFile("testgen.s19");
+        result = content.compare(0, 2, "S0") == 0 && content.find("\nS2") != std::string::npos &&
+                 content.size() > 13 && content.compare(content.size() - 13, 13, "S804000000FB\n") == 0;
+    }
+    else
+        result = 0;
+    if (result)
+        log_info("TestGenerateFlashFile TC2: pass");
+    else
+        log_fail("TestGenerateFlashFile TC2: fail");
+    // The same seed gives the same file, another seed another one.
+    std::string first = content;
+    GenerateFlashFile("testgen.s19", &spec, 0, 0);
+    std::string second = ReadWholeFile("testgen.s19");
+    spec.seed = 8;
+    GenerateFlashFile("testgen.s19", &spec, 0, 0);
+    std::string third = ReadWholeFile("testgen.s19");
+    if (!first.empty() && first == second && first != third)
+        log_info("TestGenerateFlashFile TC3: pass");
+    else
+        log_fail("TestGenerateFlashFile TC3: fail");
+    remove("testgen.hex");
+    remove("testgen.s19");
+    ImageClear(&image);
+    return 0;
+}
+
+uint8_t TestblOpenFlashFileLazy()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    uint8_t lazyAddressAndSize[5][8];
+    uint8_t lazyChecksum[4];
+    uint8_t data[0xfff];
+    uint32_t dataLength;
+    uint32_t i;
+    // The image cache and shared memory would skip decoding.
+    blSetImageCache(0);
+    blSetImageShare(0);
+    memset(addressAndSize, 0, sizeof(addressAndSize));
+    blOpenFlashFile("test.S19",&segmentsCount,addressAndSize,checksum);
+    uint32_t lastSize = flashImage.segments[segmentsCount].size;
+    uint8_t lastByte = flashImage.segments[segmentsCount].data[lastSize - 1];
+    memset(lazyAddressAndSize, 0, sizeof(lazyAddressAndSize));
+    if (blOpenFlashFileLazy("test.S19",&segmentsCount,lazyAddressAndSize) == 0 &&
+        segmentsCount == 3 &&
+        memcmp(addressAndSize, lazyAddressAndSize, sizeof(addressAndSize)) == 0)
+        log_info("TestblOpenFlashFileLazy TC1: pass");
+    else
+        log_fail("TestblOpenFlashFileLazy TC1: fail");
+    // The last block is transferred first.
+    uint8_t transferredByte = ~lastByte;
+    while (blBuffer(0xfff,data,&dataLength,segmentsCount)==0)
+    {
+        transferredByte = data[dataLength - 1];
+    }
+    if (transferredByte == lastByte)
+        log_info("TestblOpenFlashFileLazy TC2: pass");
+    else
+        log_fail("TestblOpenFlashFileLazy TC2: fail");
+    for (i = 0; i <= segmentsCount; i++)
+    {
+        if (blGetSegmentChecksum(i, lazyChecksum) != 0 ||
+            memcmp(lazyChecksum, checksum[i], 4) != 0)
+            break;
+    }
+    if (i == segmentsCount + 1 &&
+        blGetSegmentChecksum(segmentsCount + 1, lazyChecksum) == -1)
+        log_info("TestblOpenFlashFileLazy TC3: pass");
+    else
+        log_fail("TestblOpenFlashFileLazy TC3: fail");
+    if (blOpenFlashFileLazy("nonexistent",&segmentsCount,lazyAddressAndSize) == -1)
+        log_info("TestblOpenFlashFileLazy TC4: pass");
+    else
+        log_fail("TestblOpenFlashFileLazy TC4: fail");
+    return 0;
+}
+
+uint8_t TestblGetStats()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    uint8_t data[0xfff];
+    uint32_t dataLength;
+    uint32_t stats[STATS_COUNT + 1];
+    uint32_t bytes = 0, pdus = 0;
+    blSetImageCache(0);
+    blSetImageShare(0);
+    blResetStats();
+    blOpenFlashFile("test.HEX",&segmentsCount,addressAndSize,checksum);
+    for (uint32_t i = 0; i <= segmentsCount; i++)
+    {
+        bytes += flashImage.segments[i].size;
+        while (blBuffer(0xfff,data,&dataLength,i)==0)
+        {
+            pdus++;
+        }
+    }
+    // crcspec was loaded by earlier tests, its tables are cached.
+    if (blGetStats(STATS_COUNT + 1, stats) == STATS_COUNT &&
+        stats[3 * PHASE_CONFIG_LOAD + STATS_PHASE_CALLS] == 1 &&
+        stats[3 * PHASE_CRC_TABLE + STATS_PHASE_CALLS] == 0 &&
+        stats[3 * PHASE_PARSE + STATS_PHASE_CALLS] == 1 &&
+        stats[3 * PHASE_CHECKSUM + STATS_PHASE_CALLS] == segmentsCount + 1 &&
+        stats[3 * PHASE_PDU_FILL + STATS_PHASE_CALLS] == pdus &&
+        stats[3 * PHASE_PARSE + STATS_PHASE_MAX] <= stats[3 * PHASE_PARSE + STATS_PHASE_TOTAL])
+        log_info("TestblGetStats TC1: pass");
+    else
+        log_fail("TestblGetStats TC1: fail");
+    // Every blBuffer call is counted, including the ones ending a block.
+    if (stats[STATS_BUFFER_CALLS] == pdus + segmentsCount + 1 &&
+        stats[STATS_BUFFER_BYTES] == bytes &&
+        stats[STATS_BUFFER_P50] > 0 &&
+        stats[STATS_BUFFER_P50] <= stats[STATS_BUFFER_P90] &&
+        stats[STATS_BUFFER_P90] <= stats[STATS_BUFFER_P99] &&
+        stats[STATS_BUFFER_P99] <= stats[STATS_BUFFER_MAX] + stats[STATS_BUFFER_MAX] / 8)
+        log_info("TestblGetStats TC2: pass");
+    else
+        log_fail("TestblGetStats TC2: fail");
+    blResetStats();
+    if (blGetStats(STATS_COUNT, stats) == STATS_COUNT &&
+        stats[STATS_BUFFER_CALLS] == 0 &&
+        stats[STATS_BUFFER_P99] == 0)
+        log_info("TestblGetStats TC3: pass");
+    else
+        log_fail("TestblGetStats TC3: fail");
+    return 0;
+}
+
+uint8_t TestblGetWideChecksum()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    uint8_t wide[8];
+    char spec[512];
+    static CrcEngine engine = {64, 1, 1, 0x42F0E1EBA9EA3693, 0xFFFFFFFFFFFFFFFF, 0xFFFFFFFFFFFFFFFF};
+    CrcEngineInit(&engine);
+    // Add a CRC-64/XZ profile to crcspec.
+    FILE *pFile = fopen("crcspec", "r");
+    size_t specLength = fread(spec, 1, sizeof(spec) - 1, pFile);
+    fclose(pFile);
+    pFile = fopen("crcspec", "a");
+    fprintf(pFile, "\nProfile XZ\nWidth 64\nPolynomial 42F0E1EBA9EA3693\nInitialValue FFFFFFFFFFFFFFFF\n"
+                   "InputReflected 1\nResultReflected 1\nFinalXORvalue FFFFFFFFFFFFFFFF\n");
+    fclose(pFile);
+    blSetImageCache(0);
+    blSetImageShare(0);
+    uint8_t result = 1;
+    if (blSelectCrcProfile("XZ") == 0 &&
+        blOpenFlashFile("test.S19", &segmentsCount, addressAndSize, checksum) == 0)
+    {
+        uint64_t crc = CrcEngineCalculate(&engine, flashImage.segments[1].data, flashImage.segments[1].size);
+        result = blGetWideChecksum(1, wide) != 8 || memcmp(checksum[1], wide, 4) != 0;
+        for (uint32_t i = 0; i < 8; i++)
+            result |= wide[i] != (uint8_t)(crc >> (56 - 8 * i));
+    }
+    if (result == 0)
+        log_info("TestblGetWideChecksum TC1: pass");
+    else
+        log_fail("TestblGetWideChecksum TC1: fail");
+    // Checksums of lazily decoded segments are wide as well.
+    memset(wide, 0, sizeof(wide));
+    result = 1;
+    if (blOpenFlashFileLazy("test.HEX", &segmentsCount, addressAndSize) == 0 &&
+        blGetWideChecksum(segmentsCount, wide) == 8)
+    {
+        uint64_t crc = CrcEngineCalculate(&engine, flashImage.segments[segmentsCount].data,
+                                          flashImage.segments[segmentsCount].size);
+        result = 0;
+        for (uint32_t i = 0; i < 8; i++)
+            result |= wide[i] != (uint8_t)(crc >> (56 - 8 * i));
+    }
+    if (result == 0 && blGetWideChecksum(segmentsCount + 1, wide) == -1)
+        log_info("TestblGetWideChecksum TC2: pass");
+    else
+        log_fail("TestblGetWideChecksum TC2: fail");
+    pFile = fopen("crcspec", "w");
+    fwrite(spec, 1, specLength, pFile);
+    fclose(pFile);
+    blSelectCrcProfile("");
+    return 0;
+}
+
+// Compare the digests of blGetSha256 with the digests of the segment data of flashImage.
+static uint8_t CheckSha256Digests(uint8_t digest[][32], const uint8_t imageDigest[32])
+{
+    uint8_t expected[32];
+    uint8_t result = 0;
+    Sha256Context context;
+    Sha256Init(&context);
+    for (uint32_t i = 0; i < flashImage.count; i++)
+    {
+        Sha256(flashImage.segments[i].data, flashImage.segments[i].size, expected);
+        result |= memcmp(digest[i], expected, 32) != 0;
+        Sha256Update(&context, flashImage.segments[i].data, flashImage.segments[i].size);
+    }
+    Sha256Final(&context, expected);
+    return result | (memcmp(imageDigest, expected, 32) != 0);
+}
+
+uint8_t TestblGetBlockChecksum()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    uint8_t blockChecksum[8];
+    // The checksum of a window equals the CRC of the image written out with fill bytes.
+    uint8_t result = 1;
+    if (blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum) == 0)
+    {
+        uint32_t start = flashImage.segments[0].address, end = start;
+        for (uint32_t i = 0; i <= segmentsCount; i++)
+        {
+            const FlashSegment *segment = &flashImage.segments[i];
+            start = segment->address < start ? segment->address : start;
+            end = segment->address + segment->size > end ? segment->address + segment->size : end;
+        }
+        // One byte into the first segment to 16 bytes after the last one.
+        start++;
+        end += 16;
+        std::vector<uint8_t> block(end - start, 0xFF);
+        for (uint32_t i = 0; i <= segmentsCount; i++)
+        {
+            const FlashSegment *segment = &flashImage.segments[i];
+            for (uint32_t j = 0; j < segment->size; j++)
+            {
+                if (segment->address + j >= start)
+                    block[segment->address + j - start] = segment->data[j];
+            }
+        }
+        uint32_t crc = CalculateCrcOfBuffer(block.data(), (uint32_t)block.size());
+        uint8_t expected[4];
+        Uint2Array(&crc, expected);
+        result = blGetBlockChecksum(start, end, 0xFF, blockChecksum) != 4 || memcmp(blockChecksum, expected, 4) != 0;
+    }
+    if (result == 0)
+        log_info("TestblGetBlockChecksum TC1: pass");
+    else
+        log_fail("TestblGetBlockChecksum TC1: fail");
+    // A window of a single segment is its checksum, a window without data is all fill bytes.
+    std::vector<uint8_t> empty(0x10000, 0x00);
+    uint32_t crc = CalculateCrcOfBuffer(empty.data(), (uint32_t)empty.size());
+    uint8_t expected[4];
+    Uint2Array(&crc, expected);
+    const FlashSegment *last = &flashImage.segments[segmentsCount];
+    if (blGetBlockChecksum(last->address, last->address + last->size, 0xFF, blockChecksum) == 4 &&
+        memcmp(blockChecksum, checksum[segmentsCount], 4) == 0 &&
+        blGetBlockChecksum(0xFFFF0000, 0, 0x00, blockChecksum) == 4 &&
+        memcmp(blockChecksum, expected, 4) == 0 &&
+        blGetBlockChecksum(0x2000, 0x1000, 0xFF, blockChecksum) == -1)
+        log_info("TestblGetBlockChecksum TC2: pass");
+    else
+        log_fail("TestblGetBlockChecksum TC2: fail");
+    return 0;
+}
+
+uint8_t TestblGetSha256()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    uint8_t digest[5][32];
+    uint8_t imageDigest[32];
+    if (blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum) == 0 &&
+        blGetSha256(5, digest, imageDigest) == -1)
+        log_info("TestblGetSha256 TC1: pass");
+    else
+        log_fail("TestblGetSha256 TC1: fail");
+    // Digests are calculated with the checksums.
+    blSetSha256(1);
+    blSetImageCache(0);
+    blSetImageShare(0);
+    if (blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum) == 0 &&
+        flashImage.sha256Valid &&
+        blGetSha256(5, digest, imageDigest) == 0 &&
+        CheckSha256Digests(digest, imageDigest) == 0 &&
+        blGetSha256(segmentsCount, digest, imageDigest) == -1)
+        log_info("TestblGetSha256 TC2: pass");
+    else
+        log_fail("TestblGetSha256 TC2: fail");
+    // Digests are saved in the image cache.
+    ImageCacheKey key = {0x5348413235360001, 0x5348413235360002, 0};
+    FlashImage cached = {0, 0, 0, 0, 0, 0, 0};
+    blSetImageCache(1);
+    if (ImageCacheStore(&key, &flashImage) == 0 &&
+        ImageCacheLoad(&key, &cached) == 0 &&
+        cached.sha256Valid &&
+        memcmp(cached.sha256, flashImage.sha256, 32) == 0 &&
+        memcmp(cached.segments[segmentsCount].sha256, flashImage.segments[segmentsCount].sha256, 32) == 0)
+        log_info("TestblGetSha256 TC3: pass");
+    else
+        log_fail("TestblGetSha256 TC3: fail");
+    ImageClear(&cached);
+    blSetImageCache(0);
+    // Lazily decoded segments are hashed when they are decoded.
+    memset(digest, 0, sizeof(digest));
+    if (blOpenFlashFileLazy("test.S19", &segmentsCount, addressAndSize) == 0 &&
+        blGetSha256(5, digest, imageDigest) == 0 &&
+        CheckSha256Digests(digest, imageDigest) == 0)
+        log_info("TestblGetSha256 TC4: pass");
+    else
+        log_fail("TestblGetSha256 TC4: fail");
+    blSetSha256(0);
+    return 0;
+}
+
+// Compare the digests of blGetDigests for "default,CCITT,XZ" with the segment data of flashImage.
+static uint8_t CheckDigests(uint32_t segment, const uint8_t checksum[4], uint8_t digests[][8], const CrcEngine *xz)
+{
+    const FlashSegment *flashSegment = &flashImage.segments[segment];
+    uint32_t ccitt = FindCrcPreset("CRC-16/CCITT-FALSE")->calculate(flashSegment->data, flashSegment->size);
+    uint64_t crc = CrcEngineCalculate(xz, flashSegment->data, flashSegment->size);
+    uint8_t result = memcmp(digests[0], checksum, 4) != 0 || digests[0][4] != 0 ||
+                     digests[1][0] != (uint8_t)(ccitt >> 24) || digests[1][1] != (uint8_t)(ccitt >> 16) ||
+                     digests[1][2] != 0;
+    for (uint32_t i = 0; i < 8; i++)
+        result |= digests[2][i] != (uint8_t)(crc >> (56 - 8 * i));
+    uint64_t adler = CalculateChecksum(CHECKSUM_ADLER32, 32, 0, 0, flashSegment->data, flashSegment->size);
+    for (uint32_t i = 0; i < 4; i++)
+        result |= digests[3][i] != (uint8_t)(adler >> (24 - 8 * i));
+    return result;
+}
+
+uint8_t TestblGetDigests()
+{
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[5][8];
+    uint8_t checksum[5][4];
+    uint8_t digests[CRC_DIGESTS_MAX][8];
+    uint8_t lastDigests[CRC_DIGESTS_MAX][8];
+    char spec[512];
+    static CrcEngine xz = {64, 1, 1, 0x42F0E1EBA9EA3693, 0xFFFFFFFFFFFFFFFF, 0xFFFFFFFFFFFFFFFF};
+    CrcEngineInit(&xz);
+    // Add a CRC-16, a CRC-64 and an Adler-32 profile to crcspec.
+    FILE *pFile = fopen("crcspec", "r");
+    size_t specLength = fread(spec, 1, sizeof(spec) - 1, pFile);
+    fclose(pFile);
+    pFile = fopen("crcspec", "a");
+    fprintf(pFile, "\nProfile CCITT\nPreset CRC-16/CCITT-FALSE\n"
+                   "Profile XZ\nWidth 64\nPolynomial 42F0E1EBA9EA3693\nInitialValue FFFFFFFFFFFFFFFF\n"
+                   "InputReflected 1\nResultReflected 1\nFinalXORvalue FFFFFFFFFFFFFFFF\n"
+                   "Profile Adler\nAlgorithm Adler32\n");
+    fclose(pFile);
+    blSetImageCache(0);
+    blSetImageShare(0);
+    uint8_t result = 1;
+    if (blSetDigests("default,Unknown") == -1 &&
+        blSetDigests("default,CCITT,XZ,Adler") == 0 &&
+        blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum) == 0)
+    {
+        result = 0;
+        for (uint32_t i = 0; i <= segmentsCount; i++)
+            result |= blGetDigests(i, digests) != 4 || CheckDigests(i, checksum[i], digests, &xz) != 0;
+        memcpy(lastDigests, digests, sizeof(digests));
+    }
+    if (result == 0 && blGetDigests(segmentsCount + 1, digests) == -1)
+        log_info("TestblGetDigests TC1: pass");
+    else
+        log_fail("TestblGetDigests TC1: fail");
+    // Lazily decoded segments have their digests as well.
+    result = 1;
+    if (blOpenFlashFileLazy("test.S19", &segmentsCount, addressAndSize) == 0)
+    {
+        result = 0;
+        for (uint32_t i = segmentsCount + 1; i-- > 0;)
+        {
+            blGetSegmentChecksum(i, checksum[i]);
+            result |= blGetDigests(i, digests) != 4 || CheckDigests(i, checksum[i], digests, &xz) != 0;
+        }
+    }
+    if (result == 0)
+        log_info("TestblGetDigests TC2: pass");
+    else
+        log_fail("TestblGetDigests TC2: fail");
+    // The digests are saved in the image cache, which is keyed by the digest set.
+    blSetImageCache(1);
+    blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum);
+    blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum);
+    if (flashImage.mapping != 0 &&
+        blGetDigests(segmentsCount, digests) == 4 &&
+        memcmp(digests, lastDigests, sizeof(digests)) == 0 &&
+        blSetDigests("") == 0 &&
+        blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum) == 0 &&
+        blGetDigests(segmentsCount, digests) == 0)
+        log_info("TestblGetDigests TC3: pass");
+    else
+        log_fail("TestblGetDigests TC3: fail");
+    blSetImageCache(0);
+    pFile = fopen("crcspec", "w");
+    fwrite(spec, 1, specLength, pFile);
+    fclose(pFile);
+    return 0;
+}
+
+// Compare the Transfer Data PDUs of all segments of flashImage with the data of a parsed image.
+static uint8_t CheckTransferredData(const FlashImage *image)
+{
+    uint8_t data[0xfff];
+    uint32_t dataLength;
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        uint32_t offset = 0;
+        uint8_t sequenceCounter = 0;
+        while (blBuffer(0xfff, data, &dataLength, i) == 0)
+        {
+            if (data[1] != ++sequenceCounter || offset + dataLength - 2 > image->segments[i].size ||
+                memcmp(data + 2, image->segments[i].data + offset, dataLength - 2) != 0)
+                return 1;
+            offset += dataLength - 2;
+        }
+        if (offset != image->segments[i].size)
+            return 1;
+    }
+    return 0;
+}
+
+uint8_t TestStreamFlashText()
+{
+    ImageGenSpec spec;
+    FlashImage parsed = {0, 0, 0, 0, 0, 0, 0};
+    FlashImage streamed = {0, 0, 0, 0, 0, 0, 0};
+    uint32_t segmentsCount;
+    uint8_t addressAndSize[8][8];
+    uint8_t checksum[8][4];
+    uint8_t streamedAddressAndSize[8][8];
+    uint8_t streamedChecksum[8][4];
+    uint8_t blockChecksum[8];
+    uint8_t streamedBlockChecksum[8];
+    LoadCrcSpec("crcspec");
+    ImageGenDefaults(&spec);
+    spec.size = 1 << 20;
+    spec.segments = 5;
+    spec.seed = 11;
+    GenerateFlashFile("teststream.hex", &spec, 0, 0);
+    // The smallest ceiling streams the file in many chunks and reads the spill through a small window.
+    uint8_t result = ParseHex("teststream.hex", &parsed) == 0 &&
+                     StreamFlashText("teststream.hex", FORMAT_HEX, 0, "teststream.spill", 0, 1, &streamed) == 0 &&
+                     streamed.count == parsed.count && streamed.checksumsValid && streamed.sha256Valid;
+    ImageCalculateSha256(&parsed);
+    result = result && memcmp(parsed.sha256, streamed.sha256, 32) == 0;
+    for (uint32_t i = 0; result && i < parsed.count; i++)
+    {
+        const FlashSegment *segment = &streamed.segments[i];
+        SegmentCalculateChecksum(&parsed.segments[i]);
+        result = segment->data == 0 && segment->address == parsed.segments[i].address &&
+                 segment->size == parsed.segments[i].size && segment->checksum == parsed.segments[i].checksum &&
+                 segment->checksumExtension == parsed.segments[i].checksumExtension;
+        for (uint32_t offset = 0, length = 0; result && offset < segment->size; offset += length)
+        {
+            length = segment->size - offset < 0xffd ? segment->size - offset : 0xffd;
+            const uint8_t *data = SpillRead(streamed.spill, i, offset, &length);
+            result = data != 0 && memcmp(data, parsed.segments[i].data + offset, length) == 0;
+        }
+    }
+    if (result)
+        log_info("TestStreamFlashText TC1: pass");
+    else
+        log_fail("TestStreamFlashText TC1: fail");
+    // The spill file is removed with the image.
+    ImageClear(&streamed);
+    FILE *pFile = fopen("teststream.spill", "rb");
+    if (pFile == 0 && streamed.spill == 0)
+        log_info("TestStreamFlashText TC2: pass");
+    else
+    {
+        log_fail("TestStreamFlashText TC2: fail");
+        fclose(pFile);
+    }
+    // A file larger than the memory ceiling is streamed with the same checksums and PDUs.
+    blSetImageCache(0);
+    blSetImageShare(0);
+    result = blOpenFlashFile("teststream.hex", &segmentsCount, addressAndSize, checksum) == 0 &&
+             blGetBlockChecksum(0, 0, 0xff, blockChecksum) > 0;
+    blSetMemoryCeiling(1);
+    if (result && blOpenFlashFile("teststream.hex", &segmentsCount, streamedAddressAndSize, streamedChecksum) == 0 &&
+        flashImage.spill != 0 &&
+        memcmp(addressAndSize, streamedAddressAndSize, (segmentsCount + 1) * 8) == 0 &&
+        memcmp(checksum, streamedChecksum, (segmentsCount + 1) * 4) == 0 &&
+        blGetBlockChecksum(0, 0, 0xff, streamedBlockChecksum) > 0 &&
+        memcmp(blockChecksum, streamedBlockChecksum, 8) == 0 &&
+        CheckTransferredData(&parsed) == 0)
+        log_info("TestStreamFlashText TC3: pass");
+    else
+        log_fail("TestStreamFlashText TC3: fail");
+    blSetMemoryCeiling(0);
+    ImageClear(&parsed);
+    remove("teststream.hex");
+    return 0;
+}
+
 uint8_t TestblBuffer()
 {
     uint32_t segmentsCount;
@@ -441,14 +1959,182 @@ uint8_t TestblBuffer()
             if(j==0 && data[1]==0x01)
                 log_info("TestblBuffer TC1: pass");
             else if(j==0)
-                log_info("TestblBuffer TC1: fail");
+                log_fail("TestblBuffer TC1: fail");
             j++;
         }
     }
     if(data[1]==0x0b)
         log_info("TestblBuffer TC2: pass");
     else
-        log_info("TestblBuffer TC2: fail");
+        log_fail("TestblBuffer TC2: fail");
+    return 0;
+}
+
+uint8_t TestFileLogger()
+{
+    char line[256];
+    uint32_t lines = 0, ordered = 1, previous = 0, value;
+#if LOG_COMPILE_LEVEL > LOG_LEVEL_INFO
+    // The messages of this test are removed at build time.
+    log_info("TestFileLogger: skipped");
+    return 0;
+#endif
+    // More messages than the ring holds, from several threads.
+    remove("loggertest");
+    FileLoggerInit("loggertest");
+    for (uint32_t i = 1; i <= 2000; i++)
+    {
+        LOG_INFO("Message %u", i);
+    }
+    FileLoggerFlush();
+    FILE *pFile = fopen("loggertest", "r");
+    while (pFile != 0 && fgets(line, sizeof(line), pFile) != 0)
+    {
+        if (sscanf(strstr(line, "]: ") + 3, "Message %u", &value) != 1 || value != previous + 1)
+            ordered = 0;
+        previous = value;
+        lines++;
+    }
+    if (pFile != 0)
+        fclose(pFile);
+    if (lines == 2000 && ordered)
+        log_info("TestFileLogger TC1: pass");
+    else
+        log_fail("TestFileLogger TC1: fail");
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        threads.emplace_back([]()
+                             {
+                                 for (uint32_t j = 0; j < 1000; j++)
+                                 {
+                                     LOG_WARN("Thread message %u", j);
+                                 }
+                             });
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    FileLoggerClose();
+    lines = 0;
+    pFile = fopen("loggertest", "r");
+    while (pFile != 0 && fgets(line, sizeof(line), pFile) != 0)
+    {
+        lines += strstr(line, "[W]: Thread message") != 0;
+    }
+    if (pFile != 0)
+        fclose(pFile);
+    if (lines == 4000)
+        log_info("TestFileLogger TC2: pass");
+    else
+        log_fail("TestFileLogger TC2: fail");
+    // Messages below the runtime level are skipped before formatting.
+    uint32_t evaluated = 0;
+    remove("loggertest");
+    FileLoggerInit("loggertest");
+    blSetLogLevel(LOG_LEVEL_ERROR);
+    LOG_INFO("Skipped %u", ++evaluated);
+    LOG_WARN("Skipped %u", ++evaluated);
+    LOG_ERROR("Logged %u", ++evaluated);
+    blSetLogLevel(LOG_LEVEL_INFO);
+    LOG_DEBUG("Skipped %u", ++evaluated);
+    FileLoggerFlush();
+    lines = 0;
+    pFile = fopen("loggertest", "r");
+    while (pFile != 0 && fgets(line, sizeof(line), pFile) != 0)
+    {
+        lines++;
+    }
+    if (pFile != 0)
+        fclose(pFile);
+    if (lines == 1 && evaluated == 1)
+        log_info("TestFileLogger TC3: pass");
+    else
+        log_fail("TestFileLogger TC3: fail");
+    remove("loggertest");
+    FileLoggerInit("testlog");
+    return 0;
+}
+
+uint8_t TestTrace()
+{
+    TraceFileHeader header;
+    TraceRecord record;
+    uint32_t events = 0, definitions = 0, ordered = 1;
+    uint16_t formatId = 0;
+    // More events than the ring holds.
+    TraceOpen("tracetest");
+    for (uint32_t i = 0; i < 10000; i++)
+    {
+        TRACE_EVENT("Event %u", i);
+    }
+    TRACE_EVENT("Last event");
+    TraceClose();
+    TRACE_EVENT("Not recorded %u", 1);
+    FILE *pFile = fopen("tracetest", "rb");
+    if (pFile != 0 &&
+        fread(&header, sizeof(header), 1, pFile) == 1 &&
+        memcmp(header.magic, TRACE_MAGIC, 4) == 0 &&
+        header.recordSize == sizeof(record))
+        log_info("TestTrace TC1: pass");
+    else
+        log_fail("TestTrace TC1: fail");
+    while (pFile != 0 && fread(&record, sizeof(record), 1, pFile) == 1)
+    {
+        if (record.formatId == TRACE_FORMAT_DEFINITION)
+        {
+            // Skip the format string.
+            fseek(pFile, (record.arguments[1] + sizeof(record) - 1) / sizeof(record) * sizeof(record), SEEK_CUR);
+            definitions++;
+            continue;
+        }
+        if (events < 10000)
+        {
+            if (events == 0)
+                formatId = record.formatId;
+            if (record.formatId != formatId || record.arguments[0] != events)
+                ordered = 0;
+        }
+        events++;
+    }
+    if (pFile != 0)
+        fclose(pFile);
+    if (events == 10001 && definitions == 2 && ordered)
+        log_info("TestTrace TC2: pass");
+    else
+        log_fail("TestTrace TC2: fail");
+    remove("tracetest");
+
+    // A span keeps its start and duration.
+    uint64_t start = TraceTimestamp(), end;
+    uint8_t spanFound = 0;
+    TraceOpen("tracetest");
+    TRACE_SPAN(start, "Span %u %u", 7, 8);
+    end = TraceTimestamp();
+    TraceClose();
+    pFile = fopen("tracetest", "rb");
+    if (pFile != 0 && fread(&header, sizeof(header), 1, pFile) == 1)
+    {
+        while (fread(&record, sizeof(record), 1, pFile) == 1)
+        {
+            if (record.formatId == TRACE_FORMAT_DEFINITION)
+            {
+                fseek(pFile, (record.arguments[1] + sizeof(record) - 1) / sizeof(record) * sizeof(record), SEEK_CUR);
+                continue;
+            }
+            uint64_t duration = record.arguments[2] | (uint64_t)record.arguments[3] << 32;
+            spanFound = record.kind == TRACE_KIND_SPAN && record.timestamp == start &&
+                        record.arguments[0] == 7 && record.arguments[1] == 8 &&
+                        start + duration <= end;
+        }
+        fclose(pFile);
+    }
+    if (spanFound)
+        log_info("TestTrace TC3: pass");
+    else
+        log_fail("TestTrace TC3: fail");
+    remove("tracetest");
     return 0;
 }
 
@@ -456,7 +2142,14 @@ int main(void)
 {
     FileLoggerInit("testlog");
 
+    TestFileLogger();
+    TestTrace();
     TestSepcifyCRCParameters();
+    TestLoadCrcSpec();
+    TestCrcPresets();
+    TestCrcEngine();
+    TestSha256();
+    TestChecksumAlgorithms();
     TestCalculateCrcTable_CRC8();
     TestCalculateCrcTable_CRC16();
     TestCalculateCrcTable_CRC32();
@@ -470,7 +2163,32 @@ int main(void)
     TestUint2Array();
     TestHandleHex();
     TestHandleSREC();
+    TestHandleElf();
+    TestHandleBin();
+    TestDetectFlashFileFormat();
     TestblOpenFlashFile();
+    TestHashBuffer();
+    TestImageCache();
+    TestImageShare();
+    TestblOpenFlashFileAsync();
+    TestIndexFlashText();
+    TestImageMerge();
+    TestImageArena();
+    TestBatch();
+    TestGenerateFlashFile();
+    TestblOpenFlashFileLazy();
+    TestblGetWideChecksum();
+    TestblGetBlockChecksum();
+    TestblGetSha256();
+    TestblGetDigests();
+    TestStreamFlashText();
     TestblBuffer();
+    TestblGetStats();
+    ImageClear(&flashImage);
+    if (failedCases != 0)
+    {
+        log_info("%u test cases failed", failedCases);
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,472 @@
+/**
+ * @file bench.cpp
+ * @brief This tool measures the parsers, CRC and checksum kernels and the
+ * PDU composition of the CAPL DLL. Each benchmark is run a few times to
+ * warm up the caches, then repeated, and the median, 99th percentile and
+ * fastest time and the throughput are written as CSV or JSON.
+ *
+ * Usage: bench [-reps n] [-warmup n] [-size MB] [-filter text] [-json] [-o file]
+ *              [-baseline file] [-write-baseline file]
+ *
+ * It is run in the data directory by make bench. Besides data/test.HEX and
+ * data/test.S19 a synthetic Intel HEX and S3 SREC image of -size MB (default
+ * 16) are generated in the working directory and removed at the end.
+ *
+ * With -baseline the results are compared with a baseline file, each line
+ * holding a benchmark, a metric, its baseline value and the tolerated
+ * relative change, e.g. "crc.profile,gb_per_s,0.9,0.4". A benchmark slower
+ * than tolerated is a regression and the exit code is 1. Kernels the
+ * processor doesn't support and benchmarks excluded by -filter are skipped,
+ * other benchmarks of the baseline without a result fail the comparison.
+ * A benchmark whose code fails makes the exit code 1 in any case.
+ * -write-baseline writes the results as a baseline with a tolerance of 0.4.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#define CAPLDLL_EXPORTS
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "minilogger.h"
+#include "crc.h"
+#include "crcengine.h"
+#include "checksum.h"
+#include "sha256.h"
+#include "filepraser.h"
+#include "flashimage.h"
+#include "imagegen.h"
+#include "capldll.h"
+
+/**
+ * @brief Timing of a benchmark.
+ *
+ */
+struct BenchResult
+{
+    std::string name;
+    uint64_t bytes;    // Bytes processed by one repetition.
+    uint64_t ops;      // Operations of one repetition, e.g. PDUs.
+    uint32_t reps;
+    uint64_t median;   // Nanoseconds of one repetition.
+    uint64_t p99;
+    uint64_t min;
+};
+
+/**
+ * @brief Options of a run.
+ *
+ */
+struct BenchOptions
+{
+    uint32_t reps = 20;
+    uint32_t warmup = 3;
+    uint32_t sizeMB = 16;
+    const char *filter = "";
+    bool json = false;
+    const char *outputFile = 0;
+    const char *baselineFile = 0;
+    const char *writeBaselineFile = 0;
+};
+
+static BenchOptions options;
+static std::vector<BenchResult> results;
+static std::vector<std::string> failures;    // Benchmarks whose code failed.
+static std::vector<std::string> unsupported; // Benchmarks of kernels the processor doesn't support.
+
+static uint64_t Now()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Run a benchmark if its name matches the filter.
+ *
+ * @param name Name of the benchmark, group.subject.variant.
+ * @param bytes Bytes processed by one call of body.
+ * @param ops Operations of one call of body.
+ * @param body The code to be measured, it returns 0 on success.
+ */
+static void Bench(const std::string &name, uint64_t bytes, uint64_t ops, const std::function<int(void)> &body)
+{
+    if (name.find(options.filter) == std::string::npos)
+        return;
+    std::vector<uint64_t> samples;
+    for (uint32_t i = 0; i < options.warmup + options.reps; i++)
+    {
+        uint64_t start = Now();
+        int failed = body();
+        uint64_t duration = Now() - start;
+        if (failed != 0)
+        {
+            fprintf(stderr, "Benchmark %s failed\n", name.c_str());
+            failures.push_back(name);
+            return;
+        }
+        if (i >= options.warmup)
+            samples.push_back(duration);
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t p99 = (samples.size() * 99 + 99) / 100;
+    BenchResult result = {name, bytes, ops, options.reps, samples[samples.size() / 2],
+                          samples[std::min(p99, samples.size()) - 1], samples[0]};
+    results.push_back(result);
+    fprintf(stderr, "%-32s %10.3f ms %10.1f MB/s\n", name.c_str(), result.median / 1e6,
+            result.median != 0 ? bytes * 1e3 / result.median : 0.0);
+}
+
+static uint64_t FileSize(const char *fileName)
+{
+    struct stat status;
+    return stat(fileName, &status) == 0 ? (uint64_t)status.st_size : 0;
+}
+
+/**
+ * @brief Fill a buffer with reproducible pseudo random bytes.
+ *
+ * @param buffer The buffer.
+ * @param length Length of the buffer.
+ * @param seed Seed of the xorshift generator, not 0.
+ */
+static void FillRandom(uint8_t *buffer, size_t length, uint64_t seed)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        buffer[i] = (uint8_t)seed;
+    }
+}
+
+static void BenchParsers(const char *syntheticHex, const char *syntheticSrec)
+{
+    static uint32_t segmentsCount;
+    static uint8_t addressAndSize[256][8];
+    static uint8_t checksum[256][4];
+    Bench("parse.hex.test", FileSize("test.HEX"), 1,
+          []() { return (int)HandleHex("test.HEX", &segmentsCount, addressAndSize, checksum); });
+    Bench("parse.srec.test", FileSize("test.S19"), 1,
+          []() { return (int)HandleSREC("test.S19", &segmentsCount, addressAndSize, checksum); });
+    Bench("parse.hex.synthetic", FileSize(syntheticHex), 1,
+          [syntheticHex]() { return (int)HandleHex(syntheticHex, &segmentsCount, addressAndSize, checksum); });
+    Bench("parse.srec.synthetic", FileSize(syntheticSrec), 1,
+          [syntheticSrec]() { return (int)HandleSREC(syntheticSrec, &segmentsCount, addressAndSize, checksum); });
+    // The whole open without image cache and sharing, as CAPL calls it.
+    blSetImageCache(0);
+    blSetImageShare(0);
+    Bench("open.hex.test", FileSize("test.HEX"), 1,
+          []() { return (int)blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum); });
+    Bench("open.hex.synthetic", FileSize(syntheticHex), 1,
+          [syntheticHex]() { return (int)blOpenFlashFile(syntheticHex, &segmentsCount, addressAndSize, checksum); });
+}
+
+static void BenchChecksums(const std::vector<uint8_t> &buffer)
+{
+    const uint8_t *data = buffer.data();
+    uint32_t length = (uint32_t)buffer.size();
+    static volatile uint64_t sink;
+    LoadCrcSpec("crcspec");
+    Bench("crc.profile", length, 1, [data, length]() { sink = CalculateCrcOfBuffer(data, length); return 0; });
+
+    static CrcEngine engine;
+    engine.width = 64;
+    engine.polynomial = 0x42F0E1EBA9EA3693ULL;
+    engine.initialValue = 0xFFFFFFFFFFFFFFFFULL;
+    engine.finalXORValue = 0xFFFFFFFFFFFFFFFFULL;
+    engine.inputReflected = 1;
+    engine.resultReflected = 1;
+    CrcEngineInit(&engine);
+    Bench("crc.engine.crc64xz", length, 1,
+          [data, length]() { sink = CrcEngineCalculate(&engine, data, length); return 0; });
+    static const char *const engineKernelNames[] = {"table", "clmul"};
+    crcEngineKernel bestEngineKernel = GetCrcEngineKernel();
+    for (int32_t kernel = bestEngineKernel + 1; kernel <= CRC_ENGINE_KERNEL_CLMUL; kernel++)
+        unsupported.push_back(std::string("crc.engine.crc64xz.") + engineKernelNames[kernel]);
+    for (int32_t kernel = CRC_ENGINE_KERNEL_TABLE; kernel <= bestEngineKernel; kernel++)
+    {
+        SetCrcEngineKernel((crcEngineKernel)kernel);
+        Bench(std::string("crc.engine.crc64xz.") + engineKernelNames[kernel], length, 1,
+              [data, length]() { sink = CrcEngineCalculate(&engine, data, length); return 0; });
+    }
+    SetCrcEngineKernel(bestEngineKernel);
+
+    static const char *const kernelNames[] = {"scalar", "sse2", "avx2"};
+    checksumKernel best = GetChecksumKernel();
+    for (int32_t kernel = best + 1; kernel <= CHECKSUM_KERNEL_AVX2; kernel++)
+    {
+        unsupported.push_back(std::string("checksum.wordsumbe.") + kernelNames[kernel]);
+        unsupported.push_back(std::string("checksum.adler32.") + kernelNames[kernel]);
+    }
+    for (int32_t kernel = CHECKSUM_KERNEL_SCALAR; kernel <= best; kernel++)
+    {
+        SetChecksumKernel((checksumKernel)kernel);
+        Bench(std::string("checksum.wordsumbe.") + kernelNames[kernel], length, 1, [data, length]()
+              { sink = CalculateChecksum(CHECKSUM_WORD_SUM_BE, 16, 0, 0, data, length); return 0; });
+        Bench(std::string("checksum.adler32.") + kernelNames[kernel], length, 1, [data, length]()
+              { sink = CalculateChecksum(CHECKSUM_ADLER32, 32, 0, 0, data, length); return 0; });
+    }
+    SetChecksumKernel(best);
+
+    uint8_t accelerated = Sha256Accelerated();
+    if (!accelerated)
+        unsupported.push_back("sha256.shani");
+    for (int32_t enable = 0; enable <= accelerated; enable++)
+    {
+        static uint8_t digest[SHA256_DIGEST_SIZE];
+        Sha256SetAcceleration((uint8_t)enable);
+        Bench(enable ? "sha256.shani" : "sha256.portable", length, 1,
+              [data, length]() { Sha256(data, length, digest); return 0; });
+    }
+    Sha256SetAcceleration(accelerated);
+}
+
+static void BenchPdus()
+{
+    static uint32_t segmentsCount;
+    static uint8_t addressAndSize[256][8];
+    static uint8_t checksum[256][4];
+    static uint8_t pdu[4095];
+    if (blOpenFlashFile("test.HEX", &segmentsCount, addressAndSize, checksum) != 0)
+    {
+        Bench("pdu.blbuffer.4095", 0, 1, []() { return 1; });
+        return;
+    }
+    uint32_t size = (uint32_t)addressAndSize[0][4] << 24 | addressAndSize[0][5] << 16 |
+                    addressAndSize[0][6] << 8 | addressAndSize[0][7];
+    uint32_t pdus = (size + sizeof(pdu) - 3) / (sizeof(pdu) - 2);
+    // One repetition transfers segment 0, the last call ends the block.
+    Bench("pdu.blbuffer.4095", size, pdus, []()
+          {
+              uint32_t dataLength;
+              while (blBuffer(sizeof(pdu), pdu, &dataLength, 0) == 0)
+                  ;
+              return 0;
+          });
+}
+
+static void WriteResults(FILE *pFile)
+{
+    if (options.json)
+        fprintf(pFile, "[\n");
+    else
+        fprintf(pFile, "benchmark,bytes,ops,reps,median_ns,p99_ns,min_ns,mb_per_s,ns_per_op\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &result = results[i];
+        double mbPerSecond = result.median != 0 ? result.bytes * 1e3 / result.median : 0.0;
+        double nsPerOp = (double)result.median / result.ops;
+        if (options.json)
+            fprintf(pFile, "  {\"benchmark\":\"%s\",\"bytes\":%llu,\"ops\":%llu,\"reps\":%u,\"median_ns\":%llu,"
+                           "\"p99_ns\":%llu,\"min_ns\":%llu,\"mb_per_s\":%.1f,\"ns_per_op\":%.1f}%s\n",
+                    result.name.c_str(), (unsigned long long)result.bytes, (unsigned long long)result.ops,
+                    result.reps, (unsigned long long)result.median, (unsigned long long)result.p99,
+                    (unsigned long long)result.min, mbPerSecond, nsPerOp, i + 1 < results.size() ? "," : "");
+        else
+            fprintf(pFile, "%s,%llu,%llu,%u,%llu,%llu,%llu,%.1f,%.1f\n", result.name.c_str(),
+                    (unsigned long long)result.bytes, (unsigned long long)result.ops, result.reps,
+                    (unsigned long long)result.median, (unsigned long long)result.p99,
+                    (unsigned long long)result.min, mbPerSecond, nsPerOp);
+    }
+    if (options.json)
+        fprintf(pFile, "]\n");
+}
+
+/**
+ * @brief Get a metric of a result.
+ *
+ * @param result The result.
+ * @param metric mb_per_s, gb_per_s, ns_per_op, median_ns or p99_ns.
+ * @param higherIsBetter Set to true for throughput metrics.
+ * @return double The value, negative if the metric is unknown.
+ */
+static double Metric(const BenchResult &result, const std::string &metric, bool *higherIsBetter)
+{
+    *higherIsBetter = metric == "mb_per_s" || metric == "gb_per_s";
+    if (metric == "mb_per_s")
+        return result.median != 0 ? result.bytes * 1e3 / result.median : 0.0;
+    if (metric == "gb_per_s")
+        return result.median != 0 ? (double)result.bytes / result.median : 0.0;
+    if (metric == "ns_per_op")
+        return (double)result.median / result.ops;
+    if (metric == "median_ns")
+        return (double)result.median;
+    if (metric == "p99_ns")
+        return (double)result.p99;
+    return -1;
+}
+
+/**
+ * @brief Compare the results with a baseline file.
+ *
+ * @param fileName The baseline file, lines of benchmark,metric,value,tolerance.
+ * @return uint32_t Amount of regressions and of benchmarks failed or missing, 1 if the baseline can't be read.
+ */
+static uint32_t CompareBaseline(const char *fileName)
+{
+    FILE *pFile = fopen(fileName, "r");
+    char line[256];
+    uint32_t regressions = 0;
+    if (pFile == 0)
+    {
+        fprintf(stderr, "Can't open baseline %s\n", fileName);
+        return 1;
+    }
+    fprintf(stderr, "%-32s %-10s %12s %12s %8s\n", "benchmark", "metric", "baseline", "measured", "change");
+    while (fgets(line, sizeof(line), pFile) != 0)
+    {
+        char name[128], metric[32];
+        double value, tolerance;
+        if (line[0] == '#' || sscanf(line, "%127[^,],%31[^,],%lf,%lf", name, metric, &value, &tolerance) != 4)
+            continue;
+        const BenchResult *result = 0;
+        for (const BenchResult &candidate : results)
+        {
+            if (candidate.name == name)
+                result = &candidate;
+        }
+        if (result == 0)
+        {
+            bool skipped = std::string(name).find(options.filter) == std::string::npos ||
+                           std::find(unsupported.begin(), unsupported.end(), name) != unsupported.end();
+            bool failed = std::find(failures.begin(), failures.end(), name) != failures.end();
+            fprintf(stderr, "%-32s %-10s %12.1f %12s %8s %s\n", name, metric, value, "-", "-",
+                    skipped ? "skipped" : failed ? "FAILED" : "MISSING");
+            regressions += !skipped;
+            continue;
+        }
+        bool higherIsBetter;
+        double measured = Metric(*result, metric, &higherIsBetter);
+        if (measured < 0 || value <= 0)
+        {
+            fprintf(stderr, "Invalid baseline line: %s", line);
+            regressions++;
+            continue;
+        }
+        double change = measured / value - 1;
+        bool regression = higherIsBetter ? measured < value * (1 - tolerance) : measured > value * (1 + tolerance);
+        fprintf(stderr, "%-32s %-10s %12.1f %12.1f %+7.1f%% %s\n", name, metric, value, measured, change * 100,
+                regression ? "REGRESSION" : "ok");
+        regressions += regression;
+    }
+    fclose(pFile);
+    if (regressions != 0)
+        fprintf(stderr, "%u performance regressions or failed benchmarks against %s\n", regressions, fileName);
+    return regressions;
+}
+
+/**
+ * @brief Write the results as a baseline file, throughput for benchmarks of
+ * one operation per repetition and nanoseconds per operation for others.
+ *
+ * @param fileName The baseline file.
+ * @return uint8_t 0 on success.
+ */
+static uint8_t WriteBaseline(const char *fileName)
+{
+    FILE *pFile = fopen(fileName, "w");
+    if (pFile == 0)
+    {
+        fprintf(stderr, "Can't create baseline %s\n", fileName);
+        return 1;
+    }
+    fprintf(pFile, "# benchmark,metric,value,tolerance\n");
+    for (const BenchResult &result : results)
+    {
+        bool higherIsBetter;
+        const char *metric = result.ops > 1 ? "ns_per_op" : "mb_per_s";
+        fprintf(pFile, "%s,%s,%.1f,0.4\n", result.name.c_str(), metric, Metric(result, metric, &higherIsBetter));
+    }
+    fclose(pFile);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    for (int32_t arg = 1; arg < argc; arg++)
+    {
+        if (strcmp(argv[arg], "-json") == 0)
+            options.json = true;
+        else if (arg + 1 < argc && strcmp(argv[arg], "-reps") == 0)
+            options.reps = (uint32_t)strtoul(argv[++arg], 0, 0);
+        else if (arg + 1 < argc && strcmp(argv[arg], "-warmup") == 0)
+            options.warmup = (uint32_t)strtoul(argv[++arg], 0, 0);
+        else if (arg + 1 < argc && strcmp(argv[arg], "-size") == 0)
+            options.sizeMB = (uint32_t)strtoul(argv[++arg], 0, 0);
+        else if (arg + 1 < argc && strcmp(argv[arg], "-filter") == 0)
+            options.filter = argv[++arg];
+        else if (arg + 1 < argc && strcmp(argv[arg], "-o") == 0)
+            options.outputFile = argv[++arg];
+        else if (arg + 1 < argc && strcmp(argv[arg], "-baseline") == 0)
+            options.baselineFile = argv[++arg];
+        else if (arg + 1 < argc && strcmp(argv[arg], "-write-baseline") == 0)
+            options.writeBaselineFile = argv[++arg];
+        else
+        {
+            fprintf(stderr, "Usage: %s [-reps n] [-warmup n] [-size MB] [-filter text] [-json] [-o file]\n"
+                            "       [-baseline file] [-write-baseline file]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (options.reps < 1)
+    {
+        fprintf(stderr, "-reps must be at least 1\n");
+        return 2;
+    }
+    if (options.sizeMB == 0 || options.sizeMB > 1024)
+        options.sizeMB = 16;
+
+    blSetLogLevel(LOG_LEVEL_OFF);
+    const char *syntheticHex = "benchsynthetic.hex";
+    const char *syntheticSrec = "benchsynthetic.s19";
+    uint32_t size = options.sizeMB << 20;
+    ImageGenSpec spec;
+    ImageGenDefaults(&spec);
+    spec.size = size;
+    spec.fillDensity = 0.1;
+    spec.outOfOrder = 0.25;
+    uint8_t generated = GenerateFlashFile(syntheticHex, &spec, 0, 0);
+    spec.format = FORMAT_SREC;
+    spec.srecType = 3;
+    if (generated != 0 || GenerateFlashFile(syntheticSrec, &spec, 0, 0) != 0)
+    {
+        fprintf(stderr, "Can't generate the synthetic images\n");
+        return 1;
+    }
+    std::vector<uint8_t> buffer(size);
+    FillRandom(buffer.data(), buffer.size(), 0x2545F4914F6CDD1DULL);
+
+    BenchParsers(syntheticHex, syntheticSrec);
+    BenchChecksums(buffer);
+    BenchPdus();
+    remove(syntheticHex);
+    remove(syntheticSrec);
+
+    FILE *pFile = options.outputFile != 0 ? fopen(options.outputFile, "w") : stdout;
+    if (pFile == 0)
+    {
+        fprintf(stderr, "Can't create %s\n", options.outputFile);
+        return 1;
+    }
+    WriteResults(pFile);
+    if (pFile != stdout)
+        fclose(pFile);
+    if (options.writeBaselineFile != 0 && WriteBaseline(options.writeBaselineFile) != 0)
+        return 1;
+    if (options.baselineFile != 0 && CompareBaseline(options.baselineFile) != 0)
+        return 1;
+    if (!failures.empty())
+    {
+        fprintf(stderr, "%u benchmarks failed\n", (uint32_t)failures.size());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,274 @@
+/**
+ * @file blprep.cpp
+ * @brief This tool prepares flash images on a build machine, so the test
+ * bench only transmits them. It parses HEX, SREC, ELF or binary files in
+ * parallel, calculates the checksum of each segment with a crcspec profile
+ * and prints the segment table and the Transfer Data PDU plan as CSV.
+ *
+ * Usage: blprep [-j threads] [-crcspec file] [-profile name] [-plan bufferLength]
+ *               [-merge out.hex] [-log file] flashFile...
+ *        blprep -manifest file [-report file] [-j threads] [-crcspec file] [-profile name]
+ *               [-log file] [flashFile...]
+ *
+ * -plan lists the amount of PDUs, the length of the last PDU and its block
+ * sequence counter of each segment, as blBuffer composes them with a
+ * transmission buffer of bufferLength bytes. -merge joins the segments of
+ * all files into one Intel HEX file, overlapping segments are an error.
+ *
+ * -manifest runs a batch: the files of the manifest, each line a path and the
+ * expected checksum of each segment, are processed on a work-stealing thread
+ * pool and a consolidated report is written. The exit code is 1 if a file
+ * can't be parsed or its checksums don't match.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "minilogger.h"
+#include "crc.h"
+#include "filepraser.h"
+#include "flashimage.h"
+#include "batch.h"
+
+/**
+ * @brief A flash file to be prepared and its result.
+ *
+ */
+struct PrepJob
+{
+    const char *fileName;
+    FlashImage image;
+    uint8_t result; // 0 on success.
+};
+
+/**
+ * @brief Parse a flash file of any supported format and calculate the
+ * checksum of each segment.
+ *
+ * @param job The file to be parsed, its image and result are saved in it.
+ */
+static void PrepareFile(PrepJob *job)
+{
+    switch (DetectFlashFileFormat(job->fileName))
+    {
+    case FORMAT_HEX:
+        job->result = ParseHex(job->fileName, &job->image);
+        break;
+    case FORMAT_SREC:
+        job->result = ParseSREC(job->fileName, &job->image);
+        break;
+    case FORMAT_ELF:
+        job->result = ParseElf(job->fileName, &job->image);
+        break;
+    default:
+        job->result = ParseBin(job->fileName, 0, &job->image);
+        break;
+    }
+    for (uint32_t i = 0; job->result == 0 && i < job->image.count; i++)
+    {
+        SegmentCalculateChecksum(&job->image.segments[i]);
+    }
+    job->image.checksumsValid = job->result == 0;
+}
+
+/**
+ * @brief Print the CSV rows of the segments of an image.
+ *
+ * @param fileName Name of the file in the first column.
+ * @param image An image with valid checksums.
+ * @param bufferLength Length of the transmission buffer, 0 to omit the PDU plan.
+ */
+static void PrintSegments(const char *fileName, const FlashImage *image, uint32_t bufferLength)
+{
+    uint8_t crcBytes = GetCrcBytes();
+    for (uint32_t i = 0; i < image->count; i++)
+    {
+        const FlashSegment *segment = &image->segments[i];
+        uint64_t crc = (uint64_t)segment->checksum << 32 | segment->checksumExtension;
+        printf("%s,%u,0x%.8X,%u,", fileName, i, segment->address, segment->size);
+        for (uint8_t b = 0; b < crcBytes; b++)
+        {
+            printf("%.2X", (uint8_t)(crc >> (56 - 8 * b)));
+        }
+        if (bufferLength > 2)
+        {
+            // Each PDU is 0x36, the block sequence counter and up to bufferLength - 2 bytes.
+            uint32_t room = bufferLength - 2;
+            uint32_t pdus = segment->size / room + (segment->size % room != 0);
+            uint32_t last = segment->size - (pdus != 0 ? (pdus - 1) * room : 0);
+            printf(",%u,%u,0x%.2X", pdus, pdus != 0 ? last + 2 : 0, (uint8_t)pdus);
+        }
+        printf("\n");
+    }
+}
+
+/**
+ * @brief Process the files of a manifest and further files as a batch and
+ * write the consolidated report.
+ *
+ * @param manifest Path of the manifest.
+ * @param reportFile Path of the report, 0 for stdout.
+ * @param threads Amount of threads.
+ * @param files Further flash files without expected checksums.
+ * @param filesCount Amount of further flash files.
+ * @param closeLog 1 to close the log file at the end.
+ * @return int 0 if all files match, 1 otherwise.
+ */
+static int RunBatch(const char *manifest, const char *reportFile, uint32_t threads,
+                    char *files[], int32_t filesCount, uint8_t closeLog)
+{
+    Batch batch;
+    uint32_t failed = 1;
+    memset(&batch, 0, sizeof(Batch));
+    if (BatchLoadManifest(&batch, manifest) != 0)
+    {
+        fprintf(stderr, "Can't load manifest %s\n", manifest);
+        BatchClear(&batch);
+        return 1;
+    }
+    for (int32_t i = 0; i < filesCount; i++)
+        BatchAddFile(&batch, files[i], 0, 0);
+    BatchRun(&batch, threads);
+    FILE *pFile = reportFile != 0 ? fopen(reportFile, "w") : stdout;
+    if (pFile != 0)
+    {
+        failed = BatchWriteReport(&batch, pFile);
+        if (pFile != stdout)
+            fclose(pFile);
+    }
+    else
+        fprintf(stderr, "Can't create report %s\n", reportFile);
+    BatchClear(&batch);
+    if (closeLog)
+        FileLoggerClose();
+    return failed != 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *crcSpec = 0;
+    const char *profile = 0;
+    const char *mergeFile = 0;
+    const char *logFile = 0;
+    const char *manifest = 0;
+    const char *reportFile = 0;
+    uint32_t threads = std::thread::hardware_concurrency();
+    uint32_t bufferLength = 0;
+    int32_t arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        if (strcmp(argv[arg], "-j") == 0)
+            threads = (uint32_t)strtoul(argv[arg + 1], 0, 0);
+        else if (strcmp(argv[arg], "-crcspec") == 0)
+            crcSpec = argv[arg + 1];
+        else if (strcmp(argv[arg], "-profile") == 0)
+            profile = argv[arg + 1];
+        else if (strcmp(argv[arg], "-plan") == 0)
+            bufferLength = (uint32_t)strtoul(argv[arg + 1], 0, 0);
+        else if (strcmp(argv[arg], "-merge") == 0)
+            mergeFile = argv[arg + 1];
+        else if (strcmp(argv[arg], "-log") == 0)
+            logFile = argv[arg + 1];
+        else if (strcmp(argv[arg], "-manifest") == 0)
+            manifest = argv[arg + 1];
+        else if (strcmp(argv[arg], "-report") == 0)
+            reportFile = argv[arg + 1];
+        else
+            break;
+    }
+    if ((arg >= argc && manifest == 0) || (arg < argc && argv[arg][0] == '-'))
+    {
+        fprintf(stderr, "Usage: %s [-j threads] [-crcspec file] [-profile name] [-plan bufferLength]\n"
+                        "       [-merge out.hex] [-log file] flashFile...\n"
+                        "       %s -manifest file [-report file] [-j threads] [-crcspec file] [-profile name]\n"
+                        "       [-log file] [flashFile...]\n", argv[0], argv[0]);
+        return 2;
+    }
+    if (logFile != 0)
+        FileLoggerInit(logFile);
+    else
+        logLevel = LOG_LEVEL_OFF;
+
+    // crcspec of the working directory is used like in a CANoe project, if there is one.
+    struct stat status;
+    if (crcSpec == 0 && stat("crcspec", &status) == 0)
+        crcSpec = "crcspec";
+    if (crcSpec != 0 && LoadCrcSpec(crcSpec) != 0)
+    {
+        fprintf(stderr, "Can't load CRC specification %s\n", crcSpec);
+        return 1;
+    }
+    if (profile != 0 && SelectCrcProfile(profile) != 0)
+    {
+        fprintf(stderr, "CRC profile %s not found\n", profile);
+        return 1;
+    }
+
+    if (manifest != 0)
+        return RunBatch(manifest, reportFile, threads, argv + arg, argc - arg, logFile != 0);
+
+    std::vector<PrepJob> jobs(argc - arg);
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        memset(&jobs[i].image, 0, sizeof(FlashImage));
+        jobs[i].fileName = argv[arg + i];
+        jobs[i].result = 1;
+    }
+    if (threads == 0)
+        threads = 1;
+    if (threads > jobs.size())
+        threads = (uint32_t)jobs.size();
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&jobs, &next]()
+        {
+            for (size_t i = next++; i < jobs.size(); i = next++)
+                PrepareFile(&jobs[i]);
+        });
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+
+    int32_t failed = 0;
+    printf("file,segment,address,size,checksum%s\n", bufferLength > 2 ? ",pdus,lastLength,lastSequenceCounter" : "");
+    for (PrepJob &job : jobs)
+    {
+        if (job.result != 0)
+        {
+            fprintf(stderr, "Can't parse %s\n", job.fileName);
+            failed = 1;
+            continue;
+        }
+        PrintSegments(job.fileName, &job.image, bufferLength);
+    }
+
+    if (mergeFile != 0 && failed == 0)
+    {
+        std::vector<FlashImage> images;
+        FlashImage merged;
+        memset(&merged, 0, sizeof(FlashImage));
+        for (PrepJob &job : jobs)
+            images.push_back(job.image);
+        if (ImageMerge(&merged, images.data(), (uint32_t)images.size()) != 0 || WriteHex(mergeFile, &merged) != 0)
+        {
+            fprintf(stderr, "Can't merge into %s\n", mergeFile);
+            failed = 1;
+        }
+        ImageClear(&merged);
+    }
+
+    for (PrepJob &job : jobs)
+        ImageClear(&job.image);
+    if (logFile != 0)
+        FileLoggerClose();
+    return failed;
+}
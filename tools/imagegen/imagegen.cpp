@@ -0,0 +1,142 @@
+/**
+ * @file imagegen.cpp
+ * @brief This tool writes synthetic Intel HEX and SREC files for benchmarks
+ * and regression tests, from megabytes to gigabytes. The same options and
+ * seed always give the same file.
+ *
+ * Usage: imagegen [-format hex|srec] [-srec 1|2|3] [-size bytes[K|M|G]] [-record bytes]
+ *                 [-segments n] [-base address] [-gap uniform|exponential] [-gapmin bytes]
+ *                 [-gapmax bytes] [-outoforder ratio] [-fill ratio] [-seed n]
+ *                 [-crcspec file] [-profile name] [-manifest file] flashFile
+ *
+ * With -manifest a line with the file and the CRC of each of its segments
+ * of the crcspec profile is appended to a batch manifest of blprep.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <vector>
+#include "minilogger.h"
+#include "crc.h"
+#include "imagegen.h"
+
+/**
+ * @brief Parse a size with an optional suffix K, M or G.
+ *
+ * @param text The size, e.g. 512M.
+ * @return uint64_t The size in bytes.
+ */
+static uint64_t ParseSize(const char *text)
+{
+    char *end;
+    uint64_t size = strtoull(text, &end, 0);
+    switch (*end)
+    {
+    case 'G':
+    case 'g':
+        return size << 30;
+    case 'M':
+    case 'm':
+        return size << 20;
+    case 'K':
+    case 'k':
+        return size << 10;
+    default:
+        return size;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    ImageGenSpec spec;
+    const char *crcSpec = 0;
+    const char *profile = 0;
+    const char *manifest = 0;
+    int32_t arg = 1;
+    ImageGenDefaults(&spec);
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        const char *value = argv[arg + 1];
+        if (strcmp(argv[arg], "-format") == 0)
+            spec.format = strcmp(value, "srec") == 0 ? FORMAT_SREC : strcmp(value, "hex") == 0 ? FORMAT_HEX : FORMAT_UNKNOWN;
+        else if (strcmp(argv[arg], "-srec") == 0)
+            spec.srecType = (uint8_t)strtoul(value, 0, 0);
+        else if (strcmp(argv[arg], "-size") == 0)
+            spec.size = ParseSize(value);
+        else if (strcmp(argv[arg], "-record") == 0)
+            spec.recordLength = (uint32_t)strtoul(value, 0, 0);
+        else if (strcmp(argv[arg], "-segments") == 0)
+            spec.segments = (uint32_t)strtoul(value, 0, 0);
+        else if (strcmp(argv[arg], "-base") == 0)
+            spec.baseAddress = (uint32_t)strtoul(value, 0, 0);
+        else if (strcmp(argv[arg], "-gap") == 0)
+            spec.gap = strcmp(value, "exponential") == 0 ? IMAGEGEN_GAP_EXPONENTIAL : IMAGEGEN_GAP_UNIFORM;
+        else if (strcmp(argv[arg], "-gapmin") == 0)
+            spec.gapMin = (uint32_t)ParseSize(value);
+        else if (strcmp(argv[arg], "-gapmax") == 0)
+            spec.gapMax = (uint32_t)ParseSize(value);
+        else if (strcmp(argv[arg], "-outoforder") == 0)
+            spec.outOfOrder = atof(value);
+        else if (strcmp(argv[arg], "-fill") == 0)
+            spec.fillDensity = atof(value);
+        else if (strcmp(argv[arg], "-seed") == 0)
+            spec.seed = strtoull(value, 0, 0);
+        else if (strcmp(argv[arg], "-crcspec") == 0)
+            crcSpec = value;
+        else if (strcmp(argv[arg], "-profile") == 0)
+            profile = value;
+        else if (strcmp(argv[arg], "-manifest") == 0)
+            manifest = value;
+        else
+            break;
+    }
+    if (arg + 1 != argc || argv[arg][0] == '-')
+    {
+        fprintf(stderr, "Usage: %s [-format hex|srec] [-srec 1|2|3] [-size bytes[K|M|G]] [-record bytes]\n"
+                        "       [-segments n] [-base address] [-gap uniform|exponential] [-gapmin bytes]\n"
+                        "       [-gapmax bytes] [-outoforder ratio] [-fill ratio] [-seed n]\n"
+                        "       [-crcspec file] [-profile name] [-manifest file] flashFile\n", argv[0]);
+        return 2;
+    }
+    logLevel = LOG_LEVEL_OFF;
+
+    const CrcProfile *crcProfile = 0;
+    if (manifest != 0)
+    {
+        struct stat status;
+        if (crcSpec == 0 && stat("crcspec", &status) == 0)
+            crcSpec = "crcspec";
+        if (crcSpec == 0 || LoadCrcSpec(crcSpec) != 0 || (profile != 0 && SelectCrcProfile(profile) != 0))
+        {
+            fprintf(stderr, "Can't load the CRC profile for the manifest\n");
+            return 1;
+        }
+        crcProfile = GetCrcProfile();
+    }
+    std::vector<uint64_t> checksums(spec.segments + 1);
+    if (GenerateFlashFile(argv[arg], &spec, crcProfile, checksums.data()) != 0)
+    {
+        fprintf(stderr, "Can't generate %s\n", argv[arg]);
+        return 1;
+    }
+    if (manifest != 0)
+    {
+        FILE *pFile = fopen(manifest, "a");
+        if (pFile == 0)
+        {
+            fprintf(stderr, "Can't open manifest %s\n", manifest);
+            return 1;
+        }
+        fprintf(pFile, "%s", argv[arg]);
+        for (uint32_t i = 0; i < spec.segments; i++)
+            fprintf(pFile, " %.*llX", GetCrcBytes() * 2, (unsigned long long)checksums[i]);
+        fprintf(pFile, "\n");
+        fclose(pFile);
+    }
+    return 0;
+}
@@ -0,0 +1,252 @@
+/**
+ * @file tracedump.c
+ * @brief This tool converts binary trace files recorded by dllStartTrace
+ * to text, CSV or the Chrome trace event JSON format.
+ *
+ * Usage: tracedump [-csv | -chrome] traceFile...
+ *
+ * With -chrome the trace files of several CANoe processes or ECUs are
+ * merged into one timeline, each file is shown as a process. Time stamps
+ * of files recorded on the same machine use the same monotonic clock.
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "tracelog.h"
+
+/**
+ * @brief Check that a format only has conversions of unsigned int
+ * arguments, so a corrupted trace file can't crash the tool.
+ *
+ * @param format A format string read from the trace file.
+ * @return uint8_t 1 if the format is safe to be passed to snprintf.
+ */
+static uint8_t SafeFormat(const char *format)
+{
+    uint32_t conversions = 0;
+    for (const char *c = format; *c != '\0'; c++)
+    {
+        if (*c != '%')
+            continue;
+        c++;
+        if (*c == '%')
+            continue;
+        c += strspn(c, "-+ #0123456789.");
+        if (*c == '\0' || strchr("diouxXc", *c) == 0)
+            return 0;
+        conversions++;
+    }
+    return conversions <= 4;
+}
+
+/**
+ * @brief Write a field to a CSV file, quoted if necessary.
+ *
+ * @param field The text of the field.
+ * @param pFile The CSV file.
+ */
+static void WriteCsvField(const char *field, FILE *pFile)
+{
+    if (strpbrk(field, ",\"\n") == 0)
+    {
+        fputs(field, pFile);
+        return;
+    }
+    fputc('"', pFile);
+    for (const char *c = field; *c != '\0'; c++)
+    {
+        if (*c == '"')
+            fputc('"', pFile);
+        fputc(*c, pFile);
+    }
+    fputc('"', pFile);
+}
+
+/**
+ * @brief Write a string to a JSON file, quoted and escaped.
+ *
+ * @param text The string.
+ * @param pFile The JSON file.
+ */
+static void WriteJsonString(const char *text, FILE *pFile)
+{
+    fputc('"', pFile);
+    for (const unsigned char *c = (const unsigned char *)text; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            fprintf(pFile, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(pFile, "\\u%.4x", *c);
+        else
+            fputc(*c, pFile);
+    }
+    fputc('"', pFile);
+}
+
+typedef enum
+{
+    OUTPUT_TEXT,
+    OUTPUT_CSV,
+    OUTPUT_CHROME
+} outputFormat;
+
+static uint64_t Nanoseconds(uint64_t ticks, uint64_t ticksPerSecond)
+{
+    return ticks / ticksPerSecond * 1000000000ULL + ticks % ticksPerSecond * 1000000000ULL / ticksPerSecond;
+}
+
+/**
+ * @brief Convert one trace file.
+ *
+ * @param fileName Path of the trace file.
+ * @param output Output format.
+ * @param process Process id of the file in the Chrome trace.
+ * @param events Amount of events written so far to the Chrome trace, increased by the events of this file.
+ * @return int 0 on success.
+ */
+static int DumpTraceFile(const char *fileName, outputFormat output, uint32_t process, uint64_t *events)
+{
+    char *formats[TRACE_FORMATS_MAX] = {0};
+    TraceFileHeader header;
+    TraceRecord record;
+    uint64_t firstTimestamp = 0;
+    uint64_t records = 0;
+    FILE *pFile = fopen(fileName, "rb");
+    if (pFile == 0)
+    {
+        fprintf(stderr, "Can't open trace file: %s\n", fileName);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, pFile) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, 4) != 0 ||
+        header.version != TRACE_VERSION ||
+        header.recordSize != TRACE_RECORD_SIZE ||
+        header.ticksPerSecond == 0)
+    {
+        fprintf(stderr, "Not a trace file: %s\n", fileName);
+        fclose(pFile);
+        return 1;
+    }
+    if (output == OUTPUT_CHROME)
+    {
+        printf("%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":", *events ? ",\n" : "", process);
+        WriteJsonString(fileName, stdout);
+        printf("}}");
+        (*events)++;
+    }
+    while (fread(&record, sizeof(record), 1, pFile) == 1)
+    {
+        char message[512];
+        if (record.formatId == TRACE_FORMAT_DEFINITION)
+        {
+            uint32_t id = record.arguments[0];
+            uint32_t length = record.arguments[1];
+            // Checked first, the padded length of a corrupted length may wrap around.
+            if (length > TRACE_FORMAT_LENGTH_MAX)
+            {
+                fprintf(stderr, "Invalid format definition in trace file: %s\n", fileName);
+                break;
+            }
+            uint32_t padded = (length + TRACE_RECORD_SIZE - 1) / TRACE_RECORD_SIZE * TRACE_RECORD_SIZE;
+            char *format = (char *)malloc(padded + 1);
+            if (format == 0 || id == 0 || id >= TRACE_FORMATS_MAX ||
+                fread(format, 1, padded, pFile) != padded)
+            {
+                fprintf(stderr, "Invalid format definition in trace file: %s\n", fileName);
+                free(format);
+                break;
+            }
+            format[length] = '\0';
+            free(formats[id]);
+            formats[id] = format;
+            continue;
+        }
+        if (records++ == 0)
+            firstTimestamp = record.timestamp;
+        const char *format = record.formatId < TRACE_FORMATS_MAX ? formats[record.formatId] : 0;
+        if (format == 0)
+            snprintf(message, sizeof(message), "Unknown format %u", record.formatId);
+        else if (!SafeFormat(format))
+            snprintf(message, sizeof(message), "%s", format);
+        else if (record.kind == TRACE_KIND_SPAN)
+            snprintf(message, sizeof(message), format, record.arguments[0], record.arguments[1]);
+        else
+            snprintf(message, sizeof(message), format, record.arguments[0], record.arguments[1],
+                     record.arguments[2], record.arguments[3]);
+        uint64_t duration = record.kind == TRACE_KIND_SPAN
+                                ? Nanoseconds(record.arguments[2] | (uint64_t)record.arguments[3] << 32, header.ticksPerSecond)
+                                : 0;
+        if (output == OUTPUT_CHROME)
+        {
+            // Absolute time stamps in microseconds, so files of the same machine line up.
+            uint64_t nanoseconds = Nanoseconds(record.timestamp, header.ticksPerSecond);
+            printf(",\n{\"name\":");
+            WriteJsonString(message, stdout);
+            printf(",\"cat\":\"bootloader\",\"pid\":%u,\"tid\":%u,\"ts\":%llu.%.3llu", process, record.threadId,
+                   (unsigned long long)(nanoseconds / 1000), (unsigned long long)(nanoseconds % 1000));
+            if (record.kind == TRACE_KIND_SPAN)
+                printf(",\"ph\":\"X\",\"dur\":%llu.%.3llu}", (unsigned long long)(duration / 1000),
+                       (unsigned long long)(duration % 1000));
+            else
+                printf(",\"ph\":\"i\",\"s\":\"t\"}");
+            (*events)++;
+            continue;
+        }
+        // Time stamps relative to the first event, a span written after it may start before.
+        const char *sign = record.timestamp < firstTimestamp ? "-" : "";
+        uint64_t nanoseconds = record.timestamp < firstTimestamp
+                                   ? Nanoseconds(firstTimestamp - record.timestamp, header.ticksPerSecond)
+                                   : Nanoseconds(record.timestamp - firstTimestamp, header.ticksPerSecond);
+        if (output == OUTPUT_CSV)
+        {
+            printf("%s%llu,%llu,%u,%u,%u,%u,%u,%u,", sign, (unsigned long long)nanoseconds, (unsigned long long)duration,
+                   record.threadId, record.formatId,
+                   record.arguments[0], record.arguments[1], record.arguments[2], record.arguments[3]);
+            WriteCsvField(message, stdout);
+            printf("\n");
+            continue;
+        }
+        printf("%s%llu.%.9llu [%u] %s", sign, (unsigned long long)(nanoseconds / 1000000000ULL),
+               (unsigned long long)(nanoseconds % 1000000000ULL), record.threadId, message);
+        if (record.kind == TRACE_KIND_SPAN)
+            printf(" (%llu ns)", (unsigned long long)duration);
+        printf("\n");
+    }
+    fclose(pFile);
+    for (uint32_t i = 0; i < TRACE_FORMATS_MAX; i++)
+        free(formats[i]);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    outputFormat output = OUTPUT_TEXT;
+    uint64_t events = 0;
+    int first = 1, result = 0;
+    if (argc > 1 && strcmp(argv[1], "-csv") == 0)
+        output = OUTPUT_CSV;
+    else if (argc > 1 && strcmp(argv[1], "-chrome") == 0)
+        output = OUTPUT_CHROME;
+    if (output != OUTPUT_TEXT)
+        first++;
+    if (first >= argc)
+    {
+        fprintf(stderr, "Usage: tracedump [-csv | -chrome] traceFile...\n");
+        return 2;
+    }
+    if (output == OUTPUT_CSV)
+        printf("time_ns,duration_ns,thread,format_id,argument0,argument1,argument2,argument3,message\n");
+    else if (output == OUTPUT_CHROME)
+        printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (int i = first; i < argc; i++)
+    {
+        result |= DumpTraceFile(argv[i], output, (uint32_t)(i - first + 1), &events);
+    }
+    if (output == OUTPUT_CHROME)
+        printf("\n]}\n");
+    return result;
+}